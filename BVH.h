@@ -1,4 +1,8 @@
 #pragma once
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+
 #include "Triangle.h"
 
 #include "CUDA_Source/Common.h"
@@ -88,16 +92,66 @@ struct BVHBase {
 	NodeType * nodes = nullptr;
 };
 
-#if BVH_TYPE == BVH_BVH || BVH_TYPE == BVH_SBVH
-typedef BVHNode   BVHNodeType;
-#elif BVH_TYPE == BVH_QBVH
-typedef QBVHNode  BVHNodeType;
-#elif BVH_TYPE == BVH_CWBVH
-typedef CWBVHNode BVHNodeType;
-#endif
-
 typedef BVHBase<BVHNode>   BVH;
 typedef BVHBase<QBVHNode>  QBVH;
 typedef BVHBase<CWBVHNode> CWBVH;
 
-typedef BVHBase<BVHNodeType> BVHType;
+// Removes repeated indices from the indices of a single leaf, keeping the first occurrence, and returns the remaining count.
+// A BVH built over split references (see TrianglePresplitter and SBVHBuilder) can contain multiple parts of the same Triangle
+// in a leaf once leaves are merged, which would waste index slots and intersection tests on the same Triangle
+inline int remove_duplicate_indices(int indices[], int count) {
+	int unique_count = 0;
+
+	for (int i = 0; i < count; i++) {
+		bool is_duplicate = false;
+
+		for (int j = 0; j < unique_count; j++) {
+			if (indices[j] == indices[i]) {
+				is_duplicate = true;
+				break;
+			}
+		}
+
+		if (!is_duplicate) indices[unique_count++] = indices[i];
+	}
+
+	return unique_count;
+}
+
+static constexpr int BVH_TYPE_COUNT = 4;
+
+// Name of the BVH type, lower case so that it can be used on the command line and in file names
+inline const char * get_bvh_type_name(int bvh_type) {
+	switch (bvh_type) {
+		case BVH_BVH:   return "bvh";
+		case BVH_SBVH:  return "sbvh";
+		case BVH_QBVH:  return "qbvh";
+		case BVH_CWBVH: return "cwbvh";
+
+		default: abort();
+	}
+}
+
+// Returns -1 if the name does not match any BVH type
+inline int get_bvh_type_from_name(const char * name) {
+	for (int bvh_type = 0; bvh_type < BVH_TYPE_COUNT; bvh_type++) {
+		if (strcmp(name, get_bvh_type_name(bvh_type)) == 0) return bvh_type;
+	}
+
+	return -1;
+}
+
+// Calls the given function with a null pointer to the Node type of the given BVH type,
+// so that code templated on the Node type can be selected at runtime:
+// dispatch_bvh_type(bvh_type, [&](auto * node_type) { typedef std::remove_pointer_t<decltype(node_type)> NodeType; ... });
+template<typename Function>
+inline void dispatch_bvh_type(int bvh_type, Function function) {
+	switch (bvh_type) {
+		case BVH_BVH:
+		case BVH_SBVH:  function(static_cast<BVHNode   *>(nullptr)); break;
+		case BVH_QBVH:  function(static_cast<QBVHNode  *>(nullptr)); break;
+		case BVH_CWBVH: function(static_cast<CWBVHNode *>(nullptr)); break;
+
+		default: abort();
+	}
+}
@@ -1,4 +1,5 @@
 #pragma once
+#include <atomic>
 #include <algorithm>
 
 #include "BVH.h"
@@ -6,23 +7,149 @@
 
 #include "Mesh.h"
 
+#include "ThreadPool.h"
+
+// Builds a binary SAH-based BVH by evaluating the SAH at every primitive along all 3 dimensions
+// Large Nodes are partitioned using multiple Tasks, smaller subtrees are built by a single Task each.
+// Nodes are allocated atomically, afterwards they are renumbered into depth first order,
+// which makes the output independent of the number of threads and the order in which Tasks were executed
 struct BVHBuilder {
 private:
+	static constexpr int PARALLEL_SUBTREE_THRESHOLD   = 4096;  // Nodes with fewer primitives have their subtree built by a single Task
+	static constexpr int PARALLEL_PARTITION_THRESHOLD = 65536; // Nodes with at least this many primitives are partitioned by multiple Tasks
+
 	BVH * bvh = nullptr;
 
+	BVHNode * nodes           = nullptr; // Nodes that are currently being built, either bvh->nodes or nodes_unordered
+	BVHNode * nodes_unordered = nullptr; // Nodes of a multithreaded build, in the order they were allocated in. Only allocated once a build is multithreaded
+
+	std::atomic<int> node_index;
+
 	int * indices_x = nullptr;
 	int * indices_y = nullptr;
 	int * indices_z = nullptr;
-		
-	float * sah  = nullptr;
-	int   * temp = nullptr;
+
+	int primitive_count;
+	int primitive_count_max; // The number of primitives init was called with, builds can use at most this many
+
+	// All have room for 3 * primitive_count elements, such that every dimension has its own slice.
+	// Every Node only accesses the part of a slice that corresponds to its own range of indices
+	float * sah    = nullptr;
+	int   * temp   = nullptr;
+	float * bounds = nullptr; // Bounds of the primitives in Structure of Arrays layout, 6 floats per element
+
+	BitArray goes_left; // For every primitive whether it ends up in the left child of the Node it was last split by
 
 	int max_primitives_in_leaf;
 
 	template<typename Primitive>
-	void build_bvh_recursive(BVHNode & node, const Primitive * primitives, int * indices[3], int & node_index, int first_index, int index_count) {
-		node.aabb = BVHPartitions::calculate_bounds(primitives, indices[0], first_index, first_index + index_count);
-		
+	AABB calculate_bounds(const Primitive * primitives, const int * indices, int first_index, int index_count) {
+		if (index_count < PARALLEL_PARTITION_THRESHOLD) {
+			return BVHPartitions::calculate_bounds(primitives, indices, first_index, first_index + index_count);
+		}
+
+		// Calculate the bounds of a number of batches in parallel and combine them.
+		// Taking the min and max is exact, so the result does not depend on the number of batches
+		static constexpr int BATCH_COUNT = 16;
+
+		AABB aabbs[BATCH_COUNT];
+
+		ThreadPool::TaskGroup group;
+
+		for (int i = 0; i < BATCH_COUNT; i++) {
+			int batch_first = first_index + (index_count *  i     ) / BATCH_COUNT;
+			int batch_last  = first_index + (index_count * (i + 1)) / BATCH_COUNT;
+
+			ThreadPool::submit(group, [=, &aabbs]() {
+				aabbs[i] = BVHPartitions::calculate_bounds(primitives, indices, batch_first, batch_last);
+			});
+		}
+
+		ThreadPool::wait(group);
+
+		AABB aabb = AABB::create_empty();
+		for (int i = 0; i < BATCH_COUNT; i++) {
+			aabb.expand(aabbs[i]);
+		}
+
+		return aabb;
+	}
+
+	template<typename Primitive>
+	int partition_sah(const Primitive * primitives, int * indices[3], int first_index, int index_count, int & split_dimension, float & split_cost) {
+		if (index_count < PARALLEL_PARTITION_THRESHOLD) {
+			BVHSweep::BoundsSoA bounds_slice = BVHSweep::BoundsSoA::from_memory(bounds, primitive_count).offset(first_index);
+
+			return BVHPartitions::partition_sah(primitives, indices, first_index, index_count, bounds_slice, sah + first_index, split_dimension, split_cost);
+		}
+
+		int   split_indices[3];
+		float split_costs  [3];
+
+		ThreadPool::TaskGroup group;
+
+		for (int dimension = 0; dimension < 3; dimension++) {
+			ThreadPool::submit(group, [=, &split_indices, &split_costs]() {
+				float * sah_dimension = sah + dimension * primitive_count + first_index;
+
+				BVHSweep::BoundsSoA bounds_dimension = BVHSweep::BoundsSoA::from_memory(bounds + 6 * dimension * primitive_count, primitive_count).offset(first_index);
+
+				split_indices[dimension] = BVHPartitions::partition_sah_dimension(primitives, indices[dimension], first_index, index_count, bounds_dimension, sah_dimension, split_costs[dimension]);
+			});
+		}
+
+		ThreadPool::wait(group);
+
+		// Combine the results in the same order as the single threaded version
+		split_dimension = -1;
+		split_cost      = INFINITY;
+
+		int split_index = -1;
+
+		for (int dimension = 0; dimension < 3; dimension++) {
+			if (split_costs[dimension] < split_cost) {
+				split_index     = split_indices[dimension];
+				split_cost      = split_costs  [dimension];
+				split_dimension = dimension;
+			}
+		}
+
+		assert(split_dimension != -1);
+
+		return split_index;
+	}
+
+	void split_indices(int * indices[3], int first_index, int index_count, int split_dimension, int split_index) {
+		if (index_count < PARALLEL_PARTITION_THRESHOLD) {
+			BVHPartitions::split_indices(indices, first_index, index_count, temp + first_index, split_dimension, split_index, goes_left);
+
+			return;
+		}
+
+		BVHPartitions::mark_left(indices[split_dimension], first_index, index_count, split_index, goes_left);
+
+		// The two dimensions that were not split on are independent of each other
+		ThreadPool::TaskGroup group;
+
+		for (int dimension = 0; dimension < 3; dimension++) {
+			if (dimension != split_dimension) {
+				ThreadPool::submit(group, [=]() {
+					int * temp_dimension = temp + dimension * primitive_count + first_index;
+
+					BVHPartitions::split_indices_dimension(indices[dimension], first_index, index_count, temp_dimension, split_index, goes_left);
+				});
+			}
+		}
+
+		ThreadPool::wait(group);
+	}
+
+	template<typename Primitive>
+	void build_bvh_recursive(int node_id, const Primitive * primitives, int * indices[3], int first_index, int index_count) {
+		BVHNode & node = nodes[node_id];
+
+		node.aabb = calculate_bounds(primitives, indices[0], first_index, index_count);
+
 		if (index_count == 1) {
 			// Leaf Node, terminate recursion
 			node.first = first_index;
@@ -33,9 +160,9 @@ private:
 
 		int   split_dimension;
 		float split_cost;
-		int   split_index = BVHPartitions::partition_sah(primitives, indices, first_index, index_count, sah, split_dimension, split_cost);
+		int   split_index = partition_sah(primitives, indices, first_index, index_count, split_dimension, split_cost);
 
-#if !BVH_ENABLE_OPTIMIZATION && BVH_TYPE != BVH_CWBVH // BVH Optimizer and CWBVH both expect leaves with only a single primitive
+#if !BVH_ENABLE_OPTIMIZATION // BVH Optimizer expects leaves with only a single primitive, for the CWBVH max_primitives_in_leaf is 1
 		if (index_count <= max_primitives_in_leaf){
 			// Check SAH termination condition
 			float leaf_cost = node.aabb.surface_area() * SAH_COST_LEAF * float(index_count);
@@ -50,34 +177,112 @@ private:
 		}
 #endif
 
-		node.left = node_index;
-		node_index += 2;
-		
-		float split = primitives[indices[split_dimension][split_index]].get_center()[split_dimension];
-		BVHPartitions::split_indices(primitives, indices, first_index, index_count, temp, split_dimension, split_index, split);
+		node.left = node_index.fetch_add(2);
+
+		split_indices(indices, first_index, index_count, split_dimension, split_index);
 
 		node.count = (split_dimension + 1) << 30;
 
 		int num_left  = split_index - first_index;
 		int num_right = first_index + index_count - split_index;
 
-		build_bvh_recursive(bvh->nodes[node.left    ], primitives, indices, node_index, first_index,            num_left);
-		build_bvh_recursive(bvh->nodes[node.left + 1], primitives, indices, node_index, first_index + num_left, num_right);
+		int node_left = node.left;
+
+		if (index_count < PARALLEL_SUBTREE_THRESHOLD) {
+			build_bvh_recursive(node_left,     primitives, indices, first_index,            num_left);
+			build_bvh_recursive(node_left + 1, primitives, indices, first_index + num_left, num_right);
+		} else {
+			// Build the left subtree as a separate Task, while this thread continues with the right subtree
+			ThreadPool::TaskGroup group;
+			ThreadPool::submit(group, [=]() {
+				build_bvh_recursive(node_left, primitives, indices, first_index, num_left);
+			});
+
+			build_bvh_recursive(node_left + 1, primitives, indices, first_index + num_left, num_right);
+
+			ThreadPool::wait(group);
+		}
+	}
+
+	// Copies the Nodes into bvh->nodes in the same order as a single threaded depth first build would produce
+	void reorder_nodes() {
+		// Stores pairs of old and new Node indices, at most one pending pair per level of the tree
+		int * stack = new int[2 * primitive_count];
+		int   stack_size = 0;
+
+		stack[stack_size++] = 0;
+		stack[stack_size++] = 0;
+
+		int index = 2;
+
+		while (stack_size > 0) {
+			int node_id_new = stack[--stack_size];
+			int node_id_old = stack[--stack_size];
+
+			const BVHNode & node = nodes_unordered[node_id_old];
+			bvh->nodes[node_id_new] = node;
+
+			if (node.is_leaf()) continue;
+
+			bvh->nodes[node_id_new].left = index;
+
+			// Push the right child first so that the left subtree gets numbered first
+			stack[stack_size++] = node.left + 1;
+			stack[stack_size++] = index + 1;
+			stack[stack_size++] = node.left;
+			stack[stack_size++] = index;
+
+			index += 2;
+		}
+
+		assert(index == node_index);
+
+		delete [] stack;
 	}
 
 	template<typename Primitive>
 	inline void build_bvh_impl(const Primitive * primitives, int primitive_count) {
-		std::sort(indices_x, indices_x + primitive_count, [&](int a, int b) { return primitives[a].get_center().x < primitives[b].get_center().x; });
-		std::sort(indices_y, indices_y + primitive_count, [&](int a, int b) { return primitives[a].get_center().y < primitives[b].get_center().y; });
-		std::sort(indices_z, indices_z + primitive_count, [&](int a, int b) { return primitives[a].get_center().z < primitives[b].get_center().z; });
-		
+		this->primitive_count = primitive_count;
+
 		int * indices[3] = { indices_x, indices_y, indices_z };
-	
-		int node_index = 2;
-		build_bvh_recursive(bvh->nodes[0], primitives, indices, node_index, 0, primitive_count);
+
+		// Ties are broken by primitive index, so that the order is unique and does not depend on the sorting algorithm
+		ThreadPool::TaskGroup group;
+
+		for (int dimension = 0; dimension < 3; dimension++) {
+			ThreadPool::submit(group, [=]() {
+				int * indices_dimension = indices[dimension];
+				int * temp_dimension    = temp + dimension * primitive_count;
+
+				ThreadPool::parallel_sort(indices_dimension, indices_dimension + primitive_count, temp_dimension, [primitives, dimension](int a, int b) {
+					float center_a = primitives[a].get_center()[dimension];
+					float center_b = primitives[b].get_center()[dimension];
+
+					return center_a < center_b || (center_a == center_b && a < b);
+				});
+			});
+		}
+
+		ThreadPool::wait(group);
+
+		// Small BVH's are built by a single thread, in which case the Nodes are already in the right order
+		bool is_parallel = primitive_count >= PARALLEL_SUBTREE_THRESHOLD && ThreadPool::get_thread_count() > 0;
+
+		if (is_parallel && nodes_unordered == nullptr) {
+			nodes_unordered = new BVHNode[2 * primitive_count_max];
+		}
+
+		nodes = is_parallel ? nodes_unordered : bvh->nodes;
+		node_index = 2;
+
+		build_bvh_recursive(0, primitives, indices, 0, primitive_count);
 
 		assert(node_index <= 2 * primitive_count);
 
+		if (is_parallel) {
+			reorder_nodes();
+		}
+
 		bvh->node_count  = node_index;
 		bvh->index_count = primitive_count;
 	}
@@ -86,6 +291,7 @@ public:
 	inline void init(BVH * bvh, int primitive_count, int max_primitives_in_leaf) {
 		this->bvh = bvh;
 		this->max_primitives_in_leaf = max_primitives_in_leaf;
+		this->primitive_count_max    = primitive_count;
 
 		indices_x = new int[primitive_count];
 		indices_y = new int[primitive_count];
@@ -96,10 +302,13 @@ public:
 			indices_y[i] = i;
 			indices_z[i] = i;
 		}
-			
-		sah  = new float[primitive_count];
-		temp = new int  [primitive_count];
-		
+
+		sah    = new float[3 * primitive_count];
+		temp   = new int  [3 * primitive_count];
+		bounds = new float[3 * 6 * primitive_count];
+
+		goes_left.init(primitive_count);
+
 		bvh->indices = indices_x;
 		bvh->nodes   = new BVHNode[2 * primitive_count];
 	}
@@ -110,8 +319,14 @@ public:
 
 		delete [] sah;
 		delete [] temp;
+		delete [] bounds;
+
+		goes_left.free();
+
+		delete [] nodes_unordered;
+		nodes_unordered = nullptr;
 	}
-	
+
 	inline void build(const Triangle * triangles, int triangle_count) {
 		return build_bvh_impl(triangles, triangle_count);
 	}
@@ -119,4 +334,8 @@ public:
 	inline void build(const Mesh * meshes, int mesh_count) {
 		return build_bvh_impl(meshes, mesh_count);
 	}
+
+	inline void build(const BVHPartitions::PrimitiveRef * references, int reference_count) {
+		return build_bvh_impl(references, reference_count);
+	}
 };
@@ -0,0 +1,426 @@
+#include "BVHLayout.h"
+
+#include <vector>
+#include <queue>
+#include <algorithm>
+
+#include "CWBVHBuilder.h"
+
+// Group of Nodes that has to be stored contiguously
+struct Unit {
+	int first_node;
+	int node_count;
+
+	int first_child; // Into Units::children
+	int child_count;
+
+	int   height; // Of the subtree of Units, a Unit without children has height 1
+	float area;   // Surface area of the Nodes in the Unit, used as the probability of visiting it
+};
+
+struct Units {
+	std::vector<Unit> units;
+	std::vector<int>  children;
+
+	std::vector<int> order; // Unit indices in the order they should be stored in
+
+	int unit_size; // In bytes, per Node
+};
+
+static int calc_height(Units & units, int unit_index) {
+	Unit & unit = units.units[unit_index];
+
+	int height = 0;
+
+	for (int i = 0; i < unit.child_count; i++) {
+		height = std::max(height, calc_height(units, units.children[unit.first_child + i]));
+	}
+
+	unit.height = height + 1;
+
+	return unit.height;
+}
+
+static void layout_depth_first(Units & units, int unit_index) {
+	const Unit & unit = units.units[unit_index];
+
+	units.order.push_back(unit_index);
+
+	for (int i = 0; i < unit.child_count; i++) {
+		layout_depth_first(units, units.children[unit.first_child + i]);
+	}
+}
+
+static void layout_breadth_first(Units & units) {
+	std::queue<int> queue;
+	queue.push(0);
+
+	while (!queue.empty()) {
+		int unit_index = queue.front();
+		queue.pop();
+
+		units.order.push_back(unit_index);
+
+		const Unit & unit = units.units[unit_index];
+
+		for (int i = 0; i < unit.child_count; i++) {
+			queue.push(units.children[unit.first_child + i]);
+		}
+	}
+}
+
+// Grows a treelet from every treelet root by repeatedly adding the candidate with the largest surface area, until the treelet is full.
+// The remaining candidates become the roots of new treelets, which are stored directly after their parent treelet, largest first
+static void layout_treelet(Units & units) {
+	auto compare_area = [&units](int a, int b) {
+		return units.units[a].area < units.units[b].area;
+	};
+
+	std::vector<int> treelet_roots = { 0 };
+
+	while (!treelet_roots.empty()) {
+		int root = treelet_roots.back();
+		treelet_roots.pop_back();
+
+		std::priority_queue<int, std::vector<int>, decltype(compare_area)> candidates(compare_area);
+		candidates.push(root);
+
+		std::vector<int> roots_new;
+
+		int treelet_size = 0;
+
+		while (!candidates.empty()) {
+			int unit_index = candidates.top();
+			candidates.pop();
+
+			const Unit & unit = units.units[unit_index];
+
+			int size = unit.node_count * units.unit_size;
+
+			if (treelet_size > 0 && treelet_size + size > BVH_LAYOUT_TREELET_SIZE) {
+				roots_new.push_back(unit_index);
+
+				continue;
+			}
+
+			units.order.push_back(unit_index);
+			treelet_size += size;
+
+			for (int i = 0; i < unit.child_count; i++) {
+				candidates.push(units.children[unit.first_child + i]);
+			}
+		}
+
+		// The stack is popped from the back, so sort ascending to visit the largest new treelet first
+		std::sort(roots_new.begin(), roots_new.end(), compare_area);
+
+		treelet_roots.insert(treelet_roots.end(), roots_new.begin(), roots_new.end());
+	}
+}
+
+// Collects the Units at the given depth below the given Unit, from left to right
+static void collect_at_depth(const Units & units, int unit_index, int depth, std::vector<int> & result) {
+	if (depth == 0) {
+		result.push_back(unit_index);
+
+		return;
+	}
+
+	const Unit & unit = units.units[unit_index];
+
+	for (int i = 0; i < unit.child_count; i++) {
+		collect_at_depth(units, units.children[unit.first_child + i], depth - 1, result);
+	}
+}
+
+// Stores the subtree of the given Unit, truncated to the given height, in van Emde Boas order
+static void layout_van_emde_boas(Units & units, int unit_index, int height) {
+	if (height == 1) {
+		units.order.push_back(unit_index);
+
+		return;
+	}
+
+	int height_top    = height / 2;
+	int height_bottom = height - height_top;
+
+	layout_van_emde_boas(units, unit_index, height_top);
+
+	std::vector<int> bottom_roots;
+	collect_at_depth(units, unit_index, height_top, bottom_roots);
+
+	for (int i = 0; i < bottom_roots.size(); i++) {
+		int bottom_root = bottom_roots[i];
+
+		layout_van_emde_boas(units, bottom_root, std::min(height_bottom, units.units[bottom_root].height));
+	}
+}
+
+static void layout(Units & units, int layout) {
+	units.order.reserve(units.units.size());
+
+	switch (layout) {
+		case BVH_LAYOUT_DEPTH_FIRST:   layout_depth_first  (units, 0); break;
+		case BVH_LAYOUT_BREADTH_FIRST: layout_breadth_first(units);    break;
+		case BVH_LAYOUT_TREELET:       layout_treelet      (units);    break;
+
+		case BVH_LAYOUT_VAN_EMDE_BOAS: {
+			calc_height(units, 0);
+			layout_van_emde_boas(units, 0, units.units[0].height);
+
+			break;
+		}
+
+		default: abort();
+	}
+
+	assert(units.order.size() == units.units.size());
+	assert(units.order[0] == 0);
+}
+
+static AABB calc_aabb(const QBVHNode & node) {
+	AABB aabb = AABB::create_empty();
+
+	for (int i = 0; i < 4; i++) {
+		if (node.get_count(i) == -1) break;
+
+		aabb.expand(Vector3(node.aabb_min_x[i], node.aabb_min_y[i], node.aabb_min_z[i]));
+		aabb.expand(Vector3(node.aabb_max_x[i], node.aabb_max_y[i], node.aabb_max_z[i]));
+	}
+
+	return aabb;
+}
+
+static AABB calc_aabb(const CWBVHNode & node) {
+	AABB child_aabbs[8];
+	CWBVHBuilder::dequantize(node, child_aabbs);
+
+	AABB aabb = AABB::create_empty();
+
+	for (int i = 0; i < 8; i++) {
+		if (node.meta[i] != 0) aabb.expand(child_aabbs[i]);
+	}
+
+	return aabb;
+}
+
+// Every QBVH Node is its own Unit
+static int create_units(Units & units, const QBVH & qbvh, int node_index) {
+	const QBVHNode & node = qbvh.nodes[node_index];
+
+	int unit_index = units.units.size();
+	units.units.emplace_back();
+
+	int first_child = units.children.size();
+	int child_count = 0;
+
+	for (int i = 0; i < 4; i++) {
+		if (node.get_count(i) == 0) {
+			units.children.push_back(-1);
+			child_count++;
+		}
+	}
+
+	// Children are written after recursing, as the recursion appends to the same vector
+	int c = 0;
+	for (int i = 0; i < 4; i++) {
+		if (node.get_count(i) == 0) {
+			int child = create_units(units, qbvh, node.get_index(i));
+			units.children[first_child + c++] = child;
+		}
+	}
+
+	Unit & unit = units.units[unit_index];
+	unit.first_node  = node_index;
+	unit.node_count  = 1;
+	unit.first_child = first_child;
+	unit.child_count = child_count;
+	unit.area        = calc_aabb(node).surface_area();
+
+	return unit_index;
+}
+
+// Every Unit consists of the children of a CWBVH Node, except for the root which is a Unit on its own
+static int create_units(Units & units, const CWBVH & cwbvh, int first_node, int node_count) {
+	int unit_index = units.units.size();
+	units.units.emplace_back();
+
+	int first_child = units.children.size();
+	int child_count = 0;
+
+	float area = 0.0f;
+
+	for (int i = 0; i < node_count; i++) {
+		const CWBVHNode & node = cwbvh.nodes[first_node + i];
+
+		if (node.imask) {
+			units.children.push_back(-1);
+			child_count++;
+		}
+
+		area += calc_aabb(node).surface_area();
+	}
+
+	int c = 0;
+	for (int i = 0; i < node_count; i++) {
+		const CWBVHNode & node = cwbvh.nodes[first_node + i];
+
+		if (node.imask) {
+			int child_node_count = 0;
+			for (int j = 0; j < 8; j++) {
+				if (node.imask & (1 << j)) child_node_count++;
+			}
+
+			int child = create_units(units, cwbvh, node.base_index_child, child_node_count);
+			units.children[first_child + c++] = child;
+		}
+	}
+
+	Unit & unit = units.units[unit_index];
+	unit.first_node  = first_node;
+	unit.node_count  = node_count;
+	unit.first_child = first_child;
+	unit.child_count = child_count;
+	unit.area        = area;
+
+	return unit_index;
+}
+
+// Maps every old Node index to its new index, given the order of the Units. Unreachable Nodes map to -1
+static std::vector<int> calc_node_map(const Units & units, int node_count, int first_node_after_root) {
+	std::vector<int> node_map(node_count, -1);
+
+	int node_index = 0;
+
+	for (int i = 0; i < units.order.size(); i++) {
+		const Unit & unit = units.units[units.order[i]];
+
+		for (int j = 0; j < unit.node_count; j++) {
+			node_map[unit.first_node + j] = node_index++;
+		}
+
+		if (i == 0) node_index = first_node_after_root;
+	}
+
+	return node_map;
+}
+
+void BVHLayout::reorder(QBVH & qbvh, int layout) {
+	Units units;
+	units.unit_size = sizeof(QBVHNode);
+	create_units(units, qbvh, 0);
+
+	::layout(units, layout);
+
+	// Node 1 is reserved as the starting point of traversal
+	std::vector<int> node_map = calc_node_map(units, qbvh.node_count, 2);
+
+	int node_count = units.units.size() + 1;
+
+	QBVHNode * nodes   = new QBVHNode[node_count];
+	int      * indices = new int     [qbvh.index_count];
+
+	nodes[1].get_index(0) = 0;
+	nodes[1].get_count(0) = 0;
+
+	for (int i = 1; i < 4; i++) {
+		nodes[1].get_index(i) = -1;
+		nodes[1].get_count(i) = -1;
+	}
+
+	for (int i = 0; i < qbvh.node_count; i++) {
+		if (node_map[i] != -1) nodes[node_map[i]] = qbvh.nodes[i];
+	}
+
+	// Primitives are stored in the order of the Nodes they belong to
+	int index_count = 0;
+
+	for (int n = 0; n < node_count; n++) {
+		if (n == 1) continue;
+
+		QBVHNode & node = nodes[n];
+
+		for (int i = 0; i < 4; i++) {
+			int count = node.get_count(i);
+
+			if (count == 0) {
+				node.get_index(i) = node_map[node.get_index(i)];
+			} else if (count > 0) {
+				memcpy(indices + index_count, qbvh.indices + node.get_index(i), count * sizeof(int));
+
+				node.get_index(i) = index_count;
+				index_count += count;
+			}
+		}
+	}
+
+	assert(index_count == qbvh.index_count);
+
+	delete [] qbvh.nodes;
+	delete [] qbvh.indices;
+
+	qbvh.nodes      = nodes;
+	qbvh.node_count = node_count;
+	qbvh.indices    = indices;
+}
+
+void BVHLayout::reorder(CWBVH & cwbvh, int layout) {
+	Units units;
+	units.unit_size = sizeof(CWBVHNode);
+	create_units(units, cwbvh, 0, 1);
+
+	::layout(units, layout);
+
+	std::vector<int> node_map = calc_node_map(units, cwbvh.node_count, 1);
+
+	int node_count = 0;
+	for (int i = 0; i < units.units.size(); i++) {
+		node_count += units.units[i].node_count;
+	}
+
+	CWBVHNode * nodes   = new CWBVHNode[node_count];
+	int       * indices = new int      [cwbvh.index_count];
+
+	for (int i = 0; i < cwbvh.node_count; i++) {
+		if (node_map[i] != -1) nodes[node_map[i]] = cwbvh.nodes[i];
+	}
+
+	// Primitives are stored in the order of the Nodes they belong to
+	int index_count = 0;
+
+	for (int n = 0; n < node_count; n++) {
+		CWBVHNode & node = nodes[n];
+
+		int triangle_count = 0;
+
+		for (int i = 0; i < 8; i++) {
+			byte meta = node.meta[i];
+
+			if (meta != 0 && (meta & 0b00011111) < 24) {
+				int offset = meta & 0b00011111;
+				int count  = 0;
+				for (int j = 5; j < 8; j++) {
+					if (meta & (1 << j)) count++;
+				}
+
+				triangle_count = std::max(triangle_count, offset + count);
+			}
+		}
+
+		memcpy(indices + index_count, cwbvh.indices + node.base_index_triangle, triangle_count * sizeof(int));
+
+		node.base_index_child    = node.imask ? node_map[node.base_index_child] : 0;
+		node.base_index_triangle = index_count;
+
+		index_count += triangle_count;
+	}
+
+	assert(index_count == cwbvh.index_count);
+
+	delete [] cwbvh.nodes;
+	delete [] cwbvh.indices;
+
+	cwbvh.nodes      = nodes;
+	cwbvh.node_count = node_count;
+	cwbvh.indices    = indices;
+}
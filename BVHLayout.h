@@ -0,0 +1,12 @@
+#pragma once
+#include "BVH.h"
+
+// Reorders the Nodes and indices of a wide BVH in memory, without changing its topology.
+// Nodes that are stored contiguously (the children of a CWBVH Node) are moved as a single unit,
+// the indices are reordered such that the primitives of every Node follow the order of the Nodes themselves.
+// The root of both BVH types stays at Node 0, and the QBVH keeps its starting point at Node 1.
+// Afterwards the BVH is compact, Nodes that were not reachable from the root are removed
+namespace BVHLayout {
+	void reorder(QBVH  & qbvh,  int layout); // Layout is one of the BVH_LAYOUT_* defines in Common.h
+	void reorder(CWBVH & cwbvh, int layout);
+}
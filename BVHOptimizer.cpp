@@ -3,15 +3,15 @@
 #include <vector>
 #include <queue>
 #include <random>
+#include <algorithm>
+#include <cstring>
 
 #include "BitArray.h"
+#include "ThreadPool.h"
 
 #include "Random.h"
 #include "ScopeTimer.h"
 
-static std::random_device device;
-static std::mt19937 rng(device());
-
 // Calculates the SAH cost of a whole tree
 static float bvh_sah_cost(const BVH & bvh) {
 	float sum_leaf = 0.0f;
@@ -48,7 +48,7 @@ static void init_parent_indices(const BVH & bvh, int parent_indices[], int node_
 }
 
 // Produces a single batch consisting of 'batch_size' candidates for reinsertion based on random sampling
-static void select_nodes_random(const BVH & bvh, const int parent_indices[], int batch_size, int batch_indices[]) {
+static void select_nodes_random(const BVH & bvh, const int parent_indices[], int batch_size, int batch_indices[], std::mt19937 & rng) {
 	int offset = 0;
 	int * temp = new int[bvh.node_count];
 
@@ -97,28 +97,97 @@ static void select_nodes_measure(const BVH & bvh, const int parent_indices[], in
 	delete [] costs;
 }
 
+// Target index referring to the Node created by reinserting the first child of a candidate
+static constexpr int TARGET_FIRST_REINSERTION = -2;
+
+// The tree in which reinsertion positions are searched for. This is the tree at the start of the batch,
+// with the removed Node taken out and optionally the first child of the removed Node already reinserted,
+// but without modifying the actual tree, so that multiple searches can take place in parallel.
+// Taking out the removed Node replaces its parent by its sibling, the AABBs of the ancestors are not updated
+struct ReinsertionTree {
+	const BVH & bvh;
+
+	int node_removed_parent;
+	int node_removed_sibling;
+
+	int  first_reinsert_index = -1;
+	AABB first_reinsert_aabb;
+
+	// Nodes from the root to the Node that became the sibling of the first reinserted child
+	std::vector<int> first_reinsert_path;
+
+	inline int get_child(int node_index, int child) const {
+		int child_index = bvh.nodes[node_index].left + child;
+
+		return child_index == node_removed_parent ? node_removed_sibling : child_index;
+	}
+
+	// Returns the position of the child along the path of the first reinsertion, or -1 if it is not on it
+	inline int get_child_path_depth(int child_index, int path_depth) const {
+		if (path_depth == -1 || path_depth + 1 >= int(first_reinsert_path.size())) return -1;
+
+		return first_reinsert_path[path_depth + 1] == child_index ? path_depth + 1 : -1;
+	}
+};
+
 // Finds the global minimum of where best to insert the reinsertion node by traversing the tree using Branch and Bound
-static void find_reinsertion(const BVH & bvh, const BVHNode & node_reinsert, float & min_cost, int & min_index) {
+static void find_reinsertion(const ReinsertionTree & tree, const BVHNode & node_reinsert, float & min_cost, int & min_index) {
+	const BVH & bvh = tree.bvh;
+
 	float node_reinsert_area = node_reinsert.aabb.surface_area();
 
+	struct SearchNode {
+		int   node_index;
+		float induced_cost;
+		int   path_depth; // Position along the path of the first reinsertion, -1 if the Node is not on it
+	};
+
 	// Compare based on induced cost
-	auto cmp = [](const std::pair<int, float> & a, const std::pair<int, float> & b) {
-		return a.second < b.second;
+	auto cmp = [](const SearchNode & a, const SearchNode & b) {
+		return a.induced_cost < b.induced_cost;
 	};
 	
-	std::priority_queue<std::pair<int, float>, std::vector<std::pair<int, float>>, decltype(cmp)> priority_queue(cmp);
+	std::priority_queue<SearchNode, std::vector<SearchNode>, decltype(cmp)> priority_queue(cmp);
 
-	priority_queue.emplace(0, 0.0f); // Push BVH root with 0 induced cost
+	priority_queue.push({ 0, 0.0f, tree.first_reinsert_path.empty() ? -1 : 0 }); // Push BVH root with 0 induced cost
 	
 	while (priority_queue.size() > 0) {
-		auto [node_index, induced_cost] = priority_queue.top();
+		SearchNode search_node = priority_queue.top();
 		priority_queue.pop();
 
+		if (search_node.induced_cost + node_reinsert_area >= min_cost) break; // Not possible to reduce min_cost, terminate
+
+		int   node_index   = search_node.node_index;
+		float induced_cost = search_node.induced_cost;
+
 		const BVHNode & node = bvh.nodes[node_index];
 
-		if (induced_cost + node_reinsert_area >= min_cost) break; // Not possible to reduce min_cost, terminate
+		AABB aabb = node.aabb;
+
+		if (search_node.path_depth != -1) {
+			aabb.expand(tree.first_reinsert_aabb);
+
+			// The end of the path is the Node created by the first reinsertion, its children are the original Node and the first reinserted child
+			if (search_node.path_depth == int(tree.first_reinsert_path.size()) - 1) {
+				float cost = induced_cost + AABB::unify(aabb, node_reinsert.aabb).surface_area();
+
+				if (cost < min_cost) {
+					min_cost  = cost;
+					min_index = TARGET_FIRST_REINSERTION;
+				}
 
-		float direct_cost = AABB::unify(node.aabb, node_reinsert.aabb).surface_area();
+				float child_induced_cost = cost - aabb.surface_area();
+
+				if (child_induced_cost + node_reinsert_area < min_cost) {
+					priority_queue.push({ node_index,                child_induced_cost, -1 });
+					priority_queue.push({ tree.first_reinsert_index, child_induced_cost, -1 });
+				}
+
+				continue;
+			}
+		}
+
+		float direct_cost = AABB::unify(aabb, node_reinsert.aabb).surface_area();
 		float cost = induced_cost + direct_cost;
 
 		if (cost < min_cost) {
@@ -127,16 +196,76 @@ static void find_reinsertion(const BVH & bvh, const BVHNode & node_reinsert, flo
 		}
 
 		if (!node.is_leaf()) {
-			float child_induced_cost = cost - node.aabb.surface_area();
+			float child_induced_cost = cost - aabb.surface_area();
 
 			if (child_induced_cost + node_reinsert_area < min_cost) {
-				priority_queue.emplace(node.left,     child_induced_cost);
-				priority_queue.emplace(node.left + 1, child_induced_cost);
+				for (int i = 0; i < 2; i++) {
+					int child_index = tree.get_child(node_index, i);
+
+					priority_queue.push({ child_index, child_induced_cost, tree.get_child_path_depth(child_index, search_node.path_depth) });
+				}
 			}
 		}
 	}
 }
 
+// Result of the search phase for a single candidate Node, all indices refer to the tree as it was at the start of the batch
+struct ReinsertionCandidate {
+	int node_index;
+	int reinsert_index[2]; // Children of the candidate, the one with the largest area is reinserted first
+	int target_index  [2]; // Nodes that will become the new siblings of the reinserted children, -1 if the candidate is not valid
+};
+
+// Finds the best positions to reinsert both children of the candidate Node after it is removed.
+// The tree is only read, so that the candidates of a batch can be searched in parallel
+static ReinsertionCandidate find_candidate_reinsertions(const BVH & bvh, const int parent_indices[], int node_index) {
+	ReinsertionCandidate candidate = { node_index, { -1, -1 }, { -1, -1 } };
+
+	const BVHNode & node = bvh.nodes[node_index];
+
+	int parent = parent_indices[node_index];
+	if (node.is_leaf() || parent == 0 || parent == -1) return candidate;
+
+	// Child with largest area should be reinserted first
+	float area_left  = bvh.nodes[node.left]    .aabb.surface_area();
+	float area_right = bvh.nodes[node.left + 1].aabb.surface_area();
+
+	if (area_left > area_right) {
+		candidate.reinsert_index[0] = node.left;
+		candidate.reinsert_index[1] = node.left + 1;
+	} else {
+		candidate.reinsert_index[0] = node.left + 1;
+		candidate.reinsert_index[1] = node.left;
+	}
+
+	ReinsertionTree tree = { bvh, parent, (node_index & 1) ? node_index - 1 : node_index + 1 };
+
+	for (int j = 0; j < 2; j++) {
+		const BVHNode & node_reinsert = bvh.nodes[candidate.reinsert_index[j]];
+
+		float min_cost  = INFINITY;
+		int   min_index = -1;
+
+		find_reinsertion(tree, node_reinsert, min_cost, min_index);
+
+		candidate.target_index[j] = min_index;
+
+		if (j == 0) {
+			// The second child is searched for in the tree that contains the first child
+			tree.first_reinsert_index = candidate.reinsert_index[0];
+			tree.first_reinsert_aabb  = node_reinsert.aabb;
+
+			for (int ancestor = min_index; ancestor != -1; ancestor = parent_indices[ancestor]) {
+				if (ancestor != parent) tree.first_reinsert_path.push_back(ancestor);
+			}
+
+			std::reverse(tree.first_reinsert_path.begin(), tree.first_reinsert_path.end());
+		}
+	}
+
+	return candidate;
+}
+
 // Update AABBs bottom up, until the root of the tree is reached
 static void update_aabbs_bottom_up(BVH & bvh, int parent_indices[], int node_index) {
 	assert(node_index >= 0);
@@ -288,8 +417,10 @@ static void bvh_collapse(const BVH & bvh, BVH & new_bvh, int new_index, BitArray
 	} else {
 		// Check if this internal Node needs to collapse its subtree into a leaf
 		if (collapse[node_index]) {
-			new_node.count = collapse_subtree(bvh, new_bvh, node_index);
-			new_node.first = new_bvh.index_count - new_node.count;
+			new_node.first = new_bvh.index_count;
+			new_node.count = remove_duplicate_indices(new_bvh.indices + new_node.first, collapse_subtree(bvh, new_bvh, node_index));
+
+			new_bvh.index_count = new_node.first + new_node.count;
 			
 			assert(new_node.is_leaf());
 		} else {
@@ -304,12 +435,12 @@ static void bvh_collapse(const BVH & bvh, BVH & new_bvh, int new_index, BitArray
 	}
 }
 
-void BVHOptimizer::optimize(BVH & bvh) {
+bool BVHOptimizer::optimize(BVH & bvh, unsigned seed, const Budget & budget, Progress * progress) {
 	ScopeTimer timer("BVH Optimization");
 	
 	float cost_before = bvh_sah_cost(bvh);
 
-	if (bvh.node_count < 8) return; // Tree too small to optimize
+	if (bvh.node_count < 8) return true; // Tree too small to optimize
 
 	int * parent_indices = new int[bvh.node_count];
 	parent_indices[0] = -1; // Root has no parent
@@ -321,42 +452,114 @@ void BVHOptimizer::optimize(BVH & bvh) {
 	
 	static_assert(P_T >= P_R);
 
-	constexpr size_t TIME_OUT = -1; // Time budget in seconds, after this amount of time the algorithm terminates
+	constexpr int CANDIDATES_PER_TASK = 16;
+
+	Progress progress_start = progress ? *progress : Progress { };
+
+	// The generator is owned by this call and seeded explicitly, so that optimizing the same BVH always gives the same result.
+	// When continuing an earlier optimization the batch count is mixed in, so that it does not repeat the same random batches
+	std::seed_seq seed_sequence = { seed, unsigned(progress_start.batch_count) };
+	std::mt19937  rng(seed_sequence);
 
 	int   batch_size = bvh.node_count / k;
 	int * batch_indices = new int[bvh.node_count];
 
-	int batch_count = 0;
-	int batches_since_last_cost_reduction = 0;
+	// Candidates of a batch consist of the candidates deferred by the previous batch, followed by newly selected ones
+	int * candidate_indices = new int[batch_size];
+	int   candidate_count   = 0;
+
+	ReinsertionCandidate * candidates = new ReinsertionCandidate[batch_size];
+
+	int * deferred_indices = new int[batch_size];
+	int   deferred_count   = 0;
+
+	BitArray in_batch;
+	in_batch.init(bvh.node_count);
+	in_batch.set_all(false);
+
+	// Nodes touched by a reinsertion in the current batch, indexed by the position they had at the start of the batch
+	BitArray locked;
+	locked.init(bvh.node_count);
+
+	int batch_count                       = progress_start.batch_count;
+	int batches_since_last_cost_reduction = progress_start.batches_since_last_cost_reduction;
 
 	float sah_cost_best = cost_before;
+	float sah_cost      = cost_before;
+
+	// Batches can increase the SAH cost, so the best tree is kept around to be returned when the optimization stops
+	BVHNode * nodes_best = new BVHNode[bvh.node_count];
+	memcpy(nodes_best, bvh.nodes, bvh.node_count * sizeof(BVHNode));
+
+	bool finished = true;
 
 	enum struct NodeSelectionMethod {
 		RANDOM,
 		MEASURE
-	} node_selection_method = NodeSelectionMethod::MEASURE;
+	} node_selection_method = batches_since_last_cost_reduction >= P_R ? NodeSelectionMethod::RANDOM : NodeSelectionMethod::MEASURE;
 
 	int * originated   = new int[bvh.node_count];
 	int * displacement = new int[bvh.node_count];
 
 	auto start_time = std::chrono::high_resolution_clock::now();
 
-	while (true) {
+	while (sah_cost_best > budget.target_sah_cost && batches_since_last_cost_reduction < P_T) {
 		// Select a batch of internal Nodes, either randomly or using a heuristic measure
 		switch (node_selection_method) {
-			case NodeSelectionMethod::RANDOM:  select_nodes_random (bvh, parent_indices, batch_size, batch_indices); break;
-			case NodeSelectionMethod::MEASURE: select_nodes_measure(bvh, parent_indices, batch_size, batch_indices); break;
+			case NodeSelectionMethod::RANDOM:  select_nodes_random (bvh, parent_indices, batch_size, batch_indices, rng); break;
+			case NodeSelectionMethod::MEASURE: select_nodes_measure(bvh, parent_indices, batch_size, batch_indices);      break;
 
 			default: abort();
 		}
 
+		candidate_count = 0;
+
+		for (int i = 0; i < deferred_count; i++) {
+			candidate_indices[candidate_count++] = deferred_indices[i];
+			in_batch[deferred_indices[i]] = true;
+		}
+
+		for (int i = 0; i < batch_size && candidate_count < batch_size; i++) {
+			if (!in_batch[batch_indices[i]]) {
+				candidate_indices[candidate_count++] = batch_indices[i];
+			}
+		}
+
+		for (int i = 0; i < deferred_count; i++) {
+			in_batch[deferred_indices[i]] = false;
+		}
+
+		// Search phase: the reinsertion positions of all candidates are found in parallel on the tree as it is at the start of the batch
+		ThreadPool::TaskGroup group;
+
+		for (int first = 0; first < candidate_count; first += CANDIDATES_PER_TASK) {
+			int last = Math::min(first + CANDIDATES_PER_TASK, candidate_count);
+
+			ThreadPool::submit(group, [&bvh, parent_indices, candidate_indices, candidates, first, last]() {
+				for (int i = first; i < last; i++) {
+					candidates[i] = find_candidate_reinsertions(bvh, parent_indices, candidate_indices[i]);
+				}
+			});
+		}
+
+		ThreadPool::wait(group);
+
 		for (int i = 0; i < bvh.node_count; i++) {
 			originated  [i] = i;
 			displacement[i] = i;
 		}
 
-		for (int i = 0; i < batch_size; i++) {			
-			int node_index = displacement[batch_indices[i]];
+		locked.set_all(false);
+		deferred_count = 0;
+
+		// Commit phase: the reinsertions are performed serially in a fixed order, so that the result does not depend on the number of threads.
+		// A reinsertion conflicts with an earlier one in the same batch if they share a Node, or if the earlier one has
+		// invalidated its search result. Conflicting candidates are deferred to the next batch, where they are searched again
+		for (int i = 0; i < candidate_count; i++) {
+			const ReinsertionCandidate & candidate = candidates[i];
+			if (candidate.target_index[0] == -1) continue; // Not a valid candidate
+
+			int node_index = displacement[candidate.node_index];
 			if (node_index == -1) continue; // This Node was overwritten by another reinsertion and no longer exists
 
 			const BVHNode & node = bvh.nodes[node_index];
@@ -370,6 +573,63 @@ void BVHOptimizer::optimize(BVH & bvh) {
 
 			int child_left  = node.left;
 			int child_right = node.left + 1;
+
+			int nodes_touched[10] = { node_index, parent, sibling, parent_parent, child_left, child_right };
+			int nodes_touched_count = 6;
+
+			bool conflict = false;
+
+			for (int j = 0; j < 2 && !conflict; j++) {
+				int reinsert = displacement[candidate.reinsert_index[j]];
+
+				if (reinsert != child_left && reinsert != child_right) {
+					conflict = true;
+					break;
+				}
+
+				if (candidate.target_index[j] == TARGET_FIRST_REINSERTION) continue;
+
+				int target = displacement[candidate.target_index[j]];
+
+				if (target == -1 || target == parent) {
+					conflict = true;
+					break;
+				}
+
+				// The second child may be reinserted inside the first child, but any other target inside the candidate
+				// must have been moved there by an earlier reinsertion, reinserting there would create a cycle
+				int first_reinsert = displacement[candidate.reinsert_index[0]];
+
+				for (int ancestor = target; ancestor != -1; ancestor = parent_indices[ancestor]) {
+					if (j == 1 && ancestor == first_reinsert) break;
+
+					if (ancestor == node_index) {
+						conflict = true;
+						break;
+					}
+				}
+
+				nodes_touched[nodes_touched_count++] = target;
+				if (parent_indices[target] != -1) nodes_touched[nodes_touched_count++] = parent_indices[target];
+			}
+
+			if (!conflict) {
+				for (int j = 0; j < nodes_touched_count; j++) {
+					if (locked[originated[nodes_touched[j]]]) {
+						conflict = true;
+						break;
+					}
+				}
+			}
+
+			if (conflict) {
+				deferred_indices[deferred_count++] = candidate.node_index;
+				continue;
+			}
+
+			for (int j = 0; j < nodes_touched_count; j++) {
+				locked[originated[nodes_touched[j]]] = true;
+			}
 			
 			struct Reinsert {
 				int     node_index;
@@ -377,23 +637,20 @@ void BVHOptimizer::optimize(BVH & bvh) {
 			};
 
 			int      nodes_unused  [2];
+			int      nodes_inserted[2]; // Nodes created by the reinsertions
 			Reinsert nodes_reinsert[2];
 
-			// Child with largest area should be reinserted first
-			float area_left  = bvh.nodes[node.left]    .aabb.surface_area();
-			float area_right = bvh.nodes[node.left + 1].aabb.surface_area();
+			for (int j = 0; j < 2; j++) {
+				int reinsert_index = displacement[candidate.reinsert_index[j]];
 
-			if (area_left > area_right) {
-				nodes_reinsert[0] = { child_left,  bvh.nodes[child_left]  };
-				nodes_reinsert[1] = { child_right, bvh.nodes[child_right] };
-			} else {
-				nodes_reinsert[0] = { child_right, bvh.nodes[child_right] };
-				nodes_reinsert[1] = { child_left,  bvh.nodes[child_left]  };
+				nodes_reinsert[j] = { reinsert_index, bvh.nodes[reinsert_index] };
 			}
 
 			nodes_unused[0] = node_index & ~1;
 			nodes_unused[1] = child_left;
 
+			int parent_originated = originated[parent];
+
 			// Keep tree topologically consistent
 			bvh.nodes[parent] = bvh.nodes[sibling];
 			parent_indices[sibling] = parent_parent;
@@ -406,8 +663,8 @@ void BVHOptimizer::optimize(BVH & bvh) {
 				parent_indices[bvh.nodes[sibling].left + 1] = parent;
 			}
 
-			displacement[originated[parent]]     = -1;
-			displacement[originated[node_index]] = -1;
+			displacement[parent_originated]    = -1;
+			displacement[candidate.node_index] = -1;
 
 			update_aabbs_bottom_up(bvh, parent_indices, parent_parent);
 			
@@ -418,11 +675,17 @@ void BVHOptimizer::optimize(BVH & bvh) {
 
 				assert((unused & 1) == 0);
 			
-				// Find the best position to reinsert the given Node
-				float min_cost  = INFINITY;
-				int   min_index = -1;
+				// Look up where the target found during the search phase currently resides
+				int min_index;
+
+				if (candidate.target_index[j] == TARGET_FIRST_REINSERTION) {
+					min_index = nodes_inserted[0];
+				} else {
+					min_index = displacement[candidate.target_index[j]];
+				}
 
-				find_reinsertion(bvh, reinsert.node, min_cost, min_index);
+				assert(min_index != -1);
+				nodes_inserted[j] = min_index;
 
 				// Bookkeeping updates to perform the reinsertion
 				bvh.nodes[unused    ] = bvh.nodes[min_index];
@@ -457,12 +720,27 @@ void BVHOptimizer::optimize(BVH & bvh) {
 				assert(!bvh.nodes[min_index].is_leaf());
 			}
 		}
+
+		// Deferred candidates are identified by their position at the start of the next batch
+		int deferred_remaining = 0;
+
+		for (int i = 0; i < deferred_count; i++) {
+			int node_index = displacement[deferred_indices[i]];
+
+			if (node_index != -1) {
+				deferred_indices[deferred_remaining++] = node_index;
+			}
+		}
+
+		deferred_count = deferred_remaining;
 		
-		float sah_cost = bvh_sah_cost(bvh);
+		sah_cost = bvh_sah_cost(bvh);
 
 		if (sah_cost < sah_cost_best) {
 			sah_cost_best = sah_cost;
 
+			memcpy(nodes_best, bvh.nodes, bvh.node_count * sizeof(BVHNode));
+
 			batches_since_last_cost_reduction = 0;
 
 			node_selection_method = NodeSelectionMethod::MEASURE;
@@ -474,40 +752,69 @@ void BVHOptimizer::optimize(BVH & bvh) {
 				node_selection_method = NodeSelectionMethod::RANDOM;
 			}
 			// Check if we should terminate
-			if (batches_since_last_cost_reduction == P_T) {
+			if (batches_since_last_cost_reduction >= P_T) {
 				break;
 			}
 		}
 
-		auto   curr_time = std::chrono::high_resolution_clock::now();
-		size_t duration  = std::chrono::duration_cast<std::chrono::seconds>(curr_time - start_time).count();
+		printf("%i: SAH=%f best=%f last_reduction=%i     \r", batch_count, sah_cost, sah_cost_best, batches_since_last_cost_reduction);
+
+		batch_count++;
+
+		// Reaching the target counts as finished, even if the time budget ran out during the same batch
+		if (sah_cost_best <= budget.target_sah_cost) break;
+
+		auto  curr_time = std::chrono::high_resolution_clock::now();
+		float duration  = std::chrono::duration<float>(curr_time - start_time).count();
 
-		if (duration > TIME_OUT) {
-			printf("\nTime budget of %zu seconds exceeded! Optimization process was terminated.", TIME_OUT);
+		if (duration > budget.time_limit) {
+			printf("\nTime budget of %g seconds exceeded! Optimization process was terminated.", budget.time_limit);
 
+			finished = false;
 			break;
 		}
-			
-		printf("%i: SAH=%f best=%f last_reduction=%i     \r", batch_count, sah_cost, sah_cost_best, batches_since_last_cost_reduction);
-
-		batch_count++;
 	}
 
 	delete [] originated;
 	delete [] displacement;
 
+	in_batch.free();
+	locked  .free();
+
 	delete [] batch_indices;
+	delete [] candidate_indices;
+	delete [] candidates;
+	delete [] deferred_indices;
 	delete [] parent_indices;
 
+	if (sah_cost > sah_cost_best) {
+		memcpy(bvh.nodes, nodes_best, bvh.node_count * sizeof(BVHNode));
+	}
+
+	delete [] nodes_best;
+
+	if (progress) {
+		progress->batch_count                       = batch_count;
+		progress->batches_since_last_cost_reduction = batches_since_last_cost_reduction;
+	}
+
+	printf("\ncost: %f -> %f\n", cost_before, sah_cost_best);
+
+	return finished;
+}
+
+void BVHOptimizer::collapse(BVH & bvh, bool single_primitive_leaves) {
+	float cost_before = bvh_sah_cost(bvh);
+
 	// Collapse leaf Nodes of the tree based on SAH cost
 	// Step 1: Calculate costs of collapse, and fill array with the decision to collapse, yes or no
 	BitArray collapse;
 	collapse.init(bvh.node_count);
 	collapse.set_all(false);
 
-#if BVH_TYPE != BVH_CWBVH // CWBVH also requires every leaf Node to contain only 1 primitive, so in that case we skip the collapse step
-	bvh_calc_collapse_cost(bvh, collapse);
-#endif
+	if (!single_primitive_leaves) {
+		bvh_calc_collapse_cost(bvh, collapse);
+	}
 
 	// Collapse BVH using a copy
 	BVH new_bvh;
@@ -519,7 +826,7 @@ void BVHOptimizer::optimize(BVH & bvh) {
 	bvh_collapse(bvh, new_bvh, 0, collapse);
 
 	assert(new_bvh.node_count  <= bvh.node_count);
-	assert(new_bvh.index_count == bvh.index_count);
+	assert(new_bvh.index_count <= bvh.index_count);
 
 	// Cleanup
 	collapse.free();
@@ -534,5 +841,5 @@ void BVHOptimizer::optimize(BVH & bvh) {
 
 	// Report the improvement of the SAH cost
 	float cost_after = bvh_sah_cost(bvh);
-	printf("\ncost: %f -> %f - nodes: %i -> %i\n", cost_before, cost_after, node_count_before, node_count_after);
+	printf("Collapse cost: %f -> %f - nodes: %i -> %i\n", cost_before, cost_after, node_count_before, node_count_after);
 }
@@ -2,5 +2,26 @@
 #include "BVH.h"
 
 namespace BVHOptimizer {
-	void optimize(BVH & bvh);
+	// Limits how long the optimization runs, it stops at whichever limit is reached first.
+	// Without limits it runs until the SAH cost stops improving
+	struct Budget {
+		float time_limit      = INFINITY; // In seconds, checked after every batch
+		float target_sah_cost = 0.0f;     // Stop as soon as the SAH cost drops to this value
+	};
+
+	// Where an unfinished optimization left off, so that it can be continued later
+	struct Progress {
+		int batch_count                       = 0;
+		int batches_since_last_cost_reduction = 0;
+	};
+
+	// Optimizes the BVH by removing and reinserting batches of Nodes, see Bittner et al. 2013.
+	// The reinsertion positions of a batch are searched for in parallel, the same seed always produces the same BVH.
+	// The BVH is left in the best state that was found. Returns false if the time limit was reached before the optimization
+	// converged or reached the target SAH cost. The BVH can then be passed in again later, together with the Progress, to continue the optimization
+	bool optimize(BVH & bvh, unsigned seed = 0, const Budget & budget = { }, Progress * progress = nullptr);
+
+	// Collapses subtrees into a single leaf wherever that lowers the SAH cost, unless single_primitive_leaves is set (required by the CWBVH).
+	// Should be called once after all optimization passes since the optimizers expect leaves with a single primitive
+	void collapse(BVH & bvh, bool single_primitive_leaves = false);
 }
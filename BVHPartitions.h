@@ -1,5 +1,9 @@
 #pragma once
+#include <algorithm>
+
 #include "Math.h"
+#include "BitArray.h"
+#include "BVHSweep.h"
 
 #include "Util.h"
 
@@ -10,6 +14,10 @@ namespace BVHPartitions {
 	struct PrimitiveRef {
 		int  index;
 		AABB aabb;
+
+		inline Vector3 get_center() const {
+			return aabb.get_center();
+		}
 	};
 
 	// Calculates the smallest enclosing AABB over the union of all AABB's of the primitives in the range defined by [first, last>
@@ -29,86 +37,93 @@ namespace BVHPartitions {
 		return aabb;
 	} 
 
-	// Reorders indices arrays such that indices on the left side of the splitting dimension end up on the left partition in the other dimensions as well
-	template<typename Primitive>
-	inline void split_indices(const Primitive * primitives, int * indices[3], int first_index, int index_count, int * temp, int split_dimension, int split_index, float split) {
-		for (int dimension = 0; dimension < 3; dimension++) {
-			if (dimension != split_dimension) {
-				int left  = 0;
-				int right = split_index - first_index;
+	// Marks the primitives in the range that end up in the left partition, these are the ones before split_index along the split dimension.
+	// Only the bits of primitives in the range are written, so Nodes with disjoint ranges may do this concurrently
+	inline void mark_left(const int * indices, int first_index, int index_count, int split_index, BitArray & goes_left) {
+		for (int i = first_index; i < first_index + index_count; i++) {
+			goes_left.set_atomic(indices[i], i < split_index);
+		}
+	}
 
-				for (int i = first_index; i < first_index + index_count; i++) {
-					bool goes_left = primitives[indices[dimension][i]].get_center()[split_dimension] < split;
+	// Reorders the indices along the given dimension such that primitives marked as going left end up in the left partition.
+	// The relative order of the indices is preserved on both sides, so they remain sorted along the given dimension
+	inline void split_indices_dimension(int * indices, int first_index, int index_count, int * temp, int split_index, const BitArray & goes_left) {
+		int left  = 0;
+		int right = split_index - first_index;
 
-					if (primitives[indices[dimension][i]].get_center()[split_dimension] == split) {
-						// In case the current primitive has the same coordianate as the one we split on along the split dimension,
-						// We don't know whether the primitive should go left or right.
-						// In this case check all primitive indices on the left side of the split that 
-						// have the same split coordinate for equality with the current primitive index i
+		for (int i = first_index; i < first_index + index_count; i++) {
+			int index = indices[i];
 
-						int j = split_index - 1;
-						// While we can go left and the left primitive has the same coordinate along the split dimension as the split itself
-						while (j >= first_index && primitives[indices[split_dimension][j]].get_center()[split_dimension] == split) {
-							if (indices[split_dimension][j] == indices[dimension][i]) {
-								goes_left = true;
+			if (goes_left.get_atomic(index)) {
+				temp[left++] = index;
+			} else {
+				temp[right++] = index;
+			}
+		}
 
-								break;
-							}
+		// If these conditions are not met the memcpy below is invalid
+		assert(left  == split_index - first_index);
+		assert(right == index_count);
 
-							j--;
-						}
-					}
+		memcpy(indices + first_index, temp, index_count * sizeof(int));
+	}
 
-					if (goes_left) {					
-						temp[left++] = indices[dimension][i];
-					} else {
-						temp[right++] = indices[dimension][i];
-					}
-				}
+	// Reorders indices arrays such that indices on the left side of the splitting dimension end up on the left partition in the other dimensions as well
+	inline void split_indices(int * indices[3], int first_index, int index_count, int * temp, int split_dimension, int split_index, BitArray & goes_left) {
+		mark_left(indices[split_dimension], first_index, index_count, split_index, goes_left);
 
-				// If these conditions are not met the memcpy below is invalid
-				assert(left  == split_index - first_index);
-				assert(right == index_count);
+		for (int dimension = 0; dimension < 3; dimension++) {
+			if (dimension != split_dimension) {
+				split_indices_dimension(indices[dimension], first_index, index_count, temp, split_index, goes_left);
+			}
+		}
+	}
 
-				memcpy(indices[dimension] + first_index, temp, index_count * sizeof(int));
+	// Evaluates SAH for every object along a single dimension, returns the index of the first primitive on the right side of the best split
+	// If multiple splits have the same cost the first one is chosen.
+	// The bounds of the primitives are gathered into the given scratch memory first, which should have room for index_count primitives
+	template<typename Primitive>
+	inline int partition_sah_dimension(const Primitive * primitives, const int * indices, int first_index, int index_count, BVHSweep::BoundsSoA bounds, float * sah, float & split_cost) {
+		BVHSweep::gather(primitives, indices + first_index, index_count, bounds);
+
+		// First traverse left to right along the current dimension to evaluate first half of the SAH,
+		// then traverse right to left along the current dimension to evaluate second half of the SAH
+		BVHSweep::sweep_left (bounds, index_count, sah);
+		BVHSweep::sweep_right(bounds, index_count, sah);
+
+		float min_split_cost  = INFINITY;
+		int   min_split_index = -1;
+
+		// Find the minimum of the SAH
+		for (int i = 0; i < index_count - 1; i++) {
+			float cost = sah[i];
+			if (cost < min_split_cost) {
+				min_split_cost  = cost;
+				min_split_index = first_index + i + 1;
 			}
 		}
+
+		split_cost = min_split_cost;
+
+		return min_split_index;
 	}
 
 	// Evaluates SAH for every object for every dimension to determine splitting candidate
 	template<typename Primitive>
-	inline int partition_sah(const Primitive * primitives, int * indices[3], int first_index, int index_count, float * sah, int & split_dimension, float & split_cost) {
+	inline int partition_sah(const Primitive * primitives, int * indices[3], int first_index, int index_count, BVHSweep::BoundsSoA bounds, float * sah, int & split_dimension, float & split_cost) {
 		float min_split_cost = INFINITY;
 		int   min_split_index     = -1;
 		int   min_split_dimension = -1;
 
 		// Check splits along all 3 dimensions
 		for (int dimension = 0; dimension < 3; dimension++) {
-			AABB aabb_left  = AABB::create_empty();
-			AABB aabb_right = AABB::create_empty();
+			float cost;
+			int   index = partition_sah_dimension(primitives, indices[dimension], first_index, index_count, bounds, sah, cost);
 
-			// First traverse left to right along the current dimension to evaluate first half of the SAH
-			for (int i = 0; i < index_count - 1; i++) {
-				aabb_left.expand(primitives[indices[dimension][first_index + i]].aabb);
-				
-				sah[i] = aabb_left.surface_area() * float(i + 1);
-			}
-
-			// Then traverse right to left along the current dimension to evaluate second half of the SAH
-			for (int i = index_count - 1; i > 0; i--) {
-				aabb_right.expand(primitives[indices[dimension][first_index + i]].aabb);
-
-				sah[i - 1] += aabb_right.surface_area() * float(index_count - i);
-			}
-
-			// Find the minimum of the SAH
-			for (int i = 0; i < index_count - 1; i++) {
-				float cost = sah[i];
-				if (cost < min_split_cost) {
-					min_split_cost = cost;
-					min_split_index = first_index + i + 1;
-					min_split_dimension = dimension;
-				}
+			if (cost < min_split_cost) {
+				min_split_cost = cost;
+				min_split_index = index;
+				min_split_dimension = dimension;
 			}
 		}
 
@@ -120,59 +135,99 @@ namespace BVHPartitions {
 		return min_split_index;
 	}
 
-	struct ObjectSplit {
-		int   index;
+	struct Bin {
+		AABB aabb;
+		int  count;
+	};
+
+	struct BinnedSplit {
+		int   bin;
 		float cost;
 		int   dimension;
-		
-		AABB aabb_left;
-		AABB aabb_right;
+
+		// Mapping from centroid coordinate to bin index along the split dimension
+		float bin_offset;
+		float bin_scale;
 	};
 
-	// Evaluates SAH for every object for every dimension to determine splitting candidate
-	inline ObjectSplit partition_object(const Triangle * primitives, PrimitiveRef * indices[3], int first_index, int index_count, AABB * bounds, float * sah) {
-		ObjectSplit split = { };
+	// Calculates the index of the bin that the given centroid coordinate falls into
+	inline int binned_bin_index(float center, float bin_offset, float bin_scale, int bin_count) {
+		int bin = int((center - bin_offset) * bin_scale);
+
+		return Math::clamp(bin, 0, bin_count - 1);
+	}
+
+	// Evaluates SAH for 'bin_count' equally spaced split planes along every dimension, based on the centroid bounds of the references.
+	// If no valid split exists (i.e. all centroids coincide) the returned split has bin == -1
+	inline BinnedSplit partition_binned(const PrimitiveRef * references, int first_index, int index_count, const AABB & centroid_bounds, Bin * bins, float * sah, int bin_count) {
+		BinnedSplit split = { };
 		split.cost = INFINITY;
-		split.index     = -1;
+		split.bin       = -1;
 		split.dimension = -1;
-		
-		AABB * bounds_left  = bounds;
-		AABB * bounds_right = bounds + index_count;
-		
-		// Check splits along all 3 dimensions
+
+		float bin_offset[3];
+		float bin_scale [3];
+
 		for (int dimension = 0; dimension < 3; dimension++) {
-			bounds_left [0]           = AABB::create_empty();
-			bounds_right[index_count] = AABB::create_empty();
+			float centroid_delta = centroid_bounds.max[dimension] - centroid_bounds.min[dimension];
+
+			bin_offset[dimension] = centroid_bounds.min[dimension];
+			bin_scale [dimension] = centroid_delta > 0.0f ? float(bin_count) * (1.0f - 1e-5f) / centroid_delta : 0.0f;
+		}
+
+		for (int b = 0; b < 3 * bin_count; b++) {
+			bins[b].aabb  = AABB::create_empty();
+			bins[b].count = 0;
+		}
 
-			// First traverse left to right along the current dimension to evaluate first half of the SAH
-			for (int i = 1; i < index_count; i++) {
-				bounds_left[i] = bounds_left[i-1];
-				bounds_left[i].expand(indices[dimension][first_index + i - 1].aabb);
+		// Place every reference in the bin its centroid falls into, for all 3 dimensions in a single pass
+		for (int i = first_index; i < first_index + index_count; i++) {
+			const AABB & aabb = references[i].aabb;
+			Vector3 center = aabb.get_center();
 
-				sah[i] = bounds_left[i].surface_area() * float(i);
+			for (int dimension = 0; dimension < 3; dimension++) {
+				Bin & bin = bins[dimension * bin_count + binned_bin_index(center[dimension], bin_offset[dimension], bin_scale[dimension], bin_count)];
+
+				bin.aabb.expand(aabb);
+				bin.count++;
 			}
+		}
+
+		for (int dimension = 0; dimension < 3; dimension++) {
+			if (bin_scale[dimension] == 0.0f) continue; // All centroids lie on the same plane, no split possible along this dimension
+
+			const Bin * bins_dimension = bins + dimension * bin_count;
 
-			// Then traverse right to left along the current dimension to evaluate second half of the SAH
-			for (int i = index_count - 1; i > 0; i--) {
-				bounds_right[i] = bounds_right[i+1];
-				bounds_right[i].expand(indices[dimension][first_index + i].aabb);
+			// First traverse right to left along the current dimension to evaluate second half of the SAH
+			AABB aabb_right  = AABB::create_empty();
+			int  count_right = 0;
 
-				sah[i] += bounds_right[i].surface_area() * float(index_count - i);
+			for (int b = bin_count - 1; b > 0; b--) {
+				aabb_right.expand(bins_dimension[b].aabb);
+				count_right += bins_dimension[b].count;
+
+				sah[b] = count_right > 0 ? aabb_right.surface_area() * float(count_right) : INFINITY;
 			}
-			
-			// Find the minimum of the SAH
-			for (int i = 1; i < index_count; i++) {
-				float cost = sah[i];
+
+			// Then traverse left to right along the current dimension to evaluate first half of the SAH
+			AABB aabb_left  = AABB::create_empty();
+			int  count_left = 0;
+
+			for (int b = 1; b < bin_count; b++) {
+				aabb_left.expand(bins_dimension[b - 1].aabb);
+				count_left += bins_dimension[b - 1].count;
+
+				if (count_left == 0) continue;
+
+				// Split plane b lies between bin b-1 and bin b
+				float cost = sah[b] + aabb_left.surface_area() * float(count_left);
 				if (cost < split.cost) {
 					split.cost = cost;
-					split.index = first_index + i;
+					split.bin       = b;
 					split.dimension = dimension;
-					
-					assert(!bounds_left [i].is_empty());
-					assert(!bounds_right[i].is_empty());
 
-					split.aabb_left  = bounds_left[i];
-					split.aabb_right = bounds_right[i];
+					split.bin_offset = bin_offset[dimension];
+					split.bin_scale  = bin_scale [dimension];
 				}
 			}
 		}
@@ -180,6 +235,82 @@ namespace BVHPartitions {
 		return split;
 	}
 
+	// Reorders the references in place such that all references on the left side of the binned split come first
+	// Returns the index of the first reference on the right side
+	inline int split_indices_binned(PrimitiveRef * references, int first_index, int index_count, const BinnedSplit & split, int bin_count) {
+		PrimitiveRef * middle = std::partition(references + first_index, references + first_index + index_count, [&](const PrimitiveRef & reference) {
+			Vector3 center = reference.aabb.get_center();
+
+			return binned_bin_index(center[split.dimension], split.bin_offset, split.bin_scale, bin_count) < split.bin;
+		});
+
+		return int(middle - references);
+	}
+
+	struct ObjectSplit {
+		int   index;
+		float cost;
+		int   dimension;
+		
+		AABB aabb_left;
+		AABB aabb_right;
+	};
+
+	// Evaluates SAH for every object along a single dimension, updates the split if a cheaper one is found
+	// The bounds of the references are gathered into the given scratch memory first, which should have room for index_count references
+	inline void partition_object_dimension(const PrimitiveRef * indices, int first_index, int index_count, BVHSweep::BoundsSoA bounds, float * sah, int dimension, ObjectSplit & split) {
+		for (int i = 0; i < index_count; i++) {
+			bounds.store(i, indices[first_index + i].aabb);
+		}
+
+		// First traverse left to right along the current dimension to evaluate first half of the SAH,
+		// then traverse right to left along the current dimension to evaluate second half of the SAH
+		BVHSweep::sweep_left (bounds, index_count, sah);
+		BVHSweep::sweep_right(bounds, index_count, sah);
+
+		int split_index = -1;
+		
+		// Find the minimum of the SAH, sah[i] is the cost of splitting after the first i + 1 references
+		for (int i = 0; i < index_count - 1; i++) {
+			float cost = sah[i];
+			if (cost < split.cost) {
+				split.cost = cost;
+				split.index = first_index + i + 1;
+				split.dimension = dimension;
+
+				split_index = i + 1;
+			}
+		}
+
+		if (split_index == -1) return;
+
+		// Only the bounds of the chosen split are needed, so they are recomputed here instead of being stored during the sweeps
+		split.aabb_left  = AABB::create_empty();
+		split.aabb_right = AABB::create_empty();
+
+		for (int i = 0; i < split_index; i++) {
+			split.aabb_left.expand(bounds.load(i));
+		}
+		for (int i = index_count - 1; i >= split_index; i--) {
+			split.aabb_right.expand(bounds.load(i));
+		}
+	}
+
+	// Evaluates SAH for every object for every dimension to determine splitting candidate
+	inline ObjectSplit partition_object(const Triangle * primitives, PrimitiveRef * indices[3], int first_index, int index_count, BVHSweep::BoundsSoA bounds, float * sah) {
+		ObjectSplit split = { };
+		split.cost = INFINITY;
+		split.index     = -1;
+		split.dimension = -1;
+		
+		// Check splits along all 3 dimensions
+		for (int dimension = 0; dimension < 3; dimension++) {
+			partition_object_dimension(indices[dimension], first_index, index_count, bounds, sah, dimension, split);
+		}
+
+		return split;
+	}
+
 	inline void triangle_intersect_plane(Vector3 vertices[3], int dimension, float plane, Vector3 intersections[], int * intersection_count) {
 		for (int i = 0; i < 3; i++) {
 			float vertex_i = vertices[i][dimension];
@@ -218,190 +349,181 @@ namespace BVHPartitions {
 		int num_right;
 	};
 
-	inline SpatialSplit partition_spatial(const Triangle * triangles, PrimitiveRef * indices[3], int first_index, int index_count, float * sah, AABB bounds) {
-		SpatialSplit split = { };
-		split.cost = INFINITY;
-		split.index     = -1;
-		split.dimension = -1;
-		split.plane_distance = NAN;
+	// Evaluates SAH for a fixed number of spatial split planes along a single dimension, updates the split if a cheaper one is found
+	inline void partition_spatial_dimension(const Triangle * triangles, const PrimitiveRef * indices, int first_index, int index_count, AABB bounds, int dimension, SpatialSplit & split) {
+		float bounds_min  = bounds.min[dimension] - 0.001f;
+		float bounds_max  = bounds.max[dimension] + 0.001f;
+		float bounds_step = (bounds_max - bounds_min) / SBVH_BIN_COUNT;
+		
+		float inv_bounds_delta = 1.0f / (bounds_max - bounds_min);
 
-		for (int dimension = 0; dimension < 3; dimension++) {
-			float bounds_min  = bounds.min[dimension] - 0.001f;
-			float bounds_max  = bounds.max[dimension] + 0.001f;
-			float bounds_step = (bounds_max - bounds_min) / SBVH_BIN_COUNT;
+		struct Bin {
+			AABB aabb = AABB::create_empty();
+			int entries = 0;
+			int exits   = 0;
+		} bins[SBVH_BIN_COUNT];
+
+		for (int i = first_index; i < first_index + index_count; i++) {
+			const Triangle & triangle = triangles[indices[i].index];
 			
-			float inv_bounds_delta = 1.0f / (bounds_max - bounds_min);
+			AABB triangle_aabb = indices[i].aabb;
 
-			struct Bin {
-				AABB aabb = AABB::create_empty();
-				int entries = 0;
-				int exits   = 0;
-			} bins[SBVH_BIN_COUNT];
+			Vector3 vertices[3] = { 
+				triangle.position_0,
+				triangle.position_1, 
+				triangle.position_2 
+			};
+			
+			// Sort the vertices along the current dimension
+			if (vertices[0][dimension] > vertices[1][dimension]) Util::swap(vertices[0], vertices[1]);
+			if (vertices[1][dimension] > vertices[2][dimension]) Util::swap(vertices[1], vertices[2]);
+			if (vertices[0][dimension] > vertices[1][dimension]) Util::swap(vertices[0], vertices[1]);
 
-			for (int i = first_index; i < first_index + index_count; i++) {
-				const Triangle & triangle = triangles[indices[dimension][i].index];
-				
-				AABB triangle_aabb = indices[dimension][i].aabb;
+			float vertex_min = triangle_aabb.min[dimension];
+			float vertex_max = triangle_aabb.max[dimension];
+			
+			int bin_min = int(SBVH_BIN_COUNT * ((vertex_min - bounds_min) * inv_bounds_delta));
+			int bin_max = int(SBVH_BIN_COUNT * ((vertex_max - bounds_min) * inv_bounds_delta));
 
-				Vector3 vertices[3] = { 
-					triangle.position_0,
-					triangle.position_1, 
-					triangle.position_2 
-				};
-				
-				// Sort the vertices along the current dimension
-				if (vertices[0][dimension] > vertices[1][dimension]) Util::swap(vertices[0], vertices[1]);
-				if (vertices[1][dimension] > vertices[2][dimension]) Util::swap(vertices[1], vertices[2]);
-				if (vertices[0][dimension] > vertices[1][dimension]) Util::swap(vertices[0], vertices[1]);
+			bin_min = Math::clamp(bin_min, 0, SBVH_BIN_COUNT - 1);
+			bin_max = Math::clamp(bin_max, 0, SBVH_BIN_COUNT - 1);
 
-				float vertex_min = triangle_aabb.min[dimension];
-				float vertex_max = triangle_aabb.max[dimension];
+			bins[bin_min].entries++;
+			bins[bin_max].exits++;
+
+			// Iterate over bins that intersect the AABB along the current dimension
+			for (int b = bin_min; b <= bin_max; b++) {
+				Bin & bin = bins[b];
 				
-				int bin_min = int(SBVH_BIN_COUNT * ((vertex_min - bounds_min) * inv_bounds_delta));
-				int bin_max = int(SBVH_BIN_COUNT * ((vertex_max - bounds_min) * inv_bounds_delta));
+				float bin_left_plane  = bounds_min + float(b) * bounds_step;
+				float bin_right_plane = bin_left_plane + bounds_step;
 
-				bin_min = Math::clamp(bin_min, 0, SBVH_BIN_COUNT - 1);
-				bin_max = Math::clamp(bin_max, 0, SBVH_BIN_COUNT - 1);
+				assert(bin.aabb.is_valid() || bin.aabb.is_empty());
 
-				bins[bin_min].entries++;
-				bins[bin_max].exits++;
+				// If all vertices lie outside the bin we don't care about this triangle
+				if (vertex_min >= bin_right_plane || vertex_max <= bin_left_plane) {
+					continue;
+				}
+				
+				// Calculate relevant portion of the AABB with regard to the two planes that define the current Bin
+				AABB triangle_aabb_clipped_against_bin = AABB::create_empty();
+				
+				// If all verticies lie between the two planes, the AABB is just the Triangle's entire AABB
+				if (vertex_min >= bin_left_plane && vertex_max <= bin_right_plane) {
+					triangle_aabb_clipped_against_bin = triangle_aabb;
+				} else {
+					Vector3 intersections[12];
+					int     intersection_count = 0;
 
-				// Iterate over bins that intersect the AABB along the current dimension
-				for (int b = bin_min; b <= bin_max; b++) {
-					Bin & bin = bins[b];
-					
-					float bin_left_plane  = bounds_min + float(b) * bounds_step;
-					float bin_right_plane = bin_left_plane + bounds_step;
+					if (vertex_min <= bin_left_plane  && bin_left_plane  <= vertex_max) triangle_intersect_plane(vertices, dimension, bin_left_plane,  intersections, &intersection_count);
+					if (vertex_min <= bin_right_plane && bin_right_plane <= vertex_max) triangle_intersect_plane(vertices, dimension, bin_right_plane, intersections, &intersection_count);
 
-					assert(bin.aabb.is_valid() || bin.aabb.is_empty());
+					assert(intersection_count < Util::array_element_count(intersections));
 
-					// If all vertices lie outside the bin we don't care about this triangle
-					if (vertex_min >= bin_right_plane || vertex_max <= bin_left_plane) {
-						continue;
-					}
-					
-					// Calculate relevant portion of the AABB with regard to the two planes that define the current Bin
-					AABB triangle_aabb_clipped_against_bin = AABB::create_empty();
-					
-					// If all verticies lie between the two planes, the AABB is just the Triangle's entire AABB
-					if (vertex_min >= bin_left_plane && vertex_max <= bin_right_plane) {
+					if (intersection_count == 0) {
 						triangle_aabb_clipped_against_bin = triangle_aabb;
 					} else {
-						Vector3 intersections[12];
-						int     intersection_count = 0;
-
-						if (vertex_min <= bin_left_plane  && bin_left_plane  <= vertex_max) triangle_intersect_plane(vertices, dimension, bin_left_plane,  intersections, &intersection_count);
-						if (vertex_min <= bin_right_plane && bin_right_plane <= vertex_max) triangle_intersect_plane(vertices, dimension, bin_right_plane, intersections, &intersection_count);
+						// All intersection points should be included in the AABB
+						triangle_aabb_clipped_against_bin = AABB::from_points(intersections, intersection_count);
 
-						assert(intersection_count < Util::array_element_count(intersections));
-
-						if (intersection_count == 0) {
-							triangle_aabb_clipped_against_bin = triangle_aabb;
-						} else {
-							// All intersection points should be included in the AABB
-							triangle_aabb_clipped_against_bin = AABB::from_points(intersections, intersection_count);
-
-							// If the middle vertex lies between the two planes it should be included in the AABB
-							if (vertices[1][dimension] >= bin_left_plane && vertices[1][dimension] < bin_right_plane) {
-								triangle_aabb_clipped_against_bin.expand(vertices[1]);
-							}
+						// If the middle vertex lies between the two planes it should be included in the AABB
+						if (vertices[1][dimension] >= bin_left_plane && vertices[1][dimension] < bin_right_plane) {
+							triangle_aabb_clipped_against_bin.expand(vertices[1]);
+						}
 
-							if (vertices[2][dimension] <= bin_right_plane && vertices[2][dimension <= vertex_max]) triangle_aabb_clipped_against_bin.expand(vertices[2]);
-							if (vertices[0][dimension] >= bin_left_plane  && vertices[0][dimension >= vertex_min]) triangle_aabb_clipped_against_bin.expand(vertices[0]);
+						if (vertices[2][dimension] <= bin_right_plane && vertices[2][dimension <= vertex_max]) triangle_aabb_clipped_against_bin.expand(vertices[2]);
+						if (vertices[0][dimension] >= bin_left_plane  && vertices[0][dimension >= vertex_min]) triangle_aabb_clipped_against_bin.expand(vertices[0]);
 
-							triangle_aabb_clipped_against_bin = AABB::overlap(triangle_aabb_clipped_against_bin, triangle_aabb);
-						}
+						triangle_aabb_clipped_against_bin = AABB::overlap(triangle_aabb_clipped_against_bin, triangle_aabb);
 					}
+				}
 
-					// Clip the AABB against the parent bounds
-					bin.aabb.expand(triangle_aabb_clipped_against_bin);
-					bin.aabb = AABB::overlap(bin.aabb, bounds);
-
-					bin.aabb.fix_if_needed();
+				// Clip the AABB against the parent bounds
+				bin.aabb.expand(triangle_aabb_clipped_against_bin);
+				bin.aabb = AABB::overlap(bin.aabb, bounds);
 
-					// AABB must be valid
-					assert(bin.aabb.is_valid() || bin.aabb.is_empty());
-					
-					// The AABB of the current Bin cannot exceed the planes of the current Bin
-					const float epsilon = 0.01f;
-					assert(bin.aabb.min[dimension] > bin_left_plane  - epsilon);
-					assert(bin.aabb.max[dimension] < bin_right_plane + epsilon);
+				bin.aabb.fix_if_needed();
 
-					// The AABB of the current Bin cannot exceed the bounds of the Node's AABB
-					assert(bin.aabb.min[0] > bounds.min[0] - epsilon && bin.aabb.max[0] < bounds.max[0] + epsilon);
-					assert(bin.aabb.min[1] > bounds.min[1] - epsilon && bin.aabb.max[1] < bounds.max[1] + epsilon);
-					assert(bin.aabb.min[2] > bounds.min[2] - epsilon && bin.aabb.max[2] < bounds.max[2] + epsilon);
-				}
+				// AABB must be valid
+				assert(bin.aabb.is_valid() || bin.aabb.is_empty());
+				
+				// The AABB of the current Bin cannot exceed the planes of the current Bin
+				const float epsilon = 0.01f;
+				assert(bin.aabb.min[dimension] > bin_left_plane  - epsilon);
+				assert(bin.aabb.max[dimension] < bin_right_plane + epsilon);
+
+				// The AABB of the current Bin cannot exceed the bounds of the Node's AABB
+				assert(bin.aabb.min[0] > bounds.min[0] - epsilon && bin.aabb.max[0] < bounds.max[0] + epsilon);
+				assert(bin.aabb.min[1] > bounds.min[1] - epsilon && bin.aabb.max[1] < bounds.max[1] + epsilon);
+				assert(bin.aabb.min[2] > bounds.min[2] - epsilon && bin.aabb.max[2] < bounds.max[2] + epsilon);
 			}
+		}
 
-			float bin_sah[SBVH_BIN_COUNT];
+		float bin_sah[SBVH_BIN_COUNT];
 
-			AABB bounds_left [SBVH_BIN_COUNT];
-			AABB bounds_right[SBVH_BIN_COUNT + 1];
-			
-			bounds_left [0]              = AABB::create_empty();
-			bounds_right[SBVH_BIN_COUNT] = AABB::create_empty();
+		AABB bounds_left [SBVH_BIN_COUNT];
+		AABB bounds_right[SBVH_BIN_COUNT + 1];
+		
+		bounds_left [0]              = AABB::create_empty();
+		bounds_right[SBVH_BIN_COUNT] = AABB::create_empty();
 
-			int count_left [SBVH_BIN_COUNT];
-			int count_right[SBVH_BIN_COUNT + 1];
+		int count_left [SBVH_BIN_COUNT];
+		int count_right[SBVH_BIN_COUNT + 1];
 
-			count_left [0]              = 0;
-			count_right[SBVH_BIN_COUNT] = 0;
-			
-			// First traverse left to right along the current dimension to evaluate first half of the SAH
-			for (int b = 1; b < SBVH_BIN_COUNT; b++) {
-				bounds_left[b] = bounds_left[b-1];
-				bounds_left[b].expand(bins[b-1].aabb);
+		count_left [0]              = 0;
+		count_right[SBVH_BIN_COUNT] = 0;
+		
+		// First traverse left to right along the current dimension to evaluate first half of the SAH
+		for (int b = 1; b < SBVH_BIN_COUNT; b++) {
+			bounds_left[b] = bounds_left[b-1];
+			bounds_left[b].expand(bins[b-1].aabb);
 
-				assert(bounds_left[b].is_valid() || bounds_left[b].is_empty());
+			assert(bounds_left[b].is_valid() || bounds_left[b].is_empty());
 
-				count_left[b] = count_left[b-1] + bins[b-1].entries;
+			count_left[b] = count_left[b-1] + bins[b-1].entries;
 
-				if (count_left[b] < index_count) {
-					bin_sah[b] = bounds_left[b].surface_area() * float(count_left[b]);
-				} else {
-					bin_sah[b] = INFINITY;
-				}
+			if (count_left[b] < index_count) {
+				bin_sah[b] = bounds_left[b].surface_area() * float(count_left[b]);
+			} else {
+				bin_sah[b] = INFINITY;
 			}
+		}
 
-			// Then traverse right to left along the current dimension to evaluate second half of the SAH
-			for (int b = SBVH_BIN_COUNT - 1; b > 0; b--) {
-				bounds_right[b] = bounds_right[b+1];
-				bounds_right[b].expand(bins[b].aabb);
-				
-				assert(bounds_right[b].is_valid() || bounds_right[b].is_empty());
+		// Then traverse right to left along the current dimension to evaluate second half of the SAH
+		for (int b = SBVH_BIN_COUNT - 1; b > 0; b--) {
+			bounds_right[b] = bounds_right[b+1];
+			bounds_right[b].expand(bins[b].aabb);
+			
+			assert(bounds_right[b].is_valid() || bounds_right[b].is_empty());
 
-				count_right[b] = count_right[b+1] + bins[b].exits;
+			count_right[b] = count_right[b+1] + bins[b].exits;
 
-				if (count_right[b] < index_count) {
-					bin_sah[b] += bounds_right[b].surface_area() * float(count_right[b]);
-				} else {
-					bin_sah[b] = INFINITY;
-				}
+			if (count_right[b] < index_count) {
+				bin_sah[b] += bounds_right[b].surface_area() * float(count_right[b]);
+			} else {
+				bin_sah[b] = INFINITY;
 			}
+		}
 
-			assert(count_left [SBVH_BIN_COUNT - 1] + bins[SBVH_BIN_COUNT - 1].entries == index_count);
-			assert(count_right[1]                  + bins[0].exits                    == index_count);
+		assert(count_left [SBVH_BIN_COUNT - 1] + bins[SBVH_BIN_COUNT - 1].entries == index_count);
+		assert(count_right[1]                  + bins[0].exits                    == index_count);
 
-			// Find the splitting plane that yields the lowest SAH cost along the current dimension
-			for (int b = 1; b < SBVH_BIN_COUNT; b++) {
-				float cost = bin_sah[b];
-				if (cost < split.cost) {
-					split.cost = cost;
-					split.index = b;
-					split.dimension = dimension;
-					
-					split.plane_distance = bounds_min + bounds_step * float(b);
+		// Find the splitting plane that yields the lowest SAH cost along the current dimension
+		for (int b = 1; b < SBVH_BIN_COUNT; b++) {
+			float cost = bin_sah[b];
+			if (cost < split.cost) {
+				split.cost = cost;
+				split.index = b;
+				split.dimension = dimension;
+				
+				split.plane_distance = bounds_min + bounds_step * float(b);
 
-					split.aabb_left  = bounds_left [b];
-					split.aabb_right = bounds_right[b];
+				split.aabb_left  = bounds_left [b];
+				split.aabb_right = bounds_right[b];
 
-					split.num_left  = count_left [b];
-					split.num_right = count_right[b];
-				}
+				split.num_left  = count_left [b];
+				split.num_right = count_right[b];
 			}
 		}
-
-		return split;
 	}
 }
@@ -0,0 +1,175 @@
+#include "BVHRefitter.h"
+
+#include "CWBVHBuilder.h"
+
+// Surface areas summed over the BVH, the SAH cost follows after weighting and normalizing by the area of the root
+struct SAHAreas {
+	float node_area = 0.0f;
+	float leaf_area = 0.0f; // Weighted by the number of primitives in the leaf
+
+	inline float calc_cost(const AABB & root_aabb) const {
+		return (SAH_COST_NODE * node_area + SAH_COST_LEAF * leaf_area) / root_aabb.surface_area();
+	}
+};
+
+static AABB calc_leaf_aabb(const int * indices, int first, int count, const Triangle * triangles) {
+	AABB aabb = AABB::create_empty();
+
+	for (int i = first; i < first + count; i++) {
+		aabb.expand(triangles[indices[i]].aabb);
+	}
+
+	return aabb;
+}
+
+// Recomputes the AABB of the given Node bottom up, the results are only written if nodes_out is not null
+static AABB refit_recursive(const BVH & bvh, BVHNode * nodes_out, const Triangle * triangles, int node_index, SAHAreas & areas) {
+	const BVHNode & node = bvh.nodes[node_index];
+
+	AABB aabb;
+
+	if (node.is_leaf()) {
+		aabb = calc_leaf_aabb(bvh.indices, node.first, node.get_count(), triangles);
+
+		areas.leaf_area += aabb.surface_area() * float(node.get_count());
+	} else {
+		aabb = AABB::unify(
+			refit_recursive(bvh, nodes_out, triangles, node.left,     areas),
+			refit_recursive(bvh, nodes_out, triangles, node.left + 1, areas)
+		);
+
+		areas.node_area += aabb.surface_area();
+	}
+
+	if (nodes_out) nodes_out[node_index].aabb = aabb;
+
+	return aabb;
+}
+
+// Returns the AABB of all children of the given Node
+static AABB refit_recursive(const QBVH & qbvh, QBVHNode * nodes_out, const Triangle * triangles, int node_index, SAHAreas & areas) {
+	const QBVHNode & node = qbvh.nodes[node_index];
+
+	AABB aabb = AABB::create_empty();
+
+	for (int i = 0; i < 4; i++) {
+		int count = node.get_count(i);
+		if (count == -1) break;
+
+		AABB child_aabb;
+
+		if (count > 0) {
+			child_aabb = calc_leaf_aabb(qbvh.indices, node.get_index(i), count, triangles);
+
+			areas.leaf_area += child_aabb.surface_area() * float(count);
+		} else {
+			child_aabb = refit_recursive(qbvh, nodes_out, triangles, node.get_index(i), areas);
+		}
+
+		if (nodes_out) {
+			QBVHNode & node_out = nodes_out[node_index];
+
+			node_out.aabb_min_x[i] = child_aabb.min.x;
+			node_out.aabb_min_y[i] = child_aabb.min.y;
+			node_out.aabb_min_z[i] = child_aabb.min.z;
+			node_out.aabb_max_x[i] = child_aabb.max.x;
+			node_out.aabb_max_y[i] = child_aabb.max.y;
+			node_out.aabb_max_z[i] = child_aabb.max.z;
+		}
+
+		aabb.expand(child_aabb);
+	}
+
+	areas.node_area += aabb.surface_area();
+
+	return aabb;
+}
+
+// Returns the AABB of all children of the given Node, which is also the region covered by its quantization grid
+static AABB refit_recursive(const CWBVH & cwbvh, CWBVHNode * nodes_out, const Triangle * triangles, int node_index, SAHAreas & areas) {
+	const CWBVHNode & node = cwbvh.nodes[node_index];
+
+	AABB aabb = AABB::create_empty();
+	AABB child_aabbs[8];
+
+	for (int i = 0; i < 8; i++) {
+		byte meta = node.meta[i];
+		if (meta == 0) continue; // Empty slot
+
+		if ((meta & 0b00011111) >= 24) {
+			int child_index = node.base_index_child + (meta & 0b00011111) - 24;
+
+			child_aabbs[i] = refit_recursive(cwbvh, nodes_out, triangles, child_index, areas);
+		} else {
+			// Three highest bits contain unary representation of triangle count
+			int triangle_count = 0;
+			for (int j = 5; j < 8; j++) {
+				if (meta & (1 << j)) triangle_count++;
+			}
+
+			child_aabbs[i] = calc_leaf_aabb(cwbvh.indices, node.base_index_triangle + (meta & 0b00011111), triangle_count, triangles);
+
+			areas.leaf_area += child_aabbs[i].surface_area() * float(triangle_count);
+		}
+
+		aabb.expand(child_aabbs[i]);
+	}
+
+	areas.node_area += aabb.surface_area();
+
+	if (nodes_out) {
+		CWBVHNode & node_out = nodes_out[node_index];
+
+		Vector3 one_over_e = CWBVHBuilder::quantize_origin(node_out, aabb);
+
+		for (int i = 0; i < 8; i++) {
+			if (node.meta[i] != 0) {
+				CWBVHBuilder::quantize_child(node_out, i, child_aabbs[i], one_over_e);
+			}
+		}
+	}
+
+	return aabb;
+}
+
+float BVHRefitter::refit(BVH & bvh, const Triangle * triangles) {
+	SAHAreas areas;
+	AABB root_aabb = refit_recursive(bvh, bvh.nodes, triangles, 0, areas);
+
+	return areas.calc_cost(root_aabb);
+}
+
+float BVHRefitter::refit(QBVH & qbvh, const Triangle * triangles) {
+	SAHAreas areas;
+	AABB root_aabb = refit_recursive(qbvh, qbvh.nodes, triangles, 0, areas);
+
+	return areas.calc_cost(root_aabb);
+}
+
+float BVHRefitter::refit(CWBVH & cwbvh, const Triangle * triangles) {
+	SAHAreas areas;
+	AABB root_aabb = refit_recursive(cwbvh, cwbvh.nodes, triangles, 0, areas);
+
+	return areas.calc_cost(root_aabb);
+}
+
+float BVHRefitter::calc_sah_cost(const BVH & bvh, const Triangle * triangles) {
+	SAHAreas areas;
+	AABB root_aabb = refit_recursive(bvh, nullptr, triangles, 0, areas);
+
+	return areas.calc_cost(root_aabb);
+}
+
+float BVHRefitter::calc_sah_cost(const QBVH & qbvh, const Triangle * triangles) {
+	SAHAreas areas;
+	AABB root_aabb = refit_recursive(qbvh, nullptr, triangles, 0, areas);
+
+	return areas.calc_cost(root_aabb);
+}
+
+float BVHRefitter::calc_sah_cost(const CWBVH & cwbvh, const Triangle * triangles) {
+	SAHAreas areas;
+	AABB root_aabb = refit_recursive(cwbvh, nullptr, triangles, 0, areas);
+
+	return areas.calc_cost(root_aabb);
+}
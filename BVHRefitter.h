@@ -0,0 +1,18 @@
+#pragma once
+#include "BVH.h"
+
+// Updates the AABBs of an existing BVH after the Triangles it contains have moved, without changing its topology.
+// Refitting is much faster than a rebuild, but the quality of the BVH degrades as the Triangles move further away
+// from the positions the BVH was built for. To detect this, every function returns the SAH cost of the refitted BVH,
+// which can be compared to the cost right after construction to decide when a rebuild is needed.
+// Leaf bounds are recomputed from the full AABBs of the Triangles, so spatial splits of the SBVH or presplitting are lost
+namespace BVHRefitter {
+	float refit(BVH   & bvh,   const Triangle * triangles);
+	float refit(QBVH  & qbvh,  const Triangle * triangles);
+	float refit(CWBVH & cwbvh, const Triangle * triangles); // Child AABBs are requantized in place
+
+	// Calculates the SAH cost the BVH would have after refitting, without modifying it
+	float calc_sah_cost(const BVH   & bvh,   const Triangle * triangles);
+	float calc_sah_cost(const QBVH  & qbvh,  const Triangle * triangles);
+	float calc_sah_cost(const CWBVH & cwbvh, const Triangle * triangles);
+}
@@ -0,0 +1,737 @@
+#include "BVHReport.h"
+
+#include <chrono>
+#include <random>
+
+#include "MeshData.h"
+#include "OBJLoader.h"
+
+#include "QBVHBuilder.h"
+#include "CWBVHBuilder.h"
+#include "BVHLayout.h"
+
+#include "QBVHTraversal.h"
+#include "CWBVHTraversal.h"
+#include "CacheSimulator.h"
+#include "RayReplay.h"
+
+#include "Util.h"
+#include "ThreadPool.h"
+
+// Node of any BVH type, the root is stored at index 0
+struct FlatNode {
+	AABB aabb;
+
+	int depth;
+
+	int child_count; // Zero for leaves
+	int children[8];
+
+	int first_index;
+	int index_count;
+};
+
+static int flatten_leaf(const AABB & aabb, int depth, int first_index, int index_count, std::vector<FlatNode> & nodes) {
+	FlatNode leaf = { };
+	leaf.aabb        = aabb;
+	leaf.depth       = depth;
+	leaf.first_index = first_index;
+	leaf.index_count = index_count;
+
+	nodes.push_back(leaf);
+
+	return nodes.size() - 1;
+}
+
+static int flatten(const BVH & bvh, int node_index, int depth, std::vector<FlatNode> & nodes) {
+	const BVHNode & node = bvh.nodes[node_index];
+
+	if (node.is_leaf()) return flatten_leaf(node.aabb, depth, node.first, node.get_count(), nodes);
+
+	int index = nodes.size();
+	nodes.emplace_back();
+
+	FlatNode flat = { };
+	flat.aabb        = node.aabb;
+	flat.depth       = depth;
+	flat.child_count = 2;
+	flat.children[0] = flatten(bvh, node.left,     depth + 1, nodes);
+	flat.children[1] = flatten(bvh, node.left + 1, depth + 1, nodes);
+	nodes[index] = flat;
+
+	return index;
+}
+
+static int flatten(const QBVH & qbvh, int node_index, const AABB & aabb, int depth, std::vector<FlatNode> & nodes) {
+	const QBVHNode & node = qbvh.nodes[node_index];
+
+	int index = nodes.size();
+	nodes.emplace_back();
+
+	FlatNode flat = { };
+	flat.aabb  = aabb;
+	flat.depth = depth;
+
+	for (int i = 0; i < 4; i++) {
+		int count = node.get_count(i);
+		if (count == -1) break;
+
+		AABB child_aabb;
+		child_aabb.min = Vector3(node.aabb_min_x[i], node.aabb_min_y[i], node.aabb_min_z[i]);
+		child_aabb.max = Vector3(node.aabb_max_x[i], node.aabb_max_y[i], node.aabb_max_z[i]);
+
+		if (count > 0) {
+			flat.children[flat.child_count++] = flatten_leaf(child_aabb, depth + 1, node.get_index(i), count, nodes);
+		} else {
+			flat.children[flat.child_count++] = flatten(qbvh, node.get_index(i), child_aabb, depth + 1, nodes);
+		}
+	}
+
+	nodes[index] = flat;
+
+	return index;
+}
+
+static int flatten(const CWBVH & cwbvh, int node_index, const AABB & aabb, int depth, std::vector<FlatNode> & nodes) {
+	const CWBVHNode & node = cwbvh.nodes[node_index];
+
+	AABB child_aabbs[8];
+	CWBVHBuilder::dequantize(node, child_aabbs);
+
+	int index = nodes.size();
+	nodes.emplace_back();
+
+	FlatNode flat = { };
+	flat.aabb  = aabb;
+	flat.depth = depth;
+
+	for (int i = 0; i < 8; i++) {
+		byte meta = node.meta[i];
+		if (meta == 0) continue; // Empty slot
+
+		if ((meta & 0b00011111) >= 24) {
+			int child_index = node.base_index_child + (meta & 0b00011111) - 24;
+
+			flat.children[flat.child_count++] = flatten(cwbvh, child_index, child_aabbs[i], depth + 1, nodes);
+		} else {
+			// Three highest bits contain unary representation of triangle count
+			int triangle_count = 0;
+			for (int j = 5; j < 8; j++) {
+				if (meta & (1 << j)) triangle_count++;
+			}
+
+			flat.children[flat.child_count++] = flatten_leaf(child_aabbs[i], depth + 1, node.base_index_triangle + (meta & 0b00011111), triangle_count, nodes);
+		}
+	}
+
+	nodes[index] = flat;
+
+	return index;
+}
+
+// Wide BVH's do not store the AABB of their root, it is the union of the children of Node 0
+static AABB calc_root_aabb(const QBVH & qbvh) {
+	const QBVHNode & root = qbvh.nodes[0];
+
+	AABB aabb = AABB::create_empty();
+
+	for (int i = 0; i < 4; i++) {
+		if (root.get_count(i) == -1) break;
+
+		aabb.expand(Vector3(root.aabb_min_x[i], root.aabb_min_y[i], root.aabb_min_z[i]));
+		aabb.expand(Vector3(root.aabb_max_x[i], root.aabb_max_y[i], root.aabb_max_z[i]));
+	}
+
+	return aabb;
+}
+
+static AABB calc_root_aabb(const CWBVH & cwbvh) {
+	const CWBVHNode & root = cwbvh.nodes[0];
+
+	AABB child_aabbs[8];
+	CWBVHBuilder::dequantize(root, child_aabbs);
+
+	AABB aabb = AABB::create_empty();
+
+	for (int i = 0; i < 8; i++) {
+		if (root.meta[i] != 0) aabb.expand(child_aabbs[i]);
+	}
+
+	return aabb;
+}
+
+static float calc_polygon_area(const Vector3 * vertices, int vertex_count) {
+	Vector3 sum = Vector3(0.0f);
+
+	for (int i = 1; i + 1 < vertex_count; i++) {
+		sum += Vector3::cross(vertices[i] - vertices[0], vertices[i + 1] - vertices[0]);
+	}
+
+	return 0.5f * Vector3::length(sum);
+}
+
+// Calculates the area of the part of the Triangle inside the AABB by clipping it against all six planes of the AABB
+static float calc_clipped_area(const Triangle & triangle, const AABB & aabb) {
+	constexpr int MAX_VERTICES = 9; // A Triangle clipped by an AABB has at most 3 + 6 vertices
+
+	Vector3 vertices[MAX_VERTICES] = { triangle.position_0, triangle.position_1, triangle.position_2 };
+	Vector3 clipped [MAX_VERTICES];
+
+	int vertex_count = 3;
+
+	for (int plane = 0; plane < 6; plane++) {
+		int   dimension = plane >> 1;
+		float sign      = (plane & 1) ? -1.0f : 1.0f;
+		float offset    = (plane & 1) ? aabb.max[dimension] : aabb.min[dimension];
+
+		int clipped_count = 0;
+
+		for (int i = 0; i < vertex_count; i++) {
+			const Vector3 & vertex_a = vertices[i];
+			const Vector3 & vertex_b = vertices[(i + 1) % vertex_count];
+
+			// Positive distances are inside the AABB
+			float distance_a = sign * (vertex_a[dimension] - offset);
+			float distance_b = sign * (vertex_b[dimension] - offset);
+
+			if (distance_a >= 0.0f && clipped_count < MAX_VERTICES) clipped[clipped_count++] = vertex_a;
+
+			if (((distance_a < 0.0f && distance_b > 0.0f) || (distance_a > 0.0f && distance_b < 0.0f)) && clipped_count < MAX_VERTICES) {
+				float t = distance_a / (distance_a - distance_b);
+
+				clipped[clipped_count] = vertex_a + t * (vertex_b - vertex_a);
+				clipped[clipped_count][dimension] = offset;
+				clipped_count++;
+			}
+		}
+
+		if (clipped_count < 3) return 0.0f;
+
+		memcpy(vertices, clipped, clipped_count * sizeof(Vector3));
+		vertex_count = clipped_count;
+	}
+
+	return calc_polygon_area(vertices, vertex_count);
+}
+
+static inline bool overlaps(const AABB & a, const AABB & b) {
+	return
+		a.min.x <= b.max.x && a.max.x >= b.min.x &&
+		a.min.y <= b.max.y && a.max.y >= b.min.y &&
+		a.min.z <= b.max.z && a.max.z >= b.min.z;
+}
+
+// Area of the geometry inside the AABB of the given Node that is referenced outside of its subtree.
+// The references are clipped to the AABB of their leaf as well, which gives the correct area for the
+// split references of the SBVH
+static double calc_node_overlap(const std::vector<FlatNode> & nodes, int node_index, const int * indices, const Triangle * triangles) {
+	const FlatNode & node = nodes[node_index];
+
+	double overlap = 0.0;
+
+	std::vector<int> stack;
+	stack.push_back(0);
+
+	while (!stack.empty()) {
+		int index = stack.back();
+		stack.pop_back();
+
+		if (index == node_index) continue; // Skip the subtree of the Node itself
+
+		const FlatNode & other = nodes[index];
+		if (!overlaps(other.aabb, node.aabb)) continue;
+
+		if (other.child_count == 0) {
+			AABB clip_aabb;
+			clip_aabb.min = Vector3::max(other.aabb.min, node.aabb.min);
+			clip_aabb.max = Vector3::min(other.aabb.max, node.aabb.max);
+
+			for (int i = other.first_index; i < other.first_index + other.index_count; i++) {
+				const Triangle & triangle = triangles[indices[i]];
+
+				if (overlaps(triangle.aabb, clip_aabb)) {
+					overlap += double(calc_clipped_area(triangle, clip_aabb));
+				}
+			}
+		} else {
+			for (int c = 0; c < other.child_count; c++) {
+				stack.push_back(other.children[c]);
+			}
+		}
+	}
+
+	return overlap;
+}
+
+static BVHReport::Statistics calc_statistics(const std::vector<FlatNode> & nodes, const int * indices, const Triangle * triangles, int triangle_count) {
+	BVHReport::Statistics statistics = { };
+
+	// SAH cost
+	double sum_leaf = 0.0;
+	double sum_node = 0.0;
+
+	for (int i = 0; i < nodes.size(); i++) {
+		const FlatNode & node = nodes[i];
+
+		if (node.child_count == 0) {
+			sum_leaf += double(node.aabb.surface_area()) * double(node.index_count);
+
+			if (node.index_count >= statistics.leaf_size_histogram.size()) statistics.leaf_size_histogram.resize(node.index_count + 1);
+			if (node.depth       >= statistics.depth_histogram    .size()) statistics.depth_histogram    .resize(node.depth       + 1);
+
+			statistics.leaf_size_histogram[node.index_count]++;
+			statistics.depth_histogram    [node.depth]++;
+		} else {
+			sum_node += double(node.aabb.surface_area());
+		}
+	}
+
+	statistics.sah_cost = float((SAH_COST_NODE * sum_node + SAH_COST_LEAF * sum_leaf) / double(nodes[0].aabb.surface_area()));
+
+	// EPO, the overlap of every Node is computed independently and summed in a fixed order afterwards
+	constexpr int NODES_PER_TASK = 256;
+
+	std::vector<double> node_overlaps(nodes.size());
+
+	ThreadPool::TaskGroup group;
+
+	for (int first = 0; first < nodes.size(); first += NODES_PER_TASK) {
+		int last = Math::min(first + NODES_PER_TASK, int(nodes.size()));
+
+		ThreadPool::submit(group, [&, first, last]() {
+			for (int i = first; i < last; i++) {
+				node_overlaps[i] = calc_node_overlap(nodes, i, indices, triangles);
+			}
+		});
+	}
+
+	ThreadPool::wait(group);
+
+	double epo        = 0.0;
+	double total_area = 0.0;
+
+	for (int i = 0; i < nodes.size(); i++) {
+		epo += (nodes[i].child_count == 0 ? SAH_COST_LEAF : SAH_COST_NODE) * node_overlaps[i];
+	}
+
+	for (int i = 0; i < triangle_count; i++) {
+		const Triangle & triangle = triangles[i];
+
+		total_area += 0.5 * double(Vector3::length(Vector3::cross(triangle.position_1 - triangle.position_0, triangle.position_2 - triangle.position_0)));
+	}
+
+	statistics.epo = total_area > 0.0 ? float(epo / total_area) : 0.0f;
+
+	return statistics;
+}
+
+BVHReport::Statistics BVHReport::calc_statistics(const BVH & bvh, const Triangle * triangles, int triangle_count) {
+	std::vector<FlatNode> nodes;
+	flatten(bvh, 0, 0, nodes);
+
+	Statistics statistics = ::calc_statistics(nodes, bvh.indices, triangles, triangle_count);
+	statistics.node_count       = bvh.node_count;
+	statistics.index_count      = bvh.index_count;
+	statistics.memory_footprint = bvh.node_count * sizeof(BVHNode) + bvh.index_count * sizeof(int);
+
+	return statistics;
+}
+
+BVHReport::Statistics BVHReport::calc_statistics(const QBVH & qbvh, const Triangle * triangles, int triangle_count) {
+	std::vector<FlatNode> nodes;
+	flatten(qbvh, 0, calc_root_aabb(qbvh), 0, nodes);
+
+	Statistics statistics = ::calc_statistics(nodes, qbvh.indices, triangles, triangle_count);
+	statistics.node_count       = qbvh.node_count;
+	statistics.index_count      = qbvh.index_count;
+	statistics.memory_footprint = qbvh.node_count * sizeof(QBVHNode) + qbvh.index_count * sizeof(int);
+
+	return statistics;
+}
+
+BVHReport::Statistics BVHReport::calc_statistics(const CWBVH & cwbvh, const Triangle * triangles, int triangle_count) {
+	std::vector<FlatNode> nodes;
+	flatten(cwbvh, 0, calc_root_aabb(cwbvh), 0, nodes);
+
+	Statistics statistics = ::calc_statistics(nodes, cwbvh.indices, triangles, triangle_count);
+	statistics.node_count       = cwbvh.node_count;
+	statistics.index_count      = cwbvh.index_count;
+	statistics.memory_footprint = cwbvh.node_count * sizeof(CWBVHNode) + cwbvh.index_count * sizeof(int);
+
+	return statistics;
+}
+
+// Build times in milliseconds
+struct Timings {
+	double build    = 0.0;
+	double optimize = 0.0;
+	double collapse = 0.0;
+};
+
+struct Stopwatch {
+	std::chrono::high_resolution_clock::time_point start_time = std::chrono::high_resolution_clock::now();
+
+	inline double get_milliseconds() const {
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start_time).count();
+	}
+};
+
+// Builds the binary BVH underlying the given BVH type using the same steps as MeshData::load, timing each of them
+static BVH build_binary_bvh(MeshData & mesh_data, int bvh_type, Timings & timings) {
+	mesh_data.bvh_type = bvh_type;
+
+	BVH bvh;
+
+	Stopwatch stopwatch_build;
+	mesh_data.build_bvh(bvh);
+	timings.build = stopwatch_build.get_milliseconds();
+
+	Stopwatch stopwatch_optimize;
+	BVHOptimizer::Progress optimization_progress;
+	MeshData::optimize_bvh(bvh, false, optimization_progress);
+	timings.optimize = stopwatch_optimize.get_milliseconds();
+
+	Stopwatch stopwatch_collapse;
+	mesh_data.collapse_bvh(bvh);
+	timings.collapse = stopwatch_collapse.get_milliseconds();
+
+	return bvh;
+}
+
+// Writes the string with quotes and escapes, file paths on Windows contain backslashes
+static void write_string(FILE * file, const char * string) {
+	fputc('"', file);
+
+	for (const char * c = string; *c != '\0'; c++) {
+		if (*c == '"' || *c == '\\') fputc('\\', file);
+
+		fputc(*c, file);
+	}
+
+	fputc('"', file);
+}
+
+static void write_histogram(FILE * file, const char * name, const std::vector<int> & histogram) {
+	fprintf(file, "\t\t\"%s\": [", name);
+
+	for (int i = 0; i < histogram.size(); i++) {
+		fprintf(file, i == 0 ? "%i" : ", %i", histogram[i]);
+	}
+
+	fprintf(file, "]");
+}
+
+static void write_statistics(FILE * file, const char * name, const BVHReport::Statistics & statistics, const Timings & timings, bool last) {
+	fprintf(file, "\t\"%s\": {\n", name);
+	fprintf(file, "\t\t\"sah_cost\": %f,\n",       statistics.sah_cost);
+	fprintf(file, "\t\t\"epo\": %f,\n",            statistics.epo);
+	fprintf(file, "\t\t\"node_count\": %i,\n",       statistics.node_count);
+	fprintf(file, "\t\t\"index_count\": %i,\n",      statistics.index_count);
+	fprintf(file, "\t\t\"memory_footprint\": %i,\n", statistics.memory_footprint);
+	write_histogram(file, "leaf_size_histogram", statistics.leaf_size_histogram); fprintf(file, ",\n");
+	write_histogram(file, "depth_histogram",     statistics.depth_histogram);     fprintf(file, ",\n");
+	fprintf(file, "\t\t\"build_time_ms\": { \"build\": %f, \"optimize\": %f, \"collapse\": %f }\n", timings.build, timings.optimize, timings.collapse);
+	fprintf(file, last ? "\t}\n" : "\t},\n");
+}
+
+// Primary Rays of a pinhole camera looking at the Mesh, traced in scanline order
+static std::vector<Ray> generate_rays_coherent(const AABB & aabb, int resolution) {
+	Vector3 center = aabb.get_center();
+	float   radius = Vector3::length(aabb.max - aabb.min) * 0.5f;
+
+	Vector3 camera_position = center + Vector3::normalize(Vector3(1.0f, 0.5f, 1.0f)) * (2.0f * radius);
+	Vector3 camera_forward  = Vector3::normalize(center - camera_position);
+	Vector3 camera_right    = Vector3::normalize(Vector3::cross(camera_forward, Vector3(0.0f, 1.0f, 0.0f)));
+	Vector3 camera_up       = Vector3::cross(camera_right, camera_forward);
+
+	float half_size = 0.6f; // Slightly wider than the bounding sphere at a distance of 2 radii
+
+	std::vector<Ray> rays(resolution * resolution);
+
+	for (int y = 0; y < resolution; y++) {
+		for (int x = 0; x < resolution; x++) {
+			float u = (2.0f * (float(x) + 0.5f) / float(resolution) - 1.0f) * half_size;
+			float v = (2.0f * (float(y) + 0.5f) / float(resolution) - 1.0f) * half_size;
+
+			Ray & ray = rays[x + y * resolution];
+			ray.origin    = camera_position;
+			ray.direction = Vector3::normalize(camera_forward + u * camera_right + v * camera_up);
+		}
+	}
+
+	return rays;
+}
+
+// Rays with random origins inside the Mesh and random directions, resembling secondary bounces
+static std::vector<Ray> generate_rays_incoherent(const AABB & aabb, int ray_count) {
+	// The generator is local and seeded explicitly, so that every report uses the same Rays without touching the global RNG
+	std::mt19937 rng(1337);
+	std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+
+	auto random_float = [&]() {
+		return distribution(rng);
+	};
+
+	std::vector<Ray> rays(ray_count);
+
+	for (int i = 0; i < ray_count; i++) {
+		Vector3 direction;
+		float   length_squared;
+		do {
+			direction = Vector3(random_float(), random_float(), random_float()) * 2.0f - Vector3(1.0f);
+			length_squared = Vector3::length_squared(direction);
+		} while (length_squared > 1.0f || length_squared < 1e-6f);
+
+		rays[i].origin    = aabb.min + Vector3(random_float(), random_float(), random_float()) * (aabb.max - aabb.min);
+		rays[i].direction = direction / sqrtf(length_squared);
+	}
+
+	return rays;
+}
+
+static QBVH copy(const QBVH & qbvh) {
+	QBVH result = qbvh;
+	result.nodes   = new QBVHNode[qbvh.node_count];
+	result.indices = new int     [qbvh.index_count];
+	memcpy(result.nodes,   qbvh.nodes,   qbvh.node_count  * sizeof(QBVHNode));
+	memcpy(result.indices, qbvh.indices, qbvh.index_count * sizeof(int));
+
+	return result;
+}
+
+static CWBVH copy(const CWBVH & cwbvh) {
+	CWBVH result = cwbvh;
+	result.nodes   = new CWBVHNode[cwbvh.node_count];
+	result.indices = new int      [cwbvh.index_count];
+	memcpy(result.nodes,   cwbvh.nodes,   cwbvh.node_count  * sizeof(CWBVHNode));
+	memcpy(result.indices, cwbvh.indices, cwbvh.index_count * sizeof(int));
+
+	return result;
+}
+
+static bool intersect(const QBVH  & qbvh,  const Triangle * triangles, const Ray & ray, CacheSimulator & cache_simulator) {
+	RayHit ray_hit;
+	return QBVHTraversal::intersect(qbvh, triangles, ray, ray_hit, &cache_simulator);
+}
+
+static bool intersect(const CWBVH & cwbvh, const Triangle * triangles, const Ray & ray, CacheSimulator & cache_simulator) {
+	RayHit ray_hit;
+	return CWBVHTraversal::intersect(cwbvh, triangles, ray, ray_hit, &cache_simulator);
+}
+
+// Cache that is simulated during traversal, roughly the size of the L1 of a single SM
+static constexpr int SIMULATED_CACHE_SIZE          = 32 * 1024;
+static constexpr int SIMULATED_CACHE_LINE_SIZE     = 128;
+static constexpr int SIMULATED_CACHE_ASSOCIATIVITY = 8;
+
+// Traces the Rays through the BVH starting with a cold cache, returns the miss rate of the simulated cache
+template<typename BVHType>
+static float simulate_cache(const BVHType & bvh, const Triangle * triangles, const std::vector<Ray> & rays, CacheSimulator & cache_simulator) {
+	cache_simulator.reset();
+
+	for (int i = 0; i < rays.size(); i++) {
+		intersect(bvh, triangles, rays[i], cache_simulator);
+	}
+
+	return cache_simulator.get_miss_rate();
+}
+
+// Stores the given BVH in every memory layout and traces the same Rays through each of them,
+// writes the miss rate of a simulated cache for both coherent and incoherent Rays, and for every captured Ray set if there are any.
+// Captured shadow Rays are traced as closest hit queries, their max distance still limits how much of the BVH they visit
+template<typename BVHType>
+static void write_layouts(FILE * file, const char * name, const BVHType & bvh, const Triangle * triangles, const std::vector<Ray> & rays_coherent, const std::vector<Ray> & rays_incoherent, const std::vector<RayReplay::RaySet> & ray_sets) {
+	// Indexed by the BVH_LAYOUT_* defines in Common.h
+	static const char * layout_names[] = { "depth_first", "breadth_first", "treelet", "van_emde_boas" };
+	static constexpr int layout_count = sizeof(layout_names) / sizeof(const char *);
+
+	// Indexed by RayReplay::RayType
+	static const char * ray_type_names[] = { "primary", "bounce", "shadow" };
+
+	CacheSimulator cache_simulator;
+	cache_simulator.init(SIMULATED_CACHE_SIZE, SIMULATED_CACHE_LINE_SIZE, SIMULATED_CACHE_ASSOCIATIVITY);
+
+	fprintf(file, "\t\"%s_layouts\": {\n", name);
+
+	for (int layout = 0; layout < layout_count; layout++) {
+		BVHType bvh_layout = copy(bvh);
+		BVHLayout::reorder(bvh_layout, layout);
+
+		float miss_rate_coherent   = simulate_cache(bvh_layout, triangles, rays_coherent,   cache_simulator);
+		float miss_rate_incoherent = simulate_cache(bvh_layout, triangles, rays_incoherent, cache_simulator);
+
+		fprintf(file, "\t\t\"%s\": { \"miss_rate_coherent\": %f, \"miss_rate_incoherent\": %f", layout_names[layout], miss_rate_coherent, miss_rate_incoherent);
+
+		printf("%s %-13s layout cache miss rate: %f (coherent), %f (incoherent)\n", name, layout_names[layout], miss_rate_coherent, miss_rate_incoherent);
+
+		if (ray_sets.size() > 0) {
+			fprintf(file, ", \"miss_rate_captured\": [");
+
+			for (int i = 0; i < ray_sets.size(); i++) {
+				const RayReplay::RaySet & ray_set = ray_sets[i];
+
+				float miss_rate = simulate_cache(bvh_layout, triangles, ray_set.rays, cache_simulator);
+
+				fprintf(file, "%s{ \"type\": \"%s\", \"bounce\": %i, \"ray_count\": %zu, \"miss_rate\": %f }", i == 0 ? "" : ", ", ray_type_names[int(ray_set.type)], ray_set.bounce, ray_set.rays.size(), miss_rate);
+
+				printf("%s %-13s layout cache miss rate: %f (captured %s Rays, bounce %i)\n", name, layout_names[layout], miss_rate, ray_type_names[int(ray_set.type)], ray_set.bounce);
+			}
+
+			fprintf(file, "]");
+		}
+
+		fprintf(file, " }%s\n", layout + 1 < layout_count ? "," : "");
+
+		delete [] bvh_layout.indices;
+		delete [] bvh_layout.nodes;
+	}
+
+	fprintf(file, "\t},\n");
+
+	cache_simulator.free();
+}
+
+bool BVHReport::generate(const char * filename, const char * output_filename, const char * rays_filename) {
+	if (!Util::file_exists(filename)) {
+		printf("WARNING: Unable to generate BVH report, file '%s' does not exist!\n", filename);
+
+		return false;
+	}
+
+	// Rays captured by the Pathtracer in the scene, traced alongside the synthetic Rays in the layout comparison
+	std::vector<RayReplay::RaySet> ray_sets;
+	if (rays_filename && !RayReplay::load(rays_filename, ray_sets)) {
+		return false;
+	}
+
+	FILE * file;
+	fopen_s(&file, output_filename, "w");
+
+	if (file == nullptr) {
+		printf("WARNING: Unable to open BVH report file '%s' for writing!\n", output_filename);
+
+		return false;
+	}
+
+	MeshData     mesh_data;
+	MaterialList material_list;
+	OBJLoader::load_obj(filename, &mesh_data, material_list);
+
+	const Triangle * triangles      = mesh_data.triangles;
+	int              triangle_count = mesh_data.triangle_count;
+
+	// The same Rays are used for every layout, so that their cache miss rates can be compared directly
+	AABB mesh_aabb = AABB::create_empty();
+	for (int i = 0; i < triangle_count; i++) {
+		mesh_aabb.expand(triangles[i].aabb);
+	}
+
+	std::vector<Ray> rays_coherent   = generate_rays_coherent  (mesh_aabb, 256);
+	std::vector<Ray> rays_incoherent = generate_rays_incoherent(mesh_aabb, 256 * 256);
+
+	fprintf(file, "{\n");
+	fprintf(file, "\t\"file\": ");
+	write_string(file, filename);
+	fprintf(file, ",\n");
+	fprintf(file, "\t\"triangle_count\": %i,\n", triangle_count);
+	fprintf(file, "\t\"bvh_builder\": %i,\n", BVH_BUILDER);
+	fprintf(file, "\t\"bvh_optimization\": %s,\n", BVH_ENABLE_OPTIMIZATION ? "true" : "false");
+	fprintf(file, "\t\"bvh_optimizer\": %i,\n", BVH_OPTIMIZER);
+	fprintf(file, "\t\"bvh_presplitting\": %s,\n", BVH_ENABLE_PRESPLITTING ? "true" : "false");
+
+	{
+		Timings timings;
+		BVH bvh = build_binary_bvh(mesh_data, BVH_BVH, timings);
+
+		write_statistics(file, "bvh", calc_statistics(bvh, triangles, triangle_count), timings, false);
+
+		delete [] bvh.indices;
+		delete [] bvh.nodes;
+	}
+
+	{
+		Timings timings;
+		BVH sbvh = build_binary_bvh(mesh_data, BVH_SBVH, timings);
+
+		write_statistics(file, "sbvh", calc_statistics(sbvh, triangles, triangle_count), timings, false);
+
+		delete [] sbvh.indices;
+		delete [] sbvh.nodes;
+	}
+
+	{
+		Timings timings;
+		BVH bvh = build_binary_bvh(mesh_data, BVH_QBVH, timings);
+
+		Stopwatch stopwatch_collapse;
+
+		QBVH qbvh;
+		QBVHBuilder qbvh_builder;
+		qbvh_builder.init(&qbvh, bvh);
+		qbvh_builder.build(bvh);
+
+		double collapse_leaves = timings.collapse; // Both collapses start from the same binary BVH with collapsed leaves
+		timings.collapse += stopwatch_collapse.get_milliseconds();
+
+		Statistics statistics_greedy = calc_statistics(qbvh, triangles, triangle_count);
+		write_statistics(file, "qbvh", statistics_greedy, timings, false);
+
+		delete [] qbvh.nodes; // The indices are shared with the binary BVH
+
+		// Collapse the same binary BVH using the SAH-optimal collapse, so that both can be compared directly
+		Stopwatch stopwatch_collapse_sah;
+
+		QBVH qbvh_sah;
+		qbvh_builder.init(&qbvh_sah, bvh);
+		qbvh_builder.build_sah(bvh);
+
+		timings.collapse = collapse_leaves + stopwatch_collapse_sah.get_milliseconds();
+
+		Statistics statistics_sah = calc_statistics(qbvh_sah, triangles, triangle_count);
+		write_statistics(file, "qbvh_sah", statistics_sah, timings, false);
+		write_layouts(file, "qbvh_sah", qbvh_sah, triangles, rays_coherent, rays_incoherent, ray_sets);
+
+		fprintf(file, "\t\"qbvh_sah_cost_ratio\": %f,\n", statistics_sah.sah_cost / statistics_greedy.sah_cost);
+
+		printf("QBVH SAH cost: %f (greedy collapse) -> %f (SAH-optimal collapse)\n", statistics_greedy.sah_cost, statistics_sah.sah_cost);
+
+		delete [] bvh.indices;
+		delete [] bvh.nodes;
+
+		delete [] qbvh_sah.indices;
+		delete [] qbvh_sah.nodes;
+	}
+
+	{
+		Timings timings;
+		BVH bvh = build_binary_bvh(mesh_data, BVH_CWBVH, timings);
+
+		Stopwatch stopwatch_collapse;
+
+		CWBVH cwbvh;
+		CWBVHBuilder cwbvh_builder;
+		cwbvh_builder.init(&cwbvh, bvh);
+		cwbvh_builder.build(bvh);
+		cwbvh_builder.free();
+
+		timings.collapse += stopwatch_collapse.get_milliseconds();
+
+		write_layouts(file, "cwbvh", cwbvh, triangles, rays_coherent, rays_incoherent, ray_sets);
+		write_statistics(file, "cwbvh", calc_statistics(cwbvh, triangles, triangle_count), timings, true);
+
+		delete [] bvh.indices;
+		delete [] bvh.nodes;
+
+		delete [] cwbvh.indices;
+		delete [] cwbvh.nodes;
+	}
+
+	fprintf(file, "}\n");
+	fclose(file);
+
+	delete [] mesh_data.triangles;
+
+	printf("Written BVH report to %s\n", output_filename);
+
+	return true;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <vector>
+
+#include "BVH.h"
+
+// Measures the quality of BVH's, so that regressions in the builders can be caught without rendering.
+// All BVH types are first flattened into a common representation with explicit child AABB's,
+// the Nodes of the CWBVH use their dequantized AABB's since those are the ones traversal sees.
+// Besides the SAH cost, the End Point Overlap (EPO) metric is reported, see Aila et al. 2013.
+// The EPO is the surface area of geometry that lies inside a Node without being part of its subtree,
+// weighted by the cost of the Node and relative to the total surface area of the scene
+namespace BVHReport {
+	struct Statistics {
+		float sah_cost;
+		float epo;
+
+		int node_count;
+		int index_count;
+		int memory_footprint; // In bytes, Nodes and indices
+
+		std::vector<int> leaf_size_histogram; // Number of leaves per number of primitives
+		std::vector<int> depth_histogram;     // Number of leaves per depth
+	};
+
+	Statistics calc_statistics(const BVH   & bvh,   const Triangle * triangles, int triangle_count);
+	Statistics calc_statistics(const QBVH  & qbvh,  const Triangle * triangles, int triangle_count);
+	Statistics calc_statistics(const CWBVH & cwbvh, const Triangle * triangles, int triangle_count);
+
+	// Loads the .obj file, builds every BVH type over it using the settings in Common.h,
+	// and writes the statistics and build times of every type to the output file as JSON.
+	// If a file with Rays captured by the Pathtracer is given (see RayReplay), those are also used to compare the memory layouts
+	bool generate(const char * filename, const char * output_filename, const char * rays_filename = nullptr);
+}
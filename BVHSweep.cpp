@@ -0,0 +1,254 @@
+#include "BVHSweep.h"
+
+#include "Math.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+#define BVH_SWEEP_SIMD
+#elif defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#include <emmintrin.h>
+
+#define BVH_SWEEP_SIMD
+#endif
+
+#if defined(__AVX2__)
+// Eight primitives per instruction
+struct SIMD {
+	typedef __m256 Float;
+
+	static constexpr int WIDTH = 8;
+
+	static inline Float load (const float * address)         { return _mm256_loadu_ps(address); }
+	static inline void  store(float * address, Float value) { _mm256_storeu_ps(address, value); }
+
+	static inline Float set1(float value) { return _mm256_set1_ps(value); }
+
+	static inline Float add(Float a, Float b) { return _mm256_add_ps(a, b); }
+	static inline Float sub(Float a, Float b) { return _mm256_sub_ps(a, b); }
+	static inline Float mul(Float a, Float b) { return _mm256_mul_ps(a, b); }
+	static inline Float min(Float a, Float b) { return _mm256_min_ps(a, b); }
+	static inline Float max(Float a, Float b) { return _mm256_max_ps(a, b); }
+
+	// Returns float(first), float(first + step), float(first + 2 * step), ...
+	static inline Float sequence(int first, int step) {
+		__m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+		return _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(first), _mm256_mullo_epi32(lane, _mm256_set1_epi32(step))));
+	}
+
+	// Lane i receives lane max(i - offset, 0), since min and max are idempotent this suffices to compute inclusive prefixes
+	static inline Float shift_up_1(Float value) { return _mm256_permutevar8x32_ps(value, _mm256_setr_epi32(0, 0, 1, 2, 3, 4, 5, 6)); }
+	static inline Float shift_up_2(Float value) { return _mm256_permutevar8x32_ps(value, _mm256_setr_epi32(0, 0, 0, 1, 2, 3, 4, 5)); }
+	static inline Float shift_up_4(Float value) { return _mm256_permutevar8x32_ps(value, _mm256_setr_epi32(0, 0, 0, 0, 0, 1, 2, 3)); }
+
+	// Lane i receives lane min(i + offset, WIDTH - 1)
+	static inline Float shift_down_1(Float value) { return _mm256_permutevar8x32_ps(value, _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 7)); }
+	static inline Float shift_down_2(Float value) { return _mm256_permutevar8x32_ps(value, _mm256_setr_epi32(2, 3, 4, 5, 6, 7, 7, 7)); }
+	static inline Float shift_down_4(Float value) { return _mm256_permutevar8x32_ps(value, _mm256_setr_epi32(4, 5, 6, 7, 7, 7, 7, 7)); }
+
+	static inline Float broadcast_first(Float value) { return _mm256_permutevar8x32_ps(value, _mm256_set1_epi32(0)); }
+	static inline Float broadcast_last (Float value) { return _mm256_permutevar8x32_ps(value, _mm256_set1_epi32(WIDTH - 1)); }
+
+	static inline float first(Float value) { return _mm256_cvtss_f32(value); }
+
+	template<typename Op>
+	static inline Float prefix(Float value, Op op) {
+		value = op(value, shift_up_1(value));
+		value = op(value, shift_up_2(value));
+		value = op(value, shift_up_4(value));
+
+		return value;
+	}
+
+	template<typename Op>
+	static inline Float suffix(Float value, Op op) {
+		value = op(value, shift_down_1(value));
+		value = op(value, shift_down_2(value));
+		value = op(value, shift_down_4(value));
+
+		return value;
+	}
+};
+#elif defined(BVH_SWEEP_SIMD)
+// Four primitives per instruction
+struct SIMD {
+	typedef __m128 Float;
+
+	static constexpr int WIDTH = 4;
+
+	static inline Float load (const float * address)         { return _mm_loadu_ps(address); }
+	static inline void  store(float * address, Float value) { _mm_storeu_ps(address, value); }
+
+	static inline Float set1(float value) { return _mm_set1_ps(value); }
+
+	static inline Float add(Float a, Float b) { return _mm_add_ps(a, b); }
+	static inline Float sub(Float a, Float b) { return _mm_sub_ps(a, b); }
+	static inline Float mul(Float a, Float b) { return _mm_mul_ps(a, b); }
+	static inline Float min(Float a, Float b) { return _mm_min_ps(a, b); }
+	static inline Float max(Float a, Float b) { return _mm_max_ps(a, b); }
+
+	// Returns float(first), float(first + step), float(first + 2 * step), ...
+	static inline Float sequence(int first, int step) {
+		return _mm_cvtepi32_ps(_mm_setr_epi32(first, first + step, first + 2 * step, first + 3 * step));
+	}
+
+	// Lane i receives lane max(i - offset, 0), since min and max are idempotent this suffices to compute inclusive prefixes
+	static inline Float shift_up_1(Float value) { return _mm_shuffle_ps(value, value, _MM_SHUFFLE(2, 1, 0, 0)); }
+	static inline Float shift_up_2(Float value) { return _mm_shuffle_ps(value, value, _MM_SHUFFLE(1, 0, 0, 0)); }
+
+	// Lane i receives lane min(i + offset, WIDTH - 1)
+	static inline Float shift_down_1(Float value) { return _mm_shuffle_ps(value, value, _MM_SHUFFLE(3, 3, 2, 1)); }
+	static inline Float shift_down_2(Float value) { return _mm_shuffle_ps(value, value, _MM_SHUFFLE(3, 3, 3, 2)); }
+
+	static inline Float broadcast_first(Float value) { return _mm_shuffle_ps(value, value, _MM_SHUFFLE(0, 0, 0, 0)); }
+	static inline Float broadcast_last (Float value) { return _mm_shuffle_ps(value, value, _MM_SHUFFLE(3, 3, 3, 3)); }
+
+	static inline float first(Float value) { return _mm_cvtss_f32(value); }
+
+	template<typename Op>
+	static inline Float prefix(Float value, Op op) {
+		value = op(value, shift_up_1(value));
+		value = op(value, shift_up_2(value));
+
+		return value;
+	}
+
+	template<typename Op>
+	static inline Float suffix(Float value, Op op) {
+		value = op(value, shift_down_1(value));
+		value = op(value, shift_down_2(value));
+
+		return value;
+	}
+};
+#endif
+
+// Same order of operations as AABB::surface_area
+static inline float surface_area(const float min[3], const float max[3]) {
+	float diff_x = max[0] - min[0];
+	float diff_y = max[1] - min[1];
+	float diff_z = max[2] - min[2];
+
+	return 2.0f * (diff_x * diff_y + diff_y * diff_z + diff_z * diff_x);
+}
+
+#ifdef BVH_SWEEP_SIMD
+static inline SIMD::Float surface_area(const SIMD::Float min[3], const SIMD::Float max[3]) {
+	SIMD::Float diff_x = SIMD::sub(max[0], min[0]);
+	SIMD::Float diff_y = SIMD::sub(max[1], min[1]);
+	SIMD::Float diff_z = SIMD::sub(max[2], min[2]);
+
+	SIMD::Float sum = SIMD::add(SIMD::add(SIMD::mul(diff_x, diff_y), SIMD::mul(diff_y, diff_z)), SIMD::mul(diff_z, diff_x));
+
+	return SIMD::mul(SIMD::set1(2.0f), sum);
+}
+
+static inline SIMD::Float simd_min(SIMD::Float a, SIMD::Float b) { return SIMD::min(a, b); }
+static inline SIMD::Float simd_max(SIMD::Float a, SIMD::Float b) { return SIMD::max(a, b); }
+#endif
+
+void BVHSweep::sweep_left(const BoundsSoA & bounds, int count, float * sah) {
+	int split_count = count - 1;
+
+	float running_min[3] = {  INFINITY,  INFINITY,  INFINITY };
+	float running_max[3] = { -INFINITY, -INFINITY, -INFINITY };
+
+	int i = 0;
+
+#ifdef BVH_SWEEP_SIMD
+	if (split_count >= SIMD::WIDTH) {
+		SIMD::Float carry_min[3];
+		SIMD::Float carry_max[3];
+
+		for (int dimension = 0; dimension < 3; dimension++) {
+			carry_min[dimension] = SIMD::set1( INFINITY);
+			carry_max[dimension] = SIMD::set1(-INFINITY);
+		}
+
+		for (; i + SIMD::WIDTH <= split_count; i += SIMD::WIDTH) {
+			SIMD::Float prefix_min[3];
+			SIMD::Float prefix_max[3];
+
+			// Inclusive prefix within the block, combined with everything before the block
+			for (int dimension = 0; dimension < 3; dimension++) {
+				prefix_min[dimension] = SIMD::min(SIMD::prefix(SIMD::load(bounds.min[dimension] + i), simd_min), carry_min[dimension]);
+				prefix_max[dimension] = SIMD::max(SIMD::prefix(SIMD::load(bounds.max[dimension] + i), simd_max), carry_max[dimension]);
+
+				carry_min[dimension] = SIMD::broadcast_last(prefix_min[dimension]);
+				carry_max[dimension] = SIMD::broadcast_last(prefix_max[dimension]);
+			}
+
+			SIMD::store(sah + i, SIMD::mul(surface_area(prefix_min, prefix_max), SIMD::sequence(i + 1, 1)));
+		}
+
+		for (int dimension = 0; dimension < 3; dimension++) {
+			running_min[dimension] = SIMD::first(carry_min[dimension]);
+			running_max[dimension] = SIMD::first(carry_max[dimension]);
+		}
+	}
+#endif
+
+	for (; i < split_count; i++) {
+		for (int dimension = 0; dimension < 3; dimension++) {
+			running_min[dimension] = Math::min(running_min[dimension], bounds.min[dimension][i]);
+			running_max[dimension] = Math::max(running_max[dimension], bounds.max[dimension][i]);
+		}
+
+		sah[i] = surface_area(running_min, running_max) * float(i + 1);
+	}
+}
+
+void BVHSweep::sweep_right(const BoundsSoA & bounds, int count, float * sah) {
+	float running_min[3] = {  INFINITY,  INFINITY,  INFINITY };
+	float running_max[3] = { -INFINITY, -INFINITY, -INFINITY };
+
+	// The bounds at position i contribute to the split before it, at sah[i - 1]
+	int i = count - 1;
+
+#ifdef BVH_SWEEP_SIMD
+	if (count - 1 >= SIMD::WIDTH) {
+		SIMD::Float carry_min[3];
+		SIMD::Float carry_max[3];
+
+		for (int dimension = 0; dimension < 3; dimension++) {
+			carry_min[dimension] = SIMD::set1( INFINITY);
+			carry_max[dimension] = SIMD::set1(-INFINITY);
+		}
+
+		for (; i - SIMD::WIDTH >= 0; i -= SIMD::WIDTH) {
+			int first = i - SIMD::WIDTH + 1;
+
+			SIMD::Float suffix_min[3];
+			SIMD::Float suffix_max[3];
+
+			// Inclusive suffix within the block, combined with everything after the block
+			for (int dimension = 0; dimension < 3; dimension++) {
+				suffix_min[dimension] = SIMD::min(SIMD::suffix(SIMD::load(bounds.min[dimension] + first), simd_min), carry_min[dimension]);
+				suffix_max[dimension] = SIMD::max(SIMD::suffix(SIMD::load(bounds.max[dimension] + first), simd_max), carry_max[dimension]);
+
+				carry_min[dimension] = SIMD::broadcast_first(suffix_min[dimension]);
+				carry_max[dimension] = SIMD::broadcast_first(suffix_max[dimension]);
+			}
+
+			SIMD::Float cost = SIMD::mul(surface_area(suffix_min, suffix_max), SIMD::sequence(count - first, -1));
+
+			SIMD::store(sah + first - 1, SIMD::add(SIMD::load(sah + first - 1), cost));
+		}
+
+		for (int dimension = 0; dimension < 3; dimension++) {
+			running_min[dimension] = SIMD::first(carry_min[dimension]);
+			running_max[dimension] = SIMD::first(carry_max[dimension]);
+		}
+	}
+#endif
+
+	for (; i > 0; i--) {
+		for (int dimension = 0; dimension < 3; dimension++) {
+			running_min[dimension] = Math::min(running_min[dimension], bounds.min[dimension][i]);
+			running_max[dimension] = Math::max(running_max[dimension], bounds.max[dimension][i]);
+		}
+
+		sah[i - 1] += surface_area(running_min, running_max) * float(count - i);
+	}
+}
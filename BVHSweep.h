@@ -0,0 +1,66 @@
+#pragma once
+#include "AABB.h"
+
+// SAH sweeps over the bounds of a sorted range of primitives
+// The bounds are first gathered into Structure of Arrays layout, after which the sweeps process
+// multiple primitives per instruction using AVX2 or SSE, depending on what the target supports.
+// All paths perform the same floating point operations in the same order, so they produce identical costs
+namespace BVHSweep {
+	// Pointers to the bounds of a range of primitives, stored as separate arrays per component
+	struct BoundsSoA {
+		float * min[3];
+		float * max[3];
+
+		// Creates a view into memory that has room for the bounds of count primitives (6 * count floats)
+		static inline BoundsSoA from_memory(float * memory, int count) {
+			BoundsSoA bounds;
+
+			for (int dimension = 0; dimension < 3; dimension++) {
+				bounds.min[dimension] = memory + (2 * dimension    ) * count;
+				bounds.max[dimension] = memory + (2 * dimension + 1) * count;
+			}
+
+			return bounds;
+		}
+
+		inline BoundsSoA offset(int index) const {
+			BoundsSoA bounds;
+
+			for (int dimension = 0; dimension < 3; dimension++) {
+				bounds.min[dimension] = min[dimension] + index;
+				bounds.max[dimension] = max[dimension] + index;
+			}
+
+			return bounds;
+		}
+
+		inline void store(int index, const AABB & aabb) {
+			min[0][index] = aabb.min.x; min[1][index] = aabb.min.y; min[2][index] = aabb.min.z;
+			max[0][index] = aabb.max.x; max[1][index] = aabb.max.y; max[2][index] = aabb.max.z;
+		}
+
+		inline AABB load(int index) const {
+			AABB aabb;
+			aabb.min = Vector3(min[0][index], min[1][index], min[2][index]);
+			aabb.max = Vector3(max[0][index], max[1][index], max[2][index]);
+
+			return aabb;
+		}
+	};
+
+	// Copies the bounds of the primitives in the order given by the indices
+	template<typename Primitive>
+	inline void gather(const Primitive * primitives, const int * indices, int count, BoundsSoA & bounds) {
+		for (int i = 0; i < count; i++) {
+			bounds.store(i, primitives[indices[i]].aabb);
+		}
+	}
+
+	// Evaluates the left half of the SAH for every split between two consecutive primitives:
+	// sah[i] = surface area of the union of bounds [0, i] * (i + 1), for i in [0, count - 1>
+	void sweep_left(const BoundsSoA & bounds, int count, float * sah);
+
+	// Adds the right half of the SAH for every split between two consecutive primitives:
+	// sah[i] += surface area of the union of bounds [i + 1, count> * (count - 1 - i), for i in [0, count - 1>
+	void sweep_right(const BoundsSoA & bounds, int count, float * sah);
+}
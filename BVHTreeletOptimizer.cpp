@@ -0,0 +1,282 @@
+#include "BVHTreeletOptimizer.h"
+
+#include "Util.h"
+#include "ThreadPool.h"
+#include "ScopeTimer.h"
+
+static constexpr int TREELET_LEAF_COUNT   = 7; // The number of subsets grows exponentially with this, 7 is the sweet spot found by Karras and Aila
+static constexpr int TREELET_SUBSET_COUNT = 1 << TREELET_LEAF_COUNT;
+
+static constexpr int PASS_COUNT = 3; // The minimum number of primitives a treelet root should contain is doubled every pass
+
+static constexpr int PARALLEL_PRIMITIVE_THRESHOLD = 4096; // Subtrees containing fewer primitives are processed on a single thread
+
+struct TreeletOptimizer {
+	BVH * bvh;
+
+	float * costs;           // SAH cost of the subtree of every Node, not normalized by the area of the root
+	int   * primitive_counts; // Number of primitives in the subtree of every Node
+
+	int min_primitive_count;
+
+	void init_subtree(int node_index);
+
+	void optimize_subtree(int node_index);
+	void restructure_treelet(int root_index);
+};
+
+// Selects a split axis and orders the children such that the left child is also the leftmost Node on that axis,
+// using the same distance heuristic as BVHOptimizer
+static unsigned calc_axis(const AABB & aabb_left, const AABB & aabb_right, bool & swap) {
+	int   max_axis = -1;
+	float max_dist = 0.0f;
+
+	for (int dim = 0; dim < 3; dim++) {
+		float dist =
+			fabsf(aabb_left.min[dim] - aabb_right.min[dim]) +
+			fabsf(aabb_left.max[dim] - aabb_right.max[dim]);
+
+		if (dist >= max_dist) {
+			max_dist = dist;
+			max_axis = dim;
+		}
+	}
+
+	assert(max_axis != -1);
+
+	swap = aabb_left.get_center()[max_axis] > aabb_right.get_center()[max_axis];
+
+	static const unsigned dim_bits[3] = {
+		BVH_AXIS_X_BITS,
+		BVH_AXIS_Y_BITS,
+		BVH_AXIS_Z_BITS
+	};
+
+	return dim_bits[max_axis];
+}
+
+// Calculates the costs and primitive counts of the subtree as it was built
+void TreeletOptimizer::init_subtree(int node_index) {
+	const BVHNode & node = bvh->nodes[node_index];
+
+	if (node.is_leaf()) {
+		costs           [node_index] = SAH_COST_LEAF * node.aabb.surface_area() * float(node.get_count());
+		primitive_counts[node_index] = node.get_count();
+	} else {
+		init_subtree(node.left);
+		init_subtree(node.left + 1);
+
+		costs           [node_index] = SAH_COST_NODE * node.aabb.surface_area() + costs           [node.left] + costs           [node.left + 1];
+		primitive_counts[node_index] =                                            primitive_counts[node.left] + primitive_counts[node.left + 1];
+	}
+}
+
+// Processes the subtree bottom up, so that every treelet is formed from subtrees that were already optimized
+void TreeletOptimizer::optimize_subtree(int node_index) {
+	const BVHNode & node = bvh->nodes[node_index];
+
+	if (node.is_leaf()) {
+		costs[node_index] = SAH_COST_LEAF * node.aabb.surface_area() * float(node.get_count());
+
+		return;
+	}
+
+	int child_left  = node.left;
+	int child_right = node.left + 1;
+
+	// Treelets only ever modify the subtree of their root, so both children can be processed independently
+	if (primitive_counts[node_index] >= PARALLEL_PRIMITIVE_THRESHOLD) {
+		ThreadPool::TaskGroup group;
+		ThreadPool::submit(group, [this, child_left]() { optimize_subtree(child_left); });
+
+		optimize_subtree(child_right);
+
+		ThreadPool::wait(group);
+	} else {
+		optimize_subtree(child_left);
+		optimize_subtree(child_right);
+	}
+
+	costs[node_index] = SAH_COST_NODE * node.aabb.surface_area() + costs[child_left] + costs[child_right];
+
+	if (primitive_counts[node_index] >= min_primitive_count) {
+		restructure_treelet(node_index);
+	}
+}
+
+void TreeletOptimizer::restructure_treelet(int root_index) {
+	BVHNode * nodes = bvh->nodes;
+
+	// Form the treelet by repeatedly expanding the treelet leaf with the largest surface area
+	int treelet_leaves  [TREELET_LEAF_COUNT];
+	int treelet_internal[TREELET_LEAF_COUNT - 1];
+
+	int leaf_count     = 2;
+	int internal_count = 1;
+
+	treelet_leaves[0] = nodes[root_index].left;
+	treelet_leaves[1] = nodes[root_index].left + 1;
+
+	treelet_internal[0] = root_index;
+
+	while (leaf_count < TREELET_LEAF_COUNT) {
+		int   max_index = -1;
+		float max_area  = -INFINITY;
+
+		for (int i = 0; i < leaf_count; i++) {
+			const BVHNode & node = nodes[treelet_leaves[i]];
+
+			if (!node.is_leaf() && node.aabb.surface_area() > max_area) {
+				max_index = i;
+				max_area  = node.aabb.surface_area();
+			}
+		}
+
+		if (max_index == -1) break; // All treelet leaves are leaves of the BVH
+
+		int node_index = treelet_leaves[max_index];
+
+		treelet_internal[internal_count++] = node_index;
+
+		treelet_leaves[max_index]    = nodes[node_index].left;
+		treelet_leaves[leaf_count++] = nodes[node_index].left + 1;
+	}
+
+	if (leaf_count < 3) return; // Only one possible topology
+
+	// Find the optimal topology by dynamic programming over all subsets of treelet leaves,
+	// a subset is represented by a bitmask and every subset is processed after all of its own subsets
+	AABB  subset_aabbs     [TREELET_SUBSET_COUNT];
+	float subset_costs     [TREELET_SUBSET_COUNT];
+	int   subset_partitions[TREELET_SUBSET_COUNT];
+
+	int subset_full = (1 << leaf_count) - 1;
+
+	for (int i = 0; i < leaf_count; i++) {
+		int subset = 1 << i;
+
+		subset_aabbs[subset] = nodes[treelet_leaves[i]].aabb;
+		subset_costs[subset] = costs[treelet_leaves[i]];
+	}
+
+	for (int subset = 1; subset <= subset_full; subset++) {
+		int lowest_bit = subset & -subset;
+		if (subset == lowest_bit) continue; // Single treelet leaf
+
+		subset_aabbs[subset] = AABB::unify(subset_aabbs[subset ^ lowest_bit], subset_aabbs[lowest_bit]);
+
+		// Try all ways to partition the subset in two, only partitions that contain the lowest bit are considered to skip mirrored duplicates
+		float min_cost      = INFINITY;
+		int   min_partition = -1;
+
+		for (int partition = (subset - 1) & subset; partition > 0; partition = (partition - 1) & subset) {
+			if ((partition & lowest_bit) == 0) continue;
+
+			float cost = subset_costs[partition] + subset_costs[subset ^ partition];
+
+			if (cost < min_cost) {
+				min_cost      = cost;
+				min_partition = partition;
+			}
+		}
+
+		subset_costs     [subset] = SAH_COST_NODE * subset_aabbs[subset].surface_area() + min_cost;
+		subset_partitions[subset] = min_partition;
+	}
+
+	// The current topology is one of the candidates, only restructure if it gives a real improvement to avoid churn due to rounding
+	if (subset_costs[subset_full] >= costs[root_index] * 0.9999f) return;
+
+	// Every internal Node of the treelet owns a pair of consecutive slots for its children, these are reused for the new topology
+	BVHNode leaf_nodes           [TREELET_LEAF_COUNT];
+	float   leaf_costs           [TREELET_LEAF_COUNT];
+	int     leaf_primitive_counts[TREELET_LEAF_COUNT];
+
+	for (int i = 0; i < leaf_count; i++) {
+		leaf_nodes           [i] = nodes           [treelet_leaves[i]];
+		leaf_costs           [i] = costs           [treelet_leaves[i]];
+		leaf_primitive_counts[i] = primitive_counts[treelet_leaves[i]];
+	}
+
+	int slot_pairs[TREELET_LEAF_COUNT - 1];
+	int slot_pair_count = 0;
+
+	for (int i = 0; i < internal_count; i++) {
+		slot_pairs[i] = nodes[treelet_internal[i]].left;
+	}
+
+	// Writes the given subset to the given slot, returns the number of primitives in it
+	auto emit = [&](auto & emit, int subset, int node_index) -> int {
+		if ((subset & (subset - 1)) == 0) {
+			int leaf_index = 0;
+			while ((subset >> leaf_index) != 1) leaf_index++;
+
+			nodes           [node_index] = leaf_nodes           [leaf_index];
+			costs           [node_index] = leaf_costs           [leaf_index];
+			primitive_counts[node_index] = leaf_primitive_counts[leaf_index];
+
+			return primitive_counts[node_index];
+		}
+
+		int subset_left  = subset_partitions[subset];
+		int subset_right = subset ^ subset_left;
+
+		bool swap;
+		unsigned axis = calc_axis(subset_aabbs[subset_left], subset_aabbs[subset_right], swap);
+
+		if (swap) Util::swap(subset_left, subset_right);
+
+		int slot_pair = slot_pairs[slot_pair_count++];
+
+		BVHNode & node = nodes[node_index];
+		node.aabb  = subset_aabbs[subset];
+		node.left  = slot_pair;
+		node.count = axis;
+
+		costs[node_index] = subset_costs[subset];
+
+		int primitive_count =
+			emit(emit, subset_left,  slot_pair) +
+			emit(emit, subset_right, slot_pair + 1);
+
+		primitive_counts[node_index] = primitive_count;
+
+		return primitive_count;
+	};
+
+	emit(emit, subset_full, root_index);
+
+	assert(slot_pair_count == internal_count);
+}
+
+void BVHTreeletOptimizer::optimize(BVH & bvh) {
+	ScopeTimer timer("BVH Treelet Optimization");
+
+	if (bvh.node_count < 8) return; // Tree too small to optimize
+
+	TreeletOptimizer optimizer = { };
+	optimizer.bvh = &bvh;
+	optimizer.costs            = new float[bvh.node_count];
+	optimizer.primitive_counts = new int  [bvh.node_count];
+
+	optimizer.init_subtree(0);
+
+	// The root is never moved, so its area stays the same
+	float root_area = bvh.nodes[0].aabb.surface_area();
+
+	float cost_before = optimizer.costs[0] / root_area;
+
+	optimizer.min_primitive_count = TREELET_LEAF_COUNT;
+
+	for (int pass = 0; pass < PASS_COUNT; pass++) {
+		optimizer.optimize_subtree(0);
+		optimizer.min_primitive_count *= 2;
+	}
+
+	float cost_after = optimizer.costs[0] / root_area;
+
+	printf("Treelet optimization cost: %f -> %f\n", cost_before, cost_after);
+
+	delete [] optimizer.costs;
+	delete [] optimizer.primitive_counts;
+}
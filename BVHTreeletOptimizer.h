@@ -0,0 +1,11 @@
+#pragma once
+#include "BVH.h"
+
+// Optimizes the BVH by restructuring treelets, see Karras and Aila 2013.
+// Every internal Node forms a treelet together with its descendants with the largest surface areas,
+// the topology with the lowest SAH cost over the leaves of the treelet is found by dynamic programming over subsets.
+// Treelets are processed bottom up, disjoint subtrees are processed in parallel.
+// Like BVHOptimizer::optimize the leaves are not collapsed, BVHOptimizer::collapse should be called afterwards
+namespace BVHTreeletOptimizer {
+	void optimize(BVH & bvh);
+}
@@ -0,0 +1,148 @@
+#pragma once
+#include "BVH.h"
+#include "BVHPartitions.h"
+
+#include "Mesh.h"
+
+// Builds a binary SAH-based BVH by only evaluating the SAH at a fixed number of bins per dimension, see Wald 2007.
+// Produces the same Node layout as BVHBuilder, but avoids presorting the primitives along all 3 dimensions.
+// Primitives are binned based on the centroids of their AABBs. The AABBs are partitioned in place,
+// so that every pass over a Node's primitives is a linear pass over memory
+struct BinnedBVHBuilder {
+private:
+	using PrimitiveRef = BVHPartitions::PrimitiveRef;
+
+	BVH * bvh = nullptr;
+
+	PrimitiveRef * references = nullptr;
+
+	BVHPartitions::Bin * bins = nullptr;
+	float              * sah  = nullptr;
+
+	int bin_count;
+	int max_primitives_in_leaf;
+
+	void build_bvh_recursive(BVHNode & node, int & node_index, int first_index, int index_count) {
+		// Calculate bounds of the Node as well as the bounds of the centroids, which are used to place the bins
+		AABB centroid_bounds = AABB::create_empty();
+
+		node.aabb = AABB::create_empty();
+
+		for (int i = first_index; i < first_index + index_count; i++) {
+			node.aabb.expand(references[i].aabb);
+			centroid_bounds.expand(references[i].aabb.get_center());
+		}
+
+		node.aabb.fix_if_needed();
+
+		if (index_count == 1) {
+			// Leaf Node, terminate recursion
+			node.first = first_index;
+			node.count = index_count;
+
+			return;
+		}
+
+		// Small Nodes don't benefit from a large amount of bins
+		int node_bin_count = Math::min(bin_count, 2 * index_count);
+
+		BVHPartitions::BinnedSplit split = BVHPartitions::partition_binned(references, first_index, index_count, centroid_bounds, bins, sah, node_bin_count);
+
+		int split_index;
+
+		if (split.bin == -1) {
+			// All centroids coincide, no split plane can separate them.
+			// Split the primitives down the middle, any order is as good as any other
+			split.dimension = 0;
+			split.cost      = node.aabb.surface_area() * float(index_count);
+
+			split_index = first_index + index_count / 2;
+		} else {
+			split_index = BVHPartitions::split_indices_binned(references, first_index, index_count, split, node_bin_count);
+		}
+
+#if !BVH_ENABLE_OPTIMIZATION // BVH Optimizer expects leaves with only a single primitive, for the CWBVH max_primitives_in_leaf is 1
+		if (index_count <= max_primitives_in_leaf){
+			// Check SAH termination condition
+			float leaf_cost = node.aabb.surface_area() * SAH_COST_LEAF * float(index_count);
+			float node_cost = node.aabb.surface_area() * SAH_COST_NODE + split.cost;
+
+			if (leaf_cost < node_cost) {
+				node.first = first_index;
+				node.count = index_count;
+
+				return;
+			}
+		}
+#endif
+
+		node.left = node_index;
+		node_index += 2;
+
+		node.count = (split.dimension + 1) << 30;
+
+		int num_left  = split_index - first_index;
+		int num_right = first_index + index_count - split_index;
+
+		assert(num_left > 0 && num_right > 0);
+
+		build_bvh_recursive(bvh->nodes[node.left    ], node_index, first_index,            num_left);
+		build_bvh_recursive(bvh->nodes[node.left + 1], node_index, first_index + num_left, num_right);
+	}
+
+	template<typename Primitive>
+	inline void build_bvh_impl(const Primitive * primitives, int primitive_count) {
+		for (int i = 0; i < primitive_count; i++) {
+			references[i].index = i;
+			references[i].aabb  = primitives[i].aabb;
+		}
+
+		int node_index = 2;
+		build_bvh_recursive(bvh->nodes[0], node_index, 0, primitive_count);
+
+		assert(node_index <= 2 * primitive_count);
+
+		for (int i = 0; i < primitive_count; i++) {
+			bvh->indices[i] = references[i].index;
+		}
+
+		bvh->node_count  = node_index;
+		bvh->index_count = primitive_count;
+	}
+
+public:
+	inline void init(BVH * bvh, int primitive_count, int max_primitives_in_leaf, int bin_count = BVH_BINNED_BIN_COUNT) {
+		this->bvh = bvh;
+		this->max_primitives_in_leaf = max_primitives_in_leaf;
+		this->bin_count = bin_count;
+
+		assert(bin_count >= 2);
+
+		references = new PrimitiveRef[primitive_count];
+
+		bins = new BVHPartitions::Bin[3 * bin_count];
+		sah  = new float             [bin_count];
+
+		bvh->indices = new int    [primitive_count];
+		bvh->nodes   = new BVHNode[2 * primitive_count];
+	}
+
+	inline void free() {
+		delete [] references;
+
+		delete [] bins;
+		delete [] sah;
+	}
+
+	inline void build(const Triangle * triangles, int triangle_count) {
+		return build_bvh_impl(triangles, triangle_count);
+	}
+
+	inline void build(const Mesh * meshes, int mesh_count) {
+		return build_bvh_impl(meshes, mesh_count);
+	}
+
+	inline void build(const BVHPartitions::PrimitiveRef * references, int reference_count) {
+		return build_bvh_impl(references, reference_count);
+	}
+};
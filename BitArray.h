@@ -1,4 +1,5 @@
 #pragma once
+#include <atomic>
 
 struct BitArray {
 private:
@@ -32,4 +33,23 @@ public:
 	};
 
 	Access operator[](int index); // Index in bits
+
+	// Thread safe access, multiple threads may read and write different bits that share a slot concurrently
+	inline bool get_atomic(int index) const {
+		unsigned slot = reinterpret_cast<const std::atomic<unsigned> &>(buffer[index / 32]).load(std::memory_order_relaxed);
+
+		return (slot >> (index % 32)) & 1;
+	}
+
+	inline void set_atomic(int index, bool value) {
+		std::atomic<unsigned> & slot = reinterpret_cast<std::atomic<unsigned> &>(buffer[index / 32]);
+
+		if (value) {
+			slot.fetch_or (  1u << (index % 32),  std::memory_order_relaxed);
+		} else {
+			slot.fetch_and(~(1u << (index % 32)), std::memory_order_relaxed);
+		}
+	}
 };
+
+static_assert(sizeof(std::atomic<unsigned>) == sizeof(unsigned));
@@ -46,6 +46,15 @@ namespace CUDAMemory {
 		CUDACALL(cuMemcpyHtoD(ptr.ptr, data, count * sizeof(T)));
 	}
 
+	template<typename T>
+	inline void memcpy(T * data, Ptr<T> ptr, int count = 1) {
+		assert(data);
+		assert(ptr.ptr);
+		assert(count > 0);
+
+		CUDACALL(cuMemcpyDtoH(data, ptr.ptr, count * sizeof(T)));
+	}
+
 	CUarray          create_array       (int width, int height, int channels, CUarray_format format);
 	CUmipmappedArray create_array_mipmap(int width, int height, int channels, CUarray_format format, int level_count);
 
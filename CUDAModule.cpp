@@ -3,6 +3,7 @@
 #include <cstdio>
 #include <cassert>
 #include <vector>
+#include <string>
 
 #include <nvrtc.h>
 
@@ -117,7 +118,7 @@ static const char * scan_includes_recursive(const char * filename, const char *
 	return source;
 }
 
-void CUDAModule::init(const char * filename, int compute_capability, int max_registers) {
+void CUDAModule::init(const char * filename, int compute_capability, int max_registers, const std::vector<Define> & defines) {
 	ScopeTimer timer("CUDA Module Init");
 
 	if (!Util::file_exists(filename)) {
@@ -125,12 +126,25 @@ void CUDAModule::init(const char * filename, int compute_capability, int max_reg
 		abort();
 	}
 
-	int    ptx_filename_size = strlen(filename) + 16;
-	char * ptx_filename      = MALLOCA(char, ptx_filename_size);
+	// The defines are part of the filename, for example Pathtracer.cu.BVH_TYPE_3.release.ptx
+	int ptx_filename_size = strlen(filename) + 16;
+	for (const Define & define : defines) {
+		ptx_filename_size += strlen(define.name) + 16;
+	}
+
+	char * ptx_filename = MALLOCA(char, ptx_filename_size);
+	strcpy_s(ptx_filename, ptx_filename_size, filename);
+
+	for (const Define & define : defines) {
+		int length = strlen(ptx_filename);
+		sprintf_s(ptx_filename + length, ptx_filename_size - length, ".%s_%i", define.name, define.value);
+	}
+
+	int ptx_filename_length = strlen(ptx_filename);
 #ifdef _DEBUG
-	sprintf_s(ptx_filename, ptx_filename_size, "%s.debug.ptx",   filename);
+	sprintf_s(ptx_filename + ptx_filename_length, ptx_filename_size - ptx_filename_length, ".debug.ptx");
 #else
-	sprintf_s(ptx_filename, ptx_filename_size, "%s.release.ptx", filename);
+	sprintf_s(ptx_filename + ptx_filename_length, ptx_filename_size - ptx_filename_length, ".release.ptx");
 #endif
 	
 	bool should_recompile = true;
@@ -171,7 +185,7 @@ void CUDAModule::init(const char * filename, int compute_capability, int max_reg
 		char compute    [64]; sprintf_s(compute,     "--gpu-architecture=compute_%i", compute_capability);
 		char maxregcount[64]; sprintf_s(maxregcount, "--maxrregcount=%i", max_registers);
 
-		const char * options[] = {
+		std::vector<const char *> options = {
 			"--std=c++17",
 			compute,
 			maxregcount,
@@ -181,8 +195,16 @@ void CUDAModule::init(const char * filename, int compute_capability, int max_reg
 			"-restrict"
 		};
 
+		std::vector<std::string> define_options;
+		define_options.reserve(defines.size());
+
+		for (const Define & define : defines) {
+			define_options.push_back(std::string("--define-macro=") + define.name + "=" + std::to_string(define.value));
+			options.push_back(define_options.back().c_str());
+		}
+
 		// Compile to PTX
-		nvrtcResult result = nvrtcCompileProgram(program, Util::array_element_count(options), options);
+		nvrtcResult result = nvrtcCompileProgram(program, options.size(), options.data());
 
 		size_t log_size;
 		NVRTC_CALL(nvrtcGetProgramLogSize(program, &log_size));
@@ -1,5 +1,6 @@
 #pragma once
 #include <cassert>
+#include <vector>
 
 #include <cuda.h>
 
@@ -53,7 +54,14 @@ struct CUDAModule {
 		}
 	};
 
-	void init(const char * filename, int compute_capability, int max_registers);
+	// Preprocessor definition passed to NVRTC, used to compile the same source in multiple variants
+	struct Define {
+		const char * name;
+		int          value;
+	};
+
+	// Every combination of defines is compiled and cached separately
+	void init(const char * filename, int compute_capability, int max_registers, const std::vector<Define> & defines = { });
 
 	void set_surface(const char * surface_name, CUarray array) const;
 
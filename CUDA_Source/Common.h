@@ -103,11 +103,55 @@ struct Settings {
 #define BVH_QBVH  2 // Quaternary BVH,              constructed by collapsing the binary BVH
 #define BVH_CWBVH 3 // Compressed Wide BVH (8 way), constructed by collapsing the binary BVH
 
+// Default BVH type, the host selects the type at runtime (see Pathtracer::init) and compiles the kernels with BVH_TYPE defined to it
+#ifndef BVH_TYPE
 #define BVH_TYPE BVH_CWBVH
+#endif
+
+#define BVH_BUILDER_SAH    0 // Evaluates the SAH at every primitive over presorted primitives, slow but gives the best quality
+#define BVH_BUILDER_BINNED 1 // Evaluates the SAH at a fixed number of bins, several times faster at a small cost in quality
+#define BVH_BUILDER_LBVH   2 // Sorts primitives along a Morton curve, fastest to build but gives the lowest quality
+#define BVH_BUILDER_PLOC   3 // Clusters primitives bottom up, typically gives a lower SAH cost than the top down builders
+
+#define BVH_BUILDER BVH_BUILDER_SAH // Builder used to construct the underlying binary BVH (not used by the SBVH)
+
+#define BVH_BINNED_BIN_COUNT 32 // Number of bins per dimension used by the binned SAH builder
+
+#define BVH_MORTON_CODE_BITS 30 // Either 30 or 63, 63 bit Morton codes distinguish more primitives in large or very dense meshes at the cost of a slower sort
+#define LBVH_SAH_CLUSTER_BITS 15 // Primitives that share this number of highest Morton code bits form a cluster, the top levels over the clusters are built using the SAH. Zero disables this
+
+#define PLOC_SEARCH_RADIUS 16 // Number of neighbouring clusters on either side along the Morton curve that are considered for merging by the PLOC builder
 
 #define BVH_ENABLE_OPTIMIZATION true
 
+#define BVH_OPTIMIZER_INSERTION         0 // Removes and reinserts Nodes where they lower the SAH cost the most, gives the best quality
+#define BVH_OPTIMIZER_TREELET           1 // Restructures small treelets into their optimal topology, gets most of the SAH improvement of the insertion optimizer in a few percent of its time
+#define BVH_OPTIMIZER_TREELET_INSERTION 2 // Restructures treelets first, the insertion optimizer then continues from the improved BVH
+
+#define BVH_OPTIMIZER BVH_OPTIMIZER_INSERTION // Optimizer used if BVH_ENABLE_OPTIMIZATION is true
+#define BVH_OPTIMIZATION_TIME_LIMIT 0.0f      // Time budget in seconds of the insertion optimizer per Mesh, zero means unlimited. An unfinished BVH is stored in the BVH file and optimized further in the next run
+#define BVH_OPTIMIZATION_TARGET_SAH_COST 0.0f // The insertion optimizer stops once the SAH cost drops to this value
+
+#define BVH_ENABLE_PRESPLITTING false // Splits Triangles with large AABBs into multiple references before construction, a cheap alternative to the SBVH (not used by the SBVH). Mainly helps scenes with long or diagonal Triangles
+#define PRESPLIT_BUDGET 0.3f // Maximum number of references that presplitting may add, relative to the number of triangles
+
 #define SBVH_ALPHA 10e-5f // Alpha parameter for SBVH construction, alpha == 1 means regular BVH, alpha == 0 means full SBVH
+#define SBVH_SPLIT_BUDGET 1.0f // Maximum number of references that Spatial Splits may add, relative to the number of triangles
+
+#define QBVH_ENABLE_SAH_COLLAPSE true // Collapses the binary BVH into the QBVH with the lowest SAH cost using dynamic programming, instead of greedily adopting the children with the largest surface area
+#define QBVH_MAX_PRIMITIVES_IN_LEAF 4  // Maximum number of primitives the SAH-optimal collapse may merge into a single QBVH leaf
+
+#define BVH_LAYOUT_DEPTH_FIRST   0 // Every Node is followed by its subtree, this is the order in which the collapse emits Nodes
+#define BVH_LAYOUT_BREADTH_FIRST 1 // Nodes are stored level by level
+#define BVH_LAYOUT_TREELET       2 // Nodes are clustered into treelets of BVH_LAYOUT_TREELET_SIZE bytes, grown by adding the child with the largest surface area
+#define BVH_LAYOUT_VAN_EMDE_BOAS 3 // Cache oblivious, the tree is split at half its height and the top and bottom trees are stored recursively
+
+#define BVH_LAYOUT BVH_LAYOUT_DEPTH_FIRST // Order of the Nodes and indices of the QBVH and CWBVH in memory, the BVH report compares the cache behaviour of all layouts
+#define BVH_LAYOUT_TREELET_SIZE 1024      // Size in bytes of the treelets of BVH_LAYOUT_TREELET
+
+#define BVH_FILE_COMPRESSION false  // Compresses the Triangles, Nodes and indices in the BVH file, which makes it several times smaller. The arrays are then decompressed on load instead of being used in place from the mapped file
+#define BVH_FILE_POSITION_BITS 20   // With BVH_FILE_COMPRESSION, Triangle positions are snapped to a grid of at least 2^bits cells along the largest axis of the Mesh, so that they can be stored as small integers
+#define BVH_FILE_NORMAL_BITS 16     // With BVH_FILE_COMPRESSION, Triangle normal components are snapped to multiples of 2^(1 - bits)
 
 // Inverse of the percentage of active threads that triggers triangle postponing
 // A value of 5 means that if less than 1/5 = 20% of the active threads want to
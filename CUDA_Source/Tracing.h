@@ -1021,6 +1021,10 @@ __device__ inline void bvh_trace(int ray_count, int * rays_retired) {
 
 					oct_inv4 = (7 - oct) * 0x01010101;
 
+					// Both the remaining Nodes of the TLAS and the remaining Meshes of the triangle group are resumed after the BLAS
+					if (current_group.y & 0xff000000) {
+						stack_push(shared_stack, stack, stack_size, current_group);
+					}
 					if (triangle_group.y != 0) {
 						stack_push(shared_stack, stack, stack_size, triangle_group);
 					}
@@ -1197,6 +1201,10 @@ __device__ inline void bvh_trace_shadow(int ray_count, int * rays_retired, int b
 
 					oct_inv4 = (7 - oct) * 0x01010101;
 
+					// Both the remaining Nodes of the TLAS and the remaining Meshes of the triangle group are resumed after the BLAS
+					if (current_group.y & 0xff000000) {
+						stack_push(shared_stack, stack, stack_size, current_group);
+					}
 					if (triangle_group.y != 0) {
 						stack_push(shared_stack, stack, stack_size, triangle_group);
 					}
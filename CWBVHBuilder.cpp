@@ -214,10 +214,7 @@ void CWBVHBuilder::order_children(int node_index, const BVHNode nodes[], int chi
 	}
 }
 
-void CWBVHBuilder::collapse(const BVHNode nodes_sbvh[], const int indices_sbvh[], int node_index_cwbvh, int node_index_sbvh) {
-	CWBVHNode  & node = cwbvh->nodes[node_index_cwbvh];
-	const AABB & aabb = nodes_sbvh[node_index_sbvh].aabb;
-
+Vector3 CWBVHBuilder::quantize_origin(CWBVHNode & node, const AABB & aabb) {
 	node.p = aabb.min;
 
 	constexpr int Nq = 8;
@@ -229,8 +226,6 @@ void CWBVHBuilder::collapse(const BVHNode nodes_sbvh[], const int indices_sbvh[]
 		exp2f(ceilf(log2f((aabb.max.z - aabb.min.z) * denom)))
 	);
 	
-	Vector3 one_over_e(1.0f / e.x, 1.0f / e.y, 1.0f / e.z);
-	
 	// Treat float as unsigned
 	unsigned u_ex, u_ey, u_ez;
 	memcpy(&u_ex, &e.x, 4);
@@ -246,6 +241,38 @@ void CWBVHBuilder::collapse(const BVHNode nodes_sbvh[], const int indices_sbvh[]
 	node.e[0] = u_ex >> 23;
 	node.e[1] = u_ey >> 23;
 	node.e[2] = u_ez >> 23;
+
+	return Vector3(1.0f / e.x, 1.0f / e.y, 1.0f / e.z);
+}
+
+void CWBVHBuilder::quantize_child(CWBVHNode & node, int child_index, const AABB & child_aabb, const Vector3 & one_over_e) {
+	node.quantized_min_x[child_index] = byte(floorf((child_aabb.min.x - node.p.x) * one_over_e.x));
+	node.quantized_min_y[child_index] = byte(floorf((child_aabb.min.y - node.p.y) * one_over_e.y));
+	node.quantized_min_z[child_index] = byte(floorf((child_aabb.min.z - node.p.z) * one_over_e.z));
+
+	node.quantized_max_x[child_index] = byte(ceilf((child_aabb.max.x - node.p.x) * one_over_e.x));
+	node.quantized_max_y[child_index] = byte(ceilf((child_aabb.max.y - node.p.y) * one_over_e.y));
+	node.quantized_max_z[child_index] = byte(ceilf((child_aabb.max.z - node.p.z) * one_over_e.z));
+}
+
+void CWBVHBuilder::dequantize(const CWBVHNode & node, AABB child_aabbs[8]) {
+	Vector3 e;
+	for (int dimension = 0; dimension < 3; dimension++) {
+		unsigned u_e = unsigned(node.e[dimension]) << 23;
+		memcpy(&e[dimension], &u_e, 4);
+	}
+
+	for (int i = 0; i < 8; i++) {
+		child_aabbs[i].min = node.p + Vector3(float(node.quantized_min_x[i]) * e.x, float(node.quantized_min_y[i]) * e.y, float(node.quantized_min_z[i]) * e.z);
+		child_aabbs[i].max = node.p + Vector3(float(node.quantized_max_x[i]) * e.x, float(node.quantized_max_y[i]) * e.y, float(node.quantized_max_z[i]) * e.z);
+	}
+}
+
+void CWBVHBuilder::collapse(const BVHNode nodes_sbvh[], const int indices_sbvh[], int node_index_cwbvh, int node_index_sbvh) {
+	CWBVHNode  & node = cwbvh->nodes[node_index_cwbvh];
+	const AABB & aabb = nodes_sbvh[node_index_sbvh].aabb;
+
+	Vector3 one_over_e = quantize_origin(node, aabb);
 	
 	int child_count = 0;
 	int children[8] = { -1, -1, -1, -1, -1, -1, -1, -1 };
@@ -267,21 +294,16 @@ void CWBVHBuilder::collapse(const BVHNode nodes_sbvh[], const int indices_sbvh[]
 		int child_index = children[i];
 		if (child_index == -1) continue; // Empty slot
 
-		const AABB & child_aabb = nodes_sbvh[child_index].aabb;
-
-		node.quantized_min_x[i] = byte(floorf((child_aabb.min.x - node.p.x) * one_over_e.x));
-		node.quantized_min_y[i] = byte(floorf((child_aabb.min.y - node.p.y) * one_over_e.y));
-		node.quantized_min_z[i] = byte(floorf((child_aabb.min.z - node.p.z) * one_over_e.z));
-
-		node.quantized_max_x[i] = byte(ceilf((child_aabb.max.x - node.p.x) * one_over_e.x));
-		node.quantized_max_y[i] = byte(ceilf((child_aabb.max.y - node.p.y) * one_over_e.y));
-		node.quantized_max_z[i] = byte(ceilf((child_aabb.max.z - node.p.z) * one_over_e.z));
+		quantize_child(node, i, nodes_sbvh[child_index].aabb, one_over_e);
 
 		switch (decisions[child_index * 7].type) {
 			case Decision::Type::LEAF: {
-				int triangle_count = count_primitives(child_index, nodes_sbvh, indices_sbvh);
+				int first          = cwbvh->index_count;
+				int triangle_count = remove_duplicate_indices(cwbvh->indices + first, count_primitives(child_index, nodes_sbvh, indices_sbvh));
 				assert(triangle_count > 0 && triangle_count <= 3);
 
+				cwbvh->index_count = first + triangle_count;
+
 				// Three highest bits contain unary representation of triangle count
 				for (int j = 0; j < triangle_count; j++) {
 					node.meta[i] |= (1 << (j + 5));
@@ -339,7 +361,7 @@ void CWBVHBuilder::build(const BVH & bvh) {
 	// Collapse SBVH into 8-way tree (top down)
 	collapse(bvh.nodes, bvh.indices, 0, 0);
 
-	assert(cwbvh->index_count == bvh.index_count);
+	assert(cwbvh->index_count <= bvh.index_count);
 
 	//printf("CWBVH Node Collapse: %i -> %i\n", bvh.node_count, cwbvh.node_count);
 }
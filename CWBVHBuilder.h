@@ -47,4 +47,13 @@ public:
 	}
 
 	void build(const BVH & bvh);
+
+	// Sets the origin and exponents of the quantization grid of the Node such that it covers the given AABB, returns 1 / scale of the grid
+	static Vector3 quantize_origin(CWBVHNode & node, const AABB & aabb);
+
+	// Stores the AABB of the given child conservatively in the quantization grid of the Node
+	static void quantize_child(CWBVHNode & node, int child_index, const AABB & child_aabb, const Vector3 & one_over_e);
+
+	// Reconstructs the AABB's of the children of a CWBVH Node from their quantized representation
+	static void dequantize(const CWBVHNode & node, AABB child_aabbs[8]);
 };
@@ -0,0 +1,350 @@
+#include "CWBVHTraversal.h"
+
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET __attribute__((target("avx2,fma"))) // MSVC allows the AVX2 intrinsics in any function, other compilers only in functions targeting AVX2
+#endif
+
+#include "TraversalStack.h"
+
+// Size of a Triangle as stored on the GPU (position_0, position_edge_1, position_edge_2 as float4)
+static constexpr int      GPU_TRIANGLE_SIZE       = 48;
+static constexpr uint64_t CACHE_ADDRESS_TRIANGLES = 1ull << 62;
+
+// Index of the most significant set bit, same as msb on the GPU
+static inline unsigned msb(unsigned value) {
+	assert(value != 0);
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanReverse(&index, value);
+
+	return index;
+#else
+	return 31 - __builtin_clz(value);
+#endif
+}
+
+static inline unsigned popcount(unsigned value) {
+#if defined(_MSC_VER)
+	return __popcnt(value);
+#else
+	return __builtin_popcount(value);
+#endif
+}
+
+static inline float uint_as_float(unsigned value) {
+	float result;
+	memcpy(&result, &value, sizeof(float));
+
+	return result;
+}
+
+// Same as the GPU Ray, including the octant of its direction
+struct TraversalRay {
+	Vector3 origin;
+	Vector3 direction;
+	Vector3 direction_inv;
+
+	unsigned oct_inv;
+
+	inline void init(const Vector3 & origin, const Vector3 & direction) {
+		this->origin    = origin;
+		this->direction = direction;
+
+		direction_inv = Vector3(
+			1.0f / direction.x,
+			1.0f / direction.y,
+			1.0f / direction.z
+		);
+
+		// Ray octant, encoded in 3 bits
+		unsigned oct =
+			(direction.x < 0.0f ? 0b100 : 0) |
+			(direction.y < 0.0f ? 0b010 : 0) |
+			(direction.z < 0.0f ? 0b001 : 0);
+
+		oct_inv = 7 - oct;
+	}
+};
+
+// Checks for AVX2 and FMA support of both the CPU and the OS, the child intersection uses the AVX2 path only if they are available
+static bool cpu_supports_avx2() {
+#if defined(_MSC_VER)
+	int cpu_info[4];
+	__cpuid(cpu_info, 0);
+	if (cpu_info[0] < 7) return false;
+
+	__cpuid(cpu_info, 1);
+	bool has_fma     = cpu_info[2] & (1 << 12);
+	bool has_osxsave = cpu_info[2] & (1 << 27);
+	bool has_avx     = cpu_info[2] & (1 << 28);
+
+	// The OS needs to save the YMM registers on context switches
+	if (!has_fma || !has_osxsave || !has_avx || (_xgetbv(0) & 0b110) != 0b110) return false;
+
+	__cpuidex(cpu_info, 7, 0);
+	return cpu_info[1] & (1 << 5);
+#else
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+static const bool use_avx2 = cpu_supports_avx2();
+
+// Node group or triangle group, same as the uint2 used on the GPU
+struct Group {
+	unsigned base;
+	unsigned mask;
+};
+
+// Child AABBs of a CWBVHNode relative to the Ray, see node_intersect
+struct ChildPlanes {
+	Vector3 adjusted_ray_direction_inv;
+	Vector3 adjusted_ray_origin;
+
+	const byte * x_min; const byte * x_max;
+	const byte * y_min; const byte * y_max;
+	const byte * z_min; const byte * z_max;
+};
+
+// Converts the quantized planes of the 8 children to floats
+AVX2_TARGET static inline __m256 decode(const byte * quantized) {
+	return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(quantized))));
+}
+
+// Bit i is set if child slot i is intersected. NaN's that occur for axis aligned Rays are ignored like fmaxf and fminf do,
+// by always passing the accumulated value as the second operand of the SIMD min and max
+AVX2_TARGET static unsigned intersect_children_avx2(const ChildPlanes & planes, float max_distance) {
+	__m256 dir_x = _mm256_set1_ps(planes.adjusted_ray_direction_inv.x), orig_x = _mm256_set1_ps(planes.adjusted_ray_origin.x);
+	__m256 dir_y = _mm256_set1_ps(planes.adjusted_ray_direction_inv.y), orig_y = _mm256_set1_ps(planes.adjusted_ray_origin.y);
+	__m256 dir_z = _mm256_set1_ps(planes.adjusted_ray_direction_inv.z), orig_z = _mm256_set1_ps(planes.adjusted_ray_origin.z);
+
+	// Account for grid origin and scale
+	__m256 tmin_x = _mm256_fmadd_ps(decode(planes.x_min), dir_x, orig_x);
+	__m256 tmin_y = _mm256_fmadd_ps(decode(planes.y_min), dir_y, orig_y);
+	__m256 tmin_z = _mm256_fmadd_ps(decode(planes.z_min), dir_z, orig_z);
+	__m256 tmax_x = _mm256_fmadd_ps(decode(planes.x_max), dir_x, orig_x);
+	__m256 tmax_y = _mm256_fmadd_ps(decode(planes.y_max), dir_y, orig_y);
+	__m256 tmax_z = _mm256_fmadd_ps(decode(planes.z_max), dir_z, orig_z);
+
+	__m256 tmin = _mm256_max_ps(tmin_x, _mm256_max_ps(tmin_y, _mm256_max_ps(tmin_z, _mm256_set1_ps(EPSILON))));
+	__m256 tmax = _mm256_min_ps(tmax_x, _mm256_min_ps(tmax_y, _mm256_min_ps(tmax_z, _mm256_set1_ps(max_distance))));
+
+	return _mm256_movemask_ps(_mm256_cmp_ps(tmin, tmax, _CMP_LT_OQ));
+}
+
+static unsigned intersect_children_scalar(const ChildPlanes & planes, float max_distance) {
+	const Vector3 & dir  = planes.adjusted_ray_direction_inv;
+	const Vector3 & orig = planes.adjusted_ray_origin;
+
+	unsigned intersected_mask = 0;
+
+	for (int i = 0; i < 8; i++) {
+		float tmin = fmaxf(fmaxf(
+			fmaf(float(planes.x_min[i]), dir.x, orig.x),
+			fmaf(float(planes.y_min[i]), dir.y, orig.y)),
+			fmaxf(fmaf(float(planes.z_min[i]), dir.z, orig.z), EPSILON)
+		);
+		float tmax = fminf(fminf(
+			fmaf(float(planes.x_max[i]), dir.x, orig.x),
+			fmaf(float(planes.y_max[i]), dir.y, orig.y)),
+			fminf(fmaf(float(planes.z_max[i]), dir.z, orig.z), max_distance)
+		);
+
+		if (tmin < tmax) intersected_mask |= 1 << i;
+	}
+
+	return intersected_mask;
+}
+
+// Returns a bitmask of the children of the given Node that are hit by the Ray, see cwbvh_node_intersect.
+// The 24 lowest bits identify triangles relative to base_index_triangle, the 8 highest bits identify child Nodes.
+// Child AABBs are decoded as p + q * 2^e, the Ray is adjusted such that this takes a single fused multiply add per plane
+static inline unsigned node_intersect(const CWBVHNode & node, const TraversalRay & ray, float max_distance) {
+	ChildPlanes planes;
+	planes.adjusted_ray_direction_inv = Vector3(
+		uint_as_float(unsigned(node.e[0]) << 23) * ray.direction_inv.x,
+		uint_as_float(unsigned(node.e[1]) << 23) * ray.direction_inv.y,
+		uint_as_float(unsigned(node.e[2]) << 23) * ray.direction_inv.z
+	);
+	planes.adjusted_ray_origin = (node.p - ray.origin) * ray.direction_inv;
+
+	// Select near and far planes based on ray octant
+	planes.x_min = ray.direction.x < 0.0f ? node.quantized_max_x : node.quantized_min_x;
+	planes.x_max = ray.direction.x < 0.0f ? node.quantized_min_x : node.quantized_max_x;
+	planes.y_min = ray.direction.y < 0.0f ? node.quantized_max_y : node.quantized_min_y;
+	planes.y_max = ray.direction.y < 0.0f ? node.quantized_min_y : node.quantized_max_y;
+	planes.z_min = ray.direction.z < 0.0f ? node.quantized_max_z : node.quantized_min_z;
+	planes.z_max = ray.direction.z < 0.0f ? node.quantized_min_z : node.quantized_max_z;
+
+	unsigned intersected_mask = use_avx2 ? intersect_children_avx2(planes, max_distance) : intersect_children_scalar(planes, max_distance);
+
+	unsigned hit_mask = 0;
+
+	while (intersected_mask) {
+		unsigned i = msb(intersected_mask);
+		intersected_mask &= ~(1 << i);
+
+		unsigned meta = node.meta[i];
+
+		// Child Nodes are reordered by the octant of the Ray, so that popping the highest bit first visits them front to back
+		bool     is_inner   = (meta & (meta << 1)) & 0b00010000;
+		unsigned bit_index  = (is_inner ? meta ^ ray.oct_inv : meta) & 0b00011111;
+		unsigned child_bits = meta >> 5;
+
+		hit_mask |= child_bits << bit_index;
+	}
+
+	return hit_mask;
+}
+
+// Port of bvh_trace and bvh_trace_shadow. If instances is not null the given CWBVH is a TLAS,
+// every triangle group then refers to Instances and the Ray continues in the BLAS of the Instance
+template<bool ANY_HIT>
+static bool traverse(const CWBVH & cwbvh, const Triangle * triangles, const CWBVHTraversal::Instance instances[], const Ray & ray_world, RayHit & ray_hit, CacheSimulator * cache_simulator = nullptr) {
+	TraversalRay ray;
+	ray.init(ray_world.origin, ray_world.direction);
+
+	float max_distance = ray_world.max_distance;
+
+	TraversalStack<Group> stack;
+
+	Group current_group = { 0, 0x80000000 };
+
+	const CWBVH    * bvh           = &cwbvh;
+	const Triangle * bvh_triangles = triangles;
+
+	int tlas_stack_size = instances ? -1 : 0;
+	int mesh_id = -1;
+
+	bool hit = false;
+
+	while (true) {
+		Group triangle_group;
+
+		if (current_group.mask & 0xff000000) {
+			unsigned hits_imask = current_group.mask;
+
+			unsigned child_index_offset = msb(hits_imask);
+			unsigned child_index_base   = current_group.base;
+
+			// Remove n from current_group
+			current_group.mask &= ~(1 << child_index_offset);
+
+			// If the node group is not yet empty, push it on the stack
+			if (current_group.mask & 0xff000000) {
+				stack.push(current_group);
+			}
+
+			unsigned slot_index     = (child_index_offset - 24) ^ ray.oct_inv;
+			unsigned relative_index = popcount(hits_imask & ~(0xffffffff << slot_index));
+
+			const CWBVHNode & node = bvh->nodes[child_index_base + relative_index];
+
+			if (cache_simulator) cache_simulator->access(&node, sizeof(CWBVHNode));
+
+			unsigned hit_mask = node_intersect(node, ray, max_distance);
+
+			current_group  = { node.base_index_child,    (hit_mask & 0xff000000) | unsigned(node.imask) };
+			triangle_group = { node.base_index_triangle,  hit_mask & 0x00ffffff };
+		} else {
+			triangle_group = current_group;
+			current_group  = { 0, 0 };
+		}
+
+		// While the triangle group is not empty
+		while (triangle_group.mask != 0) {
+			unsigned triangle_offset = msb(triangle_group.mask);
+			triangle_group.mask &= ~(1 << triangle_offset);
+
+			if (tlas_stack_size == -1) {
+				mesh_id = cwbvh.indices[triangle_group.base + triangle_offset];
+
+				const CWBVHTraversal::Instance & instance = instances[mesh_id];
+
+				ray.init(
+					Matrix4::transform_position (instance.transform_inv, ray_world.origin),
+					Matrix4::transform_direction(instance.transform_inv, ray_world.direction)
+				);
+
+				// Both the remaining Nodes of the TLAS and the remaining Instances of the triangle group are resumed after the BLAS
+				if (current_group.mask & 0xff000000) {
+					stack.push(current_group);
+				}
+				if (triangle_group.mask != 0) {
+					stack.push(triangle_group);
+				}
+
+				tlas_stack_size = stack.size;
+
+				bvh           = instance.cwbvh;
+				bvh_triangles = instance.triangles;
+
+				current_group = { 0, 0x80000000 };
+
+				break;
+			} else {
+				int triangle_id = bvh->indices[triangle_group.base + triangle_offset];
+
+				// On the GPU Triangles are stored in the order of the indices, they are given their own address range
+				if (cache_simulator) cache_simulator->access(CACHE_ADDRESS_TRIANGLES + uint64_t(triangle_group.base + triangle_offset) * GPU_TRIANGLE_SIZE, GPU_TRIANGLE_SIZE);
+
+				float t, u, v;
+				if (ray_triangle_intersect(bvh_triangles[triangle_id], ray.origin, ray.direction, max_distance, t, u, v)) {
+					if (ANY_HIT) return true;
+
+					max_distance = t;
+
+					ray_hit.t = t;
+					ray_hit.u = u;
+					ray_hit.v = v;
+					ray_hit.mesh_id     = instances ? mesh_id : -1;
+					ray_hit.triangle_id = triangle_id;
+
+					hit = true;
+				}
+			}
+		}
+
+		if ((current_group.mask & 0xff000000) == 0) {
+			if (stack.size == 0) break;
+
+			if (stack.size == tlas_stack_size) {
+				tlas_stack_size = -1;
+
+				// Reset Ray to untransformed version
+				ray.init(ray_world.origin, ray_world.direction);
+
+				bvh           = &cwbvh;
+				bvh_triangles = triangles;
+			}
+
+			current_group = stack.pop();
+		}
+	}
+
+	return hit;
+}
+
+bool CWBVHTraversal::intersect(const CWBVH & cwbvh, const Triangle * triangles, const Ray & ray, RayHit & ray_hit, CacheSimulator * cache_simulator) {
+	return traverse<false>(cwbvh, triangles, nullptr, ray, ray_hit, cache_simulator);
+}
+
+bool CWBVHTraversal::intersect_any(const CWBVH & cwbvh, const Triangle * triangles, const Ray & ray, CacheSimulator * cache_simulator) {
+	RayHit ray_hit;
+	return traverse<true>(cwbvh, triangles, nullptr, ray, ray_hit, cache_simulator);
+}
+
+bool CWBVHTraversal::intersect(const CWBVH & tlas, const Instance instances[], const Ray & ray, RayHit & ray_hit) {
+	return traverse<false>(tlas, nullptr, instances, ray, ray_hit);
+}
+
+bool CWBVHTraversal::intersect_any(const CWBVH & tlas, const Instance instances[], const Ray & ray) {
+	RayHit ray_hit;
+	return traverse<true>(tlas, nullptr, instances, ray, ray_hit);
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include "BVH.h"
+
+#include "Ray.h"
+#include "Matrix4.h"
+#include "CacheSimulator.h"
+
+// Ray queries against a CWBVH on the CPU, used as a fallback without a GPU and as a reference for the GPU traversal.
+// This is a direct port of bvh_trace and bvh_trace_shadow in Tracing.h: Nodes are visited in the same order using
+// the same node groups, triangle groups and octant based child ordering, and the quantized child AABBs are decoded
+// using the same fused multiply adds, which is done for all 8 children at once using AVX2 if available.
+// Only triangle postponing and the dynamic fetch heuristic are left out, as they only affect scheduling on the GPU
+namespace CWBVHTraversal {
+	// Single level, the Ray is in the space of the CWBVH.
+	// If a CacheSimulator is given, every Node and Triangle fetch is passed to it
+	bool intersect    (const CWBVH & cwbvh, const Triangle * triangles, const Ray & ray, RayHit & ray_hit, CacheSimulator * cache_simulator = nullptr); // Closest hit, returns whether anything was hit
+	bool intersect_any(const CWBVH & cwbvh, const Triangle * triangles, const Ray & ray,                   CacheSimulator * cache_simulator = nullptr); // Returns as soon as anything is hit
+
+	struct Instance {
+		const CWBVH    * cwbvh;
+		const Triangle * triangles;
+
+		Matrix4 transform_inv;
+	};
+
+	// Two level, the leaves of the TLAS refer to Instances through tlas.indices.
+	// Before descending into a BLAS the Ray is transformed into its object space using the inverse transform of the Instance,
+	// in the same way the GPU uses mesh_transforms_inv
+	bool intersect    (const CWBVH & tlas, const Instance instances[], const Ray & ray, RayHit & ray_hit);
+	bool intersect_any(const CWBVH & tlas, const Instance instances[], const Ray & ray);
+}
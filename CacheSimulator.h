@@ -0,0 +1,79 @@
+#pragma once
+#include <stdint.h>
+#include <cassert>
+
+// Simulates a set associative cache with least recently used replacement,
+// used to compare how well different memory layouts of a BVH make use of the cache during traversal
+struct CacheSimulator {
+private:
+	int line_size_log2;
+	int set_count;
+	int associativity;
+
+	uint64_t * tags; // Per set, ordered from most to least recently used. Empty ways contain UINT64_MAX
+
+public:
+	uint64_t access_count;
+	uint64_t miss_count;
+
+	// Size and line size in bytes, line size and number of sets must be powers of two
+	inline void init(int size, int line_size, int associativity) {
+		line_size_log2 = 0;
+		while ((1 << line_size_log2) < line_size) line_size_log2++;
+
+		this->set_count     = size / (line_size * associativity);
+		this->associativity = associativity;
+
+		assert((1 << line_size_log2) == line_size);
+		assert(set_count > 0 && (set_count & (set_count - 1)) == 0);
+
+		tags = new uint64_t[set_count * associativity];
+
+		reset();
+	}
+
+	inline void free() {
+		delete [] tags;
+	}
+
+	inline void reset() {
+		for (int i = 0; i < set_count * associativity; i++) {
+			tags[i] = UINT64_MAX;
+		}
+
+		access_count = 0;
+		miss_count   = 0;
+	}
+
+	// Touches every cache line in the range [address, address + size>
+	inline void access(uint64_t address, int size) {
+		uint64_t line_first = address                     >> line_size_log2;
+		uint64_t line_last  = (address + uint64_t(size) - 1) >> line_size_log2;
+
+		for (uint64_t line = line_first; line <= line_last; line++) {
+			uint64_t * set = tags + (line & (set_count - 1)) * associativity;
+
+			access_count++;
+
+			// Find the line in the set, or evict the least recently used way on a miss
+			int way = 0;
+			while (way < associativity - 1 && set[way] != line) way++;
+
+			if (set[way] != line) miss_count++;
+
+			// Move to the front
+			for (int i = way; i > 0; i--) {
+				set[i] = set[i - 1];
+			}
+			set[0] = line;
+		}
+	}
+
+	inline void access(const void * address, int size) {
+		access(uint64_t(uintptr_t(address)), size);
+	}
+
+	inline float get_miss_rate() const {
+		return access_count > 0 ? float(miss_count) / float(access_count) : 0.0f;
+	}
+};
@@ -0,0 +1,767 @@
+#include "Compression.h"
+
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <stddef.h>
+
+#include <atomic>
+
+#include "ThreadPool.h"
+
+#include "Util.h"
+
+using Compression::Encoding;
+
+static constexpr int BLOCK_SIZE = 256 * 1024; // Uncompressed size in bytes of a block
+
+static constexpr int      RANS_PROBABILITY_BITS  = 12;
+static constexpr unsigned RANS_PROBABILITY_TOTAL = 1u << RANS_PROBABILITY_BITS;
+static constexpr unsigned RANS_STATE_LOWER_BOUND = 1u << 23;
+
+// Positions and normals are stored as integers on a grid, the members that follow them as 32 bit words
+static constexpr int TRIANGLE_GRID_OFFSETS[] = { offsetof(Triangle, position_0), offsetof(Triangle, normal_0) };
+
+static constexpr int TRIANGLE_WORD_OFFSET = offsetof(Triangle, tex_coord_0);
+static constexpr int TRIANGLE_WORD_COUNT  = (sizeof(Triangle) - TRIANGLE_WORD_OFFSET) / 4;
+
+static_assert(offsetof(Triangle, position_0) + 9 * sizeof(float) == offsetof(Triangle, normal_0), "Triangle positions must be contiguous");
+static_assert(offsetof(Triangle, normal_0)   + 9 * sizeof(float) == TRIANGLE_WORD_OFFSET,       "Triangle normals must be contiguous");
+static_assert(TRIANGLE_WORD_OFFSET + TRIANGLE_WORD_COUNT * 4 == sizeof(Triangle), "Triangle must consist of 32 bit words");
+
+// The texture coordinates of the second and third vertex are predicted from those of the first vertex of the same Triangle,
+// which they are usually close to. The first texture coordinate and the Material id are predicted from the previous Triangle
+static constexpr int TRIANGLE_WORD_REFERENCES[TRIANGLE_WORD_COUNT] = {
+	INVALID, INVALID, // tex_coord_0
+	0, 1,             // tex_coord_1
+	0, 1,             // tex_coord_2
+	INVALID           // material_id
+};
+
+// The bytes of variable length integers are split into streams by their position within the integer.
+// The first byte is mostly noise, while the bytes after it are increasingly predictable
+static constexpr int VARINT_STREAM_COUNT = 3;
+static constexpr int VARINT_MAX_SIZE     = 10; // In bytes, for a 64 bit integer
+
+enum struct StreamMode : unsigned char {
+	STORED,
+	RANS
+};
+
+struct CompressedHeader {
+	int element_size;
+	int element_count;
+	int block_element_count;
+	int block_count; // Followed by block_count + 1 offsets of the blocks, relative to the start of the header
+};
+
+// Every block starts with a hash of its uncompressed elements, which is compared against the decoded elements
+using BlockChecksum = unsigned long long;
+
+static void write_bytes(std::vector<unsigned char> & buffer, const void * data, size_t size) {
+	buffer.insert(buffer.end(), reinterpret_cast<const unsigned char *>(data), reinterpret_cast<const unsigned char *>(data) + size);
+}
+
+template<typename T>
+static void write_value(std::vector<unsigned char> & buffer, T value) {
+	write_bytes(buffer, &value, sizeof(T));
+}
+
+template<typename T>
+static bool read_value(const unsigned char *& ptr, const unsigned char * end, T & value) {
+	if (end - ptr < sizeof(T)) return false;
+
+	memcpy(&value, ptr, sizeof(T));
+	ptr += sizeof(T);
+
+	return true;
+}
+
+static unsigned long long zigzag_encode(long long value) {
+	return ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63);
+}
+
+static long long zigzag_decode(unsigned long long value) {
+	return (long long)(value >> 1) ^ -(long long)(value & 1);
+}
+
+static void write_varint(std::vector<unsigned char> streams[VARINT_STREAM_COUNT], long long value) {
+	unsigned long long bits = zigzag_encode(value);
+
+	int i = 0;
+	while (bits >= 0x80) {
+		streams[Math::min(i++, VARINT_STREAM_COUNT - 1)].push_back((unsigned char)(bits | 0x80));
+		bits >>= 7;
+	}
+	streams[Math::min(i, VARINT_STREAM_COUNT - 1)].push_back((unsigned char)bits);
+}
+
+struct VarintReader {
+	const unsigned char * ptrs[VARINT_STREAM_COUNT];
+	const unsigned char * ends[VARINT_STREAM_COUNT];
+
+	VarintReader(const std::vector<unsigned char> streams[VARINT_STREAM_COUNT]) {
+		for (int s = 0; s < VARINT_STREAM_COUNT; s++) {
+			ptrs[s] = streams[s].data();
+			ends[s] = streams[s].data() + streams[s].size();
+		}
+	}
+
+	bool read(long long & value) {
+		unsigned long long bits = 0;
+
+		for (int i = 0; i < VARINT_MAX_SIZE; i++) {
+			int s = Math::min(i, VARINT_STREAM_COUNT - 1);
+			if (ptrs[s] == ends[s]) return false;
+
+			unsigned char byte = *ptrs[s]++;
+			bits |= (unsigned long long)(byte & 0x7f) << (7 * i);
+
+			if ((byte & 0x80) == 0) {
+				value = zigzag_decode(bits);
+
+				return true;
+			}
+		}
+
+		return false;
+	}
+};
+
+// Scales the symbol counts so that they sum to RANS_PROBABILITY_TOTAL, every symbol that occurs keeps a frequency of at least one
+static void normalize_frequencies(const unsigned counts[256], int total, unsigned short frequencies[256]) {
+	int frequency_sum = 0;
+
+	for (int s = 0; s < 256; s++) {
+		if (counts[s] == 0) {
+			frequencies[s] = 0;
+		} else {
+			frequencies[s] = (unsigned short)Math::max(1ull, (unsigned long long)counts[s] * RANS_PROBABILITY_TOTAL / total);
+		}
+		frequency_sum += frequencies[s];
+	}
+
+	// Distribute the remainder over the most frequent symbols, where it affects the compression ratio the least
+	while (frequency_sum != RANS_PROBABILITY_TOTAL) {
+		int most_frequent = 0;
+		for (int s = 1; s < 256; s++) {
+			if (frequencies[s] > frequencies[most_frequent]) most_frequent = s;
+		}
+
+		if (frequency_sum < RANS_PROBABILITY_TOTAL) {
+			frequencies[most_frequent] += RANS_PROBABILITY_TOTAL - frequency_sum;
+			frequency_sum = RANS_PROBABILITY_TOTAL;
+		} else {
+			int excess = Math::min(frequency_sum - int(RANS_PROBABILITY_TOTAL), frequencies[most_frequent] - 1);
+
+			frequencies[most_frequent] -= excess;
+			frequency_sum -= excess;
+
+			if (excess == 0) {
+				// Every symbol is at a frequency of one, which cannot happen as there are fewer symbols than RANS_PROBABILITY_TOTAL
+				assert(false);
+				break;
+			}
+		}
+	}
+}
+
+// A stream consists of its mode, its uncompressed size and the size of the data that follows.
+// An rANS stream stores a bitmask of the symbols that occur and their frequencies, followed by the encoded bytes.
+// If entropy coding does not make the stream smaller it is stored as is
+static void encode_stream(const std::vector<unsigned char> & data, std::vector<unsigned char> & buffer) {
+	int size = data.size();
+
+	unsigned counts[256] = { };
+	for (int i = 0; i < size; i++) counts[data[i]]++;
+
+	unsigned short frequencies[256];
+	unsigned       starts[256];
+
+	std::vector<unsigned char> encoded;
+
+	if (size > 0) {
+		normalize_frequencies(counts, size, frequencies);
+
+		unsigned start = 0;
+		for (int s = 0; s < 256; s++) {
+			starts[s] = start;
+			start += frequencies[s];
+		}
+
+		// Symbols with a frequency of one take 12 bits, so the encoded data is at most twice the size of the input
+		encoded.resize(2 * size + 4);
+
+		unsigned char * ptr = encoded.data() + encoded.size();
+		unsigned        state = RANS_STATE_LOWER_BOUND;
+
+		// rANS works in reverse, the bytes are encoded back to front so that they are decoded front to back
+		for (int i = size - 1; i >= 0; i--) {
+			unsigned char symbol    = data[i];
+			unsigned      frequency = frequencies[symbol];
+
+			unsigned state_max = ((RANS_STATE_LOWER_BOUND >> RANS_PROBABILITY_BITS) << 8) * frequency;
+			while (state >= state_max) {
+				*--ptr = (unsigned char)state;
+				state >>= 8;
+			}
+
+			state = ((state / frequency) << RANS_PROBABILITY_BITS) + (state % frequency) + starts[symbol];
+		}
+
+		ptr -= sizeof(state);
+		memcpy(ptr, &state, sizeof(state));
+
+		encoded.erase(encoded.begin(), encoded.begin() + (ptr - encoded.data()));
+	}
+
+	int symbol_count = 0;
+	for (int s = 0; s < 256; s++) symbol_count += counts[s] > 0;
+
+	int rans_size = 32 + symbol_count * sizeof(unsigned short) + encoded.size();
+
+	if (size == 0 || rans_size >= size) {
+		write_value(buffer, StreamMode::STORED);
+		write_value(buffer, size);
+		write_value(buffer, size);
+		write_bytes(buffer, data.data(), size);
+	} else {
+		unsigned char symbol_mask[32] = { };
+		for (int s = 0; s < 256; s++) {
+			if (counts[s] > 0) symbol_mask[s / 8] |= 1 << (s % 8);
+		}
+
+		write_value(buffer, StreamMode::RANS);
+		write_value(buffer, size);
+		write_value(buffer, rans_size);
+		write_bytes(buffer, symbol_mask, sizeof(symbol_mask));
+
+		for (int s = 0; s < 256; s++) {
+			if (counts[s] > 0) write_value(buffer, frequencies[s]);
+		}
+
+		write_bytes(buffer, encoded.data(), encoded.size());
+	}
+}
+
+// Decodes the stream at ptr into data, which is resized to the uncompressed size of the stream if that does not exceed max_size
+static bool decode_stream(const unsigned char *& ptr, const unsigned char * end, std::vector<unsigned char> & data, int max_size) {
+	StreamMode mode;
+	int        size;
+	int        stored_size;
+
+	if (!read_value(ptr, end, mode) || !read_value(ptr, end, size) || !read_value(ptr, end, stored_size)) return false;
+	if (size < 0 || size > max_size || stored_size < 0 || stored_size > end - ptr) return false;
+
+	const unsigned char * stream_end = ptr + stored_size;
+
+	data.resize(size);
+
+	if (mode == StreamMode::STORED) {
+		if (stored_size != size) return false;
+
+		if (size > 0) memcpy(data.data(), ptr, size);
+		ptr = stream_end;
+
+		return true;
+	}
+
+	if (mode != StreamMode::RANS) return false;
+
+	unsigned char symbol_mask[32];
+	if (stream_end - ptr < sizeof(symbol_mask)) return false;
+
+	memcpy(symbol_mask, ptr, sizeof(symbol_mask));
+	ptr += sizeof(symbol_mask);
+
+	unsigned short frequencies[256];
+	unsigned       starts     [256];
+	unsigned char  slot_symbols[RANS_PROBABILITY_TOTAL];
+
+	unsigned start = 0;
+
+	for (int s = 0; s < 256; s++) {
+		frequencies[s] = 0;
+		starts     [s] = start;
+
+		if (symbol_mask[s / 8] & (1 << (s % 8))) {
+			if (!read_value(ptr, stream_end, frequencies[s])) return false;
+			if (frequencies[s] == 0 || start + frequencies[s] > RANS_PROBABILITY_TOTAL) return false;
+
+			memset(slot_symbols + start, s, frequencies[s]);
+			start += frequencies[s];
+		}
+	}
+
+	if (start != RANS_PROBABILITY_TOTAL) return false;
+
+	unsigned state;
+	if (!read_value(ptr, stream_end, state)) return false;
+
+	for (int i = 0; i < size; i++) {
+		unsigned slot = state & (RANS_PROBABILITY_TOTAL - 1);
+		unsigned char symbol = slot_symbols[slot];
+
+		state = frequencies[symbol] * (state >> RANS_PROBABILITY_BITS) + slot - starts[symbol];
+
+		while (state < RANS_STATE_LOWER_BOUND) {
+			if (ptr == stream_end) return false;
+
+			state = (state << 8) | *ptr++;
+		}
+
+		data[i] = symbol;
+	}
+
+	ptr = stream_end;
+
+	return true;
+}
+
+// Word of the element that a word is predicted from, either another word of the same element if word_references is given and
+// names one for this word, or the same word of the previous element. Returns false for the first element, which is not predicted
+static bool get_reference_word(const unsigned char * elements, int element_stride, int word_offset, const int word_references[], int e, int w, unsigned & reference) {
+	if (word_references && word_references[w] != INVALID) {
+		memcpy(&reference, elements + size_t(e) * element_stride + word_offset + word_references[w] * 4, 4);
+
+		return true;
+	}
+
+	if (e == 0) return false;
+
+	memcpy(&reference, elements + size_t(e - 1) * element_stride + word_offset + w * 4, 4);
+
+	return true;
+}
+
+// Splits 32 bit words, XORed with the word they are predicted from, into four streams by byte significance
+static void split_words(const unsigned char * elements, int element_stride, int word_offset, int word_count, const int word_references[], int element_count, std::vector<unsigned char> streams[4]) {
+	for (int b = 0; b < 4; b++) streams[b].reserve(element_count * word_count);
+
+	for (int e = 0; e < element_count; e++) {
+		for (int w = 0; w < word_count; w++) {
+			unsigned word;
+			memcpy(&word, elements + size_t(e) * element_stride + word_offset + w * 4, 4);
+
+			unsigned reference;
+			if (get_reference_word(elements, element_stride, word_offset, word_references, e, w, reference)) word ^= reference;
+
+			for (int b = 0; b < 4; b++) streams[b].push_back((unsigned char)(word >> (8 * b)));
+		}
+	}
+}
+
+// Words may only reference words with a lower index, so that the reference has already been decoded
+static void merge_words(unsigned char * elements, int element_stride, int word_offset, int word_count, const int word_references[], int element_count, const std::vector<unsigned char> streams[4]) {
+	for (int e = 0; e < element_count; e++) {
+		for (int w = 0; w < word_count; w++) {
+			int i = e * word_count + w;
+
+			unsigned word = streams[0][i] | (streams[1][i] << 8) | (streams[2][i] << 16) | (unsigned(streams[3][i]) << 24);
+
+			unsigned reference;
+			if (get_reference_word(elements, element_stride, word_offset, word_references, e, w, reference)) word ^= reference;
+
+			memcpy(elements + size_t(e) * element_stride + word_offset + w * 4, &word, 4);
+		}
+	}
+}
+
+// Exponent of the lowest set bit of a finite, non-zero float, the float is a multiple of 2 to this power
+static int get_lowest_bit_exponent(float value) {
+	unsigned bits;
+	memcpy(&bits, &value, sizeof(float));
+
+	int      exponent = (bits >> 23) & 0xff;
+	unsigned mantissa =  bits        & 0x7fffff;
+
+	if (exponent == 0) {
+		exponent = 1; // Denormal
+	} else {
+		mantissa |= 0x800000;
+	}
+
+	int trailing_zeros = 0;
+	while ((mantissa & 1) == 0) {
+		mantissa >>= 1;
+		trailing_zeros++;
+	}
+
+	return exponent - 127 - 23 + trailing_zeros;
+}
+
+// Finds the largest power of two that divides the 9 floats at the given offset of every Triangle, which are the positions or normals.
+// Returns false if they do not fit the TRIANGLES encoding
+static bool get_grid_exponent(const Triangle * triangles, int triangle_count, int offset, int & grid_exponent) {
+	grid_exponent = INT_MAX;
+
+	for (int t = 0; t < triangle_count; t++) {
+		const float * values = reinterpret_cast<const float *>(reinterpret_cast<const unsigned char *>(triangles + t) + offset);
+
+		for (int i = 0; i < 9; i++) {
+			if (!isfinite(values[i])) return false;
+			if (values[i] == 0.0f) continue;
+
+			grid_exponent = Math::min(grid_exponent, get_lowest_bit_exponent(values[i]));
+		}
+	}
+
+	if (grid_exponent == INT_MAX) grid_exponent = 0; // All values are zero
+
+	// The grid coordinates must fit in 62 bits, so that deltas between them do not overflow
+	for (int t = 0; t < triangle_count; t++) {
+		const float * values = reinterpret_cast<const float *>(reinterpret_cast<const unsigned char *>(triangles + t) + offset);
+
+		for (int i = 0; i < 9; i++) {
+			if (fabsf(ldexpf(values[i], -grid_exponent)) >= 4.6e18f) return false;
+		}
+	}
+
+	return true;
+}
+
+static bool encode_block(const unsigned char * elements, int element_size, int element_count, Encoding encoding, std::vector<unsigned char> & buffer) {
+	std::vector<unsigned char> streams[VARINT_STREAM_COUNT + 4];
+	int                        stream_count;
+
+	write_value(buffer, encoding);
+
+	switch (encoding) {
+		case Encoding::RAW: {
+			streams[0].assign(elements, elements + size_t(element_size) * element_count);
+			stream_count = 1;
+
+			break;
+		}
+
+		case Encoding::WORDS: {
+			if (element_size % 4 != 0) return false;
+
+			split_words(elements, element_size, 0, element_size / 4, nullptr, element_count, streams);
+			stream_count = 4;
+
+			break;
+		}
+
+		case Encoding::INDICES: {
+			if (element_size != sizeof(int)) return false;
+
+			const int * indices = reinterpret_cast<const int *>(elements);
+
+			for (int i = 0; i < element_count; i++) {
+				write_varint(streams, (long long)indices[i] - (i > 0 ? indices[i - 1] : 0));
+			}
+			stream_count = VARINT_STREAM_COUNT;
+
+			break;
+		}
+
+		case Encoding::TRIANGLES: {
+			if (element_size != sizeof(Triangle)) return false;
+
+			const Triangle * triangles = reinterpret_cast<const Triangle *>(elements);
+
+			for (int offset : TRIANGLE_GRID_OFFSETS) {
+				int grid_exponent;
+				if (!get_grid_exponent(triangles, element_count, offset, grid_exponent)) return false;
+
+				write_value(buffer, grid_exponent);
+
+				// The first vertex is predicted from the first vertex of the previous Triangle, the other two from the first vertex
+				long long grid_prev[3] = { };
+
+				for (int t = 0; t < element_count; t++) {
+					const float * values = reinterpret_cast<const float *>(elements + size_t(t) * sizeof(Triangle) + offset);
+
+					long long grid_values[9];
+					for (int i = 0; i < 9; i++) grid_values[i] = (long long)ldexpf(values[i], -grid_exponent);
+
+					for (int i = 0; i < 3; i++) {
+						write_varint(streams, grid_values[i] - grid_prev[i]);
+						grid_prev[i] = grid_values[i];
+					}
+					for (int i = 3; i < 9; i++) {
+						write_varint(streams, grid_values[i] - grid_values[i % 3]);
+					}
+				}
+			}
+
+			split_words(elements, sizeof(Triangle), TRIANGLE_WORD_OFFSET, TRIANGLE_WORD_COUNT, TRIANGLE_WORD_REFERENCES, element_count, streams + VARINT_STREAM_COUNT);
+			stream_count = VARINT_STREAM_COUNT + 4;
+
+			break;
+		}
+
+		default: return false;
+	}
+
+	for (int s = 0; s < stream_count; s++) {
+		encode_stream(streams[s], buffer);
+	}
+
+	return true;
+}
+
+static bool decode_block(const unsigned char * ptr, const unsigned char * end, unsigned char * elements, int element_size, int element_count) {
+	std::vector<unsigned char> streams[VARINT_STREAM_COUNT + 4];
+
+	Encoding encoding;
+	if (!read_value(ptr, end, encoding)) return false;
+
+	switch (encoding) {
+		case Encoding::RAW: {
+			if (!decode_stream(ptr, end, streams[0], element_size * element_count) || streams[0].size() != element_size * element_count) return false;
+
+			memcpy(elements, streams[0].data(), streams[0].size());
+
+			break;
+		}
+
+		case Encoding::WORDS: {
+			if (element_size % 4 != 0) return false;
+
+			int word_count = element_size / 4 * element_count;
+
+			for (int s = 0; s < 4; s++) {
+				if (!decode_stream(ptr, end, streams[s], word_count) || streams[s].size() != word_count) return false;
+			}
+
+			merge_words(elements, element_size, 0, element_size / 4, nullptr, element_count, streams);
+
+			break;
+		}
+
+		case Encoding::INDICES: {
+			if (element_size != sizeof(int)) return false;
+
+			for (int s = 0; s < VARINT_STREAM_COUNT; s++) {
+				if (!decode_stream(ptr, end, streams[s], VARINT_MAX_SIZE * element_count)) return false;
+			}
+
+			VarintReader reader(streams);
+
+			int * indices = reinterpret_cast<int *>(elements);
+
+			for (int i = 0; i < element_count; i++) {
+				long long delta;
+				if (!reader.read(delta)) return false;
+
+				indices[i] = int((i > 0 ? indices[i - 1] : 0) + delta);
+			}
+
+			break;
+		}
+
+		case Encoding::TRIANGLES: {
+			if (element_size != sizeof(Triangle)) return false;
+
+			int grid_exponents[Util::array_element_count(TRIANGLE_GRID_OFFSETS)];
+			for (int & grid_exponent : grid_exponents) {
+				if (!read_value(ptr, end, grid_exponent)) return false;
+			}
+
+			for (int s = 0; s < VARINT_STREAM_COUNT; s++) {
+				if (!decode_stream(ptr, end, streams[s], 2 * 9 * VARINT_MAX_SIZE * element_count)) return false;
+			}
+
+			int word_count = TRIANGLE_WORD_COUNT * element_count;
+
+			for (int s = VARINT_STREAM_COUNT; s < VARINT_STREAM_COUNT + 4; s++) {
+				if (!decode_stream(ptr, end, streams[s], word_count) || streams[s].size() != word_count) return false;
+			}
+
+			VarintReader reader(streams);
+
+			for (int g = 0; g < Util::array_element_count(TRIANGLE_GRID_OFFSETS); g++) {
+				long long grid_prev[3] = { };
+
+				for (int t = 0; t < element_count; t++) {
+					long long grid_values[9];
+
+					for (int i = 0; i < 9; i++) {
+						long long delta;
+						if (!reader.read(delta)) return false;
+
+						grid_values[i] = delta + (i < 3 ? grid_prev[i] : grid_values[i % 3]);
+					}
+
+					for (int i = 0; i < 3; i++) grid_prev[i] = grid_values[i];
+
+					float * values = reinterpret_cast<float *>(elements + size_t(t) * sizeof(Triangle) + TRIANGLE_GRID_OFFSETS[g]);
+					for (int i = 0; i < 9; i++) values[i] = ldexpf(float(grid_values[i]), grid_exponents[g]);
+				}
+			}
+
+			Triangle * triangles = reinterpret_cast<Triangle *>(elements);
+
+			for (int t = 0; t < element_count; t++) {
+				// Same as AABB::from_points, without asserting that the AABB is valid as the data may be corrupt
+				AABB & aabb = triangles[t].aabb;
+				aabb = AABB::create_empty();
+				aabb.expand(triangles[t].position_0);
+				aabb.expand(triangles[t].position_1);
+				aabb.expand(triangles[t].position_2);
+				aabb.fix_if_needed();
+			}
+
+			merge_words(elements, sizeof(Triangle), TRIANGLE_WORD_OFFSET, TRIANGLE_WORD_COUNT, TRIANGLE_WORD_REFERENCES, element_count, streams + VARINT_STREAM_COUNT);
+
+			break;
+		}
+
+		default: return false;
+	}
+
+	return true;
+}
+
+// Rounds the value to the nearest multiple of 2 to the given power
+static float snap_to_grid(float value, int exponent) {
+	float cell = rintf(ldexpf(value, -exponent));
+
+	// Beyond 2^24 cells from the origin a float is already a multiple of the cell size.
+	// Adding zero turns negative zero into positive zero, which the TRIANGLES encoding cannot represent
+	if (fabsf(cell) < 16777216.0f) {
+		return ldexpf(cell, exponent) + 0.0f;
+	}
+
+	return value;
+}
+
+void Compression::compress(const void * elements, int element_size, int element_count, Encoding encoding, std::vector<unsigned char> & compressed) {
+	int block_element_count = Math::max(1, BLOCK_SIZE / element_size);
+	int block_count         = Math::divide_round_up(element_count, block_element_count);
+
+	size_t header_offset = compressed.size();
+
+	CompressedHeader header = { element_size, element_count, block_element_count, block_count };
+	write_value(compressed, header);
+
+	size_t offsets_offset = compressed.size();
+	compressed.resize(compressed.size() + (block_count + 1) * sizeof(long long));
+
+	std::vector<unsigned char> decoded(block_element_count * element_size);
+
+	for (int b = 0; b < block_count; b++) {
+		const unsigned char * block_elements = reinterpret_cast<const unsigned char *>(elements) + size_t(b) * block_element_count * element_size;
+		int                   block_size     = Math::min(block_element_count, element_count - b * block_element_count);
+
+		size_t block_offset = compressed.size();
+
+		BlockChecksum checksum = Util::hash(block_elements, block_size * element_size);
+		write_value(compressed, checksum);
+
+		size_t encoding_offset = compressed.size();
+
+		// Verify that the block decodes to the exact same elements, otherwise fall back to a more general encoding
+		bool valid =
+			encode_block(block_elements, element_size, block_size, encoding, compressed) &&
+			decode_block(compressed.data() + encoding_offset, compressed.data() + compressed.size(), decoded.data(), element_size, block_size) &&
+			memcmp(decoded.data(), block_elements, block_size * element_size) == 0;
+
+		if (!valid) {
+			compressed.resize(encoding_offset);
+
+			if (!encode_block(block_elements, element_size, block_size, Encoding::WORDS, compressed)) {
+				compressed.resize(encoding_offset);
+				encode_block(block_elements, element_size, block_size, Encoding::RAW, compressed);
+			}
+		}
+
+		long long offset = block_offset - header_offset;
+		memcpy(compressed.data() + offsets_offset + b * sizeof(long long), &offset, sizeof(long long));
+	}
+
+	long long offset_end = compressed.size() - header_offset;
+	memcpy(compressed.data() + offsets_offset + block_count * sizeof(long long), &offset_end, sizeof(long long));
+}
+
+bool Compression::decompress(const unsigned char * compressed, size_t compressed_size, void * elements, int element_size, int element_count) {
+	const unsigned char * ptr = compressed;
+	const unsigned char * end = compressed + compressed_size;
+
+	CompressedHeader header;
+	if (!read_value(ptr, end, header)) return false;
+
+	if (header.element_size != element_size || header.element_count != element_count || header.block_element_count <= 0 ||
+		header.block_count != Math::divide_round_up(element_count, header.block_element_count) ||
+		(end - ptr) / sizeof(long long) < header.block_count + 1
+	) return false;
+
+	long long * block_offsets = new long long[header.block_count + 1];
+	memcpy(block_offsets, ptr, (header.block_count + 1) * sizeof(long long));
+
+	for (int b = 0; b < header.block_count; b++) {
+		if (block_offsets[b] < 0 || block_offsets[b] > block_offsets[b + 1] || block_offsets[b + 1] > compressed_size) {
+			delete [] block_offsets;
+
+			return false;
+		}
+	}
+
+	std::atomic<bool> valid = true;
+
+	// The blocks are independent, every block is decompressed by a separate Task
+	ThreadPool::TaskGroup group;
+
+	for (int b = 0; b < header.block_count; b++) {
+		ThreadPool::submit(group, [&, b]() {
+			int first = b * header.block_element_count;
+			int count = Math::min(header.block_element_count, element_count - first);
+
+			const unsigned char * block     = compressed + block_offsets[b];
+			const unsigned char * block_end = compressed + block_offsets[b + 1];
+
+			unsigned char * block_elements = reinterpret_cast<unsigned char *>(elements) + size_t(first) * element_size;
+
+			// Most corruption still decodes to some elements, only the checksum can tell that they are not the original ones
+			BlockChecksum checksum;
+			if (!read_value(block, block_end, checksum) ||
+				!decode_block(block, block_end, block_elements, element_size, count) ||
+				Util::hash(block_elements, size_t(count) * element_size) != checksum
+			) {
+				valid = false;
+			}
+		});
+	}
+
+	ThreadPool::wait(group);
+
+	delete [] block_offsets;
+
+	return valid;
+}
+
+void Compression::quantize_vertices(Triangle * triangles, int triangle_count, int position_bits, int normal_bits) {
+	AABB aabb = AABB::create_empty();
+
+	for (int t = 0; t < triangle_count; t++) {
+		aabb.expand(triangles[t].position_0);
+		aabb.expand(triangles[t].position_1);
+		aabb.expand(triangles[t].position_2);
+	}
+
+	Vector3 extent = aabb.max - aabb.min;
+	float   extent_max = Math::max(Math::max(extent.x, extent.y), extent.z);
+
+	// The cell size of the positions is the smallest power of two that divides the largest extent into at most 2^bits cells
+	int position_exponent = 0;
+	if (extent_max > 0.0f && isfinite(extent_max)) {
+		frexpf(extent_max, &position_exponent);
+		position_exponent -= position_bits;
+	}
+
+	// Normal components lie in [-1, 1], one bit encodes the sign
+	int normal_exponent = 1 - normal_bits;
+
+	for (int t = 0; t < triangle_count; t++) {
+		float * positions = &triangles[t].position_0.x;
+		float * normals   = &triangles[t].normal_0.x;
+
+		for (int i = 0; i < 9; i++) {
+			if (extent_max > 0.0f) positions[i] = snap_to_grid(positions[i], position_exponent);
+
+			normals[i] = snap_to_grid(normals[i], normal_exponent);
+		}
+	}
+}
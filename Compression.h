@@ -0,0 +1,37 @@
+#pragma once
+#include <vector>
+
+#include "Triangle.h"
+
+// Lossless codec for the arrays stored in the BVH file (see BVH_FILE_COMPRESSION).
+// The elements are split into blocks that are compressed independently, so that blocks can be decompressed in parallel
+// and in the order in which they are read from disk. Every block is transformed into a few byte streams that suit its contents,
+// which are then entropy coded with a static order 0 rANS coder:
+// - TRIANGLES: positions and normals are stored as integers on the power of two grid they lie on (see quantize_vertices), the first
+//              vertex is delta coded against the previous Triangle and the other two against the first. The AABB is not stored at all,
+//              it is recalculated from the positions. Texture coordinates are XORed in the same way, the Material id is XORed with that
+//              of the previous Triangle
+// - INDICES:   every index is delta coded against the previous index
+// - WORDS:     every 32 bit word of an element is XORed with the same word of the previous element
+// Integers are written as variable length integers split into streams by byte position, XORed words are split into four streams by byte significance.
+// Every block is decoded again after encoding, if its encoding does not reproduce the elements exactly it falls back to WORDS.
+// Every block also stores a hash of its elements, so that corrupt data is detected after decoding
+namespace Compression {
+	enum struct Encoding : char {
+		RAW,
+		WORDS,
+		INDICES,
+		TRIANGLES
+	};
+
+	// Appends the compressed elements to the given buffer
+	void compress(const void * elements, int element_size, int element_count, Encoding encoding, std::vector<unsigned char> & compressed);
+
+	// Blocks are decompressed on the Thread Pool. Returns false if the data is corrupt or describes a different number or size of elements
+	bool decompress(const unsigned char * compressed, size_t compressed_size, void * elements, int element_size, int element_count);
+
+	// Snaps the positions of the Triangles to a power of two grid with at least 2^position_bits cells along the largest axis of their bounds,
+	// and the normals to multiples of 2^(1 - normal_bits), so that the TRIANGLES encoding stores them exactly as small integers.
+	// The AABBs of the Triangles are not updated
+	void quantize_vertices(Triangle * triangles, int triangle_count, int position_bits, int normal_bits);
+}
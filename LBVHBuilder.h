@@ -0,0 +1,265 @@
+#pragma once
+#include "BVH.h"
+#include "BVHPartitions.h"
+#include "Morton.h"
+
+#include "Mesh.h"
+
+#include "ThreadPool.h"
+
+// Builds a binary BVH by sorting the primitives along a Morton curve, see Karras 2012.
+// Every Node splits its range of primitives at the highest bit in which their Morton codes differ.
+// If LBVH_SAH_CLUSTER_BITS is nonzero, primitives that share the highest bits of their Morton code form clusters,
+// the top levels of the hierarchy are then built over these clusters using the binned SAH (HLBVH, see Pantaleoni and Luebke 2010).
+// Every leaf contains a single primitive, so a subtree over n primitives always consists of 2n - 1 Nodes.
+// This means the index of every Node is known upfront and subtrees can be built in parallel without synchronization
+struct LBVHBuilder {
+private:
+	static constexpr int PARALLEL_SUBTREE_THRESHOLD = 4096; // Nodes with fewer primitives have their subtree built by a single Task
+
+	static_assert(LBVH_SAH_CLUSTER_BITS >= 0 && LBVH_SAH_CLUSTER_BITS < BVH_MORTON_CODE_BITS);
+
+	BVH * bvh = nullptr;
+
+	Morton::Code * morton_codes      = nullptr;
+	Morton::Code * morton_codes_temp = nullptr;
+	int          * indices_temp      = nullptr;
+
+	// Clusters are stored as references, where the index refers to the cluster
+	BVHPartitions::PrimitiveRef * clusters = nullptr;
+	int * cluster_offsets = nullptr;
+	int * cluster_sizes   = nullptr;
+
+	// Returns the index of the first primitive whose Morton code has the highest differing bit set,
+	// as well as the dimension that bit belongs to. All Morton codes in the range should share the bits above it
+	inline int find_split(int first_index, int index_count, int & split_dimension) const {
+		Morton::Code code_first = morton_codes[first_index];
+		Morton::Code code_last  = morton_codes[first_index + index_count - 1];
+
+		if (code_first == code_last) {
+			// All Morton codes are equal, split the range down the middle
+			split_dimension = 0;
+
+			return first_index + index_count / 2;
+		}
+
+		// Set all bits below the highest differing bit
+		Morton::Code mask = code_first ^ code_last;
+		mask |= mask >> 1;
+		mask |= mask >> 2;
+		mask |= mask >> 4;
+		mask |= mask >> 8;
+		mask |= mask >> 16;
+		if constexpr (BVH_MORTON_CODE_BITS == 63) mask |= mask >> 32;
+
+		int bit = 0;
+		while ((mask >> (bit + 1)) != 0) bit++;
+
+		// x, y and z are stored in bits 2, 1 and 0 of every triplet respectively
+		split_dimension = 2 - bit % 3;
+
+		// The first Morton code in the right half shares the bits above the highest differing bit and has that bit set
+		Morton::Code code_split = code_last & ~(mask >> 1);
+
+		return int(std::lower_bound(morton_codes + first_index, morton_codes + first_index + index_count, code_split) - morton_codes);
+	}
+
+	// Builds the subtree over the given range of sorted primitives, the descendants of the Node are stored starting at node_index
+	template<typename Primitive>
+	void build_lbvh_recursive(const Primitive * primitives, int node_id, int node_index, int first_index, int index_count) {
+		BVHNode & node = bvh->nodes[node_id];
+
+		if (index_count == 1) {
+			node.aabb  = primitives[bvh->indices[first_index]].aabb;
+			node.aabb.fix_if_needed();
+			node.first = first_index;
+			node.count = 1;
+
+			return;
+		}
+
+		int split_dimension;
+		int split_index = find_split(first_index, index_count, split_dimension);
+
+		int num_left  = split_index - first_index;
+		int num_right = index_count - num_left;
+
+		assert(num_left > 0 && num_right > 0);
+
+		node.left  = node_index;
+		node.count = (split_dimension + 1) << 30;
+
+		// The left subtree has 2 * num_left - 2 descendants, the right subtree is stored after those
+		int node_index_left  = node_index + 2;
+		int node_index_right = node_index_left + 2 * (num_left - 1);
+
+		int node_left = node.left;
+
+		if (index_count < PARALLEL_SUBTREE_THRESHOLD) {
+			build_lbvh_recursive(primitives, node_left,     node_index_left,  first_index, num_left);
+			build_lbvh_recursive(primitives, node_left + 1, node_index_right, split_index, num_right);
+		} else {
+			ThreadPool::TaskGroup group;
+			ThreadPool::submit(group, [=]() {
+				build_lbvh_recursive(primitives, node_left, node_index_left, first_index, num_left);
+			});
+
+			build_lbvh_recursive(primitives, node_left + 1, node_index_right, split_index, num_right);
+
+			ThreadPool::wait(group);
+		}
+
+		node.aabb = AABB::unify(bvh->nodes[node_left].aabb, bvh->nodes[node_left + 1].aabb);
+	}
+
+	// Builds the top levels of the hierarchy over the given range of clusters using the binned SAH
+	template<typename Primitive>
+	void build_clusters_recursive(const Primitive * primitives, int node_id, int node_index, int first_cluster, int cluster_count) {
+		if (cluster_count == 1) {
+			int cluster = clusters[first_cluster].index;
+
+			build_lbvh_recursive(primitives, node_id, node_index, cluster_offsets[cluster], cluster_sizes[cluster]);
+
+			return;
+		}
+
+		BVHNode & node = bvh->nodes[node_id];
+
+		AABB centroid_bounds = AABB::create_empty();
+		for (int i = first_cluster; i < first_cluster + cluster_count; i++) {
+			centroid_bounds.expand(clusters[i].aabb.get_center());
+		}
+
+		BVHPartitions::Bin bins[3 * BVH_BINNED_BIN_COUNT];
+		float              sah [BVH_BINNED_BIN_COUNT];
+
+		int bin_count = Math::min(BVH_BINNED_BIN_COUNT, 2 * cluster_count);
+
+		BVHPartitions::BinnedSplit split = BVHPartitions::partition_binned(clusters, first_cluster, cluster_count, centroid_bounds, bins, sah, bin_count);
+
+		int split_index;
+		if (split.bin == -1) {
+			// All centroids coincide, split the clusters down the middle
+			split.dimension = 0;
+
+			split_index = first_cluster + cluster_count / 2;
+		} else {
+			split_index = BVHPartitions::split_indices_binned(clusters, first_cluster, cluster_count, split, bin_count);
+		}
+
+		int num_left  = split_index - first_cluster;
+		int num_right = cluster_count - num_left;
+
+		assert(num_left > 0 && num_right > 0);
+
+		int primitive_count_left = 0;
+		int primitive_count      = 0;
+
+		for (int i = first_cluster; i < first_cluster + cluster_count; i++) {
+			int size = cluster_sizes[clusters[i].index];
+
+			if (i < split_index) primitive_count_left += size;
+			primitive_count += size;
+		}
+
+		node.left  = node_index;
+		node.count = (split.dimension + 1) << 30;
+
+		int node_index_left  = node_index + 2;
+		int node_index_right = node_index_left + 2 * (primitive_count_left - 1);
+
+		int node_left = node.left;
+
+		if (primitive_count < PARALLEL_SUBTREE_THRESHOLD) {
+			build_clusters_recursive(primitives, node_left,     node_index_left,  first_cluster, num_left);
+			build_clusters_recursive(primitives, node_left + 1, node_index_right, split_index,   num_right);
+		} else {
+			ThreadPool::TaskGroup group;
+			ThreadPool::submit(group, [=]() {
+				build_clusters_recursive(primitives, node_left, node_index_left, first_cluster, num_left);
+			});
+
+			build_clusters_recursive(primitives, node_left + 1, node_index_right, split_index, num_right);
+
+			ThreadPool::wait(group);
+		}
+
+		node.aabb = AABB::unify(bvh->nodes[node_left].aabb, bvh->nodes[node_left + 1].aabb);
+	}
+
+	template<typename Primitive>
+	inline void build_bvh_impl(const Primitive * primitives, int primitive_count) {
+		Morton::calc_codes(primitives, primitive_count, morton_codes);
+
+		for (int i = 0; i < primitive_count; i++) {
+			bvh->indices[i] = i;
+		}
+
+		Morton::radix_sort(morton_codes, morton_codes_temp, bvh->indices, indices_temp, primitive_count);
+
+		// Group primitives that share the highest bits of their Morton code into clusters
+		constexpr int cluster_shift = BVH_MORTON_CODE_BITS - LBVH_SAH_CLUSTER_BITS;
+
+		int cluster_count = 0;
+
+		for (int i = 0; i < primitive_count; i++) {
+			if (i == 0 || (morton_codes[i] >> cluster_shift) != (morton_codes[i - 1] >> cluster_shift)) {
+				clusters[cluster_count].index = cluster_count;
+				clusters[cluster_count].aabb  = AABB::create_empty();
+
+				cluster_offsets[cluster_count] = i;
+				cluster_sizes  [cluster_count] = 0;
+
+				cluster_count++;
+			}
+
+			clusters     [cluster_count - 1].aabb.expand(primitives[bvh->indices[i]].aabb);
+			cluster_sizes[cluster_count - 1]++;
+		}
+
+		build_clusters_recursive(primitives, 0, 2, 0, cluster_count);
+
+		bvh->node_count  = 2 * primitive_count;
+		bvh->index_count = primitive_count;
+	}
+
+public:
+	inline void init(BVH * bvh, int primitive_count) {
+		this->bvh = bvh;
+
+		morton_codes      = new Morton::Code[primitive_count];
+		morton_codes_temp = new Morton::Code[primitive_count];
+		indices_temp      = new int         [primitive_count];
+
+		int cluster_count_max = Math::min(primitive_count, 1 << Math::min(LBVH_SAH_CLUSTER_BITS, 30));
+
+		clusters        = new BVHPartitions::PrimitiveRef[cluster_count_max];
+		cluster_offsets = new int                        [cluster_count_max];
+		cluster_sizes   = new int                        [cluster_count_max];
+
+		bvh->indices = new int    [primitive_count];
+		bvh->nodes   = new BVHNode[2 * primitive_count];
+	}
+
+	inline void free() {
+		delete [] morton_codes;
+		delete [] morton_codes_temp;
+		delete [] indices_temp;
+
+		delete [] clusters;
+		delete [] cluster_offsets;
+		delete [] cluster_sizes;
+	}
+
+	inline void build(const Triangle * triangles, int triangle_count) {
+		return build_bvh_impl(triangles, triangle_count);
+	}
+
+	inline void build(const Mesh * meshes, int mesh_count) {
+		return build_bvh_impl(meshes, mesh_count);
+	}
+
+	inline void build(const BVHPartitions::PrimitiveRef * references, int reference_count) {
+		return build_bvh_impl(references, reference_count);
+	}
+};
@@ -0,0 +1,541 @@
+#include "LinkedScene.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <process.h>
+
+#include "MeshData.h"
+#include "Material.h"
+#include "Texture.h"
+
+#include "Util.h"
+#include "ScopeTimer.h"
+
+static constexpr int SCENE_FILETYPE_VERSION = 1;
+
+// Same layout as the BVH file, a header and a table of contents followed by the aligned sections
+static constexpr int SCENE_FILE_SECTION_ALIGNMENT = 64;
+
+enum struct SceneFileSectionType : int {
+	BVH_NODES,
+	TRIANGLES,
+	TRIANGLE_MATERIAL_IDS,
+	TRIANGLE_LODS,
+	MESH_DATA_BVH_OFFSETS,
+	MESH_DATA_TRIANGLE_OFFSETS,
+	REVERSE_INDICES,
+	LIGHT_INDICES,
+	LIGHT_AREAS_CUMULATIVE,
+	LIGHT_MESHES,
+	LIGHT_MESH_DATA_INDICES
+};
+
+struct SceneFileSection {
+	SceneFileSectionType type;
+	int                  element_size;  // Used to detect changes to the layout of the stored structs
+	int                  element_count;
+	long long            offset;        // In bytes from the start of the file, a multiple of SCENE_FILE_SECTION_ALIGNMENT
+};
+
+struct alignas(8) SceneFileHeader { // Aligned so that the table of contents can directly follow it
+	char filetype_identifier[4];
+	char filetype_version;
+	char bvh_type;
+
+	unsigned long long content_hash; // Hash of everything the linked Scene depends on, see get_content_hash
+
+	int section_count; // Number of SceneFileSections in the table of contents
+};
+
+// Makes a Node of a MeshData's BVH point into the global Node and index arrays
+static void offset_node(BVHNode & node, int node_offset, int index_offset) {
+	if (node.is_leaf()) {
+		node.first += index_offset;
+	} else {
+		node.left += node_offset;
+	}
+}
+
+static void offset_node(QBVHNode & node, int node_offset, int index_offset) {
+	int child_count = node.get_child_count();
+	for (int c = 0; c < child_count; c++) {
+		if (node.is_leaf(c)) {
+			node.get_index(c) += index_offset;
+		} else {
+			node.get_index(c) += node_offset;
+		}
+	}
+}
+
+static void offset_node(CWBVHNode & node, int node_offset, int index_offset) {
+	node.base_index_child    += node_offset;
+	node.base_index_triangle += index_offset;
+}
+
+static int get_node_size(int bvh_type) {
+	int node_size = 0;
+
+	dispatch_bvh_type(bvh_type, [&](auto * node_type) {
+		node_size = sizeof(std::remove_pointer_t<decltype(node_type)>);
+	});
+
+	return node_size;
+}
+
+// Any change to the geometry of a MeshData, the Materials or the sizes of their Textures results in a different hash.
+// Returns 0 if the Scene cannot be cached, because the BVH of one of the MeshDatas is not final and may still change
+static unsigned long long get_content_hash(int bvh_type, int reserved_node_count) {
+	unsigned long long hash = Util::hash(&bvh_type, sizeof(bvh_type));
+	hash = Util::hash(&reserved_node_count, sizeof(reserved_node_count), hash);
+
+	for (int m = 0; m < MeshData::mesh_datas.size(); m++) {
+		const MeshData * mesh_data = MeshData::mesh_datas[m];
+
+		if (mesh_data->geometry_hash == 0) return 0;
+
+		hash = Util::hash(&mesh_data->geometry_hash,   sizeof(mesh_data->geometry_hash),   hash);
+		hash = Util::hash(&mesh_data->material_offset, sizeof(mesh_data->material_offset), hash);
+	}
+
+	// Only the type of a Material and the size of its Texture are used when linking
+	for (int i = 0; i < Material::materials.size(); i++) {
+		const Material & material = Material::materials[i];
+
+		int texture_size = 0;
+		if (material.texture_id != INVALID) {
+			const Texture & texture = Texture::textures[material.texture_id];
+
+			texture_size = texture.width * texture.height;
+		}
+
+		hash = Util::hash(&material.type, sizeof(material.type), hash);
+		hash = Util::hash(&texture_size,  sizeof(texture_size),  hash);
+	}
+
+	return hash;
+}
+
+// Named after the first Mesh of the Scene, for example "sponza.obj.scene.cwbvh", or "sponza.obj.scene.0123456789abcdef.cwbvh" inside the cache directory
+static std::string get_scene_filename(const char * scene_name, int bvh_type, unsigned long long content_hash) {
+	if (MeshData::cache_directory.empty()) {
+		return std::string(scene_name) + ".scene." + get_bvh_type_name(bvh_type);
+	}
+
+	char hash_string[17];
+	sprintf_s(hash_string, "%016llx", content_hash);
+
+	std::filesystem::path path = std::filesystem::path(MeshData::cache_directory) / std::filesystem::path(scene_name).filename();
+
+	return path.string() + ".scene." + hash_string + "." + get_bvh_type_name(bvh_type);
+}
+
+// Looks up the section of the given type and stores a pointer to its data, which points directly into the mapped file or is null if the section is empty.
+// Returns false if it is missing or does not lie within the file
+template<typename T>
+static bool get_section(const MappedFile & file, const SceneFileSection sections[], int section_count, SceneFileSectionType type, int element_size, int & element_count, T *& data) {
+	for (int i = 0; i < section_count; i++) {
+		const SceneFileSection & section = sections[i];
+
+		if (section.type != type) continue;
+
+		if (section.element_size != element_size || section.element_count < 0 ||
+			section.offset % SCENE_FILE_SECTION_ALIGNMENT != 0 ||
+			section.offset + (long long)section.element_size * (long long)section.element_count > (long long)file.size
+		) return false;
+
+		element_count = section.element_count;
+		data = element_count > 0 ? reinterpret_cast<T *>(const_cast<char *>(file.data + section.offset)) : nullptr;
+
+		return true;
+	}
+
+	return false;
+}
+
+void LinkedScene::init(const char * scene_name, int bvh_type, int reserved_node_count) {
+	this->bvh_type = bvh_type;
+
+	unsigned long long content_hash = get_content_hash(bvh_type, reserved_node_count);
+
+	if (content_hash == 0) {
+		link(reserved_node_count);
+
+		return;
+	}
+
+	std::string filename = get_scene_filename(scene_name, bvh_type, content_hash);
+
+	if (try_to_load_from_disk(filename.c_str(), content_hash)) return;
+
+	link(reserved_node_count);
+
+	save_to_disk(filename.c_str(), content_hash);
+}
+
+void LinkedScene::link(int reserved_node_count) {
+	ScopeTimer timer("Scene Linking");
+
+	mesh_data_count = MeshData::mesh_datas.size();
+
+	mesh_data_bvh_offsets      = new int[mesh_data_count];
+	mesh_data_triangle_offsets = new int[mesh_data_count];
+
+	int * mesh_data_index_offsets = MALLOCA(int, mesh_data_count);
+
+	bvh_node_count = reserved_node_count;
+	index_count    = 0;
+	triangle_count = 0;
+
+	for (int m = 0; m < mesh_data_count; m++) {
+		const MeshData * mesh_data = MeshData::mesh_datas[m];
+
+		assert(mesh_data->bvh_type == bvh_type);
+
+		mesh_data_bvh_offsets     [m] = bvh_node_count;
+		mesh_data_index_offsets   [m] = index_count;
+		mesh_data_triangle_offsets[m] = triangle_count;
+
+		mesh_data->visit_bvh([&](const auto & bvh) {
+			bvh_node_count += bvh.node_count;
+			index_count    += bvh.index_count;
+		});
+		triangle_count += mesh_data->triangle_count;
+	}
+
+	// Concatenate the BVH's of all MeshDatas into a single Node array
+	dispatch_bvh_type(bvh_type, [&](auto * node_type) {
+		typedef std::remove_pointer_t<decltype(node_type)> NodeType;
+
+		NodeType * nodes = new NodeType[bvh_node_count];
+		memset(nodes, 0, reserved_node_count * sizeof(NodeType));
+
+		for (int m = 0; m < mesh_data_count; m++) {
+			const BVHBase<NodeType> & bvh = MeshData::mesh_datas[m]->get_bvh<NodeType>();
+
+			for (int n = 0; n < bvh.node_count; n++) {
+				NodeType & node = nodes[mesh_data_bvh_offsets[m] + n];
+
+				node = bvh.nodes[n];
+				offset_node(node, mesh_data_bvh_offsets[m], mesh_data_index_offsets[m]);
+			}
+		}
+
+		bvh_nodes = nodes;
+	});
+
+	triangles             = new Triangle[index_count];
+	triangle_material_ids = new int     [index_count];
+	triangle_lods         = new float   [index_count];
+
+	reverse_indices = new int[triangle_count];
+
+	// The Triangles are read directly from the MeshData, in the order of the BVH indices
+	for (int m = 0; m < mesh_data_count; m++) {
+		const MeshData * mesh_data = MeshData::mesh_datas[m];
+
+		mesh_data->visit_bvh([&](const auto & bvh) {
+			for (int j = 0; j < bvh.index_count; j++) {
+				int i     = mesh_data_index_offsets[m] + j;
+				int index = bvh.indices[j];
+
+				assert(index < mesh_data->triangle_count);
+
+				const ::Triangle & triangle = mesh_data->triangles[index];
+
+				triangles[i].position_0      = triangle.position_0;
+				triangles[i].position_edge_1 = triangle.position_1 - triangle.position_0;
+				triangles[i].position_edge_2 = triangle.position_2 - triangle.position_0;
+
+				triangles[i].normal_0      = triangle.normal_0;
+				triangles[i].normal_edge_1 = triangle.normal_1 - triangle.normal_0;
+				triangles[i].normal_edge_2 = triangle.normal_2 - triangle.normal_0;
+
+				triangles[i].tex_coord_0      = triangle.tex_coord_0;
+				triangles[i].tex_coord_edge_1 = triangle.tex_coord_1 - triangle.tex_coord_0;
+				triangles[i].tex_coord_edge_2 = triangle.tex_coord_2 - triangle.tex_coord_0;
+
+				int material_id = triangle.material_id + mesh_data->material_offset;
+				triangle_material_ids[i] = material_id;
+
+				int texture_id = Material::materials[material_id].texture_id;
+				if (texture_id != INVALID) {
+					const Texture & texture = Texture::textures[texture_id];
+
+					// Triangle texture base LOD as described in "Texture Level of Detail Strategies for Real-Time Ray Tracing"
+					float t_a = float(texture.width * texture.height) * fabsf(
+						triangles[i].tex_coord_edge_1.x * triangles[i].tex_coord_edge_2.y -
+						triangles[i].tex_coord_edge_2.x * triangles[i].tex_coord_edge_1.y
+					);
+					float p_a = Vector3::length(Vector3::cross(triangles[i].position_edge_1, triangles[i].position_edge_2));
+
+					triangle_lods[i] = 0.5f * log2f(t_a / p_a);
+				} else {
+					triangle_lods[i] = 0.0f;
+				}
+
+				reverse_indices[mesh_data_triangle_offsets[m] + index] = i;
+			}
+		});
+	}
+
+	FREEA(mesh_data_index_offsets);
+
+	// Initialize Lights
+	struct LightTriangle {
+		int   index;
+		float area;
+	};
+	std::vector<LightTriangle> light_triangles;
+
+	std::vector<LightMesh> light_mesh_list;
+
+	light_mesh_data_indices = new int[mesh_data_count];
+	memset(light_mesh_data_indices, -1, mesh_data_count * sizeof(int));
+
+	// Loop over every MeshData and check whether it has at least 1 Triangle that is a Light
+	for (int m = 0; m < mesh_data_count; m++) {
+		const MeshData * mesh_data = MeshData::mesh_datas[m];
+
+		LightMesh * light_mesh = nullptr;
+
+		// For every Triangle, check whether it is a Light based on its Material
+		for (int t = 0; t < mesh_data->triangle_count; t++) {
+			const ::Triangle & triangle = mesh_data->triangles[t];
+
+			if (Material::materials[mesh_data->material_offset + triangle.material_id].type == Material::Type::LIGHT) {
+				float area = 0.5f * Vector3::length(Vector3::cross(
+					triangle.position_1 - triangle.position_0,
+					triangle.position_2 - triangle.position_0
+				));
+
+				if (light_mesh == nullptr) {
+					light_mesh_data_indices[m] = light_mesh_list.size();
+
+					light_mesh = &light_mesh_list.emplace_back();
+					light_mesh->triangle_first_index = light_triangles.size();
+					light_mesh->triangle_count = 0;
+				}
+
+				light_triangles.push_back({ reverse_indices[mesh_data_triangle_offsets[m] + t], area });
+
+				light_mesh->triangle_count++;
+			}
+		}
+
+		if (light_mesh) {
+			// Sort Lights on area within each Mesh
+			LightTriangle * triangles_begin = light_triangles.data() + light_mesh->triangle_first_index;
+			LightTriangle * triangles_end   = triangles_begin        + light_mesh->triangle_count;
+
+			assert(triangles_end > triangles_begin);
+
+			std::sort(triangles_begin, triangles_end, [](const LightTriangle & a, const LightTriangle & b) { return a.area < b.area; });
+		}
+	}
+
+	light_count            = light_triangles.size();
+	light_indices          = new int  [light_count];
+	light_areas_cumulative = new float[light_count];
+
+	light_mesh_count = light_mesh_list.size();
+	light_meshes     = new LightMesh[light_mesh_count];
+
+	for (int m = 0; m < light_mesh_count; m++) {
+		LightMesh & light_mesh = light_meshes[m];
+		light_mesh = light_mesh_list[m];
+
+		float cumulative_area = 0.0f;
+
+		for (int i = light_mesh.triangle_first_index; i < light_mesh.triangle_first_index + light_mesh.triangle_count; i++) {
+			light_indices[i] = light_triangles[i].index;
+
+			cumulative_area += light_triangles[i].area;
+			light_areas_cumulative[i] = cumulative_area;
+		}
+
+		light_mesh.area = cumulative_area;
+	}
+}
+
+// The file is written under a temporary name first and then renamed, so that processes sharing the cache never see a partially written file
+void LinkedScene::save_to_disk(const char * filename, unsigned long long content_hash) const {
+	std::string temp_filename = std::string(filename) + "." + std::to_string(_getpid()) + ".tmp";
+
+	std::error_code error;
+	if (!MeshData::cache_directory.empty()) std::filesystem::create_directories(MeshData::cache_directory, error);
+
+	FILE * file;
+	fopen_s(&file, temp_filename.c_str(), "wb");
+
+	if (file == nullptr) {
+		printf("WARNING: Unable to save linked Scene to file %s!\n", filename);
+
+		return;
+	}
+
+	SceneFileHeader header = { };
+	header.filetype_identifier[0] = 'S';
+	header.filetype_identifier[1] = 'C';
+	header.filetype_identifier[2] = 'N';
+	header.filetype_identifier[3] = '\0';
+	header.filetype_version = SCENE_FILETYPE_VERSION;
+	header.bvh_type         = bvh_type;
+	header.content_hash     = content_hash;
+
+	SceneFileSection sections[] = {
+		{ SceneFileSectionType::BVH_NODES,                  get_node_size(bvh_type), bvh_node_count },
+		{ SceneFileSectionType::TRIANGLES,                  sizeof(Triangle),        index_count },
+		{ SceneFileSectionType::TRIANGLE_MATERIAL_IDS,      sizeof(int),             index_count },
+		{ SceneFileSectionType::TRIANGLE_LODS,              sizeof(float),           index_count },
+		{ SceneFileSectionType::MESH_DATA_BVH_OFFSETS,      sizeof(int),             mesh_data_count },
+		{ SceneFileSectionType::MESH_DATA_TRIANGLE_OFFSETS, sizeof(int),             mesh_data_count },
+		{ SceneFileSectionType::REVERSE_INDICES,            sizeof(int),             triangle_count },
+		{ SceneFileSectionType::LIGHT_INDICES,              sizeof(int),             light_count },
+		{ SceneFileSectionType::LIGHT_AREAS_CUMULATIVE,     sizeof(float),           light_count },
+		{ SceneFileSectionType::LIGHT_MESHES,               sizeof(LightMesh),       light_mesh_count },
+		{ SceneFileSectionType::LIGHT_MESH_DATA_INDICES,    sizeof(int),             mesh_data_count }
+	};
+	const void * section_data[] = {
+		bvh_nodes,
+		triangles,
+		triangle_material_ids,
+		triangle_lods,
+		mesh_data_bvh_offsets,
+		mesh_data_triangle_offsets,
+		reverse_indices,
+		light_indices,
+		light_areas_cumulative,
+		light_meshes,
+		light_mesh_data_indices
+	};
+
+	header.section_count = Util::array_element_count(sections);
+
+	long long offset = sizeof(SceneFileHeader) + sizeof(sections);
+
+	for (int i = 0; i < header.section_count; i++) {
+		sections[i].offset = (offset + SCENE_FILE_SECTION_ALIGNMENT - 1) / SCENE_FILE_SECTION_ALIGNMENT * SCENE_FILE_SECTION_ALIGNMENT;
+
+		offset = sections[i].offset + (long long)sections[i].element_size * (long long)sections[i].element_count;
+	}
+
+	fwrite(reinterpret_cast<const char *>(&header),  sizeof(header),   1, file);
+	fwrite(reinterpret_cast<const char *>(sections), sizeof(sections), 1, file);
+
+	offset = sizeof(SceneFileHeader) + sizeof(sections);
+
+	for (int i = 0; i < header.section_count; i++) {
+		// Pad with zeroes up to the start of the section
+		static constexpr char padding[SCENE_FILE_SECTION_ALIGNMENT] = { };
+		fwrite(padding, 1, sections[i].offset - offset, file);
+
+		fwrite(reinterpret_cast<const char *>(section_data[i]), sections[i].element_size, sections[i].element_count, file);
+
+		offset = sections[i].offset + (long long)sections[i].element_size * (long long)sections[i].element_count;
+	}
+
+	bool write_failed = ferror(file) != 0;
+
+	fclose(file);
+
+	if (!write_failed) {
+		// If another process is using the existing file it cannot be replaced, the file it uses was created from the same content
+		std::filesystem::rename(temp_filename, filename, error);
+	}
+
+	if (write_failed || error) {
+		printf("WARNING: Unable to save linked Scene to file %s!\n", filename);
+
+		std::filesystem::remove(temp_filename, error);
+	}
+}
+
+// Maps the Scene file into memory, all arrays point directly into the mapped file
+bool LinkedScene::try_to_load_from_disk(const char * filename, unsigned long long content_hash) {
+	if (!Util::file_exists(filename)) return false;
+
+	if (!file.init(filename)) return false;
+
+	const SceneFileHeader  * header   = reinterpret_cast<const SceneFileHeader  *>(file.data);
+	const SceneFileSection * sections = reinterpret_cast<const SceneFileSection *>(file.data + sizeof(SceneFileHeader));
+
+	int section_counts[5];
+
+	bool has_sections;
+
+	if (file.size < sizeof(SceneFileHeader) || strcmp(header->filetype_identifier, "SCN") != 0) {
+		printf("WARNING: Scene file '%s' has an invalid header!\n", filename);
+		goto fail;
+	}
+
+	if (header->filetype_version != SCENE_FILETYPE_VERSION || header->bvh_type != bvh_type) goto fail;
+
+	// The Scene file is named after its first Mesh only, if other Meshes or their Materials changed it is linked again
+	if (header->content_hash != content_hash) {
+		printf("Scene file '%s' was created from a different Scene, linking Scene from scratch.\n", filename);
+		goto fail;
+	}
+
+	if (header->section_count < 0 || sizeof(SceneFileHeader) + header->section_count * sizeof(SceneFileSection) > file.size) {
+		printf("WARNING: Scene file '%s' has an invalid table of contents!\n", filename);
+		goto fail;
+	}
+
+	has_sections =
+		get_section(file, sections, header->section_count, SceneFileSectionType::BVH_NODES,                  get_node_size(bvh_type), bvh_node_count,    bvh_nodes) &&
+		get_section(file, sections, header->section_count, SceneFileSectionType::TRIANGLES,                  sizeof(Triangle),        index_count,       triangles) &&
+		get_section(file, sections, header->section_count, SceneFileSectionType::TRIANGLE_MATERIAL_IDS,      sizeof(int),             section_counts[0], triangle_material_ids) &&
+		get_section(file, sections, header->section_count, SceneFileSectionType::TRIANGLE_LODS,              sizeof(float),           section_counts[1], triangle_lods) &&
+		get_section(file, sections, header->section_count, SceneFileSectionType::MESH_DATA_BVH_OFFSETS,      sizeof(int),             mesh_data_count,   mesh_data_bvh_offsets) &&
+		get_section(file, sections, header->section_count, SceneFileSectionType::MESH_DATA_TRIANGLE_OFFSETS, sizeof(int),             section_counts[2], mesh_data_triangle_offsets) &&
+		get_section(file, sections, header->section_count, SceneFileSectionType::REVERSE_INDICES,            sizeof(int),             triangle_count,    reverse_indices) &&
+		get_section(file, sections, header->section_count, SceneFileSectionType::LIGHT_INDICES,              sizeof(int),             light_count,       light_indices) &&
+		get_section(file, sections, header->section_count, SceneFileSectionType::LIGHT_AREAS_CUMULATIVE,     sizeof(float),           section_counts[3], light_areas_cumulative) &&
+		get_section(file, sections, header->section_count, SceneFileSectionType::LIGHT_MESHES,               sizeof(LightMesh),       light_mesh_count,  light_meshes) &&
+		get_section(file, sections, header->section_count, SceneFileSectionType::LIGHT_MESH_DATA_INDICES,    sizeof(int),             section_counts[4], light_mesh_data_indices);
+
+	// Arrays of the same length must agree with each other and with the currently loaded MeshDatas
+	if (!has_sections ||
+		section_counts[0] != index_count || section_counts[1] != index_count ||
+		section_counts[2] != mesh_data_count || section_counts[4] != mesh_data_count || mesh_data_count != MeshData::mesh_datas.size() ||
+		section_counts[3] != light_count
+	) {
+		printf("WARNING: Scene file '%s' is missing sections or is truncated!\n", filename);
+		goto fail;
+	}
+
+	printf("Loaded linked Scene %s from disk\n", filename);
+
+	return true;
+
+fail:
+	file.free();
+
+	return false;
+}
+
+void LinkedScene::free() {
+	// Arrays inside the mapped file are released by unmapping it
+	if (!file.contains(bvh_nodes)) {
+		dispatch_bvh_type(bvh_type, [&](auto * node_type) {
+			delete [] static_cast<decltype(node_type)>(bvh_nodes);
+		});
+	}
+	if (!file.contains(triangles))             delete [] triangles;
+	if (!file.contains(triangle_material_ids)) delete [] triangle_material_ids;
+	if (!file.contains(triangle_lods))         delete [] triangle_lods;
+
+	if (!file.contains(mesh_data_bvh_offsets))      delete [] mesh_data_bvh_offsets;
+	if (!file.contains(mesh_data_triangle_offsets)) delete [] mesh_data_triangle_offsets;
+	if (!file.contains(reverse_indices))            delete [] reverse_indices;
+
+	if (!file.contains(light_indices))           delete [] light_indices;
+	if (!file.contains(light_areas_cumulative))  delete [] light_areas_cumulative;
+	if (!file.contains(light_meshes))            delete [] light_meshes;
+	if (!file.contains(light_mesh_data_indices)) delete [] light_mesh_data_indices;
+
+	file.free();
+}
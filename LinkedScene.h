@@ -0,0 +1,69 @@
+#pragma once
+#include "Vector2.h"
+#include "Vector3.h"
+
+#include "MappedFile.h"
+
+// The geometry of all MeshDatas linked together into the arrays the Pathtracer uploads to the Device.
+// The BVH's of all MeshDatas are concatenated into a single Node array, the Triangles are stored in edge form in the order of the BVH indices
+// and the Light Triangles are sorted per MeshData. The result only depends on the MeshDatas, their Materials and the sizes of their Textures,
+// so it is cached in a file next to the first Mesh (or in MeshData::cache_directory) and used in place from the mapped file on the next run
+struct LinkedScene {
+	struct Triangle {
+		Vector3 position_0;
+		Vector3 position_edge_1;
+		Vector3 position_edge_2;
+
+		Vector3 normal_0;
+		Vector3 normal_edge_1;
+		Vector3 normal_edge_2;
+
+		Vector2 tex_coord_0;
+		Vector2 tex_coord_edge_1;
+		Vector2 tex_coord_edge_2;
+	};
+
+	struct LightMesh {
+		int triangle_first_index; // Into light_indices and light_areas_cumulative
+		int triangle_count;
+
+		float area;
+	};
+
+	int    bvh_type;
+	int    bvh_node_count;
+	void * bvh_nodes; // Nodes of the given BVH type, the Nodes before the first MeshData are reserved and zeroed
+
+	int        index_count;
+	Triangle * triangles;
+	int      * triangle_material_ids;
+	float    * triangle_lods;
+
+	int   mesh_data_count;
+	int * mesh_data_bvh_offsets;      // Index of the root Node of every MeshData
+	int * mesh_data_triangle_offsets; // Offset of every MeshData into reverse_indices
+
+	int   triangle_count;  // Sum of the Triangle counts of all MeshDatas, less than index_count if Triangles were split
+	int * reverse_indices; // For every Triangle of every MeshData the index it was last referenced at in the linked Triangles
+
+	int     light_count;
+	int   * light_indices;          // Indices of Light Triangles, sorted on area within each LightMesh
+	float * light_areas_cumulative; // Cumulative area of the Light Triangles within each LightMesh
+
+	int         light_mesh_count;
+	LightMesh * light_meshes;
+	int       * light_mesh_data_indices; // Index into light_meshes for every MeshData, or -1 if the MeshData contains no Lights
+
+	MappedFile file;
+
+	// Links all MeshDatas in MeshData::mesh_datas, which must have been loaded with the given BVH type, or loads the result from the cache.
+	// The Textures must have finished loading, as their sizes determine the Triangle LODs
+	void init(const char * scene_name, int bvh_type, int reserved_node_count);
+	void free();
+
+private:
+	void link(int reserved_node_count);
+
+	void save_to_disk        (const char * filename, unsigned long long content_hash) const;
+	bool try_to_load_from_disk(const char * filename, unsigned long long content_hash);
+};
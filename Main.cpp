@@ -10,9 +10,12 @@
 #include "Window.h"
 
 #include "Random.h"
+#include "ThreadPool.h"
 
 #include "Util.h"
 #include "PerfTest.h"
+#include "BVHReport.h"
+#include "RayReplay.h"
 #include "ScopeTimer.h"
 
 // Forces NVIDIA driver to be used 
@@ -60,6 +63,68 @@ static void window_resize(unsigned frame_buffer_handle, int width, int height) {
 };
 
 int main(int argument_count, char ** arguments) {
+	// Applies to every mode below and may appear anywhere, it is removed from the arguments so that the positional arguments of the modes are unaffected
+	for (int i = 1; i < argument_count - 1; i++) {
+		if (strcmp(arguments[i], "--cache-dir") == 0) {
+			MeshData::cache_directory = arguments[i + 1];
+
+			for (int j = i; j < argument_count - 2; j++) {
+				arguments[j] = arguments[j + 2];
+			}
+			argument_count -= 2;
+			i--;
+		}
+	}
+
+	if (argument_count > 1 && strcmp(arguments[1], "--benchmark-bvh") == 0) {
+		ThreadPool::init();
+		PerfTest::benchmark_bvh_construction();
+		ThreadPool::free();
+
+		return EXIT_SUCCESS;
+	}
+
+	if (argument_count > 2 && strcmp(arguments[1], "--bvh-report") == 0) {
+		const char * output_filename = argument_count > 3 ? arguments[3] : "bvh_report.json";
+		const char * rays_filename   = argument_count > 4 ? arguments[4] : nullptr;
+
+		ThreadPool::init();
+		bool success = BVHReport::generate(arguments[2], output_filename, rays_filename);
+		ThreadPool::free();
+
+		return success ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (argument_count > 3 && strcmp(arguments[1], "--replay-rays") == 0) {
+		ThreadPool::init();
+		bool success = RayReplay::replay(arguments[2], arguments[3]);
+		ThreadPool::free();
+
+		return success ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (argument_count > 2 && strcmp(arguments[1], "--benchmark-bvh-types") == 0) {
+		ThreadPool::init();
+		PerfTest::benchmark_bvh_types(arguments[2]);
+		ThreadPool::free();
+
+		return EXIT_SUCCESS;
+	}
+
+	int bvh_type = BVH_TYPE;
+
+	for (int i = 1; i < argument_count - 1; i++) {
+		if (strcmp(arguments[i], "--bvh-type") == 0) {
+			int type = get_bvh_type_from_name(arguments[i + 1]);
+
+			if (type == -1) {
+				printf("WARNING: Unknown BVH type '%s', expected one of bvh, sbvh, qbvh or cwbvh! Using %s instead\n", arguments[i + 1], get_bvh_type_name(bvh_type));
+			} else {
+				bvh_type = type;
+			}
+		}
+	}
+
 	Window window("Pathtracer");
 
 	// Initialize timing stuff
@@ -79,7 +144,9 @@ int main(int argument_count, char ** arguments) {
 	};
 	const char * sky_filename = DATA_PATH("Sky_Probes/sky_15.hdr");
 
-	pathtracer.init(Util::array_element_count(mesh_names), mesh_names, sky_filename, window.frame_buffer_handle);
+	ThreadPool::init();
+
+	pathtracer.init(Util::array_element_count(mesh_names), mesh_names, sky_filename, window.frame_buffer_handle, bvh_type);
 
 	perf_test.init(&pathtracer, false, mesh_names[0]);
 
@@ -93,6 +160,13 @@ int main(int argument_count, char ** arguments) {
 	while (!window.is_closed) {
 		perf_test.frame_begin();
 
+		if (Input::is_key_pressed(SDL_SCANCODE_R)) {
+			char rays_name[32];
+			sprintf_s(rays_name, "rays_%i.bin", current_frame);
+
+			pathtracer.capture_rays(rays_name);
+		}
+
 		pathtracer.update(delta_time);
 		pathtracer.render();
 		
@@ -235,5 +309,7 @@ int main(int argument_count, char ** arguments) {
 
 	CUDAContext::destroy();
 
+	ThreadPool::free();
+
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,59 @@
+#include "MappedFile.h"
+
+#include <stdio.h>
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+
+bool MappedFile::init(const char * filename) {
+	handle_file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+	if (handle_file == INVALID_HANDLE_VALUE) {
+		handle_file = nullptr;
+
+		printf("WARNING: Unable to open file '%s' for mapping!\n", filename);
+		return false;
+	}
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(handle_file, &file_size) || file_size.QuadPart == 0) {
+		printf("WARNING: Unable to map empty file '%s'!\n", filename);
+
+		free();
+		return false;
+	}
+
+	// PAGE_WRITECOPY allows the view to be mapped with FILE_MAP_COPY while the file itself is only opened for reading
+	handle_mapping = CreateFileMappingA(handle_file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+	if (handle_mapping == nullptr) {
+		printf("WARNING: Unable to create file mapping for '%s'!\n", filename);
+
+		free();
+		return false;
+	}
+
+	data = reinterpret_cast<const char *>(MapViewOfFile(handle_mapping, FILE_MAP_COPY, 0, 0, 0));
+	size = file_size.QuadPart;
+
+	if (data == nullptr) {
+		printf("WARNING: Unable to map view of file '%s'!\n", filename);
+
+		free();
+		return false;
+	}
+
+	return true;
+}
+
+void MappedFile::free() {
+	if (data) UnmapViewOfFile(data);
+
+	if (handle_mapping) CloseHandle(handle_mapping);
+	if (handle_file)    CloseHandle(handle_file);
+
+	data = nullptr;
+	size = 0;
+
+	handle_file    = nullptr;
+	handle_mapping = nullptr;
+}
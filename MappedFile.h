@@ -0,0 +1,23 @@
+#pragma once
+#include <cstddef>
+
+// Read-only file mapped into memory. The view is copy-on-write, so the mapped data may be modified in place
+// (for example when refitting a BVH) without the changes ever reaching the file on disk
+struct MappedFile {
+	const char * data = nullptr;
+	size_t       size = 0;
+
+	bool init(const char * filename); // Returns false if the file could not be mapped
+	void free();
+
+	inline bool is_mapped() const { return data != nullptr; }
+
+	// Checks whether the given pointer points into the mapped view, memory inside the view must not be deleted
+	inline bool contains(const void * ptr) const {
+		return ptr >= data && ptr < data + size;
+	}
+
+private:
+	void * handle_file    = nullptr;
+	void * handle_mapping = nullptr;
+};
@@ -1,5 +1,6 @@
 #pragma once
 #include <vector>
+#include <string>
 
 struct Material {
 	enum class Type : char {
@@ -23,3 +24,9 @@ struct Material {
 
 	inline static std::vector<Material> materials;
 };
+
+// Materials of a single file before they are appended to Material::materials, their Texture ids index texture_paths
+struct MaterialList {
+	std::vector<Material>    materials;
+	std::vector<std::string> texture_paths;
+};
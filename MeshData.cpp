@@ -3,38 +3,128 @@
 #include <GL/glew.h>
 
 #include <unordered_map>
+#include <filesystem>
+#include <thread>
+
+#include <process.h>
 
 #include "OBJLoader.h"
+#include "Material.h"
+#include "Texture.h"
 
 #include "BVHBuilder.h"
+#include "BinnedBVHBuilder.h"
+#include "LBVHBuilder.h"
+#include "PLOCBuilder.h"
 #include "SBVHBuilder.h"
 #include "QBVHBuilder.h"
 #include "CWBVHBuilder.h"
+#include "TrianglePresplitter.h"
 #include "BVHOptimizer.h"
+#include "BVHTreeletOptimizer.h"
+#include "BVHRefitter.h"
+#include "BVHLayout.h"
+
+#include "ThreadPool.h"
+
+#include "Compression.h"
 
 #include "Util.h"
 #include "ScopeTimer.h"
 
-static constexpr int UNDERLYING_BVH_TYPE    = BVH_TYPE == BVH_SBVH ? BVH_SBVH : BVH_BVH; // All BVH use standard BVH as underlying type, only SBVH uses SBVH
-static constexpr int MAX_PRIMITIVES_IN_LEAF = BVH_TYPE == BVH_CWBVH || BVH_ENABLE_OPTIMIZATION ? 1 : INT_MAX; // CWBVH and BVH optimization require 1 primitive per leaf Node, the others have no upper limits
+// All BVH use standard BVH as underlying type, only SBVH uses SBVH
+static int get_underlying_bvh_type(int bvh_type) {
+	return bvh_type == BVH_SBVH ? BVH_SBVH : BVH_BVH;
+}
 
-static constexpr const char * BVH_FILE_EXTENSION = ".bvh";
-static constexpr int          BVH_FILETYPE_VERSION = 2;
+// CWBVH and BVH optimization require 1 primitive per leaf Node, the others have no upper limits
+static int get_max_primitives_in_leaf(int bvh_type) {
+	return bvh_type == BVH_CWBVH || BVH_ENABLE_OPTIMIZATION ? 1 : INT_MAX;
+}
 
-struct BVHFileHeader {
-	char filetype_identifier[4];
-	char filetype_version;
+// The SBVH performs its own spatial splits
+static bool use_presplitting(int bvh_type) {
+	return BVH_ENABLE_PRESPLITTING && bvh_type != BVH_SBVH;
+}
 
-	// Store settings with which the BVH was created
+static constexpr int BVH_FILETYPE_VERSION = 15;
+
+// The file starts with a header and a table of contents, followed by the sections it describes.
+// Every section is aligned so that the file can be memory mapped and its arrays used in place
+static constexpr int BVH_FILE_SECTION_ALIGNMENT = 64;
+
+enum struct BVHFileSectionType : int {
+	TRIANGLES,
+	BVH_NODES,
+	BVH_INDICES,
+	QBVH_NODES,
+	QBVH_INDICES,
+	CWBVH_NODES,
+	CWBVH_INDICES,
+	MATERIALS,    // The texture id of a Material indexes the Texture paths
+	TEXTURE_PATHS // Null terminated paths, stored back to back
+};
+
+// Section types of the nodes and indices of each type of BVH
+template<typename NodeType> struct BVHFileSectionTypes;
+template<> struct BVHFileSectionTypes<BVHNode>   { static constexpr BVHFileSectionType nodes = BVHFileSectionType::BVH_NODES;   static constexpr BVHFileSectionType indices = BVHFileSectionType::BVH_INDICES;   };
+template<> struct BVHFileSectionTypes<QBVHNode>  { static constexpr BVHFileSectionType nodes = BVHFileSectionType::QBVH_NODES;  static constexpr BVHFileSectionType indices = BVHFileSectionType::QBVH_INDICES;  };
+template<> struct BVHFileSectionTypes<CWBVHNode> { static constexpr BVHFileSectionType nodes = BVHFileSectionType::CWBVH_NODES; static constexpr BVHFileSectionType indices = BVHFileSectionType::CWBVH_INDICES; };
+
+struct BVHFileSection {
+	BVHFileSectionType type;
+	int                element_size;  // Used to detect changes to the layout of the stored structs
+	int                element_count;
+	bool               compressed;    // If true the elements are stored in the format of Compression, otherwise as is
+	long long          offset;        // In bytes from the start of the file, a multiple of BVH_FILE_SECTION_ALIGNMENT
+	long long          size;          // In bytes
+};
+
+// Settings with which the BVH was created. The struct is zeroed before it is filled in, so that it can be compared and hashed as raw memory
+struct BVHFileSettings {
+	char bvh_type;
 	char underlying_bvh_type;
+	char bvh_builder;
 	bool bvh_is_optimized;
+	char bvh_optimizer;
 	int  max_primitives_in_leaf;
 	float sah_cost_node;
 	float sah_cost_leaf;
+	float presplit_budget;
+
+	// Parameters of the builder of the binary BVH, zero if the builder does not use them
+	int   binned_bin_count;
+	char  morton_code_bits;
+	char  lbvh_sah_cluster_bits;
+	int   ploc_search_radius;
+	float sbvh_alpha;
+	float sbvh_split_budget;
+
+	// Settings with which the final BVH was collapsed and laid out, only used by the QBVH and CWBVH
+	bool qbvh_sah_collapse;
+	int  qbvh_max_primitives_in_leaf;
+	char bvh_layout;
+	int  bvh_layout_treelet_size;
+
+	// Compression snaps the vertices of the Triangles to a grid before the BVH is built
+	bool file_compression;
+	char file_position_bits;
+	char file_normal_bits;
+};
 
-	int num_triangles;
-	int num_nodes;
-	int num_indices;
+struct alignas(8) BVHFileHeader { // Aligned so that the table of contents can directly follow it
+	char filetype_identifier[4];
+	char filetype_version;
+
+	bool bvh_optimization_finished; // If false the optimization ran out of time, the binary BVH is stored before collapsing so that it can be optimized further
+	BVHOptimizer::Progress bvh_optimization_progress;
+
+	BVHFileSettings settings;
+
+	unsigned long long content_hash;  // Hash of the .obj file, the .mtl file and the settings the file was created from
+	unsigned long long geometry_hash; // Hash of the stored Triangles and final BVH, zero if the BVH is not final
+
+	int section_count; // Number of BVHFileSections in the table of contents
 };
 
 struct Vertex {
@@ -44,22 +134,165 @@ struct Vertex {
 	int     triangle_id;
 };
 
-static std::unordered_map<std::string, int> cache;
+static std::unordered_map<std::string, int> cache[BVH_TYPE_COUNT]; // Per BVH type
+
+static BVHFileSettings get_settings(int bvh_type) {
+	BVHFileSettings settings;
+	memset(&settings, 0, sizeof(settings));
+
+	settings.bvh_type               = bvh_type;
+	settings.underlying_bvh_type    = get_underlying_bvh_type(bvh_type);
+	settings.bvh_builder            = BVH_BUILDER;
+	settings.bvh_is_optimized       = BVH_ENABLE_OPTIMIZATION;
+	settings.bvh_optimizer          = BVH_OPTIMIZER;
+	settings.max_primitives_in_leaf = get_max_primitives_in_leaf(bvh_type);
+	settings.sah_cost_node = SAH_COST_NODE;
+	settings.sah_cost_leaf = SAH_COST_LEAF;
+	settings.presplit_budget = use_presplitting(bvh_type) ? PRESPLIT_BUDGET : 0.0f;
+
+	if (bvh_type == BVH_SBVH) {
+		settings.sbvh_alpha        = SBVH_ALPHA;
+		settings.sbvh_split_budget = SBVH_SPLIT_BUDGET;
+	} else {
+		bool uses_morton_codes = BVH_BUILDER == BVH_BUILDER_LBVH || BVH_BUILDER == BVH_BUILDER_PLOC;
+		bool uses_bins         = BVH_BUILDER == BVH_BUILDER_BINNED || (BVH_BUILDER == BVH_BUILDER_LBVH && LBVH_SAH_CLUSTER_BITS > 0); // The LBVH bins its clusters
+
+		settings.binned_bin_count      = uses_bins         ? BVH_BINNED_BIN_COUNT : 0;
+		settings.morton_code_bits      = uses_morton_codes ? BVH_MORTON_CODE_BITS : 0;
+		settings.lbvh_sah_cluster_bits = BVH_BUILDER == BVH_BUILDER_LBVH ? LBVH_SAH_CLUSTER_BITS : 0;
+		settings.ploc_search_radius    = BVH_BUILDER == BVH_BUILDER_PLOC ? PLOC_SEARCH_RADIUS    : 0;
+	}
+
+	if (bvh_type == BVH_QBVH || bvh_type == BVH_CWBVH) {
+		settings.bvh_layout              = BVH_LAYOUT;
+		settings.bvh_layout_treelet_size = BVH_LAYOUT == BVH_LAYOUT_TREELET ? BVH_LAYOUT_TREELET_SIZE : 0;
+	}
+
+	if (bvh_type == BVH_QBVH) {
+		settings.qbvh_sah_collapse           = QBVH_ENABLE_SAH_COLLAPSE;
+		settings.qbvh_max_primitives_in_leaf = QBVH_ENABLE_SAH_COLLAPSE ? QBVH_MAX_PRIMITIVES_IN_LEAF : 0;
+	}
+
+	settings.file_compression   = BVH_FILE_COMPRESSION;
+	settings.file_position_bits = BVH_FILE_COMPRESSION ? BVH_FILE_POSITION_BITS : 0;
+	settings.file_normal_bits   = BVH_FILE_COMPRESSION ? BVH_FILE_NORMAL_BITS   : 0;
+
+	return settings;
+}
+
+// The Materials of an .obj file are expected in an .mtl file with the same name
+static std::string get_mtl_filename(const char * filename) {
+	std::string mtl_filename(filename);
+	mtl_filename.replace(mtl_filename.size() - 4, 4, ".mtl");
+
+	return mtl_filename;
+}
+
+// Any change to the .obj file, the .mtl file or the settings results in a different hash
+static unsigned long long get_content_hash(const char * filename, int bvh_type) {
+	BVHFileSettings settings = get_settings(bvh_type);
+
+	unsigned long long hash = Util::file_hash(filename);
+	hash = Util::file_hash(get_mtl_filename(filename).c_str(), hash);
+	hash = Util::hash(&settings, sizeof(settings), hash);
+
+	return hash;
+}
+
+// Without a cache directory the file is stored next to the .obj file with the name of the BVH type as extension, for example "sponza.obj.cwbvh".
+// Inside the cache directory the content hash is part of the name, for example "sponza.obj.0123456789abcdef.cwbvh",
+// so that different versions of the same file and files built with different settings can be cached side by side
+static std::string get_bvh_filename(const char * filename, int bvh_type, unsigned long long content_hash) {
+	if (MeshData::cache_directory.empty()) {
+		return std::string(filename) + "." + get_bvh_type_name(bvh_type);
+	}
+
+	char hash_string[17];
+	sprintf_s(hash_string, "%016llx", content_hash);
+
+	std::filesystem::path path = std::filesystem::path(MeshData::cache_directory) / std::filesystem::path(filename).filename();
+
+	return path.string() + "." + hash_string + "." + get_bvh_type_name(bvh_type);
+}
+
+static long long align_section_offset(long long offset) {
+	return (offset + BVH_FILE_SECTION_ALIGNMENT - 1) / BVH_FILE_SECTION_ALIGNMENT * BVH_FILE_SECTION_ALIGNMENT;
+}
+
+// Looks up the section of the given type in the table of contents, returns nullptr if it is missing or does not lie within the file
+static const BVHFileSection * find_section(const MappedFile & file, const BVHFileSection sections[], int section_count, BVHFileSectionType type, int element_size) {
+	for (int i = 0; i < section_count; i++) {
+		const BVHFileSection & section = sections[i];
+
+		if (section.type != type) continue;
+
+		if (section.element_size != element_size || section.element_count < 0 || section.size < 0 ||
+			(!section.compressed && section.size != (long long)section.element_size * (long long)section.element_count) ||
+			section.offset % BVH_FILE_SECTION_ALIGNMENT != 0 ||
+			section.offset + section.size > (long long)file.size
+		) return nullptr;
+
+		return &section;
+	}
+
+	return nullptr;
+}
+
+// If copy is true the section is copied into a new array, otherwise the returned pointer points directly into the mapped file.
+// A compressed section is always decompressed into a new array, returns nullptr if it is corrupt
+template<typename T>
+static T * get_section_data(const MappedFile & file, const BVHFileSection & section, bool copy) {
+	if (section.compressed) {
+		T * data = new T[section.element_count];
+
+		if (!Compression::decompress(reinterpret_cast<const unsigned char *>(file.data + section.offset), section.size, data, sizeof(T), section.element_count)) {
+			delete [] data;
+
+			return nullptr;
+		}
+
+		return data;
+	}
+
+	T * data = reinterpret_cast<T *>(const_cast<char *>(file.data + section.offset));
 
-static void save_to_disk(const BVH & bvh, const MeshData * mesh_data, const char * filename) {
-	int    bvh_filename_length = strlen(filename) + strlen(BVH_FILE_EXTENSION) + 1;
-	char * bvh_filename        = MALLOCA(char, bvh_filename_length);
+	if (copy) {
+		T * data_copy = new T[section.element_count];
+		memcpy(data_copy, data, section.element_count * sizeof(T));
 
-	strcpy_s(bvh_filename, bvh_filename_length, filename);
-	strcat_s(bvh_filename, bvh_filename_length, BVH_FILE_EXTENSION);
+		return data_copy;
+	}
+
+	return data;
+}
+
+template<typename NodeType>
+static unsigned long long get_geometry_hash(const BVHBase<NodeType> & bvh, const MeshData * mesh_data) {
+	unsigned long long hash = Util::hash(mesh_data->triangles, mesh_data->triangle_count * sizeof(Triangle));
+	hash = Util::hash(bvh.nodes,   bvh.node_count  * sizeof(NodeType), hash);
+	hash = Util::hash(bvh.indices, bvh.index_count * sizeof(int),      hash);
+
+	// Zero marks a BVH that is not final
+	return hash != 0 ? hash : 1;
+}
+
+// Saves the Triangles and Materials together with either the final BVH of the MeshData's type, or with the unfinished binary BVH.
+// The file is written under a temporary name first and then renamed, so that processes sharing the cache never see a partially written file
+template<typename NodeType>
+static void save_to_disk(const BVHBase<NodeType> & bvh, const MeshData * mesh_data, const MaterialList & material_list, const char * filename, unsigned long long content_hash, bool optimization_finished, const BVHOptimizer::Progress & optimization_progress) {
+	std::string bvh_filename = get_bvh_filename(filename, mesh_data->bvh_type, content_hash);
+
+	// MeshDatas are loaded concurrently, so the temporary name contains the thread as well as the process
+	std::string temp_filename = bvh_filename + "." + std::to_string(_getpid()) + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+
+	std::error_code error;
+	if (!MeshData::cache_directory.empty()) std::filesystem::create_directories(MeshData::cache_directory, error);
 
 	FILE * file;
-	fopen_s(&file, bvh_filename, "wb");
+	fopen_s(&file, temp_filename.c_str(), "wb");
 
 	if (file == nullptr) {
-		printf("WARNING: Unable to save BVH to file %s!\n", bvh_filename);
-
-		FREEA(bvh_filename);
+		printf("WARNING: Unable to save BVH to file %s!\n", bvh_filename.c_str());
 
 		return;
 	}
@@ -71,176 +304,527 @@ static void save_to_disk(const BVH & bvh, const MeshData * mesh_data, const char
 	header.filetype_identifier[3] = '\0';
 	header.filetype_version = BVH_FILETYPE_VERSION;
 
-	header.underlying_bvh_type    = UNDERLYING_BVH_TYPE;
-	header.bvh_is_optimized       = BVH_ENABLE_OPTIMIZATION;
-	header.max_primitives_in_leaf = MAX_PRIMITIVES_IN_LEAF;
-	header.sah_cost_node = SAH_COST_NODE;
-	header.sah_cost_leaf = SAH_COST_LEAF;
+	header.bvh_optimization_finished = optimization_finished;
+	header.bvh_optimization_progress = optimization_progress;
+
+	header.settings      = get_settings(mesh_data->bvh_type);
+	header.content_hash  = content_hash;
+	header.geometry_hash = optimization_finished ? mesh_data->geometry_hash : 0;
+
+	// The Texture ids of the Materials index the Texture paths, which are stored one after the other with null terminators
+	std::string texture_paths;
+	for (const std::string & texture_path : material_list.texture_paths) {
+		texture_paths += texture_path;
+		texture_paths += '\0';
+	}
+
+	int material_count = material_list.materials.size();
+
+	BVHFileSection sections[] = {
+		{ BVHFileSectionType::TRIANGLES,          sizeof(Triangle), mesh_data->triangle_count },
+		{ BVHFileSectionTypes<NodeType>::nodes,   sizeof(NodeType), bvh.node_count },
+		{ BVHFileSectionTypes<NodeType>::indices, sizeof(int),      bvh.index_count },
+		{ BVHFileSectionType::MATERIALS,          sizeof(Material), material_count },
+		{ BVHFileSectionType::TEXTURE_PATHS,      sizeof(char),     int(texture_paths.size()) }
+	};
+	const void * section_data[] = { mesh_data->triangles, bvh.nodes, bvh.indices, material_list.materials.data(), texture_paths.data() };
+
+	header.section_count = Util::array_element_count(sections);
+
+	for (int i = 0; i < header.section_count; i++) {
+		sections[i].size = (long long)sections[i].element_size * (long long)sections[i].element_count;
+	}
+
+	// Only the geometry and the BVH are compressed, the Materials and Texture paths are small
+	const Compression::Encoding section_encodings[] = { Compression::Encoding::TRIANGLES, Compression::Encoding::WORDS, Compression::Encoding::INDICES };
+	std::vector<unsigned char>  compressed_sections[Util::array_element_count(section_encodings)];
+
+	if (BVH_FILE_COMPRESSION) {
+		for (int i = 0; i < Util::array_element_count(section_encodings); i++) {
+			Compression::compress(section_data[i], sections[i].element_size, sections[i].element_count, section_encodings[i], compressed_sections[i]);
+
+			sections[i].compressed = true;
+			sections[i].size       = compressed_sections[i].size();
+			section_data[i]        = compressed_sections[i].data();
+		}
+	}
+
+	long long offset = sizeof(BVHFileHeader) + sizeof(sections);
+
+	for (int i = 0; i < header.section_count; i++) {
+		sections[i].offset = align_section_offset(offset);
+
+		offset = sections[i].offset + sections[i].size;
+	}
+
+	fwrite(reinterpret_cast<const char *>(&header),  sizeof(header),   1, file);
+	fwrite(reinterpret_cast<const char *>(sections), sizeof(sections), 1, file);
+
+	offset = sizeof(BVHFileHeader) + sizeof(sections);
 
-	header.num_triangles = mesh_data->triangle_count;
-	header.num_nodes     = bvh.node_count;
-	header.num_indices   = bvh.index_count;
+	for (int i = 0; i < header.section_count; i++) {
+		// Pad with zeroes up to the start of the section
+		static constexpr char padding[BVH_FILE_SECTION_ALIGNMENT] = { };
+		fwrite(padding, 1, sections[i].offset - offset, file);
 
-	fwrite(reinterpret_cast<const char *>(&header), sizeof(header), 1, file);
+		fwrite(reinterpret_cast<const char *>(section_data[i]), 1, sections[i].size, file);
 
-	fwrite(reinterpret_cast<const char *>(mesh_data->triangles), sizeof(Triangle), mesh_data->triangle_count, file);
-	fwrite(reinterpret_cast<const char *>(bvh.nodes),            sizeof(BVHNode),  bvh.node_count,            file);
-	fwrite(reinterpret_cast<const char *>(bvh.indices),          sizeof(int),      bvh.index_count,           file);
+		offset = sections[i].offset + sections[i].size;
+	}
+
+	bool write_failed = ferror(file) != 0;
 
 	fclose(file);
 
-	FREEA(bvh_filename);
+	if (!write_failed) {
+		// If another process is using the existing file it cannot be replaced, the file it uses was created from the same content
+		std::filesystem::rename(temp_filename, bvh_filename, error);
+	}
+
+	if (write_failed || error) {
+		printf("WARNING: Unable to save BVH to file %s!\n", bvh_filename.c_str());
+
+		std::filesystem::remove(temp_filename, error);
+	}
 }
 
-static bool try_to_load_from_disk(BVH & bvh, MeshData * mesh_data, const char * filename) {
-	int    bvh_filename_size = strlen(filename) + strlen(BVH_FILE_EXTENSION) + 1;
-	char * bvh_filename      = MALLOCA(char, bvh_filename_size);
+// Looks up the nodes and indices of the given type of BVH, returns false if either is missing or corrupt
+template<typename NodeType>
+static bool get_bvh_sections(const MappedFile & file, const BVHFileSection sections[], int section_count, bool copy, BVHBase<NodeType> & bvh) {
+	const BVHFileSection * section_nodes   = find_section(file, sections, section_count, BVHFileSectionTypes<NodeType>::nodes,   sizeof(NodeType));
+	const BVHFileSection * section_indices = find_section(file, sections, section_count, BVHFileSectionTypes<NodeType>::indices, sizeof(int));
+
+	if (!section_nodes || !section_indices) return false;
+
+	bvh.node_count  = section_nodes  ->element_count;
+	bvh.index_count = section_indices->element_count;
 
-	strcpy_s(bvh_filename, bvh_filename_size, filename);
-	strcat_s(bvh_filename, bvh_filename_size, BVH_FILE_EXTENSION);
+	bvh.nodes   = get_section_data<NodeType>(file, *section_nodes,   copy);
+	bvh.indices = get_section_data<int>     (file, *section_indices, copy);
 
-	// If the BVH file doesn't exist or is outdated return false
-	if (!Util::file_exists(bvh_filename) || !Util::file_is_newer(filename, bvh_filename)) {
-		FREEA(bvh_filename);
+	if (bvh.nodes == nullptr || bvh.indices == nullptr) {
+		if (!file.contains(bvh.nodes))   delete [] bvh.nodes;
+		if (!file.contains(bvh.indices)) delete [] bvh.indices;
 
 		return false;
 	}
 
-	FILE * file;
-	fopen_s(&file, bvh_filename, "rb");
-	
-	BVHFileHeader header = { };
+	return true;
+}
 
-	bool success = false;
+// Copies the stored Materials and Texture paths into the Material list
+static void load_materials(MaterialList & material_list, const Material materials[], int material_count, const char * texture_paths, int texture_paths_size) {
+	for (int i = 0; i < texture_paths_size; i += strlen(texture_paths + i) + 1) {
+		material_list.texture_paths.emplace_back(texture_paths + i);
+	}
+
+	material_list.materials.assign(materials, materials + material_count);
 
-	if (!file) {
-		printf("WARNING: Unable to open BVH file '%s'!\n", bvh_filename);
-		goto exit;
+	for (Material & material : material_list.materials) {
+		if (material.texture_id < 0 || material.texture_id >= int(material_list.texture_paths.size())) material.texture_id = INVALID;
 	}
+}
 
-	fread(reinterpret_cast<char *>(&header), sizeof(header), 1, file);
+// Maps the BVH file into memory. If the file contains the final BVH it is stored directly in the MeshData, and together with
+// the Triangles it is used in place from the mapped file. An unfinished binary BVH is copied into the given BVH, as it is still
+// optimized and the file is written again afterwards, which requires it to be unmapped. The Materials are always loaded from the file
+static bool try_to_load_from_disk(BVH & bvh, MeshData * mesh_data, MaterialList & material_list, const char * filename, unsigned long long content_hash, bool & optimization_finished, BVHOptimizer::Progress & optimization_progress) {
+	std::string bvh_filename_string = get_bvh_filename(filename, mesh_data->bvh_type, content_hash);
+	const char * bvh_filename = bvh_filename_string.c_str();
 
-	if (strcmp(header.filetype_identifier, "BVH") != 0) {
+	if (!Util::file_exists(bvh_filename)) return false;
+
+	MappedFile & file = mesh_data->bvh_file;
+
+	if (!file.init(bvh_filename)) return false;
+
+	const BVHFileHeader  * header   = reinterpret_cast<const BVHFileHeader  *>(file.data);
+	const BVHFileSection * sections = reinterpret_cast<const BVHFileSection *>(file.data + sizeof(BVHFileHeader));
+
+	BVHFileSettings settings = get_settings(mesh_data->bvh_type);
+
+	bool is_final;
+	bool has_bvh_sections = false;
+
+	const BVHFileSection * section_triangles;
+	const BVHFileSection * section_materials;
+	const BVHFileSection * section_texture_paths;
+
+	if (file.size < sizeof(BVHFileHeader) || strcmp(header->filetype_identifier, "BVH") != 0) {
 		printf("WARNING: BVH file '%s' has an invalid header!\n", bvh_filename);
-		goto exit;
+		goto fail;
 	}
 
-	if (header.filetype_version < BVH_FILETYPE_VERSION) goto exit;
+	if (header->filetype_version < BVH_FILETYPE_VERSION) goto fail;
 
 	// Check if the settings used to create the BVH file are the same as the current settings
-	if (header.underlying_bvh_type    != UNDERLYING_BVH_TYPE || 
-		header.bvh_is_optimized       != BVH_ENABLE_OPTIMIZATION || 
-		header.max_primitives_in_leaf != MAX_PRIMITIVES_IN_LEAF ||
-		header.sah_cost_node != SAH_COST_NODE || 
-		header.sah_cost_leaf != SAH_COST_LEAF
-	) {
+	if (memcmp(&header->settings, &settings, sizeof(BVHFileSettings)) != 0) {
 		printf("BVH file '%s' was created with different settings, rebuiling BVH from scratch.\n", bvh_filename);
-		goto exit;
+		goto fail;
 	}
 
-	mesh_data->triangle_count = header.num_triangles;
-	bvh.node_count            = header.num_nodes;
-	bvh.index_count           = header.num_indices;
+	if (header->content_hash != content_hash) {
+		printf("BVH file '%s' was created from a different version of '%s', rebuiling BVH from scratch.\n", bvh_filename, filename);
+		goto fail;
+	}
 
-	mesh_data->triangles = new Triangle[mesh_data->triangle_count];
-	bvh.nodes            = new BVHNode[bvh.node_count];
-	bvh.indices          = new int    [bvh.index_count];
+	if (header->section_count < 0 || sizeof(BVHFileHeader) + header->section_count * sizeof(BVHFileSection) > file.size) {
+		printf("WARNING: BVH file '%s' has an invalid table of contents!\n", bvh_filename);
+		goto fail;
+	}
 
-	fread(reinterpret_cast<char *>(mesh_data->triangles), sizeof(Triangle), mesh_data->triangle_count, file);
-	fread(reinterpret_cast<char *>(bvh.nodes),            sizeof(BVHNode),  bvh.node_count,            file);
-	fread(reinterpret_cast<char *>(bvh.indices),          sizeof(int),      bvh.index_count,           file);
+	is_final = header->bvh_optimization_finished;
 
-	printf("Loaded BVH %s from disk\n", bvh_filename);
+	section_triangles     = find_section(file, sections, header->section_count, BVHFileSectionType::TRIANGLES,     sizeof(Triangle));
+	section_materials     = find_section(file, sections, header->section_count, BVHFileSectionType::MATERIALS,     sizeof(Material));
+	section_texture_paths = find_section(file, sections, header->section_count, BVHFileSectionType::TEXTURE_PATHS, sizeof(char));
 
-	success = true;
+	// The Texture paths must end in a null terminator
+	if (section_texture_paths && section_texture_paths->element_count > 0 && file.data[section_texture_paths->offset + section_texture_paths->element_count - 1] != '\0') {
+		section_texture_paths = nullptr;
+	}
 
-exit:
-	fclose(file);
+	if (section_triangles && section_materials && section_texture_paths) {
+		mesh_data->triangles = get_section_data<Triangle>(file, *section_triangles, !is_final);
+
+		if (mesh_data->triangles) {
+			if (is_final) {
+				mesh_data->visit_bvh([&](auto & final_bvh) {
+					has_bvh_sections = get_bvh_sections(file, sections, header->section_count, false, final_bvh);
+				});
+			} else {
+				has_bvh_sections = get_bvh_sections(file, sections, header->section_count, true, bvh);
+			}
+
+			if (!has_bvh_sections) {
+				if (!file.contains(mesh_data->triangles)) delete [] mesh_data->triangles;
+				mesh_data->triangles = nullptr;
+			}
+		}
+	}
 
-	FREEA(bvh_filename);
+	if (!has_bvh_sections) {
+		printf("WARNING: BVH file '%s' is missing sections, is truncated or is corrupt!\n", bvh_filename);
+		goto fail;
+	}
 
-	return success;
-}
+	mesh_data->triangle_count = section_triangles->element_count;
 
-int MeshData::load(const char * filename) {
-	int & mesh_data_index = cache[filename];
+	load_materials(material_list,
+		reinterpret_cast<const Material *>(file.data + section_materials->offset), section_materials->element_count,
+		file.data + section_texture_paths->offset, section_texture_paths->element_count
+	);
 
-	// If the cache already contains this Model Data simply return it
-	if (mesh_data_index != 0) return mesh_data_index - 1;
+	if (is_final) mesh_data->geometry_hash = header->geometry_hash;
 
-	mesh_data_index = mesh_datas.size() + 1;
+	optimization_finished = header->bvh_optimization_finished;
+	optimization_progress = header->bvh_optimization_progress;
 
-	MeshData * mesh_data = new MeshData();
-	mesh_datas.push_back(mesh_data);
-	
-	BVH bvh;
-	bool bvh_loaded = try_to_load_from_disk(bvh, mesh_data, filename);
+	if (!is_final) file.free();
 
-	if (bvh_loaded) {
-		// If the BVH loaded successfully we only need to load the Materials
-		// of the Mesh, because the geometry is already included in the BVH
+	printf("Loaded BVH %s from disk\n", bvh_filename);
 
-		// Replace ".obj" in the filename with ".mtl"
-		int filename_length = strlen(filename);
-		char * mtl_filename = MALLOCA(char, filename_length + 1);
-		strcpy_s(mtl_filename, filename_length + 1, filename);
-		memcpy(mtl_filename + filename_length - 4, ".mtl", 4);
+	return true;
 
-		OBJLoader::load_mtl(mtl_filename, mesh_data);
+fail:
+	file.free();
 
-		FREEA(mtl_filename);
-	} else {
-		OBJLoader::load_obj(filename, mesh_data);
-		
-#if BVH_TYPE == BVH_SBVH // All other BVH types use standard BVH as a starting point
-		{
-			ScopeTimer timer("SBVH Construction");
-
-			SBVHBuilder sbvh_builder;
-			sbvh_builder.init(&bvh, mesh_data->triangle_count, MAX_PRIMITIVES_IN_LEAF);
-			sbvh_builder.build(mesh_data->triangles, mesh_data->triangle_count);
-			sbvh_builder.free();
-		}
+	return false;
+}
+
+void MeshData::build_bvh(BVH & bvh) const {
+	int max_primitives_in_leaf = get_max_primitives_in_leaf(bvh_type);
+
+	if (bvh_type == BVH_SBVH) { // All other BVH types use standard BVH as a starting point
+		ScopeTimer timer("SBVH Construction");
+
+		SBVHBuilder sbvh_builder;
+		sbvh_builder.init(&bvh, triangle_count, max_primitives_in_leaf);
+		sbvh_builder.build(triangles, triangle_count);
+		sbvh_builder.free();
+
+		return;
+	}
+
+#if BVH_ENABLE_PRESPLITTING
+	TrianglePresplitter presplitter;
+	presplitter.init(triangle_count, PRESPLIT_BUDGET);
+	{
+		ScopeTimer timer("Triangle Presplitting");
+
+		presplitter.presplit(triangles, triangle_count);
+	}
+
+	const BVHPartitions::PrimitiveRef * primitives      = presplitter.references;
+	int                                 primitive_count = presplitter.reference_count;
 #else
-		{
-			ScopeTimer timer("BVH Construction");
-			
-			BVHBuilder bvh_builder;
-			bvh_builder.init(&bvh, mesh_data->triangle_count, MAX_PRIMITIVES_IN_LEAF);
-			bvh_builder.build(mesh_data->triangles, mesh_data->triangle_count);
-			bvh_builder.free();
-		}
+	const Triangle * primitives      = triangles;
+	int              primitive_count = triangle_count;
 #endif
+	
+#if BVH_BUILDER == BVH_BUILDER_BINNED
+	{
+		ScopeTimer timer("Binned BVH Construction");
+
+		BinnedBVHBuilder bvh_builder;
+		bvh_builder.init(&bvh, primitive_count, max_primitives_in_leaf);
+		bvh_builder.build(primitives, primitive_count);
+		bvh_builder.free();
+	}
+#elif BVH_BUILDER == BVH_BUILDER_LBVH
+	{
+		ScopeTimer timer("LBVH Construction");
+
+		LBVHBuilder bvh_builder;
+		bvh_builder.init(&bvh, primitive_count);
+		bvh_builder.build(primitives, primitive_count);
+		bvh_builder.free();
+	}
+#elif BVH_BUILDER == BVH_BUILDER_PLOC
+	{
+		ScopeTimer timer("PLOC BVH Construction");
+
+		PLOCBuilder bvh_builder;
+		bvh_builder.init(&bvh, primitive_count);
+		bvh_builder.build(primitives, primitive_count);
+		bvh_builder.free();
+	}
+#else
+	{
+		ScopeTimer timer("BVH Construction");
 		
+		BVHBuilder bvh_builder;
+		bvh_builder.init(&bvh, primitive_count, max_primitives_in_leaf);
+		bvh_builder.build(primitives, primitive_count);
+		bvh_builder.free();
+	}
+#endif
+
+#if BVH_ENABLE_PRESPLITTING
+	// The BVH indexes the references, make it index the Triangles again
+	presplitter.remap_indices(bvh);
+	presplitter.free();
+#endif
+}
+
+bool MeshData::optimize_bvh(BVH & bvh, bool resume, BVHOptimizer::Progress & progress) {
+	bool finished = true;
+
 #if BVH_ENABLE_OPTIMIZATION
-		BVHOptimizer::optimize(bvh);
+#if BVH_OPTIMIZER == BVH_OPTIMIZER_TREELET || BVH_OPTIMIZER == BVH_OPTIMIZER_TREELET_INSERTION
+	if (!resume) BVHTreeletOptimizer::optimize(bvh);
 #endif
+#if BVH_OPTIMIZER == BVH_OPTIMIZER_INSERTION || BVH_OPTIMIZER == BVH_OPTIMIZER_TREELET_INSERTION
+	BVHOptimizer::Budget budget;
+	if (BVH_OPTIMIZATION_TIME_LIMIT > 0.0f) budget.time_limit = BVH_OPTIMIZATION_TIME_LIMIT;
+	budget.target_sah_cost = BVH_OPTIMIZATION_TARGET_SAH_COST;
 
-		save_to_disk(bvh, mesh_data, filename);
-	}
-	
-#if BVH_TYPE == BVH_BVH || BVH_TYPE == BVH_SBVH
-	mesh_data->bvh = bvh;
-#elif BVH_TYPE == BVH_QBVH
-	// Collapse binary BVH into quaternary BVH
-	QBVHBuilder qbvh_builder;
-	qbvh_builder.init(&mesh_data->bvh, bvh);
-	qbvh_builder.build(bvh);
-	
-	delete [] bvh.indices;
-	delete [] bvh.nodes;
-#elif BVH_TYPE == BVH_CWBVH
-	// Collapse binary BVH into 8-way Compressed Wide BVH
-	CWBVHBuilder cwbvh_builder;
-	cwbvh_builder.init(&mesh_data->bvh, bvh);
-	cwbvh_builder.build(bvh);
-	cwbvh_builder.free();
-
-	delete [] bvh.indices;
-	delete [] bvh.nodes;
+	finished = BVHOptimizer::optimize(bvh, 0, budget, &progress);
+#endif
 #endif
+
+	return finished;
+}
+
+void MeshData::collapse_bvh(BVH & bvh) const {
+#if BVH_ENABLE_OPTIMIZATION
+	BVHOptimizer::collapse(bvh, bvh_type == BVH_CWBVH);
+#endif
+}
+
+// Converts the binary BVH into the type of BVH used for rendering and stores it in the MeshData
+static void init_bvh(MeshData * mesh_data, BVH & bvh) {
+	switch (mesh_data->bvh_type) {
+		case BVH_BVH:
+		case BVH_SBVH: {
+			mesh_data->bvh = bvh;
+
+			break;
+		}
+
+		case BVH_QBVH: {
+			// Collapse binary BVH into quaternary BVH
+			QBVHBuilder qbvh_builder;
+			qbvh_builder.init(&mesh_data->qbvh, bvh);
+#if QBVH_ENABLE_SAH_COLLAPSE
+			qbvh_builder.build_sah(bvh);
+
+			delete [] bvh.indices;
+			delete [] bvh.nodes;
+#else
+			qbvh_builder.build(bvh);
 	
-	return mesh_data_index - 1;
+			delete [] bvh.nodes; // The indices are shared with the QBVH
+#endif
+
+			BVHLayout::reorder(mesh_data->qbvh, BVH_LAYOUT);
+
+			break;
+		}
+
+		case BVH_CWBVH: {
+			// Collapse binary BVH into 8-way Compressed Wide BVH
+			CWBVHBuilder cwbvh_builder;
+			cwbvh_builder.init(&mesh_data->cwbvh, bvh);
+			cwbvh_builder.build(bvh);
+			cwbvh_builder.free();
+
+			delete [] bvh.indices;
+			delete [] bvh.nodes;
+
+			BVHLayout::reorder(mesh_data->cwbvh, BVH_LAYOUT);
+
+			break;
+		}
+
+		default: abort();
+	}
+}
+
+static float calc_sah_cost(const MeshData * mesh_data) {
+	float sah_cost = 0.0f;
+
+	mesh_data->visit_bvh([&](const auto & bvh) {
+		sah_cost = BVHRefitter::calc_sah_cost(bvh, mesh_data->triangles);
+	});
+
+	return sah_cost;
+}
+
+static void update_triangle_aabbs(MeshData * mesh_data) {
+	for (int i = 0; i < mesh_data->triangle_count; i++) {
+		Triangle & triangle = mesh_data->triangles[i];
+
+		Vector3 vertices[3] = { triangle.position_0, triangle.position_1, triangle.position_2 };
+		triangle.aabb = AABB::from_points(vertices, 3);
+	}
+}
+
+void MeshData::free_bvh() {
+	visit_bvh([&](auto & bvh) {
+		if (!bvh_file.contains(bvh.indices)) delete [] bvh.indices;
+		if (!bvh_file.contains(bvh.nodes))   delete [] bvh.nodes;
+	});
+}
+
+void MeshData::free() {
+	free_bvh();
+
+	if (!bvh_file.contains(triangles)) delete [] triangles;
+
+	bvh_file.free();
+}
+
+// Loads the geometry and builds the BVH of a single MeshData, only touches the given MeshData and Material list so it can run on any thread
+static void load_mesh_data(MeshData * mesh_data, MaterialList & material_list, const char * filename) {
+	int bvh_type = mesh_data->bvh_type;
+
+	BVH  bvh;
+	bool bvh_optimization_finished = false;
+	BVHOptimizer::Progress bvh_optimization_progress;
+
+	unsigned long long content_hash = get_content_hash(filename, bvh_type);
+
+	// The BVH file contains the geometry and Materials, the .obj and .mtl files are only parsed if it could not be loaded
+	bool bvh_loaded = try_to_load_from_disk(bvh, mesh_data, material_list, filename, content_hash, bvh_optimization_finished, bvh_optimization_progress);
+
+	if (!bvh_loaded) {
+		OBJLoader::load_obj(filename, mesh_data, material_list);
+
+		if (BVH_FILE_COMPRESSION) {
+			// Vertices on the grids of the compressed file are stored exactly, so the BVH is built over the snapped positions
+			Compression::quantize_vertices(mesh_data->triangles, mesh_data->triangle_count, BVH_FILE_POSITION_BITS, BVH_FILE_NORMAL_BITS);
+			update_triangle_aabbs(mesh_data);
+		}
+
+		mesh_data->build_bvh(bvh);
+	}
+
+	// If the file contained the final BVH it has already been stored in the MeshData, otherwise the binary BVH is finished and collapsed here
+	if (!bvh_loaded || !bvh_optimization_finished) {
+		bvh_optimization_finished = MeshData::optimize_bvh(bvh, bvh_loaded, bvh_optimization_progress);
+
+		if (!bvh_optimization_finished) {
+			// Store the BVH as a checkpoint before collapsing, so that the next run can continue the optimization
+			save_to_disk(bvh, mesh_data, material_list, filename, content_hash, false, bvh_optimization_progress);
+		}
+
+		mesh_data->collapse_bvh(bvh);
+
+		init_bvh(mesh_data, bvh);
+
+		if (bvh_optimization_finished) {
+			mesh_data->visit_bvh([&](const auto & final_bvh) {
+				mesh_data->geometry_hash = get_geometry_hash(final_bvh, mesh_data);
+
+				save_to_disk(final_bvh, mesh_data, material_list, filename, content_hash, true, bvh_optimization_progress);
+			});
+		}
+	}
+
+	mesh_data->bvh_sah_cost = calc_sah_cost(mesh_data);
+}
+
+// Appends the Materials to the global Material table and starts loading their Textures
+static void add_materials(MeshData * mesh_data, const MaterialList & material_list) {
+	mesh_data->material_offset = Material::materials.size();
+	mesh_data->material_count  = material_list.materials.size();
+
+	for (const Material & material : material_list.materials) {
+		Material & new_material = Material::materials.emplace_back(material);
+
+		if (new_material.texture_id != INVALID) {
+			new_material.texture_id = Texture::load(material_list.texture_paths[material.texture_id].c_str());
+		}
+	}
+}
+
+int MeshData::load(const char * filename, int bvh_type) {
+	int mesh_data_index;
+	load(1, &filename, &mesh_data_index, bvh_type);
+
+	return mesh_data_index;
+}
+
+void MeshData::load(int file_count, const char * filenames[], int mesh_data_indices[], int bvh_type) {
+	struct PendingLoad {
+		MeshData   * mesh_data;
+		const char * filename;
+		MaterialList material_list;
+	};
+	std::vector<PendingLoad> pending_loads;
+
+	for (int i = 0; i < file_count; i++) {
+		int & mesh_data_index = cache[bvh_type][filenames[i]];
+
+		// If the cache already contains this Model Data, or it is already being loaded as part of this call, simply return it
+		if (mesh_data_index == 0) {
+			mesh_data_index = mesh_datas.size() + 1;
+
+			MeshData * mesh_data = new MeshData();
+			mesh_data->bvh_type = bvh_type;
+			mesh_datas.push_back(mesh_data);
+
+			pending_loads.push_back({ mesh_data, filenames[i] });
+		}
+
+		mesh_data_indices[i] = mesh_data_index - 1;
+	}
+
+	ThreadPool::TaskGroup group;
+
+	for (PendingLoad & pending_load : pending_loads) {
+		ThreadPool::submit(group, [&pending_load]() {
+			load_mesh_data(pending_load.mesh_data, pending_load.material_list, pending_load.filename);
+		});
+	}
+
+	ThreadPool::wait(group);
+
+	// The Materials are added in the order of the files rather than the order in which their loads finished
+	for (const PendingLoad & pending_load : pending_loads) {
+		add_materials(pending_load.mesh_data, pending_load.material_list);
+	}
 }
 
 void MeshData::gl_init(int reverse_indices[]) const {
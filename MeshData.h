@@ -1,17 +1,33 @@
 #pragma once
 #include <vector>
+#include <string>
 
 #include "Triangle.h"
 
 #include "BVH.h"
+#include "BVHOptimizer.h"
+
+#include "MappedFile.h"
 
 struct MeshData {
 	int        triangle_count;
 	Triangle * triangles;
 
-	BVHType bvh;
+	int   bvh_type; // One of BVH_BVH, BVH_SBVH, BVH_QBVH or BVH_CWBVH, only the BVH of that type below is used
+	BVH   bvh;      // Used by both BVH_BVH and BVH_SBVH
+	QBVH  qbvh;
+	CWBVH cwbvh;
+	float bvh_sah_cost; // SAH cost of the final BVH
+
+	// Hash of the Triangles and the final BVH, identifies the exact geometry for caches built on top of the MeshData (see LinkedScene).
+	// Zero if the BVH is not final, because its optimization ran out of time
+	unsigned long long geometry_hash;
+
+	int material_offset; // Index of the first Material of this MeshData in Material::materials
+	int material_count;
 
-	int material_offset;
+	// If the MeshData was loaded from the BVH cache file, the Triangles and possibly the BVH point directly into the mapped file
+	MappedFile bvh_file;
 	
 	mutable unsigned gl_vao;
 	mutable unsigned gl_vbo;
@@ -19,7 +35,51 @@ struct MeshData {
 	void gl_init(int reverse_indices[]) const;
 	void gl_render() const;
 
-	static int load(const char * filename);
+	template<typename NodeType>       BVHBase<NodeType> & get_bvh();
+	template<typename NodeType> const BVHBase<NodeType> & get_bvh() const { return const_cast<MeshData *>(this)->get_bvh<NodeType>(); }
+
+	// Calls the given function with the BVH of the type this MeshData was loaded with
+	template<typename Function>
+	inline void visit_bvh(Function function) const {
+		dispatch_bvh_type(bvh_type, [&](auto * node_type) {
+			function(get_bvh<std::remove_pointer_t<decltype(node_type)>>());
+		});
+	}
+
+	template<typename Function>
+	inline void visit_bvh(Function function) {
+		dispatch_bvh_type(bvh_type, [&](auto * node_type) {
+			function(get_bvh<std::remove_pointer_t<decltype(node_type)>>());
+		});
+	}
+
+	// Builds a binary BVH over the Triangles, using the builder selected in Common.h and the settings that belong to the bvh_type
+	void build_bvh(BVH & bvh) const;
+	// Collapses the leaves of the optimized binary BVH, after which it can be converted into the bvh_type
+	void collapse_bvh(BVH & bvh) const;
+
+	// Optimizes the binary BVH using the optimizers selected in Common.h, the leaves still need to be collapsed afterwards.
+	// Returns false if the time budget ran out, when resuming a BVH that was not finished only the insertion optimizer continues
+	static bool optimize_bvh(BVH & bvh, bool resume, BVHOptimizer::Progress & progress);
+
+	void free_bvh();
+	void free(); // Frees the Triangles, the BVH and the mapped BVH cache file
+
+	// The same file can be loaded with different BVH types, every type results in a separate MeshData
+	static int load(const char * filename, int bvh_type = BVH_TYPE);
+
+	// Loads the files concurrently on the Thread Pool and stores the index of the MeshData of every file in mesh_data_indices.
+	// The MeshDatas and their Materials are added in the order of the files, regardless of the order in which their loads finish.
+	// Files that occur more than once are only loaded once. Must be called from one thread at a time
+	static void load(int file_count, const char * filenames[], int mesh_data_indices[], int bvh_type = BVH_TYPE);
+
+	// Directory in which the processed geometry, BVH and Materials are cached, keyed by a hash of the .obj and .mtl file contents
+	// and the BVH settings. If empty the cache file is stored next to the .obj file
+	inline static std::string cache_directory;
 
 	inline static std::vector<const MeshData *> mesh_datas;
 };
+
+template<> inline BVH   & MeshData::get_bvh<BVHNode>  () { return bvh;   }
+template<> inline QBVH  & MeshData::get_bvh<QBVHNode> () { return qbvh;  }
+template<> inline CWBVH & MeshData::get_bvh<CWBVHNode>() { return cwbvh; }
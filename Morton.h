@@ -0,0 +1,100 @@
+#pragma once
+#include <type_traits>
+
+#include "AABB.h"
+
+#include "Util.h"
+
+#include "CUDA_Source/Common.h"
+
+// Helper methods to order primitives along a Morton (Z-order) curve
+namespace Morton {
+	static_assert(BVH_MORTON_CODE_BITS == 30 || BVH_MORTON_CODE_BITS == 63, "Morton codes should either be 30 or 63 bits");
+
+	typedef std::conditional<BVH_MORTON_CODE_BITS == 30, unsigned, unsigned long long>::type Code;
+
+	constexpr int BITS_PER_DIMENSION = BVH_MORTON_CODE_BITS / 3;
+
+	// Spreads the lowest bits of the given value out such that there are two zero bits in between every bit
+	inline Code expand_bits(Code value) {
+		if constexpr (BVH_MORTON_CODE_BITS == 30) {
+			value = (value * 0x00010001u) & 0xff0000ffu;
+			value = (value * 0x00000101u) & 0x0f00f00fu;
+			value = (value * 0x00000011u) & 0xc30c30c3u;
+			value = (value * 0x00000005u) & 0x49249249u;
+		} else {
+			value &= 0x1fffff;
+			value = (value | value << 32) & 0x1f00000000ffffull;
+			value = (value | value << 16) & 0x1f0000ff0000ffull;
+			value = (value | value <<  8) & 0x100f00f00f00f00full;
+			value = (value | value <<  4) & 0x10c30c30c30c30c3ull;
+			value = (value | value <<  2) & 0x1249249249249249ull;
+		}
+
+		return value;
+	}
+
+	// Calculates the Morton code of a point that lies in the unit cube, with x stored in the highest bit of every triplet
+	inline Code calc_code(const Vector3 & point) {
+		constexpr float scale = float(1 << BITS_PER_DIMENSION);
+
+		Code x = Code(Math::clamp(point.x * scale, 0.0f, scale - 1.0f));
+		Code y = Code(Math::clamp(point.y * scale, 0.0f, scale - 1.0f));
+		Code z = Code(Math::clamp(point.z * scale, 0.0f, scale - 1.0f));
+
+		return (expand_bits(x) << 2) | (expand_bits(y) << 1) | expand_bits(z);
+	}
+
+	// Calculates the Morton codes of the centroids of the primitives, relative to the bounds of all centroids
+	template<typename Primitive>
+	inline void calc_codes(const Primitive * primitives, int primitive_count, Code * codes) {
+		AABB centroid_bounds = AABB::create_empty();
+
+		for (int i = 0; i < primitive_count; i++) {
+			centroid_bounds.expand(primitives[i].get_center());
+		}
+
+		Vector3 extent = centroid_bounds.max - centroid_bounds.min;
+		Vector3 inv_extent = Vector3(
+			extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+			extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+			extent.z > 0.0f ? 1.0f / extent.z : 0.0f
+		);
+
+		for (int i = 0; i < primitive_count; i++) {
+			codes[i] = calc_code((primitives[i].get_center() - centroid_bounds.min) * inv_extent);
+		}
+	}
+
+	// Sorts the Morton codes along with the indices using an LSD radix sort on 8 bit digits. The sort is stable.
+	// The temp buffers are used as scratch memory, the pointers may be swapped with their temp counterparts
+	inline void radix_sort(Code *& codes, Code *& codes_temp, int *& indices, int *& indices_temp, int count) {
+		for (int shift = 0; shift < BVH_MORTON_CODE_BITS; shift += 8) {
+			int histogram[256] = { };
+
+			for (int i = 0; i < count; i++) {
+				histogram[(codes[i] >> shift) & 0xff]++;
+			}
+
+			// If all Morton codes have the same digit this pass would not change anything
+			if (histogram[(codes[0] >> shift) & 0xff] == count) continue;
+
+			int offset = 0;
+			for (int digit = 0; digit < 256; digit++) {
+				int digit_count = histogram[digit];
+				histogram[digit] = offset;
+				offset += digit_count;
+			}
+
+			for (int i = 0; i < count; i++) {
+				int index = histogram[(codes[i] >> shift) & 0xff]++;
+
+				codes_temp  [index] = codes  [i];
+				indices_temp[index] = indices[i];
+			}
+
+			Util::swap(codes,   codes_temp);
+			Util::swap(indices, indices_temp);
+		}
+	}
+}
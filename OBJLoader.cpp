@@ -5,20 +5,15 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader/tiny_obj_loader.h>
 
-#include "Texture.h"
-#include "Material.h"
-
 #include "Util.h"
 #include "ScopeTimer.h"
 
 // Converts 'tinyobj::material_t' to 'Material'
-// Returns offset into Material table to convert relative Material indices to global ones
-static void load_materials(const std::vector<tinyobj::material_t> & materials, MeshData * mesh_data, const char * path) {
-	mesh_data->material_offset = Material::materials.size();
-
+// The Textures are not loaded yet, Texture ids index the Texture paths in the Material list
+static void load_materials(const std::vector<tinyobj::material_t> & materials, MaterialList & material_list, const char * path) {
 	if (materials.size() == 0) {
 		// Add default Material
-		Material & default_material = Material::materials.emplace_back();
+		Material & default_material = material_list.materials.emplace_back();
 		default_material.diffuse = Vector3(1.0f, 0.0f, 1.0f);
 
 		return;
@@ -27,7 +22,7 @@ static void load_materials(const std::vector<tinyobj::material_t> & materials, M
 	for (int i = 0; i < materials.size(); i++) {
 		const tinyobj::material_t & material = materials[i];
 
-		Material & new_material = Material::materials.emplace_back();
+		Material & new_material = material_list.materials.emplace_back();
 
 		switch (material.illum) {
 			case 0: case 3:                 new_material.type = Material::Type::GLOSSY;     break;
@@ -39,12 +34,14 @@ static void load_materials(const std::vector<tinyobj::material_t> & materials, M
 
 		new_material.diffuse = Vector3(material.diffuse[0], material.diffuse[1], material.diffuse[2]);
 		if (material.diffuse_texname.length() > 0) {
+			new_material.texture_id = material_list.texture_paths.size();
+
 			if (Util::file_exists(material.diffuse_texname.c_str())) {
 				// Load as absolute path
-				new_material.texture_id = Texture::load(material.diffuse_texname.c_str());
+				material_list.texture_paths.push_back(material.diffuse_texname);
 			} else {
 				// Load as relative path
-				new_material.texture_id = Texture::load((std::string(path) + material.diffuse_texname).c_str());
+				material_list.texture_paths.push_back(std::string(path) + material.diffuse_texname);
 			}
 		}
 
@@ -60,34 +57,7 @@ static void load_materials(const std::vector<tinyobj::material_t> & materials, M
 	}
 }
 
-void OBJLoader::load_mtl(const char * filename, MeshData * mesh_data) {
-	// Load only the mtl file
-	std::map<std::string, int> material_map;
-	std::vector<tinyobj::material_t> materials;
-
-	std::string warning;
-	std::string error;
-
-	std::string str(filename);
-
-	std::filebuf fb;
-	if (fb.open(filename, std::ios::in)) {
-		std::istream is(&fb);
-
-		tinyobj::LoadMtl(&material_map, &materials, &is, &warning, &error);
-	} else {
-		printf("Warning: MTL file '%s' does not exist!\n", filename);
-	}
-
-	char * path = MALLOCA(char, strlen(filename) + 1);
-	Util::get_path(filename, path);
-
-	load_materials(materials, mesh_data, path);
-
-	FREEA(path);
-}
-
-void OBJLoader::load_obj(const char * filename, MeshData * mesh_data) {
+void OBJLoader::load_obj(const char * filename, MeshData * mesh_data, MaterialList & material_list) {
 	tinyobj::attrib_t attrib;
 	std::vector<tinyobj::shape_t> shapes;
 	std::vector<tinyobj::material_t> materials;
@@ -104,7 +74,7 @@ void OBJLoader::load_obj(const char * filename, MeshData * mesh_data) {
 		abort();
 	}
 
-	load_materials(materials, mesh_data, path);
+	load_materials(materials, material_list, path);
 
 	FREEA(path);
 	
@@ -1,8 +1,10 @@
 #pragma once
 
 #include "MeshData.h"
+#include "Material.h"
 
 namespace OBJLoader {
-	void load_mtl(const char * filename, MeshData * mesh_data); // Only loads materials
-	void load_obj(const char * filename, MeshData * mesh_data); // Loads geometry + materials
+	// Loads geometry + materials, the Triangle Material ids index the Materials in the given list.
+	// Does not touch any global state, so that multiple files can be loaded concurrently
+	void load_obj(const char * filename, MeshData * mesh_data, MaterialList & material_list);
 }
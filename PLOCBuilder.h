@@ -0,0 +1,247 @@
+#pragma once
+#include "BVH.h"
+#include "BVHPartitions.h"
+#include "Morton.h"
+
+#include "Mesh.h"
+
+#include "ThreadPool.h"
+
+// Builds a binary BVH bottom up using Parallel Locally-Ordered Clustering, see Meister and Bittner 2018.
+// Primitives are sorted along a Morton curve and start out as clusters of their own. In every iteration each cluster searches
+// for the cluster within PLOC_SEARCH_RADIUS positions that minimizes the surface area of their union.
+// Clusters that are each other's nearest neighbour are merged, until only a single cluster remains.
+// The resulting tree is then laid out top down in the standard BVH Node layout. Every leaf contains a single primitive
+struct PLOCBuilder {
+private:
+	static constexpr int PARALLEL_BATCH_SIZE = 4096; // Number of clusters that search for their nearest neighbour in a single Task
+
+	BVH * bvh = nullptr;
+
+	Morton::Code * morton_codes      = nullptr;
+	Morton::Code * morton_codes_temp = nullptr;
+	int          * indices_temp      = nullptr;
+
+	// Tree that is built bottom up. The first primitive_count Nodes are the leaves, in Morton order
+	AABB * tree_aabbs    = nullptr;
+	int  * tree_children = nullptr; // Two per Node, only valid for internal Nodes
+	int    tree_node_count;
+
+	int * clusters           = nullptr; // Tree Nodes of the clusters that remain, in Morton order
+	int * clusters_next      = nullptr;
+	int * nearest_neighbours = nullptr;
+
+	int primitive_count;
+
+	// Returns true if merging cluster i with a is preferred over merging it with b.
+	// Ties in area are broken by position, such that the cheapest pair overall is always mutually nearest
+	static inline bool is_closer(float area_a, int a, float area_b, int b) {
+		return area_a < area_b || (area_a == area_b && a < b);
+	}
+
+	void find_nearest_neighbours(int first, int last, int cluster_count) {
+		for (int i = first; i < last; i++) {
+			const AABB & aabb = tree_aabbs[clusters[i]];
+
+			float min_area = INFINITY;
+			int   min_index = -1;
+
+			int search_first = Math::max(i - PLOC_SEARCH_RADIUS, 0);
+			int search_last  = Math::min(i + PLOC_SEARCH_RADIUS, cluster_count - 1);
+
+			for (int j = search_first; j <= search_last; j++) {
+				if (j == i) continue;
+
+				float area = AABB::unify(aabb, tree_aabbs[clusters[j]]).surface_area();
+
+				// Compare pairs by their lowest position, so that both clusters of a pair use the same tie breaker
+				if (min_index == -1 || is_closer(area, Math::min(i, j), min_area, Math::min(i, min_index))) {
+					min_area  = area;
+					min_index = j;
+				}
+			}
+
+			nearest_neighbours[i] = min_index;
+		}
+	}
+
+	// Merges all pairs of clusters that are each other's nearest neighbour, returns the number of clusters that remain
+	int merge_clusters(int cluster_count) {
+		int cluster_count_next = 0;
+
+		for (int i = 0; i < cluster_count; i++) {
+			int j = nearest_neighbours[i];
+
+			if (nearest_neighbours[j] == i) {
+				// The pair is merged once, at the position of the first cluster
+				if (i < j) {
+					int node = tree_node_count++;
+
+					tree_children[2 * node    ] = clusters[i];
+					tree_children[2 * node + 1] = clusters[j];
+
+					tree_aabbs[node] = AABB::unify(tree_aabbs[clusters[i]], tree_aabbs[clusters[j]]);
+
+					clusters_next[cluster_count_next++] = node;
+				}
+			} else {
+				clusters_next[cluster_count_next++] = clusters[i];
+			}
+		}
+
+		Util::swap(clusters, clusters_next);
+
+		return cluster_count_next;
+	}
+
+	// Copies the tree into the BVH in depth first order, the split axis is the one along which the child centroids are furthest apart
+	void layout_tree(int root) {
+		int * stack = new int[2 * tree_node_count];
+		int   stack_size = 0;
+
+		stack[stack_size++] = root;
+		stack[stack_size++] = 0;
+
+		int node_index = 2;
+
+		while (stack_size > 0) {
+			int node_id   = stack[--stack_size];
+			int tree_node = stack[--stack_size];
+
+			BVHNode & node = bvh->nodes[node_id];
+			node.aabb = tree_aabbs[tree_node];
+
+			if (tree_node < primitive_count) {
+				node.first = tree_node;
+				node.count = 1;
+
+				continue;
+			}
+
+			int child_left  = tree_children[2 * tree_node    ];
+			int child_right = tree_children[2 * tree_node + 1];
+
+			Vector3 delta = tree_aabbs[child_right].get_center() - tree_aabbs[child_left].get_center();
+			delta = Vector3(fabsf(delta.x), fabsf(delta.y), fabsf(delta.z));
+
+			int split_dimension = 0;
+			if (delta.y > delta[split_dimension]) split_dimension = 1;
+			if (delta.z > delta[split_dimension]) split_dimension = 2;
+
+			node.left  = node_index;
+			node.count = (split_dimension + 1) << 30;
+
+			node_index += 2;
+
+			// Push the right child first so that the left subtree gets numbered first
+			stack[stack_size++] = child_right;
+			stack[stack_size++] = node.left + 1;
+			stack[stack_size++] = child_left;
+			stack[stack_size++] = node.left;
+		}
+
+		assert(node_index == 2 * primitive_count);
+
+		delete [] stack;
+	}
+
+	template<typename Primitive>
+	inline void build_bvh_impl(const Primitive * primitives, int primitive_count) {
+		this->primitive_count = primitive_count;
+
+		Morton::calc_codes(primitives, primitive_count, morton_codes);
+
+		for (int i = 0; i < primitive_count; i++) {
+			bvh->indices[i] = i;
+		}
+
+		Morton::radix_sort(morton_codes, morton_codes_temp, bvh->indices, indices_temp, primitive_count);
+
+		for (int i = 0; i < primitive_count; i++) {
+			tree_aabbs[i] = primitives[bvh->indices[i]].aabb;
+			tree_aabbs[i].fix_if_needed();
+
+			clusters[i] = i;
+		}
+
+		tree_node_count = primitive_count;
+
+		int cluster_count = primitive_count;
+
+		while (cluster_count > 1) {
+			if (cluster_count < PARALLEL_BATCH_SIZE) {
+				find_nearest_neighbours(0, cluster_count, cluster_count);
+			} else {
+				ThreadPool::TaskGroup group;
+
+				for (int first = 0; first < cluster_count; first += PARALLEL_BATCH_SIZE) {
+					int last = Math::min(first + PARALLEL_BATCH_SIZE, cluster_count);
+
+					ThreadPool::submit(group, [this, first, last, cluster_count]() {
+						find_nearest_neighbours(first, last, cluster_count);
+					});
+				}
+
+				ThreadPool::wait(group);
+			}
+
+			int cluster_count_next = merge_clusters(cluster_count);
+
+			// The cheapest pair is always mutually nearest, so every iteration makes progress
+			assert(cluster_count_next < cluster_count);
+
+			cluster_count = cluster_count_next;
+		}
+
+		assert(tree_node_count == 2 * primitive_count - 1);
+
+		layout_tree(clusters[0]);
+
+		bvh->node_count  = 2 * primitive_count;
+		bvh->index_count = primitive_count;
+	}
+
+public:
+	inline void init(BVH * bvh, int primitive_count) {
+		this->bvh = bvh;
+
+		morton_codes      = new Morton::Code[primitive_count];
+		morton_codes_temp = new Morton::Code[primitive_count];
+		indices_temp      = new int         [primitive_count];
+
+		tree_aabbs    = new AABB[2 * primitive_count];
+		tree_children = new int [2 * 2 * primitive_count];
+
+		clusters           = new int[primitive_count];
+		clusters_next      = new int[primitive_count];
+		nearest_neighbours = new int[primitive_count];
+
+		bvh->indices = new int    [primitive_count];
+		bvh->nodes   = new BVHNode[2 * primitive_count];
+	}
+
+	inline void free() {
+		delete [] morton_codes;
+		delete [] morton_codes_temp;
+		delete [] indices_temp;
+
+		delete [] tree_aabbs;
+		delete [] tree_children;
+
+		delete [] clusters;
+		delete [] clusters_next;
+		delete [] nearest_neighbours;
+	}
+
+	inline void build(const Triangle * triangles, int triangle_count) {
+		return build_bvh_impl(triangles, triangle_count);
+	}
+
+	inline void build(const Mesh * meshes, int mesh_count) {
+		return build_bvh_impl(meshes, mesh_count);
+	}
+
+	inline void build(const BVHPartitions::PrimitiveRef * references, int reference_count) {
+		return build_bvh_impl(references, reference_count);
+	}
+};
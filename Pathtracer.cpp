@@ -6,6 +6,7 @@
 
 #include "MeshData.h"
 #include "Material.h"
+#include "LinkedScene.h"
 
 #include "Random.h"
 #include "BlueNoise.h"
@@ -111,18 +112,54 @@ struct BufferSizes {
 };
 static BufferSizes * buffer_sizes; // Pinned memory (Non-Pageable)
 
-void Pathtracer::init(int mesh_count, char const ** mesh_names, char const * sky_name, unsigned frame_buffer_handle) {
+// Appends the first count Rays of a Ray buffer on the Device to the Ray set, max distance is optional
+static void download_rays(RayReplay::RaySet & ray_set, const CUDAVector3_SoA & origin, const CUDAVector3_SoA & direction, CUDAMemory::Ptr<float> max_distance, int count) {
+	if (count == 0) return;
+
+	int first = ray_set.rays.size();
+	ray_set.rays.resize(first + count);
+
+	float * buffer = new float[count];
+
+	auto copy = [&](CUDAMemory::Ptr<float> ptr, auto set) {
+		CUDAMemory::memcpy(buffer, ptr, count);
+
+		for (int i = 0; i < count; i++) {
+			set(ray_set.rays[first + i], buffer[i]);
+		}
+	};
+
+	copy(origin.x, [](Ray & ray, float value) { ray.origin.x = value; });
+	copy(origin.y, [](Ray & ray, float value) { ray.origin.y = value; });
+	copy(origin.z, [](Ray & ray, float value) { ray.origin.z = value; });
+
+	copy(direction.x, [](Ray & ray, float value) { ray.direction.x = value; });
+	copy(direction.y, [](Ray & ray, float value) { ray.direction.y = value; });
+	copy(direction.z, [](Ray & ray, float value) { ray.direction.z = value; });
+
+	if (max_distance.ptr) {
+		copy(max_distance, [](Ray & ray, float value) { ray.max_distance = value; });
+	}
+
+	delete [] buffer;
+}
+
+static int bvh_stack_element_size; // In bytes, read by the occupancy callback of the trace Kernel which can't capture
+
+void Pathtracer::init(int mesh_count, char const ** mesh_names, char const * sky_name, unsigned frame_buffer_handle, int bvh_type) {
 	ScopeTimer timer("Pathtracer Initialization");
 	
 	pixel_count = SCREEN_WIDTH * SCREEN_HEIGHT;
 	batch_size  = BATCH_SIZE;
 
+	this->bvh_type = bvh_type;
+
 	CUDAContext::init();
 	
-	scene.init(mesh_count, mesh_names, sky_name);
+	scene.init(mesh_count, mesh_names, sky_name, bvh_type);
 	
-	// Init CUDA Module and its Kernel
-	module.init("CUDA_Source/Pathtracer.cu", CUDAContext::compute_capability, MAX_REGISTERS);
+	// Init CUDA Module and its Kernel, the traversal code is selected through the BVH_TYPE define
+	module.init("CUDA_Source/Pathtracer.cu", CUDAContext::compute_capability, MAX_REGISTERS, { { "BVH_TYPE", bvh_type } });
 	
 	// Set global Material table
 	module.get_global("materials").set_buffer(Material::materials);
@@ -196,69 +233,14 @@ void Pathtracer::init(int mesh_count, char const ** mesh_names, char const * sky
 		delete [] tex_objects;
 	}
 
-	int mesh_data_count = MeshData::mesh_datas.size();
-
-	mesh_data_bvh_offsets = new int[mesh_data_count];
-
-	int * mesh_data_index_offsets    = MALLOCA(int, mesh_data_count);
-	int * mesh_data_triangle_offsets = MALLOCA(int, mesh_data_count);
-
-	int global_bvh_node_count = 2 * scene.mesh_count; // Reserve 2 times Mesh count for TLAS
-	int global_index_count    = 0;
-	int global_triangle_count = 0;
-
-	for (int i = 0; i < mesh_data_count; i++) {
-		mesh_data_bvh_offsets     [i] = global_bvh_node_count;
-		mesh_data_index_offsets   [i] = global_index_count;
-		mesh_data_triangle_offsets[i] = global_triangle_count;
-
-		global_bvh_node_count += MeshData::mesh_datas[i]->bvh.node_count;
-		global_index_count    += MeshData::mesh_datas[i]->bvh.index_count;
-		global_triangle_count += MeshData::mesh_datas[i]->triangle_count;
-	}
-
-	BVHNodeType * global_bvh_nodes = new BVHNodeType[global_bvh_node_count];
-	int         * global_indices   = new int        [global_index_count];
-	Triangle    * global_triangles = new Triangle   [global_triangle_count];
-
-	for (int m = 0; m < mesh_data_count; m++) {
-		const MeshData * mesh_data = MeshData::mesh_datas[m];
-
-		for (int n = 0; n < mesh_data->bvh.node_count; n++) {
-			BVHNodeType & node = global_bvh_nodes[mesh_data_bvh_offsets[m] + n];
-
-			node = mesh_data->bvh.nodes[n];
-
-#if BVH_TYPE == BVH_BVH || BVH_TYPE == BVH_SBVH
-			if (node.is_leaf()) {
-				node.first += mesh_data_index_offsets[m];
-			} else {
-				node.left += mesh_data_bvh_offsets[m];
-			}
-#elif BVH_TYPE == BVH_QBVH
-			int child_count = node.get_child_count();
-			for (int c = 0; c < child_count; c++) {
-				if (node.is_leaf(c)) {
-					node.get_index(c) += mesh_data_index_offsets[m];
-				} else {
-					node.get_index(c) += mesh_data_bvh_offsets[m];
-				}
-			}
-#elif BVH_TYPE == BVH_CWBVH
-			node.base_index_child    += mesh_data_bvh_offsets[m];
-			node.base_index_triangle += mesh_data_index_offsets[m];
-#endif
-		}
+	// Link the geometry of all MeshDatas into the arrays used by the Device, the Nodes before the first MeshData are reserved for the TLAS
+	LinkedScene linked_scene;
+	linked_scene.init(mesh_names[0], bvh_type, 2 * scene.mesh_count);
 
-		for (int i = 0; i < mesh_data->bvh.index_count; i++) {
-			global_indices[mesh_data_index_offsets[m] + i] = mesh_data->bvh.indices[i] + mesh_data_triangle_offsets[m];
-		}
+	int mesh_data_count = linked_scene.mesh_data_count;
 
-		for (int t = 0; t < mesh_data->triangle_count; t++) {
-			global_triangles[mesh_data_triangle_offsets[m] + t]              = mesh_data->triangles[t];
-			global_triangles[mesh_data_triangle_offsets[m] + t].material_id += mesh_data->material_offset;
-		}
-	}
+	mesh_data_bvh_offsets = new int[mesh_data_count];
+	memcpy(mesh_data_bvh_offsets, linked_scene.mesh_data_bvh_offsets, mesh_data_count * sizeof(int));
 
 	pinned_mesh_bvh_root_indices        = CUDAMemory::malloc_pinned<int>      (scene.mesh_count);
 	pinned_mesh_transforms              = CUDAMemory::malloc_pinned<Matrix3x4>(scene.mesh_count);
@@ -274,91 +256,39 @@ void Pathtracer::init(int mesh_count, char const ** mesh_names, char const * sky
 	module.get_global("mesh_transforms")      .set_value(ptr_mesh_transforms);
 	module.get_global("mesh_transforms_inv")  .set_value(ptr_mesh_transforms_inv);
 	
-	ptr_bvh_nodes = CUDAMemory::malloc<BVHNodeType>(global_bvh_node_count);
-	CUDAMemory::memcpy(ptr_bvh_nodes, global_bvh_nodes, global_bvh_node_count);
-
-#if BVH_TYPE == BVH_BVH || BVH_TYPE == BVH_SBVH
-	module.get_global("bvh_nodes").set_value(ptr_bvh_nodes);
-#elif BVH_TYPE == BVH_QBVH
-	module.get_global("qbvh_nodes").set_value(ptr_bvh_nodes);
-#elif BVH_TYPE == BVH_CWBVH
-	module.get_global("cwbvh_nodes").set_value(ptr_bvh_nodes);
-#endif
-
-	tlas_bvh_builder.init(&tlas_raw, mesh_count, 1);
-
-	tlas_raw.node_count = mesh_count * 2;
-#if BVH_TYPE == BVH_QBVH || BVH_TYPE == BVH_CWBVH
-	tlas_converter.init(&tlas, tlas_raw);
-#endif
-
-	struct CUDATriangle {
-		Vector3 position_0;
-		Vector3 position_edge_1;
-		Vector3 position_edge_2;
-
-		Vector3 normal_0;
-		Vector3 normal_edge_1;
-		Vector3 normal_edge_2;
-
-		Vector2 tex_coord_0;
-		Vector2 tex_coord_edge_1;
-		Vector2 tex_coord_edge_2;
-	};
-	
-	CUDATriangle * triangles             = new CUDATriangle[global_index_count];
-	int          * triangle_material_ids = new int         [global_index_count];
-	float        * triangle_lods         = new float       [global_index_count];
-
-	int * reverse_indices = new int[global_index_count];
-
-	for (int i = 0; i < global_index_count; i++) {
-		int index = global_indices[i];
+	dispatch_bvh_type(bvh_type, [&](auto * node_type) {
+		typedef std::remove_pointer_t<decltype(node_type)> NodeType;
 
-		assert(index < global_triangle_count);
+		CUDAMemory::Ptr<NodeType> ptr_nodes = CUDAMemory::malloc<NodeType>(linked_scene.bvh_node_count);
+		CUDAMemory::memcpy(ptr_nodes, static_cast<const NodeType *>(linked_scene.bvh_nodes), linked_scene.bvh_node_count);
 
-		triangles[i].position_0      = global_triangles[index].position_0;
-		triangles[i].position_edge_1 = global_triangles[index].position_1 - global_triangles[index].position_0;
-		triangles[i].position_edge_2 = global_triangles[index].position_2 - global_triangles[index].position_0;
+		ptr_bvh_nodes = ptr_nodes.ptr;
+	});
 
-		triangles[i].normal_0      = global_triangles[index].normal_0;
-		triangles[i].normal_edge_1 = global_triangles[index].normal_1 - global_triangles[index].normal_0;
-		triangles[i].normal_edge_2 = global_triangles[index].normal_2 - global_triangles[index].normal_0;
-
-		triangles[i].tex_coord_0      = global_triangles[index].tex_coord_0;
-		triangles[i].tex_coord_edge_1 = global_triangles[index].tex_coord_1 - global_triangles[index].tex_coord_0;
-		triangles[i].tex_coord_edge_2 = global_triangles[index].tex_coord_2 - global_triangles[index].tex_coord_0;
-
-		int material_id = global_triangles[index].material_id;
-		triangle_material_ids[i] = material_id;
-
-		int texture_id = Material::materials[material_id].texture_id;
-		if (texture_id != INVALID) {
-			const Texture & texture = Texture::textures[texture_id];
+	switch (bvh_type) {
+		case BVH_BVH:
+		case BVH_SBVH:  module.get_global("bvh_nodes")  .set_value(ptr_bvh_nodes); break;
+		case BVH_QBVH:  module.get_global("qbvh_nodes") .set_value(ptr_bvh_nodes); break;
+		case BVH_CWBVH: module.get_global("cwbvh_nodes").set_value(ptr_bvh_nodes); break;
+	}
 
-			// Triangle texture base LOD as described in "Texture Level of Detail Strategies for Real-Time Ray Tracing"
-			float t_a = float(texture.width * texture.height) * fabsf(
-				triangles[i].tex_coord_edge_1.x * triangles[i].tex_coord_edge_2.y -
-				triangles[i].tex_coord_edge_2.x * triangles[i].tex_coord_edge_1.y
-			); 
-			float p_a = Vector3::length(Vector3::cross(triangles[i].position_edge_1, triangles[i].position_edge_2));
+	tlas_bvh_builder.init(&tlas_raw, mesh_count, 1);
 
-			triangle_lods[i] = 0.5f * log2f(t_a / p_a);
-		} else {
-			triangle_lods[i] = 0.0f;
-		}
+	tlas_raw.node_count = mesh_count * 2;
 
-		reverse_indices[index] = i;
+	switch (bvh_type) {
+		case BVH_QBVH:  tlas_qbvh_converter .init(&tlas_qbvh,  tlas_raw); break;
+		case BVH_CWBVH: tlas_cwbvh_converter.init(&tlas_cwbvh, tlas_raw); break;
 	}
 
-	module.get_global("triangles")            .set_buffer(triangles,             global_index_count);
-	module.get_global("triangle_material_ids").set_buffer(triangle_material_ids, global_index_count);
+	module.get_global("triangles")            .set_buffer(linked_scene.triangles,             linked_scene.index_count);
+	module.get_global("triangle_material_ids").set_buffer(linked_scene.triangle_material_ids, linked_scene.index_count);
 
-	module.get_global("triangle_lods").set_buffer(triangle_lods, global_index_count);
+	module.get_global("triangle_lods").set_buffer(linked_scene.triangle_lods, linked_scene.index_count);
 	
 	// Init OpenGL MeshData for rasterization
 	for (int m = 0; m < mesh_data_count; m++) {
-		MeshData::mesh_datas[m]->gl_init(reverse_indices + mesh_data_triangle_offsets[m]);
+		MeshData::mesh_datas[m]->gl_init(linked_scene.reverse_indices + linked_scene.mesh_data_triangle_offsets[m]);
 	}
 
 	// Initialize OpenGL Shaders
@@ -378,88 +308,8 @@ void Pathtracer::init(int mesh_count, char const ** mesh_names, char const * sky
 	uniform_mesh_id = shader.get_uniform("mesh_id");
 
 	if (scene.has_lights) {
-		// Initialize Lights
-		struct LightTriangle {
-			int   index;
-			float area;
-		};
-		std::vector<LightTriangle> light_triangles;
-
-		struct LightMesh {
-			int triangle_first_index;
-			int triangle_count;
-
-			float area;
-		};
-		std::vector<LightMesh> light_meshes;
-
-		int * light_mesh_data_indices = MALLOCA(int, mesh_data_count);
-		memset(light_mesh_data_indices, -1, mesh_data_count * sizeof(int));
-
-		// Loop over every MeshData and check whether it has at least 1 Triangle that is a Light
-		for (int m = 0; m < mesh_data_count; m++) {
-			const MeshData * mesh_data = MeshData::mesh_datas[m];
-
-			LightMesh * light_mesh = nullptr;
-
-			// For every Triangle, check whether it is a Light based on its Material
-			for (int t = 0; t < mesh_data->triangle_count; t++) {
-				const Triangle & triangle = mesh_data->triangles[t];
-
-				if (Material::materials[mesh_data->material_offset + triangle.material_id].type == Material::Type::LIGHT) {
-					float area = 0.5f * Vector3::length(Vector3::cross(
-						triangle.position_1 - triangle.position_0,
-						triangle.position_2 - triangle.position_0
-					));
-
-					if (light_mesh == nullptr) {
-						light_mesh_data_indices[m] = light_meshes.size();
-
-						light_mesh = &light_meshes.emplace_back();
-						light_mesh->triangle_first_index = light_triangles.size();
-						light_mesh->triangle_count = 0;
-					}
-
-					light_triangles.push_back({ reverse_indices[mesh_data_triangle_offsets[m] + t], area });
-
-					light_mesh->triangle_count++;
-				}
-			}
-
-			if (light_mesh) {		
-				// Sort Lights on area within each Mesh
-				LightTriangle * triangles_begin = light_triangles.data() + light_mesh->triangle_first_index;
-				LightTriangle * triangles_end   = triangles_begin        + light_mesh->triangle_count;
-
-				assert(triangles_end > triangles_begin);
-
-				std::sort(triangles_begin, triangles_end, [](const LightTriangle & a, const LightTriangle & b) { return a.area < b.area; });
-			}
-		}
-
-		int   * light_indices          = new int  [light_triangles.size()];
-		float * light_areas_cumulative = new float[light_triangles.size()];
-
-		for (int m = 0; m < light_meshes.size(); m++) {
-			LightMesh & light_mesh = light_meshes[m];
-
-			float cumulative_area = 0.0f;
-
-			for (int i = light_mesh.triangle_first_index; i < light_mesh.triangle_first_index + light_mesh.triangle_count; i++) {
-				light_indices[i] = light_triangles[i].index;
-
-				cumulative_area += light_triangles[i].area;
-				light_areas_cumulative[i] = cumulative_area;
-			}
-
-			light_mesh.area = cumulative_area;
-		}
-
-		module.get_global("light_indices")         .set_buffer(light_indices,          light_triangles.size());
-		module.get_global("light_areas_cumulative").set_buffer(light_areas_cumulative, light_triangles.size());
-
-		delete [] light_indices;
-		delete [] light_areas_cumulative;
+		module.get_global("light_indices")         .set_buffer(linked_scene.light_indices,          linked_scene.light_count);
+		module.get_global("light_areas_cumulative").set_buffer(linked_scene.light_areas_cumulative, linked_scene.light_count);
 
 		float * light_mesh_area_unscaled        = MALLOCA(float, mesh_count);
 		int   * light_mesh_triangle_count       = MALLOCA(int,   mesh_count);
@@ -469,10 +319,10 @@ void Pathtracer::init(int mesh_count, char const ** mesh_names, char const * sky
 		int light_mesh_count  = 0;
 		
 		for (int m = 0; m < mesh_count; m++) {
-			int light_mesh_data_index = light_mesh_data_indices[scene.meshes[m].mesh_data_index];
+			int light_mesh_data_index = linked_scene.light_mesh_data_indices[scene.meshes[m].mesh_data_index];
 
 			if (light_mesh_data_index != -1) {
-				const LightMesh & light_mesh = light_meshes[light_mesh_data_index];
+				const LinkedScene::LightMesh & light_mesh = linked_scene.light_meshes[light_mesh_data_index];
 
 				scene.meshes[m].light_index = light_mesh_count;
 				scene.meshes[m].light_area  = light_mesh.area;
@@ -505,21 +355,11 @@ void Pathtracer::init(int mesh_count, char const ** mesh_names, char const * sky
 		FREEA(light_mesh_area_unscaled);
 		FREEA(light_mesh_triangle_count);
 		FREEA(light_mesh_triangle_first_index);
-
-		FREEA(light_mesh_data_indices);
 	} else {
 		module.get_global("light_total_count_inv").set_value(INFINITY); // 1 / 0
 	}
 
-	delete [] global_bvh_nodes;
-	delete [] global_indices;
-	delete [] global_triangles;
-
-	delete [] triangles;
-	delete [] triangle_lods;
-	delete [] triangle_material_ids;
-
-	delete [] reverse_indices;
+	linked_scene.free();
 
 	module.get_global("sky_width") .set_value(scene.sky.width);
 	module.get_global("sky_height").set_value(scene.sky.height);
@@ -533,9 +373,9 @@ void Pathtracer::init(int mesh_count, char const ** mesh_names, char const * sky
 	module.get_global("ranking_tile").set_buffer(ranking_tile);
 	
 	for (int m = 0; m < mesh_data_count; m++) {
-		delete [] MeshData::mesh_datas[m]->bvh.indices;
-		delete [] MeshData::mesh_datas[m]->bvh.nodes;
-		delete [] MeshData::mesh_datas[m]->triangles;
+		MeshData * mesh_data = const_cast<MeshData *>(MeshData::mesh_datas[m]);
+
+		mesh_data->free();
 	}
 	
 	// Initialize buffers used by Wavefront kernels
@@ -594,11 +434,8 @@ void Pathtracer::init(int mesh_count, char const ** mesh_names, char const * sky
 	kernel_shade_dielectric.set_block_dim(WARP_SIZE * 2, 1, 1);
 	kernel_shade_glossy    .set_block_dim(WARP_SIZE * 2, 1, 1);
 	
-#if BVH_TYPE == BVH_CWBVH
-	static constexpr int bvh_stack_element_size = 8; // CWBVH uses a stack of int2's (8 bytes)
-#else
-	static constexpr int bvh_stack_element_size = 4; // Other BVH's use a stack of ints (4 bytes)
-#endif
+	// CWBVH uses a stack of int2's (8 bytes), other BVH's use a stack of ints (4 bytes)
+	bvh_stack_element_size = bvh_type == BVH_CWBVH ? 8 : 4;
 
 	CUoccupancyB2DSize block_size_to_shared_memory = [](int block_size) {
 		return size_t(block_size) * SHARED_STACK_SIZE * bvh_stack_element_size;
@@ -657,8 +494,21 @@ void Pathtracer::init(int mesh_count, char const ** mesh_names, char const * sky
 	resize_init(frame_buffer_handle, SCREEN_WIDTH, SCREEN_HEIGHT);
 	
 	// Realloc as pinned memory
-	delete [] tlas.nodes;
-	tlas.nodes = CUDAMemory::malloc_pinned<BVHNodeType>(2 * mesh_count);
+	switch (bvh_type) {
+		case BVH_QBVH: {
+			delete [] tlas_qbvh.nodes;
+			tlas_qbvh.nodes = CUDAMemory::malloc_pinned<QBVHNode>(2 * mesh_count);
+
+			break;
+		}
+
+		case BVH_CWBVH: {
+			delete [] tlas_cwbvh.nodes;
+			tlas_cwbvh.nodes = CUDAMemory::malloc_pinned<CWBVHNode>(2 * mesh_count);
+
+			break;
+		}
+	}
 
 	scene.update(0.0f);
 	build_tlas();
@@ -784,25 +634,52 @@ void Pathtracer::resize_free() {
 void Pathtracer::build_tlas() {
 	tlas_bvh_builder.build(scene.meshes, scene.mesh_count);
 
-	tlas.index_count = tlas_raw.index_count;
-	tlas.indices     = tlas_raw.indices;
-	tlas.node_count  = tlas_raw.node_count;
+	assert(tlas_raw.index_count == scene.mesh_count);
 
-#if BVH_TYPE == BVH_BVH || BVH_TYPE == BVH_SBVH
-	const BVH & tlas = tlas_raw;
-#else
-	tlas_converter.build(tlas_raw);
-#endif
+	switch (bvh_type) {
+		case BVH_BVH:
+		case BVH_SBVH: {
+			CUDAMemory::memcpy(CUDAMemory::Ptr<BVHNode>(ptr_bvh_nodes), tlas_raw.nodes, tlas_raw.node_count);
+
+			tlas_indices = tlas_raw.indices;
 
-	CUDAMemory::memcpy<BVHNodeType>(ptr_bvh_nodes, tlas.nodes, tlas.node_count);
+			break;
+		}
+
+		case BVH_QBVH: {
+			tlas_qbvh.index_count = tlas_raw.index_count;
+			tlas_qbvh.indices     = tlas_raw.indices;
+			tlas_qbvh.node_count  = tlas_raw.node_count;
+
+			tlas_qbvh_converter.build(tlas_raw);
+
+			CUDAMemory::memcpy(CUDAMemory::Ptr<QBVHNode>(ptr_bvh_nodes), tlas_qbvh.nodes, tlas_qbvh.node_count);
+
+			tlas_indices = tlas_qbvh.indices;
+
+			break;
+		}
+
+		case BVH_CWBVH: {
+			tlas_cwbvh.index_count = tlas_raw.index_count;
+			tlas_cwbvh.indices     = tlas_raw.indices;
+			tlas_cwbvh.node_count  = tlas_raw.node_count;
+
+			tlas_cwbvh_converter.build(tlas_raw);
 
-	assert(tlas.index_count == scene.mesh_count);
+			CUDAMemory::memcpy(CUDAMemory::Ptr<CWBVHNode>(ptr_bvh_nodes), tlas_cwbvh.nodes, tlas_cwbvh.node_count);
+
+			tlas_indices = tlas_cwbvh.indices;
+
+			break;
+		}
+	}
 
 	int   light_count = 0;
 	float light_total_area = 0.0f;
 
 	for (int i = 0; i < scene.mesh_count; i++) {
-		const Mesh & mesh = scene.meshes[tlas.indices[i]];
+		const Mesh & mesh = scene.meshes[tlas_indices[i]];
 
 		pinned_mesh_bvh_root_indices[i] = mesh_data_bvh_offsets[mesh.mesh_data_index];
 
@@ -834,6 +711,10 @@ void Pathtracer::build_tlas() {
 	}
 }
 
+void Pathtracer::capture_rays(const char * filename) {
+	ray_capture_filename = filename;
+}
+
 void Pathtracer::update(float delta) {
 	if (settings.enable_scene_update) {
 		scene.update(delta);
@@ -909,7 +790,7 @@ void Pathtracer::render() {
 		glUniformMatrix4fv(uniform_view_projection_prev, 1, GL_TRUE, reinterpret_cast<const GLfloat *>(&scene.camera.view_projection_prev));
 		
 		for (int m = 0; m < scene.mesh_count; m++) {
-			const Mesh & mesh = scene.meshes[tlas.indices[m]];
+			const Mesh & mesh = scene.meshes[tlas_indices[m]];
 			
 			glUniformMatrix4fv(uniform_transform,      1, GL_TRUE, reinterpret_cast<const GLfloat *>(&mesh.transform));
 			glUniformMatrix4fv(uniform_transform_prev, 1, GL_TRUE, reinterpret_cast<const GLfloat *>(&mesh.transform_prev));
@@ -924,6 +805,23 @@ void Pathtracer::render() {
 		glFinish();
 	}
 
+	// When capturing, the Rays of every bounce are collected over all batches. Even indices are Trace Rays, odd indices Shadow Rays
+	bool capture = !ray_capture_filename.empty();
+
+	std::vector<RayReplay::RaySet> ray_sets;
+
+	if (capture) {
+		ray_sets.resize(2 * NUM_BOUNCES);
+
+		for (int bounce = 0; bounce < NUM_BOUNCES; bounce++) {
+			ray_sets[2 * bounce    ].type = bounce == 0 ? RayReplay::RayType::PRIMARY : RayReplay::RayType::BOUNCE;
+			ray_sets[2 * bounce + 1].type = RayReplay::RayType::SHADOW;
+
+			ray_sets[2 * bounce    ].bounce = bounce;
+			ray_sets[2 * bounce + 1].bounce = bounce;
+		}
+	}
+
 	int pixels_left = pixel_count;
 
 	// Render in batches of BATCH_SIZE pixels at a time
@@ -955,6 +853,12 @@ void Pathtracer::render() {
 		for (int bounce = 0; bounce < NUM_BOUNCES; bounce++) {
 			// When rasterizing primary rays we can skip tracing rays on bounce 0
 			if (!(bounce == 0 && settings.enable_rasterization)) {
+				if (capture) {
+					TraceBuffer ray_buffer_trace = module.get_global("ray_buffer_trace").get_value<TraceBuffer>();
+
+					download_rays(ray_sets[2 * bounce], ray_buffer_trace.origin, ray_buffer_trace.direction, { }, global_buffer_sizes.get_value<BufferSizes>().trace[bounce]);
+				}
+
 				// Extend all Rays that are still alive to their next Triangle intersection
 				RECORD_EVENT(event_trace[bounce]);
 				kernel_trace.execute(bounce);
@@ -981,6 +885,12 @@ void Pathtracer::render() {
 
 			// Trace shadow Rays
 			if (scene.has_lights) {
+				if (capture) {
+					ShadowRayBuffer ray_buffer_shadow = module.get_global("ray_buffer_shadow").get_value<ShadowRayBuffer>();
+
+					download_rays(ray_sets[2 * bounce + 1], ray_buffer_shadow.ray_origin, ray_buffer_shadow.ray_direction, ray_buffer_shadow.max_distance, global_buffer_sizes.get_value<BufferSizes>().shadow[bounce]);
+				}
+
 				RECORD_EVENT(event_shadow_trace[bounce]);
 				kernel_trace_shadow.execute(bounce);
 			}
@@ -995,6 +905,14 @@ void Pathtracer::render() {
 		}
 	}
 
+	if (capture) {
+		if (RayReplay::save(ray_capture_filename.c_str(), ray_sets)) {
+			printf("Captured Rays to %s\n", ray_capture_filename.c_str());
+		}
+
+		ray_capture_filename.clear();
+	}
+
 	if (settings.enable_svgf) {
 		// Integrate temporally
 		RECORD_EVENT(event_svgf_temporal);
@@ -1,5 +1,6 @@
 #pragma once
 #include <vector>
+#include <string>
 
 #include "CUDAModule.h"
 #include "CUDAKernel.h"
@@ -16,6 +17,8 @@
 
 #include "Scene.h"
 
+#include "RayReplay.h"
+
 // Mirror CUDA vector types
 struct alignas(8)  float2 { float x, y; };
 struct             float3 { float x, y, z; };
@@ -33,7 +36,8 @@ struct Pathtracer {
 
 	std::vector<const CUDAEvent *> events;
 
-	void init(int mesh_count, char const ** mesh_names, char const * sky_name, unsigned frame_buffer_handle);
+	// The BVH type is one of BVH_BVH, BVH_SBVH, BVH_QBVH or BVH_CWBVH, the kernels are compiled for the given type
+	void init(int mesh_count, char const ** mesh_names, char const * sky_name, unsigned frame_buffer_handle, int bvh_type = BVH_TYPE);
 
 	void resize_init(unsigned frame_buffer_handle, int width, int height); // Part of resize that initializes new size
 	void resize_free();                                                    // Part of resize that cleans up old size
@@ -41,7 +45,12 @@ struct Pathtracer {
 	void update(float delta);
 	void render();
 
+	// Dumps all Rays traced during the next frame to the given file, so that they can be replayed on the CPU (see RayReplay.h)
+	void capture_rays(const char * filename);
+
 private:
+	std::string ray_capture_filename; // Empty if no capture was requested
+
 	int pixel_count;
 	int batch_size;
 	
@@ -114,15 +123,18 @@ private:
 	CUDAEvent event_accumulate;
 	CUDAEvent event_end;
 
+	int bvh_type;
+
 	BVH        tlas_raw;
 	BVHBuilder tlas_bvh_builder;
-	BVHType    tlas;
 
-#if BVH_TYPE == BVH_QBVH
-	QBVHBuilder tlas_converter;
-#elif BVH_TYPE == BVH_CWBVH
-	CWBVHBuilder tlas_converter;
-#endif
+	// The TLAS is converted into the selected BVH type, the BVH and SBVH use tlas_raw directly
+	QBVH         tlas_qbvh;
+	QBVHBuilder  tlas_qbvh_converter;
+	CWBVH        tlas_cwbvh;
+	CWBVHBuilder tlas_cwbvh_converter;
+
+	const int * tlas_indices; // Mesh indices in the order of the leaves of the converted TLAS, which is the order the GPU uses
 	
 	int * mesh_data_bvh_offsets;
 
@@ -136,7 +148,7 @@ private:
 	int       * pinned_light_mesh_transform_indices;
 	float     * pinned_light_mesh_area_scaled;
 
-	CUDAMemory::Ptr<BVHNodeType> ptr_bvh_nodes;
+	CUdeviceptr                  ptr_bvh_nodes; // Nodes of the selected BVH type
 	CUDAMemory::Ptr<int>         ptr_mesh_bvh_root_indices;
 	CUDAMemory::Ptr<Matrix3x4>   ptr_mesh_transforms;
 	CUDAMemory::Ptr<Matrix3x4>   ptr_mesh_transforms_inv;
@@ -1,5 +1,12 @@
 #include "PerfTest.h"
 
+#include "BVHBuilder.h"
+
+#include "MeshData.h"
+#include "Texture.h"
+
+#include "ScopeTimer.h"
+
 void PerfTest::init(Pathtracer * pathtracer, bool enabled, const char * scene_name) {
 	this->enabled = enabled;
 
@@ -90,3 +97,77 @@ bool PerfTest::frame_end(float frame_time) {
 
 	return false;
 }
+
+void PerfTest::benchmark_bvh_construction() {
+	// A column of voxel faces stacked along the y axis, every face consists of two coincident Triangles (front and back).
+	// All Triangles share their x and z centroid coordinates and are ordered along y, so the orders along x and z are the same as the order along y.
+	// This means the SAH of a split along x is just as good as along y, and splits end up inside large groups of equal coordinates
+	constexpr int face_count     = 1 << 20;
+	constexpr int triangle_count = 2 * face_count;
+
+	Triangle * triangles = new Triangle[triangle_count];
+
+	int index = 0;
+
+	for (int i = 0; i < face_count; i++) {
+		Vector3 center = Vector3(0.0f, float(i), 0.0f);
+
+		Vector3 position_0 = center + Vector3(-0.5f, -0.5f, 0.0f);
+		Vector3 position_1 = center + Vector3( 0.5f, -0.5f, 0.0f);
+		Vector3 position_2 = center + Vector3( 0.0f,  1.0f, 0.0f);
+
+		for (int side = 0; side < 2; side++) {
+			Triangle & triangle = triangles[index++];
+
+			triangle.position_0 = position_0;
+			triangle.position_1 = side == 0 ? position_1 : position_2;
+			triangle.position_2 = side == 0 ? position_2 : position_1;
+
+			Vector3 vertices[3] = { triangle.position_0, triangle.position_1, triangle.position_2 };
+			triangle.aabb = AABB::from_points(vertices, 3);
+		}
+	}
+
+	assert(index == triangle_count);
+
+	printf("Benchmarking BVH construction over %i Triangles\n", triangle_count);
+
+	BVH bvh;
+
+	{
+		ScopeTimer timer("BVH Construction");
+
+		BVHBuilder bvh_builder;
+		bvh_builder.init(&bvh, triangle_count, 1);
+		bvh_builder.build(triangles, triangle_count);
+		bvh_builder.free();
+	}
+
+	delete [] bvh.indices;
+	delete [] bvh.nodes;
+
+	delete [] triangles;
+}
+
+void PerfTest::benchmark_bvh_types(const char * filename) {
+	for (int bvh_type = 0; bvh_type < BVH_TYPE_COUNT; bvh_type++) {
+		char timer_name[64];
+		sprintf_s(timer_name, "Loading %s", get_bvh_type_name(bvh_type));
+
+		int mesh_data_index;
+		{
+			ScopeTimer timer(timer_name);
+
+			mesh_data_index = MeshData::load(filename, bvh_type);
+		}
+
+		const MeshData * mesh_data = MeshData::mesh_datas[mesh_data_index];
+
+		mesh_data->visit_bvh([&](const auto & bvh) {
+			printf("%-5s: %8i Nodes, %8i indices, SAH cost: %.2f\n\n", get_bvh_type_name(bvh_type), bvh.node_count, bvh.index_count, mesh_data->bvh_sah_cost);
+		});
+	}
+
+	// Loading the MeshDatas started loading their Textures on separate threads, make sure they are done before returning
+	Texture::wait_until_textures_loaded();
+}
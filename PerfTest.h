@@ -60,4 +60,11 @@ public:
 
 	void frame_begin();
 	bool frame_end(float frame_time);
+
+	// Times BVH construction on a synthetic voxel-like scene, in which millions of primitives share their centroid coordinates
+	static void benchmark_bvh_construction();
+
+	// Loads the given Mesh once with every BVH type and prints the load time, Node count and SAH cost of each.
+	// BVH's that are already cached on disk are loaded from the cache instead of being built
+	static void benchmark_bvh_types(const char * filename);
 };
@@ -141,3 +141,237 @@ void QBVHBuilder::build(const BVH & bvh) {
 		collapse(0);
 	}
 }
+
+// Fills the cost table bottom up, cost[node_index * 4 + i] is the cost of representing the subtree using at most i + 1 children of the parent
+int QBVHBuilder::calculate_cost(int node_index, const BVHNode nodes[]) {
+	const BVHNode & node = nodes[node_index];
+
+	int num_primitives;
+
+	if (node.is_leaf()) {
+		num_primitives = node.get_count();
+
+		// SAH cost
+		float cost_leaf = SAH_COST_LEAF * node.aabb.surface_area() * float(num_primitives);
+
+		for (int i = 0; i < 4; i++) {
+			cost     [node_index * 4 + i]      = cost_leaf;
+			decisions[node_index * 4 + i].type = Decision::Type::LEAF;
+		}
+	} else {
+		num_primitives = 
+			calculate_cost(node.left,     nodes) +
+			calculate_cost(node.left + 1, nodes);
+
+		// Separate case: i=0, the Node becomes either a leaf or an internal Node whose children fill up to 4 slots
+		{
+			float cost_leaf = num_primitives <= QBVH_MAX_PRIMITIVES_IN_LEAF ? SAH_COST_LEAF * float(num_primitives) * node.aabb.surface_area() : INFINITY;
+
+			float cost_distribute = INFINITY;
+			
+			char distribute_0 = -1;
+			char distribute_1 = -1;
+
+			for (int k = 0; k < 3; k++) {
+				float c = 
+					cost[(node.left)     * 4 +     k] + 
+					cost[(node.left + 1) * 4 + 2 - k];
+
+				if (c < cost_distribute) {
+					cost_distribute = c;
+					
+					distribute_0 =     k;
+					distribute_1 = 2 - k;
+				}
+			}
+
+			float cost_internal = cost_distribute + SAH_COST_NODE * node.aabb.surface_area();
+
+			if (cost_leaf < cost_internal) {
+				cost[node_index * 4] = cost_leaf;
+
+				decisions[node_index * 4].type = Decision::Type::LEAF;
+			} else {
+				cost[node_index * 4] = cost_internal;
+
+				decisions[node_index * 4].type = Decision::Type::INTERNAL;
+			}
+
+			decisions[node_index * 4].distribute_0 = distribute_0;
+			decisions[node_index * 4].distribute_1 = distribute_1;
+		}
+
+		// i=1..3, the Node may also be replaced by its descendants
+		for (int i = 1; i < 4; i++) {
+			float cost_distribute = cost[node_index * 4 + i - 1];
+
+			char distribute_0 = -1;
+			char distribute_1 = -1;
+
+			for (int k = 0; k < i; k++) {
+				float c = 
+					cost[(node.left)     * 4 +     k    ] + 
+					cost[(node.left + 1) * 4 + i - k - 1];
+
+				if (c < cost_distribute) {
+					cost_distribute = c;
+					
+					distribute_0 =     k;
+					distribute_1 = i - k - 1;
+				}
+			}
+
+			cost[node_index * 4 + i] = cost_distribute;
+
+			if (distribute_0 != -1) {
+				decisions[node_index * 4 + i].type = Decision::Type::DISTRIBUTE;
+				decisions[node_index * 4 + i].distribute_0 = distribute_0;
+				decisions[node_index * 4 + i].distribute_1 = distribute_1;
+			} else {
+				decisions[node_index * 4 + i] = decisions[node_index * 4 + i - 1];
+			}
+		}
+	}
+
+	return num_primitives;
+}
+
+void QBVHBuilder::get_children(int node_index, const BVHNode nodes[], int i, int & child_count, int children[4]) {
+	const BVHNode & node = nodes[node_index];
+	
+	if (node.is_leaf()) {
+		children[child_count++] = node_index;
+
+		return;
+	}
+
+	int distribute_0 = decisions[node_index * 4 + i].distribute_0;
+	int distribute_1 = decisions[node_index * 4 + i].distribute_1;
+
+	assert(distribute_0 >= 0 && distribute_0 < 4);
+	assert(distribute_1 >= 0 && distribute_1 < 4);
+	
+	assert(child_count < 4);
+
+	// Recurse on left child if it needs to distribute
+	if (decisions[node.left * 4 + distribute_0].type == Decision::Type::DISTRIBUTE) {
+		get_children(node.left, nodes, distribute_0, child_count, children);
+	} else {
+		children[child_count++] = node.left;
+	}
+	
+	// Recurse on right child if it needs to distribute
+	if (decisions[(node.left + 1) * 4 + distribute_1].type == Decision::Type::DISTRIBUTE) {
+		get_children(node.left + 1, nodes, distribute_1, child_count, children);
+	} else {
+		children[child_count++] = node.left + 1;
+	}
+}
+
+// Recursively count primitives in subtree of the given Node
+// Simultaneously fills the indices buffer of the QBVH
+int QBVHBuilder::count_primitives(int node_index, const BVHNode nodes[], const int indices[]) {
+	const BVHNode & node = nodes[node_index];
+
+	if (node.is_leaf()) {
+		int primitive_count = node.get_count();
+
+		for (int i = 0; i < primitive_count; i++) {
+			qbvh->indices[qbvh->index_count++] = indices[node.first + i];
+		}
+
+		return primitive_count;
+	}
+
+	return 
+		count_primitives(node.left,     nodes, indices) +
+		count_primitives(node.left + 1, nodes, indices);
+}
+
+void QBVHBuilder::collapse_sah(const BVHNode nodes[], const int indices[], int node_index_qbvh, int node_index_bvh) {
+	QBVHNode & node = qbvh->nodes[node_index_qbvh];
+
+	int child_count = 0;
+	int children[4] = { -1, -1, -1, -1 };
+	get_children(node_index_bvh, nodes, 0, child_count, children);
+
+	assert(child_count >= 2 && child_count <= 4);
+
+	for (int i = 0; i < 4; i++) {
+		if (i >= child_count) {
+			node.get_index(i) = -1;
+			node.get_count(i) = -1;
+
+			continue;
+		}
+
+		const AABB & child_aabb = nodes[children[i]].aabb;
+
+		node.aabb_min_x[i] = child_aabb.min.x;
+		node.aabb_min_y[i] = child_aabb.min.y;
+		node.aabb_min_z[i] = child_aabb.min.z;
+		node.aabb_max_x[i] = child_aabb.max.x;
+		node.aabb_max_y[i] = child_aabb.max.y;
+		node.aabb_max_z[i] = child_aabb.max.z;
+
+		if (decisions[children[i] * 4].type == Decision::Type::LEAF) {
+			int first = qbvh->index_count;
+
+			node.get_index(i) = first;
+			node.get_count(i) = remove_duplicate_indices(qbvh->indices + first, count_primitives(children[i], nodes, indices));
+
+			qbvh->index_count = first + node.get_count(i);
+		} else {
+			node.get_index(i) = qbvh->node_count++;
+			node.get_count(i) = 0;
+		}
+	}
+
+	// Recurse on Internal Nodes
+	for (int i = 0; i < child_count; i++) {
+		if (node.get_count(i) == 0) {
+			collapse_sah(nodes, indices, node.get_index(i), children[i]);
+		}
+	}
+}
+
+void QBVHBuilder::build_sah(const BVH & bvh) {
+	// Check for the special case where the root is a leaf, the greedy collapse handles this without touching the indices
+	if (bvh.nodes[0].is_leaf()) {
+		build(bvh);
+
+		qbvh->indices = new int[bvh.index_count];
+		memcpy(qbvh->indices, bvh.indices, bvh.index_count * sizeof(int));
+
+		return;
+	}
+
+	cost      = new float   [bvh.node_count * 4];
+	decisions = new Decision[bvh.node_count * 4];
+
+	qbvh->index_count = 0;
+	qbvh->indices     = new int[bvh.index_count];
+
+	// Node 0 contains the children of the root, Node 1 points to Node 0 and serves as the starting point of traversal
+	qbvh->node_count = 2;
+
+	qbvh->nodes[1].get_index(0) = 0;
+	qbvh->nodes[1].get_count(0) = 0;
+
+	for (int i = 1; i < 4; i++) {
+		qbvh->nodes[1].get_index(i) = -1;
+		qbvh->nodes[1].get_count(i) = -1;
+	}
+
+	// Fill cost table using dynamic programming (bottom up)
+	calculate_cost(0, bvh.nodes);
+
+	// Collapse binary BVH into 4-way tree (top down)
+	collapse_sah(bvh.nodes, bvh.indices, 0, 0);
+
+	assert(qbvh->node_count  <= bvh.node_count);
+	assert(qbvh->index_count <= bvh.index_count);
+
+	delete [] cost;
+	delete [] decisions;
+}
@@ -7,6 +7,29 @@ private:
 
 	void collapse(int node_index);
 
+	// Used by the SAH-optimal collapse, same cost model as the CWBVHBuilder
+	struct Decision {
+		enum class Type : char {
+			LEAF,
+			INTERNAL,
+			DISTRIBUTE
+		} type;
+
+		char distribute_0 = -1;
+		char distribute_1 = -1;
+	};
+
+	float    * cost;
+	Decision * decisions;
+
+	int calculate_cost(int node_index, const BVHNode nodes[]);
+
+	void get_children(int node_index, const BVHNode nodes[], int i, int & child_count, int children[4]);
+
+	int count_primitives(int node_index, const BVHNode nodes[], const int indices[]);
+
+	void collapse_sah(const BVHNode nodes[], const int indices[], int node_index_qbvh, int node_index_bvh);
+
 public:
 	inline void init(QBVH * qbvh, const BVH & bvh) {
 		this->qbvh = qbvh;
@@ -19,5 +42,11 @@ public:
 
 	}
 
+	// Greedily collapses the binary BVH by adopting the children with the largest surface area.
+	// The QBVH Nodes keep the indices of the binary BVH Nodes, and the QBVH shares its indices with the binary BVH
 	void build(const BVH & bvh);
+
+	// Finds the collapse with the lowest SAH cost using dynamic programming, leaves may contain up to QBVH_MAX_PRIMITIVES_IN_LEAF primitives.
+	// Because leaves are merged the QBVH gets its own indices, the indices of the binary BVH are no longer needed afterwards
+	void build_sah(const BVH & bvh);
 };
@@ -0,0 +1,215 @@
+#include "QBVHTraversal.h"
+
+#include <xmmintrin.h>
+
+#include "TraversalStack.h"
+
+// Size of a Triangle as stored on the GPU (position_0, position_edge_1, position_edge_2 as float4)
+static constexpr int      GPU_TRIANGLE_SIZE       = 48;
+static constexpr uint64_t CACHE_ADDRESS_TRIANGLES = 1ull << 62;
+
+// Ray data splatted over all 4 lanes
+struct SIMDRay {
+	__m128 origin_x;
+	__m128 origin_y;
+	__m128 origin_z;
+
+	__m128 direction_inv_x;
+	__m128 direction_inv_y;
+	__m128 direction_inv_z;
+
+	inline SIMDRay(const Vector3 & origin, const Vector3 & direction) {
+		origin_x = _mm_set1_ps(origin.x);
+		origin_y = _mm_set1_ps(origin.y);
+		origin_z = _mm_set1_ps(origin.z);
+
+		direction_inv_x = _mm_set1_ps(1.0f / direction.x);
+		direction_inv_y = _mm_set1_ps(1.0f / direction.y);
+		direction_inv_z = _mm_set1_ps(1.0f / direction.z);
+	}
+};
+
+// Checks the Ray against the four AABBs of the children of the given Node,
+// returns a bitmask of the children that were hit and writes their entry distances
+static inline int intersect_children(const QBVHNode & node, const SIMDRay & ray, float max_distance, float t_near[4]) {
+	__m128 tx0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.aabb_min_x), ray.origin_x), ray.direction_inv_x);
+	__m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.aabb_max_x), ray.origin_x), ray.direction_inv_x);
+	__m128 ty0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.aabb_min_y), ray.origin_y), ray.direction_inv_y);
+	__m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.aabb_max_y), ray.origin_y), ray.direction_inv_y);
+	__m128 tz0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.aabb_min_z), ray.origin_z), ray.direction_inv_z);
+	__m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.aabb_max_z), ray.origin_z), ray.direction_inv_z);
+
+	__m128 t_min = _mm_max_ps(
+		_mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)),
+		_mm_max_ps(_mm_min_ps(tz0, tz1), _mm_set1_ps(EPSILON))
+	);
+	__m128 t_max = _mm_min_ps(
+		_mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)),
+		_mm_min_ps(_mm_max_ps(tz0, tz1), _mm_set1_ps(max_distance))
+	);
+
+	_mm_storeu_ps(t_near, t_min);
+
+	// Unlike the GPU the comparison is inclusive, so that flat AABBs of axis aligned Triangles are not missed
+	int mask = _mm_movemask_ps(_mm_cmple_ps(t_min, t_max));
+
+	// Mask out empty slots, these are always at the end
+	int child_count = node.get_child_count();
+
+	return mask & ((1 << child_count) - 1);
+}
+
+// Visits all leaves of the QBVH hit by the Ray, nearest first. The leaf callback receives the index and count
+// of the leaf and may lower the distance it is given, which prunes entries on the stack that are now further away.
+// If ANY_HIT is true traversal stops at the first leaf that reports a hit, and children are not sorted
+template<bool ANY_HIT, typename IntersectLeaf>
+static bool traverse(const QBVH & qbvh, const Vector3 & origin, const Vector3 & direction, float & max_distance, IntersectLeaf intersect_leaf, CacheSimulator * cache_simulator = nullptr) {
+	SIMDRay ray(origin, direction);
+
+	struct StackEntry {
+		int   index;
+		int   count;
+		float t_near;
+	};
+
+	TraversalStack<StackEntry> stack; // Grows by at most 3 entries per level of the QBVH
+
+	// Node 0 contains the children of the root
+	stack.push({ 0, 0, 0.0f });
+
+	bool hit = false;
+
+	while (stack.size > 0) {
+		StackEntry entry = stack.pop();
+
+		if (entry.t_near > max_distance) continue;
+
+		if (entry.count > 0) {
+			if (intersect_leaf(entry.index, entry.count, max_distance)) {
+				if (ANY_HIT) return true;
+
+				hit = true;
+			}
+
+			continue;
+		}
+
+		const QBVHNode & node = qbvh.nodes[entry.index];
+
+		if (cache_simulator) cache_simulator->access(&node, sizeof(QBVHNode));
+
+		float t_near[4];
+		int   mask = intersect_children(node, ray, max_distance, t_near);
+
+		// Order the children that were hit by distance, using insertion sort
+		int order[4];
+		int order_count = 0;
+
+		for (int i = 0; i < 4; i++) {
+			if ((mask & (1 << i)) == 0) continue;
+
+			int j = order_count++;
+
+			if (!ANY_HIT) {
+				while (j > 0 && t_near[order[j - 1]] > t_near[i]) {
+					order[j] = order[j - 1];
+					j--;
+				}
+			}
+
+			order[j] = i;
+		}
+
+		// Push in reverse order, so that the nearest child is popped first
+		for (int i = order_count - 1; i >= 0; i--) {
+			int child = order[i];
+
+			stack.push({ node.get_index(child), node.get_count(child), t_near[child] });
+		}
+	}
+
+	return hit;
+}
+
+template<bool ANY_HIT>
+static bool intersect_blas(const QBVH & qbvh, const Triangle * triangles, const Vector3 & origin, const Vector3 & direction, float & max_distance, RayHit & ray_hit, CacheSimulator * cache_simulator = nullptr) {
+	return traverse<ANY_HIT>(qbvh, origin, direction, max_distance, [&](int index, int count, float & distance) {
+		bool hit = false;
+
+		for (int i = index; i < index + count; i++) {
+			int triangle_id = qbvh.indices[i];
+
+			// On the GPU Triangles are stored in the order of the indices, they are given their own address range
+			if (cache_simulator) cache_simulator->access(CACHE_ADDRESS_TRIANGLES + uint64_t(i) * GPU_TRIANGLE_SIZE, GPU_TRIANGLE_SIZE);
+
+			float t, u, v;
+			if (ray_triangle_intersect(triangles[triangle_id], origin, direction, distance, t, u, v)) {
+				if (ANY_HIT) return true;
+
+				distance = t;
+
+				ray_hit.t = t;
+				ray_hit.u = u;
+				ray_hit.v = v;
+				ray_hit.triangle_id = triangle_id;
+
+				hit = true;
+			}
+		}
+
+		return hit;
+	}, cache_simulator);
+}
+
+template<bool ANY_HIT>
+static bool intersect_tlas(const QBVH & tlas, const QBVHTraversal::Instance instances[], const Vector3 & origin, const Vector3 & direction, float & max_distance, RayHit & ray_hit) {
+	return traverse<ANY_HIT>(tlas, origin, direction, max_distance, [&](int index, int count, float & distance) {
+		bool hit = false;
+
+		for (int i = index; i < index + count; i++) {
+			int mesh_id = tlas.indices[i];
+
+			const QBVHTraversal::Instance & instance = instances[mesh_id];
+
+			// Transform the Ray into object space of the Mesh, the direction is not normalized so distances stay the same
+			Vector3 origin_object    = Matrix4::transform_position (instance.transform_inv, origin);
+			Vector3 direction_object = Matrix4::transform_direction(instance.transform_inv, direction);
+
+			if (intersect_blas<ANY_HIT>(*instance.qbvh, instance.triangles, origin_object, direction_object, distance, ray_hit)) {
+				if (ANY_HIT) return true;
+
+				ray_hit.mesh_id = mesh_id;
+
+				hit = true;
+			}
+		}
+
+		return hit;
+	});
+}
+
+bool QBVHTraversal::intersect(const QBVH & qbvh, const Triangle * triangles, const Ray & ray, RayHit & ray_hit, CacheSimulator * cache_simulator) {
+	float max_distance = ray.max_distance;
+
+	return intersect_blas<false>(qbvh, triangles, ray.origin, ray.direction, max_distance, ray_hit, cache_simulator);
+}
+
+bool QBVHTraversal::intersect_any(const QBVH & qbvh, const Triangle * triangles, const Ray & ray, CacheSimulator * cache_simulator) {
+	float  max_distance = ray.max_distance;
+	RayHit ray_hit;
+
+	return intersect_blas<true>(qbvh, triangles, ray.origin, ray.direction, max_distance, ray_hit, cache_simulator);
+}
+
+bool QBVHTraversal::intersect(const QBVH & tlas, const Instance instances[], const Ray & ray, RayHit & ray_hit) {
+	float max_distance = ray.max_distance;
+
+	return intersect_tlas<false>(tlas, instances, ray.origin, ray.direction, max_distance, ray_hit);
+}
+
+bool QBVHTraversal::intersect_any(const QBVH & tlas, const Instance instances[], const Ray & ray) {
+	float  max_distance = ray.max_distance;
+	RayHit ray_hit;
+
+	return intersect_tlas<true>(tlas, instances, ray.origin, ray.direction, max_distance, ray_hit);
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include "BVH.h"
+
+#include "Ray.h"
+#include "Matrix4.h"
+#include "CacheSimulator.h"
+
+// Ray queries against a QBVH on the CPU, for picking, baking and validation without a GPU.
+// Every QBVH Node is tested as a whole using 4-wide SSE slab tests against the SoA AABBs of its children,
+// the hit children are visited front to back. Distances are preserved by the TLAS -> BLAS transform
+namespace QBVHTraversal {
+	// Single level, the Ray is in the space of the QBVH.
+	// If a CacheSimulator is given, every Node and Triangle fetch is passed to it
+	bool intersect    (const QBVH & qbvh, const Triangle * triangles, const Ray & ray, RayHit & ray_hit, CacheSimulator * cache_simulator = nullptr); // Closest hit, returns whether anything was hit
+	bool intersect_any(const QBVH & qbvh, const Triangle * triangles, const Ray & ray,                   CacheSimulator * cache_simulator = nullptr); // Returns as soon as anything is hit
+
+	struct Instance {
+		const QBVH     * qbvh;
+		const Triangle * triangles;
+
+		Matrix4 transform_inv;
+	};
+
+	// Two level, the leaves of the TLAS refer to Instances through tlas.indices.
+	// Before descending into a BLAS the Ray is transformed into its object space using the inverse transform of the Instance,
+	// in the same way the GPU uses mesh_transforms_inv
+	bool intersect    (const QBVH & tlas, const Instance instances[], const Ray & ray, RayHit & ray_hit);
+	bool intersect_any(const QBVH & tlas, const Instance instances[], const Ray & ray);
+}
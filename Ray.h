@@ -0,0 +1,45 @@
+#pragma once
+#include "Triangle.h"
+
+#include "CUDA_Source/Common.h"
+
+// Ray queries on the CPU. Like on the GPU the direction does not need to be normalized,
+// distances are expressed in multiples of the direction
+struct Ray {
+	Vector3 origin;
+	Vector3 direction;
+
+	float max_distance = INFINITY;
+};
+
+struct RayHit {
+	float t = INFINITY;
+	float u, v; // Barycentric coordinates
+
+	int mesh_id     = -1; // Index of the Instance that was hit, -1 for single level queries
+	int triangle_id = -1; // Index into the Triangles of the Mesh
+};
+
+// Möller-Trumbore, same as triangle_trace on the GPU
+inline bool ray_triangle_intersect(const Triangle & triangle, const Vector3 & origin, const Vector3 & direction, float max_distance, float & t, float & u, float & v) {
+	Vector3 edge_1 = triangle.position_1 - triangle.position_0;
+	Vector3 edge_2 = triangle.position_2 - triangle.position_0;
+
+	Vector3 h = Vector3::cross(direction, edge_2);
+	float   a = Vector3::dot(edge_1, h);
+
+	float   f = 1.0f / a;
+	Vector3 s = origin - triangle.position_0;
+	u = f * Vector3::dot(s, h);
+
+	if (u < 0.0f || u > 1.0f) return false;
+
+	Vector3 q = Vector3::cross(s, edge_1);
+	v = f * Vector3::dot(direction, q);
+
+	if (v < 0.0f || u + v > 1.0f) return false;
+
+	t = f * Vector3::dot(edge_2, q);
+
+	return t > EPSILON && t < max_distance;
+}
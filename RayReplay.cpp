@@ -0,0 +1,737 @@
+#include "RayReplay.h"
+
+#include <cstdio>
+#include <chrono>
+#include <algorithm>
+
+#include "MeshData.h"
+#include "Texture.h"
+#include "ThreadPool.h"
+#include "TraversalStack.h"
+
+#define RAY_FILETYPE_VERSION 1
+
+// Rays are replayed in parallel in chunks of this many Rays, a multiple of the warp size
+static constexpr int CHUNK_SIZE = 64 * WARP_SIZE;
+
+// Constants used by Dynamic Fetch Heuristic (see section 4.4 of Ylitie et al. 2017), same as in Tracing.h
+static constexpr int N_d = 4;
+static constexpr int N_w = 16;
+
+struct RayFileHeader {
+	char filetype_identifier[4];
+	char filetype_version;
+
+	int ray_set_count;
+};
+
+struct RaySetHeader {
+	RayReplay::RayType type;
+	int                bounce;
+	int                ray_count;
+};
+
+bool RayReplay::save(const char * filename, const std::vector<RaySet> & ray_sets) {
+	FILE * file;
+	fopen_s(&file, filename, "wb");
+
+	if (file == nullptr) {
+		printf("WARNING: Unable to save Rays to file %s!\n", filename);
+
+		return false;
+	}
+
+	RayFileHeader header = { };
+	header.filetype_identifier[0] = 'R';
+	header.filetype_identifier[1] = 'A';
+	header.filetype_identifier[2] = 'Y';
+	header.filetype_identifier[3] = '\0';
+	header.filetype_version = RAY_FILETYPE_VERSION;
+	header.ray_set_count = ray_sets.size();
+
+	fwrite(reinterpret_cast<const char *>(&header), sizeof(header), 1, file);
+
+	for (int i = 0; i < ray_sets.size(); i++) {
+		const RaySet & ray_set = ray_sets[i];
+
+		RaySetHeader ray_set_header = { ray_set.type, ray_set.bounce, int(ray_set.rays.size()) };
+
+		fwrite(reinterpret_cast<const char *>(&ray_set_header), sizeof(ray_set_header), 1,                    file);
+		fwrite(reinterpret_cast<const char *>(ray_set.rays.data()), sizeof(Ray),         ray_set.rays.size(), file);
+	}
+
+	fclose(file);
+
+	return true;
+}
+
+bool RayReplay::load(const char * filename, std::vector<RaySet> & ray_sets) {
+	FILE * file;
+	fopen_s(&file, filename, "rb");
+
+	if (file == nullptr) {
+		printf("WARNING: Unable to open Ray file '%s'!\n", filename);
+
+		return false;
+	}
+
+	RayFileHeader header = { };
+	bool success = fread(reinterpret_cast<char *>(&header), sizeof(header), 1, file) == 1;
+
+	if (!success || strcmp(header.filetype_identifier, "RAY") != 0 || header.filetype_version != RAY_FILETYPE_VERSION) {
+		printf("WARNING: Ray file '%s' is corrupt or outdated!\n", filename);
+
+		fclose(file);
+
+		return false;
+	}
+
+	ray_sets.resize(header.ray_set_count);
+
+	for (int i = 0; i < header.ray_set_count && success; i++) {
+		RaySet & ray_set = ray_sets[i];
+
+		RaySetHeader ray_set_header;
+		success = fread(reinterpret_cast<char *>(&ray_set_header), sizeof(ray_set_header), 1, file) == 1;
+
+		if (success) {
+			ray_set.type   = ray_set_header.type;
+			ray_set.bounce = ray_set_header.bounce;
+			ray_set.rays.resize(ray_set_header.ray_count);
+
+			success = fread(reinterpret_cast<char *>(ray_set.rays.data()), sizeof(Ray), ray_set_header.ray_count, file) == ray_set_header.ray_count;
+		}
+	}
+
+	fclose(file);
+
+	if (!success) {
+		printf("WARNING: Ray file '%s' is truncated!\n", filename);
+
+		ray_sets.clear();
+	}
+
+	return success;
+}
+
+static void finish_ray(RayReplay::Statistics & statistics, bool hit, int stack_depth_max) {
+	statistics.ray_count++;
+	if (hit) statistics.hit_count++;
+
+	statistics.stack_depth_max  = std::max(statistics.stack_depth_max, stack_depth_max);
+	statistics.stack_depth_sum += stack_depth_max;
+
+	if (stack_depth_max > SHARED_STACK_SIZE) statistics.stack_spill_count++;
+	if (stack_depth_max > BVH_STACK_SIZE)    statistics.stack_overflow_count++;
+}
+
+static void merge_statistics(RayReplay::Statistics & statistics, const RayReplay::Statistics & other) {
+	statistics.ray_count += other.ray_count;
+	statistics.hit_count += other.hit_count;
+
+	statistics.node_visits    += other.node_visits;
+	statistics.triangle_tests += other.triangle_tests;
+
+	statistics.stack_depth_max       = std::max(statistics.stack_depth_max, other.stack_depth_max);
+	statistics.stack_depth_sum      += other.stack_depth_sum;
+	statistics.stack_spill_count    += other.stack_spill_count;
+	statistics.stack_overflow_count += other.stack_overflow_count;
+
+	statistics.postpone_count += other.postpone_count;
+}
+
+// Calls replay_chunk(first, last, statistics) for chunks of the Ray set on the Thread Pool and merges the results
+template<typename ReplayChunk>
+static RayReplay::Statistics replay_parallel(const RayReplay::RaySet & ray_set, ReplayChunk replay_chunk) {
+	int ray_count   = ray_set.rays.size();
+	int chunk_count = (ray_count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+	std::vector<RayReplay::Statistics> chunk_statistics(chunk_count);
+
+	ThreadPool::TaskGroup group;
+
+	for (int i = 0; i < chunk_count; i++) {
+		int first = i * CHUNK_SIZE;
+		int last  = std::min(first + CHUNK_SIZE, ray_count);
+
+		RayReplay::Statistics * statistics = &chunk_statistics[i];
+
+		ThreadPool::submit(group, [&replay_chunk, first, last, statistics]() {
+			replay_chunk(first, last, *statistics);
+		});
+	}
+
+	ThreadPool::wait(group);
+
+	RayReplay::Statistics result;
+
+	for (int i = 0; i < chunk_count; i++) {
+		merge_statistics(result, chunk_statistics[i]);
+	}
+
+	return result;
+}
+
+static bool is_any_hit(const RayReplay::RaySet & ray_set) {
+	return ray_set.type == RayReplay::RayType::SHADOW;
+}
+
+static inline Vector3 calc_direction_inv(const Vector3 & direction) {
+	return Vector3(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+}
+
+// Same slab test as AABB::intersects in Tracing.h
+static inline bool aabb_intersect(const AABB & aabb, const Vector3 & origin, const Vector3 & direction_inv, float max_distance) {
+	Vector3 t0 = (aabb.min - origin) * direction_inv;
+	Vector3 t1 = (aabb.max - origin) * direction_inv;
+
+	float t_near = fmaxf(fminf(t0.x, t1.x), fmaxf(fminf(t0.y, t1.y), fmaxf(fminf(t0.z, t1.z), EPSILON)));
+	float t_far  = fminf(fmaxf(t0.x, t1.x), fminf(fmaxf(t0.y, t1.y), fminf(fmaxf(t0.z, t1.z), max_distance)));
+
+	return t_near < t_far;
+}
+
+static inline bool should_visit_left_first(const BVHNode & node, const Vector3 & direction) {
+	switch (node.count & BVH_AXIS_MASK) {
+		case BVH_AXIS_X_BITS: return direction.x > 0.0f;
+		case BVH_AXIS_Y_BITS: return direction.y > 0.0f;
+		case BVH_AXIS_Z_BITS: return direction.z > 0.0f;
+
+		default: return true;
+	}
+}
+
+// Port of bvh_trace and bvh_trace_shadow for the binary BVH
+template<bool ANY_HIT>
+static void trace(const BVH & bvh, const Triangle * triangles, const Ray & ray, RayReplay::Statistics & statistics) {
+	Vector3 direction_inv = calc_direction_inv(ray.direction);
+	float   max_distance  = ray.max_distance;
+
+	TraversalStack<int> stack; // Unbounded, so that Rays that would overflow the stack on the GPU can be counted
+
+	// Push root on stack
+	stack.push(0);
+
+	int stack_depth_max = stack.size;
+
+	bool hit = false;
+
+	while (stack.size > 0) {
+		const BVHNode & node = bvh.nodes[stack.pop()];
+
+		statistics.node_visits++;
+
+		if (!aabb_intersect(node.aabb, ray.origin, direction_inv, max_distance)) continue;
+
+		if (node.is_leaf()) {
+			for (int i = node.first; i < node.first + node.get_count(); i++) {
+				statistics.triangle_tests++;
+
+				float t, u, v;
+				if (ray_triangle_intersect(triangles[bvh.indices[i]], ray.origin, ray.direction, max_distance, t, u, v)) {
+					hit = true;
+
+					if (ANY_HIT) {
+						stack.size = 0;
+
+						break;
+					}
+
+					max_distance = t;
+				}
+			}
+		} else {
+			bool left_first = should_visit_left_first(node, ray.direction);
+
+			stack.push(left_first ? node.left + 1 : node.left);
+			stack.push(left_first ? node.left     : node.left + 1);
+
+			stack_depth_max = std::max(stack_depth_max, stack.size);
+		}
+	}
+
+	finish_ray(statistics, hit, stack_depth_max);
+}
+
+// Port of bvh_trace and bvh_trace_shadow for the QBVH, stack entries refer to a child slot of a Node
+template<bool ANY_HIT>
+static void trace(const QBVH & qbvh, const Triangle * triangles, const Ray & ray, RayReplay::Statistics & statistics) {
+	Vector3 direction_inv = calc_direction_inv(ray.direction);
+	float   max_distance  = ray.max_distance;
+
+	TraversalStack<unsigned> stack;
+
+	// Node 1 refers to the root through its first slot
+	stack.push(1);
+
+	int stack_depth_max = stack.size;
+
+	bool hit = false;
+
+	while (stack.size > 0) {
+		unsigned packed = stack.pop();
+
+		int node_index = packed & 0x3fffffff;
+		int node_id    = packed >> 30;
+
+		int index = qbvh.nodes[node_index].get_index(node_id);
+		int count = qbvh.nodes[node_index].get_count(node_id);
+
+		assert(index != -1 && count != -1);
+
+		if (count > 0) {
+			for (int j = index; j < index + count; j++) {
+				statistics.triangle_tests++;
+
+				float t, u, v;
+				if (ray_triangle_intersect(triangles[qbvh.indices[j]], ray.origin, ray.direction, max_distance, t, u, v)) {
+					hit = true;
+
+					if (ANY_HIT) {
+						stack.size = 0;
+
+						break;
+					}
+
+					max_distance = t;
+				}
+			}
+		} else {
+			const QBVHNode & node = qbvh.nodes[index];
+
+			statistics.node_visits++;
+
+			float t_near[4];
+			bool  hits  [4];
+
+			for (int i = 0; i < 4; i++) {
+				float tx0 = (node.aabb_min_x[i] - ray.origin.x) * direction_inv.x;
+				float tx1 = (node.aabb_max_x[i] - ray.origin.x) * direction_inv.x;
+				float ty0 = (node.aabb_min_y[i] - ray.origin.y) * direction_inv.y;
+				float ty1 = (node.aabb_max_y[i] - ray.origin.y) * direction_inv.y;
+				float tz0 = (node.aabb_min_z[i] - ray.origin.z) * direction_inv.z;
+				float tz1 = (node.aabb_max_z[i] - ray.origin.z) * direction_inv.z;
+
+				t_near[i]   = fmaxf(fminf(tx0, tx1), fmaxf(fminf(ty0, ty1), fmaxf(fminf(tz0, tz1), EPSILON)));
+				float t_far = fminf(fmaxf(tx0, tx1), fminf(fmaxf(ty0, ty1), fminf(fmaxf(tz0, tz1), max_distance)));
+
+				// Empty slots have a zero AABB, on the GPU they are never hit in practice
+				hits[i] = t_near[i] < t_far && node.get_count(i) != -1;
+			}
+
+			// Same bubble sort as the GPU, the furthest child is pushed first so that the nearest is popped first
+			int order[4] = { 0, 1, 2, 3 };
+
+			for (int i = 1; i < 4; i++) {
+				for (int j = i - 1; j >= 0; j--) {
+					if (t_near[order[j]] < t_near[order[j + 1]]) {
+						std::swap(order[j], order[j + 1]);
+					}
+				}
+			}
+
+			for (int i = 0; i < 4; i++) {
+				int id = order[i];
+
+				if (hits[id]) {
+					stack.push((id << 30) | index);
+				}
+			}
+
+			stack_depth_max = std::max(stack_depth_max, stack.size);
+		}
+	}
+
+	finish_ray(statistics, hit, stack_depth_max);
+}
+
+static inline unsigned msb(unsigned value) {
+	assert(value != 0);
+
+	unsigned index = 31;
+	while ((value & (1u << index)) == 0) index--;
+
+	return index;
+}
+
+static inline unsigned popcount(unsigned value) {
+	unsigned count = 0;
+
+	while (value) {
+		value &= value - 1;
+		count++;
+	}
+
+	return count;
+}
+
+static inline float uint_as_float(unsigned value) {
+	float result;
+	memcpy(&result, &value, sizeof(float));
+
+	return result;
+}
+
+// Node group or triangle group, same as the uint2 used on the GPU
+struct Group {
+	unsigned base;
+	unsigned mask;
+};
+
+// State of a single thread of a warp tracing through a CWBVH
+struct WarpThread {
+	const Ray * ray = nullptr; // Null if the thread has no more Rays to trace
+
+	Vector3  direction_inv;
+	unsigned oct_inv;
+
+	float max_distance;
+	bool  hit;
+
+	TraversalStack<Group> stack;
+	int                   stack_depth_max;
+
+	Group current_group  = { 0, 0 };
+	Group triangle_group = { 0, 0 };
+
+	inline void init(const Ray & ray) {
+		this->ray = &ray;
+
+		direction_inv = calc_direction_inv(ray.direction);
+
+		// Ray octant, encoded in 3 bits
+		unsigned oct =
+			(ray.direction.x < 0.0f ? 0b100 : 0) |
+			(ray.direction.y < 0.0f ? 0b010 : 0) |
+			(ray.direction.z < 0.0f ? 0b001 : 0);
+
+		oct_inv = 7 - oct;
+
+		max_distance = ray.max_distance;
+		hit          = false;
+
+		stack.size      = 0;
+		stack_depth_max = 0;
+
+		current_group = { 0, 0x80000000 };
+	}
+
+	inline void push(const Group & group) {
+		stack.push(group);
+		stack_depth_max = std::max(stack_depth_max, stack.size);
+	}
+
+	inline bool is_inactive() const {
+		return stack.size == 0 && current_group.mask == 0;
+	}
+};
+
+// Same as cwbvh_node_intersect, returns the triangle bits in the lowest 24 bits and the child Node bits in the highest 8 bits
+static inline unsigned node_intersect(const CWBVHNode & node, const WarpThread & thread) {
+	const Vector3 & origin    = thread.ray->origin;
+	const Vector3 & direction = thread.ray->direction;
+
+	Vector3 adjusted_ray_direction_inv(
+		uint_as_float(unsigned(node.e[0]) << 23) * thread.direction_inv.x,
+		uint_as_float(unsigned(node.e[1]) << 23) * thread.direction_inv.y,
+		uint_as_float(unsigned(node.e[2]) << 23) * thread.direction_inv.z
+	);
+	Vector3 adjusted_ray_origin = (node.p - origin) * thread.direction_inv;
+
+	// Select near and far planes based on ray octant
+	const byte * x_min = direction.x < 0.0f ? node.quantized_max_x : node.quantized_min_x;
+	const byte * x_max = direction.x < 0.0f ? node.quantized_min_x : node.quantized_max_x;
+	const byte * y_min = direction.y < 0.0f ? node.quantized_max_y : node.quantized_min_y;
+	const byte * y_max = direction.y < 0.0f ? node.quantized_min_y : node.quantized_max_y;
+	const byte * z_min = direction.z < 0.0f ? node.quantized_max_z : node.quantized_min_z;
+	const byte * z_max = direction.z < 0.0f ? node.quantized_min_z : node.quantized_max_z;
+
+	unsigned hit_mask = 0;
+
+	for (int i = 0; i < 8; i++) {
+		float tmin = fmaxf(fmaxf(
+			fmaf(float(x_min[i]), adjusted_ray_direction_inv.x, adjusted_ray_origin.x),
+			fmaf(float(y_min[i]), adjusted_ray_direction_inv.y, adjusted_ray_origin.y)),
+			fmaxf(fmaf(float(z_min[i]), adjusted_ray_direction_inv.z, adjusted_ray_origin.z), EPSILON)
+		);
+		float tmax = fminf(fminf(
+			fmaf(float(x_max[i]), adjusted_ray_direction_inv.x, adjusted_ray_origin.x),
+			fmaf(float(y_max[i]), adjusted_ray_direction_inv.y, adjusted_ray_origin.y)),
+			fminf(fmaf(float(z_max[i]), adjusted_ray_direction_inv.z, adjusted_ray_origin.z), thread.max_distance)
+		);
+
+		if (tmin < tmax) {
+			unsigned meta = node.meta[i];
+
+			// Child Nodes are reordered by the octant of the Ray, so that popping the highest bit first visits them front to back
+			bool     is_inner   = (meta & (meta << 1)) & 0b00010000;
+			unsigned bit_index  = (is_inner ? meta ^ thread.oct_inv : meta) & 0b00011111;
+			unsigned child_bits = meta >> 5;
+
+			hit_mask |= child_bits << bit_index;
+		}
+	}
+
+	return hit_mask;
+}
+
+// Simulates a single persistent warp that traces the Rays [first, last> of the Ray set through the CWBVH,
+// executing one iteration of the traversal loop of bvh_trace or bvh_trace_shadow for all active threads at a time
+template<bool ANY_HIT>
+static void trace_warp(const CWBVH & cwbvh, const Triangle * triangles, const std::vector<Ray> & rays, int first, int last, RayReplay::Statistics & statistics) {
+	WarpThread threads[WARP_SIZE];
+
+	int rays_retired = first;
+
+	while (true) {
+		// Inactive threads fetch a new Ray, threads that run out of Rays leave the kernel
+		int thread_count = 0;
+
+		for (int t = 0; t < WARP_SIZE; t++) {
+			WarpThread & thread = threads[t];
+
+			if (thread.is_inactive()) {
+				if (rays_retired < last) {
+					thread.init(rays[rays_retired++]);
+				} else {
+					thread.ray = nullptr;
+				}
+			}
+
+			if (thread.ray) thread_count++;
+		}
+
+		if (thread_count == 0) break;
+
+		bool traversing[WARP_SIZE];
+		for (int t = 0; t < WARP_SIZE; t++) {
+			traversing[t] = threads[t].ray != nullptr;
+		}
+
+		int iterations_lost = 0;
+
+		do {
+			int active_count = 0;
+
+			for (int t = 0; t < WARP_SIZE; t++) {
+				if (!traversing[t]) continue;
+
+				WarpThread & thread = threads[t];
+				active_count++;
+
+				if (thread.current_group.mask & 0xff000000) {
+					unsigned hits_imask = thread.current_group.mask;
+
+					unsigned child_index_offset = msb(hits_imask);
+					unsigned child_index_base   = thread.current_group.base;
+
+					// Remove n from current_group
+					thread.current_group.mask &= ~(1 << child_index_offset);
+
+					// If the node group is not yet empty, push it on the stack
+					if (thread.current_group.mask & 0xff000000) {
+						thread.push(thread.current_group);
+					}
+
+					unsigned slot_index     = (child_index_offset - 24) ^ thread.oct_inv;
+					unsigned relative_index = popcount(hits_imask & ~(0xffffffff << slot_index));
+
+					const CWBVHNode & node = cwbvh.nodes[child_index_base + relative_index];
+
+					statistics.node_visits++;
+
+					unsigned hit_mask = node_intersect(node, thread);
+
+					thread.current_group  = { node.base_index_child,    (hit_mask & 0xff000000) | unsigned(node.imask) };
+					thread.triangle_group = { node.base_index_triangle,  hit_mask & 0x00ffffff };
+				} else {
+					thread.triangle_group = thread.current_group;
+					thread.current_group  = { 0, 0 };
+				}
+			}
+
+			int postpone_threshold = active_count / CWBVH_TRIANGLE_POSTPONING_THRESHOLD_DIVISOR;
+
+			// Threads that are still in the triangle loop, the loop runs in lockstep
+			bool testing_triangles[WARP_SIZE];
+			for (int t = 0; t < WARP_SIZE; t++) {
+				testing_triangles[t] = traversing[t] && threads[t].triangle_group.mask != 0;
+			}
+
+			while (true) {
+				int triangle_thread_count = 0;
+				for (int t = 0; t < WARP_SIZE; t++) {
+					if (testing_triangles[t]) triangle_thread_count++;
+				}
+
+				if (triangle_thread_count == 0) break;
+
+				for (int t = 0; t < WARP_SIZE; t++) {
+					if (!testing_triangles[t]) continue;
+
+					WarpThread & thread = threads[t];
+
+					if (triangle_thread_count < postpone_threshold) {
+						// Not enough threads currently active that want to check triangle intersection, postpone by pushing on the stack
+						thread.push(thread.triangle_group);
+						statistics.postpone_count++;
+
+						testing_triangles[t] = false;
+
+						continue;
+					}
+
+					unsigned triangle_offset = msb(thread.triangle_group.mask);
+					thread.triangle_group.mask &= ~(1 << triangle_offset);
+
+					statistics.triangle_tests++;
+
+					int triangle_id = cwbvh.indices[thread.triangle_group.base + triangle_offset];
+
+					float t_hit, u, v;
+					if (ray_triangle_intersect(triangles[triangle_id], thread.ray->origin, thread.ray->direction, thread.max_distance, t_hit, u, v)) {
+						thread.hit = true;
+
+						if (ANY_HIT) {
+							thread.stack.size         = 0;
+							thread.current_group.mask = 0;
+
+							testing_triangles[t] = false;
+
+							continue;
+						}
+
+						thread.max_distance = t_hit;
+					}
+
+					if (thread.triangle_group.mask == 0) testing_triangles[t] = false;
+				}
+			}
+
+			int traversing_count = 0;
+
+			for (int t = 0; t < WARP_SIZE; t++) {
+				if (!traversing[t]) continue;
+
+				WarpThread & thread = threads[t];
+
+				if ((thread.current_group.mask & 0xff000000) == 0) {
+					if (thread.stack.size == 0) {
+						finish_ray(statistics, thread.hit, thread.stack_depth_max);
+
+						thread.current_group.mask = 0;
+						traversing[t] = false;
+
+						continue;
+					}
+
+					thread.current_group = thread.stack.pop();
+				}
+
+				traversing_count++;
+			}
+
+			if (traversing_count == 0) break;
+
+			iterations_lost += WARP_SIZE - traversing_count - N_d;
+		} while (iterations_lost < N_w);
+	}
+}
+
+RayReplay::Statistics RayReplay::replay(const BVH & bvh, const Triangle * triangles, const RaySet & ray_set) {
+	return replay_parallel(ray_set, [&](int first, int last, Statistics & statistics) {
+		for (int i = first; i < last; i++) {
+			if (is_any_hit(ray_set)) {
+				trace<true> (bvh, triangles, ray_set.rays[i], statistics);
+			} else {
+				trace<false>(bvh, triangles, ray_set.rays[i], statistics);
+			}
+		}
+	});
+}
+
+RayReplay::Statistics RayReplay::replay(const QBVH & qbvh, const Triangle * triangles, const RaySet & ray_set) {
+	return replay_parallel(ray_set, [&](int first, int last, Statistics & statistics) {
+		for (int i = first; i < last; i++) {
+			if (is_any_hit(ray_set)) {
+				trace<true> (qbvh, triangles, ray_set.rays[i], statistics);
+			} else {
+				trace<false>(qbvh, triangles, ray_set.rays[i], statistics);
+			}
+		}
+	});
+}
+
+RayReplay::Statistics RayReplay::replay(const CWBVH & cwbvh, const Triangle * triangles, const RaySet & ray_set) {
+	return replay_parallel(ray_set, [&](int first, int last, Statistics & statistics) {
+		if (is_any_hit(ray_set)) {
+			trace_warp<true> (cwbvh, triangles, ray_set.rays, first, last, statistics);
+		} else {
+			trace_warp<false>(cwbvh, triangles, ray_set.rays, first, last, statistics);
+		}
+	});
+}
+
+static const char * get_ray_type_name(RayReplay::RayType type) {
+	switch (type) {
+		case RayReplay::RayType::PRIMARY: return "Primary";
+		case RayReplay::RayType::BOUNCE:  return "Bounce";
+		case RayReplay::RayType::SHADOW:  return "Shadow";
+
+		default: abort();
+	}
+}
+
+bool RayReplay::replay(const char * obj_filename, const char * rays_filename) {
+	std::vector<RaySet> ray_sets;
+	if (!load(rays_filename, ray_sets)) return false;
+
+	int mesh_data_indices[BVH_TYPE_COUNT];
+
+	for (int bvh_type = 0; bvh_type < BVH_TYPE_COUNT; bvh_type++) {
+		mesh_data_indices[bvh_type] = MeshData::load(obj_filename, bvh_type);
+	}
+
+	for (int i = 0; i < ray_sets.size(); i++) {
+		const RaySet & ray_set = ray_sets[i];
+
+		printf("\n%s Rays, bounce %i, %zu Rays\n", get_ray_type_name(ray_set.type), ray_set.bounce, ray_set.rays.size());
+		printf("Type  | Hit rate | Nodes/Ray | Triangles/Ray | Stack avg | Stack max | Spilled | Overflowed | Postponed/Ray | Time\n");
+
+		if (ray_set.rays.empty()) continue;
+
+		for (int bvh_type = 0; bvh_type < BVH_TYPE_COUNT; bvh_type++) {
+			const MeshData * mesh_data = MeshData::mesh_datas[mesh_data_indices[bvh_type]];
+
+			Statistics statistics;
+
+			std::chrono::high_resolution_clock::time_point start_time = std::chrono::high_resolution_clock::now();
+
+			mesh_data->visit_bvh([&](const auto & bvh) {
+				statistics = replay(bvh, mesh_data->triangles, ray_set);
+			});
+
+			std::chrono::high_resolution_clock::time_point stop_time = std::chrono::high_resolution_clock::now();
+
+			float ray_count_inv = 1.0f / float(statistics.ray_count);
+
+			printf("%-5s | %7.2f%% | %9.2f | %13.2f | %9.2f | %9i | %7i | %10i | %13.3f | %llu ms\n",
+				get_bvh_type_name(bvh_type),
+				100.0f * float(statistics.hit_count) * ray_count_inv,
+				float(statistics.node_visits)    * ray_count_inv,
+				float(statistics.triangle_tests) * ray_count_inv,
+				float(statistics.stack_depth_sum) * ray_count_inv,
+				statistics.stack_depth_max,
+				statistics.stack_spill_count,
+				statistics.stack_overflow_count,
+				float(statistics.postpone_count) * ray_count_inv,
+				std::chrono::duration_cast<std::chrono::milliseconds>(stop_time - start_time).count()
+			);
+		}
+	}
+
+	// Loading the MeshDatas started loading their Textures on separate threads, make sure they are done before returning
+	Texture::wait_until_textures_loaded();
+
+	return true;
+}
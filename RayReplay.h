@@ -0,0 +1,52 @@
+#pragma once
+#include <vector>
+
+#include "BVH.h"
+#include "Ray.h"
+
+// Captured sets of Rays that can be traced against any BVH type on the CPU, without a GPU.
+// The Pathtracer dumps the Rays it traces during a single frame (see Pathtracer::capture_rays),
+// replaying them against BVH's built with different settings or layouts gives comparable traversal statistics.
+// Traversal mirrors bvh_trace and bvh_trace_shadow in Tracing.h, for the CWBVH Rays are simulated in warps of
+// WARP_SIZE threads that step in lockstep, so that triangle postponing and the dynamic fetch heuristic behave as on the GPU.
+// Rays are traced in the object space of the given Mesh, which is the same as world space for a Mesh without transform
+namespace RayReplay {
+	enum struct RayType : int {
+		PRIMARY,
+		BOUNCE,
+		SHADOW
+	};
+
+	struct RaySet {
+		RayType type;
+		int     bounce;
+
+		std::vector<Ray> rays; // Primary and bounce Rays have an infinite max distance
+	};
+
+	bool save(const char * filename, const std::vector<RaySet> & ray_sets);
+	bool load(const char * filename,       std::vector<RaySet> & ray_sets);
+
+	struct Statistics {
+		int ray_count = 0;
+		int hit_count = 0;
+
+		long long node_visits    = 0; // Number of Node intersection tests
+		long long triangle_tests = 0;
+
+		int       stack_depth_max      = 0;
+		long long stack_depth_sum      = 0; // Sum of the deepest stack of every Ray
+		int       stack_spill_count    = 0; // Rays whose stack exceeded SHARED_STACK_SIZE and spilled into local memory
+		int       stack_overflow_count = 0; // Rays whose stack exceeded BVH_STACK_SIZE, these would corrupt memory on the GPU
+
+		long long postpone_count = 0; // CWBVH only, number of times a triangle group was pushed back on the stack
+	};
+
+	// Shadow Rays are any hit queries, all other Rays look for the closest hit
+	Statistics replay(const BVH   & bvh,   const Triangle * triangles, const RaySet & ray_set);
+	Statistics replay(const QBVH  & qbvh,  const Triangle * triangles, const RaySet & ray_set);
+	Statistics replay(const CWBVH & cwbvh, const Triangle * triangles, const RaySet & ray_set);
+
+	// Loads the .obj file with every BVH type, replays every Ray set in the given file against each of them and prints the statistics
+	bool replay(const char * obj_filename, const char * rays_filename);
+}
@@ -5,19 +5,380 @@
 #include "BVHPartitions.h"
 
 #include "Util.h"
+#include "ThreadPool.h"
 #include "ScopeTimer.h"
 
-int SBVHBuilder::build_sbvh(BVHNode & node, const Triangle * triangles, PrimitiveRef * indices[3], int & node_index, int first_index, int index_count, float inv_root_surface_area) {
+using PrimitiveRef = BVHPartitions::PrimitiveRef;
+
+// Orders references by the center of their AABB along the given dimension, ties are broken by Triangle index.
+// A Node never contains two references to the same Triangle, which makes this a strict total order
+static bool reference_less(const PrimitiveRef & a, const PrimitiveRef & b, int dimension) {
+	float center_a = a.aabb.get_center()[dimension];
+	float center_b = b.aabb.get_center()[dimension];
+
+	return center_a < center_b || (center_a == center_b && a.index < b.index);
+}
+
+// Invokes the function for all 3 dimensions, if parallel is true every dimension is processed by a separate Task
+template<typename Function>
+static void for_each_dimension(bool parallel, Function function) {
+	if (parallel) {
+		ThreadPool::TaskGroup group;
+
+		for (int dimension = 0; dimension < 3; dimension++) {
+			ThreadPool::submit(group, [&function, dimension]() { function(dimension); });
+		}
+
+		ThreadPool::wait(group);
+	} else {
+		for (int dimension = 0; dimension < 3; dimension++) {
+			function(dimension);
+		}
+	}
+}
+
+// Merges the clipped references into the sorted references, both end up sorted along the given dimension
+static void merge_clipped(std::vector<PrimitiveRef> & references, std::vector<PrimitiveRef> & clipped, int dimension) {
+	if (clipped.empty()) return;
+
+	auto compare = [dimension](const PrimitiveRef & a, const PrimitiveRef & b) { return reference_less(a, b, dimension); };
+
+	std::sort(clipped.begin(), clipped.end(), compare);
+
+	std::vector<PrimitiveRef> merged(references.size() + clipped.size());
+	std::merge(references.begin(), references.end(), clipped.begin(), clipped.end(), merged.begin(), compare);
+
+	references = std::move(merged);
+}
+
+// Decision made for a reference that straddles the plane of a Spatial Split
+struct Straddler {
+	int  index;
+	bool goes_left;
+	bool goes_right;
+
+	AABB aabb_left;
+	AABB aabb_right;
+};
+
+BVHPartitions::ObjectSplit SBVHBuilder::partition_object(References & references, Scratch & scratch) {
+	int index_count = references.size();
+
+	bool parallel = index_count >= PARALLEL_PARTITION_THRESHOLD;
+
+	BVHPartitions::ObjectSplit splits[3];
+
+	for_each_dimension(parallel, [&](int dimension) {
+		// Dimensions that are evaluated in parallel need their own scratch memory
+		Scratch   scratch_parallel;
+		Scratch & scratch_dimension = parallel ? scratch_parallel : scratch;
+
+		scratch_dimension.sah   .resize(index_count);
+		scratch_dimension.bounds.resize(6 * index_count);
+
+		splits[dimension] = { };
+		splits[dimension].cost      = INFINITY;
+		splits[dimension].index     = -1;
+		splits[dimension].dimension = -1;
+
+		BVHSweep::BoundsSoA bounds = BVHSweep::BoundsSoA::from_memory(scratch_dimension.bounds.data(), index_count);
+
+		BVHPartitions::partition_object_dimension(references.sorted[dimension].data(), 0, index_count, bounds, scratch_dimension.sah.data(), dimension, splits[dimension]);
+	});
+
+	// Combine the results in the same order as a single threaded evaluation would
+	BVHPartitions::ObjectSplit split = splits[0];
+
+	for (int dimension = 1; dimension < 3; dimension++) {
+		if (splits[dimension].cost < split.cost) {
+			split = splits[dimension];
+		}
+	}
+
+	return split;
+}
+
+BVHPartitions::SpatialSplit SBVHBuilder::partition_spatial(References & references, const AABB & bounds) {
+	int index_count = references.size();
+
+	bool parallel = index_count >= PARALLEL_PARTITION_THRESHOLD;
+
+	BVHPartitions::SpatialSplit splits[3];
+
+	for_each_dimension(parallel, [&](int dimension) {
+		splits[dimension] = { };
+		splits[dimension].cost      = INFINITY;
+		splits[dimension].index     = -1;
+		splits[dimension].dimension = -1;
+		splits[dimension].plane_distance = NAN;
+
+		BVHPartitions::partition_spatial_dimension(triangles, references.sorted[dimension].data(), 0, index_count, bounds, dimension, splits[dimension]);
+	});
+
+	// Combine the results in the same order as a single threaded evaluation would
+	BVHPartitions::SpatialSplit split = splits[0];
+
+	for (int dimension = 1; dimension < 3; dimension++) {
+		if (splits[dimension].cost < split.cost) {
+			split = splits[dimension];
+		}
+	}
+
+	return split;
+}
+
+void SBVHBuilder::split_object(References & references, const BVHPartitions::ObjectSplit & object_split, References & children_left, References & children_right) {
+	int index_count = references.size();
+
+	// The first reference on the right side of the split, every reference that is ordered before it goes left
+	PrimitiveRef split_reference = references.sorted[object_split.dimension][object_split.index];
+
+	for_each_dimension(index_count >= PARALLEL_PARTITION_THRESHOLD, [&](int dimension) {
+		std::vector<PrimitiveRef> & left  = children_left .sorted[dimension];
+		std::vector<PrimitiveRef> & right = children_right.sorted[dimension];
+
+		left .reserve(object_split.index);
+		right.reserve(index_count - object_split.index);
+
+		for (const PrimitiveRef & reference : references.sorted[dimension]) {
+			if (reference_less(reference, split_reference, object_split.dimension)) {
+				left.push_back(reference);
+			} else {
+				right.push_back(reference);
+			}
+		}
+	});
+
+	// Using object split, no duplicates can occur.
+	// Thus, left + right should equal the total number of triangles
+	assert(children_left.size() == object_split.index);
+	assert(children_left.size() + children_right.size() == index_count);
+}
+
+void SBVHBuilder::split_spatial(References & references, BVHPartitions::SpatialSplit & spatial_split, References & children_left, References & children_right, const AABB & bounds) {
+	int index_count = references.size();
+
+	int dimension_split = spatial_split.dimension;
+
+	float bounds_min = bounds.min[dimension_split] - 0.001f;
+	float bounds_max = bounds.max[dimension_split] + 0.001f;
+
+	float inv_bounds_delta = 1.0f / (bounds_max - bounds_min);
+
+	auto calc_bin_min = [&](const AABB & aabb) { return int(BVHPartitions::SBVH_BIN_COUNT * ((aabb.min[dimension_split] - bounds_min) * inv_bounds_delta)); };
+	auto calc_bin_max = [&](const AABB & aabb) { return int(BVHPartitions::SBVH_BIN_COUNT * ((aabb.max[dimension_split] - bounds_min) * inv_bounds_delta)); };
+
+	// Keep track of amount of rejected references on both sides for debugging purposes
+	int rejected_left  = 0;
+	int rejected_right = 0;
+
+	float n_1 = float(spatial_split.num_left);
+	float n_2 = float(spatial_split.num_right);
+
+	std::vector<Straddler> straddlers;
+
+	// Decide what happens to the references that straddle the split plane.
+	// Unsplitting depends on the decisions made for previous references, so this is done in order along the split dimension
+	for (const PrimitiveRef & reference : references.sorted[dimension_split]) {
+		const AABB & triangle_aabb = reference.aabb;
+
+		bool goes_left  = calc_bin_min(triangle_aabb) <  spatial_split.index;
+		bool goes_right = calc_bin_max(triangle_aabb) >= spatial_split.index;
+
+		assert(goes_left || goes_right);
+
+		if (!(goes_left && goes_right)) {
+			if (goes_left) {
+				spatial_split.aabb_left.expand(triangle_aabb);
+			} else {
+				spatial_split.aabb_right.expand(triangle_aabb);
+			}
+
+			continue;
+		}
+
+		// Consider unsplitting
+		AABB delta_left  = spatial_split.aabb_left;
+		AABB delta_right = spatial_split.aabb_right;
+
+		delta_left .expand(triangle_aabb);
+		delta_right.expand(triangle_aabb);
+
+		float spatial_split_aabb_left_surface_area  = spatial_split.aabb_left .surface_area();
+		float spatial_split_aabb_right_surface_area = spatial_split.aabb_right.surface_area();
+
+		// Calculate SAH cost for the 3 different cases
+		float c_split = spatial_split_aabb_left_surface_area   *  n_1       + spatial_split_aabb_right_surface_area   *  n_2;
+		float c_1     =              delta_left.surface_area() *  n_1       + spatial_split_aabb_right_surface_area   * (n_2-1.0f);
+		float c_2     = spatial_split_aabb_left_surface_area   * (n_1-1.0f) +              delta_right.surface_area() *  n_2;
+
+		// If C_1 resp. C_2 is cheapest, let the triangle go left resp. right
+		// Otherwise, do nothing and let the triangle go both left and right
+		if (c_1 < c_split) {
+			if (c_2 < c_1) { // C_2 is cheapest, remove from left
+				goes_left = false;
+				rejected_left++;
+
+				n_1 -= 1.0f;
+
+				spatial_split.aabb_right.expand(triangle_aabb);
+			} else { // C_1 is cheapest, remove from right
+				goes_right = false;
+				rejected_right++;
+
+				n_2 -= 1.0f;
+
+				spatial_split.aabb_left.expand(triangle_aabb);
+			}
+		} else if (c_2 < c_split) { // C_2 is cheapest, remove from left
+			goes_left = false;
+			rejected_left++;
+
+			n_1 -= 1.0f;
+
+			spatial_split.aabb_right.expand(triangle_aabb);
+		}
+
+		Straddler straddler = { reference.index, goes_left, goes_right };
+
+		if (goes_left && goes_right) {
+			const Triangle & triangle = triangles[reference.index];
+
+			Vector3 vertices[3] = {
+				triangle.position_0,
+				triangle.position_1,
+				triangle.position_2
+			};
+
+			// Sort the vertices along the current dimension
+			if (vertices[0][dimension_split] > vertices[1][dimension_split]) Util::swap(vertices[0], vertices[1]);
+			if (vertices[1][dimension_split] > vertices[2][dimension_split]) Util::swap(vertices[1], vertices[2]);
+			if (vertices[0][dimension_split] > vertices[1][dimension_split]) Util::swap(vertices[0], vertices[1]);
+
+			Vector3 intersections[6];
+			int     intersection_count = 0;
+
+			BVHPartitions::triangle_intersect_plane(vertices, dimension_split, spatial_split.plane_distance, intersections, &intersection_count);
+
+			assert(intersection_count < Util::array_element_count(intersections));
+
+			// All intersection points should be included both AABBs
+			AABB aabb_intersections = AABB::from_points(intersections, intersection_count);
+			AABB aabb_left 	= aabb_intersections;
+			AABB aabb_right = aabb_intersections;
+
+			for (int v = 0; v < 3; v++) {
+				if (vertices[v][dimension_split] < spatial_split.plane_distance) {
+					aabb_left.expand(vertices[v]);
+				} else {
+					aabb_right.expand(vertices[v]);
+				}
+			}
+
+			aabb_left.min = Vector3::max(aabb_left.min, triangle_aabb.min);
+			aabb_left.max = Vector3::min(aabb_left.max, triangle_aabb.max);
+			aabb_right.min = Vector3::max(aabb_right.min, triangle_aabb.min);
+			aabb_right.max = Vector3::min(aabb_right.max, triangle_aabb.max);
+
+			aabb_left .fix_if_needed();
+			aabb_right.fix_if_needed();
+
+			spatial_split.aabb_left .expand(aabb_left);
+			spatial_split.aabb_right.expand(aabb_right);
+
+			straddler.aabb_left  = aabb_left;
+			straddler.aabb_right = aabb_right;
+		}
+
+		straddlers.push_back(straddler);
+	}
+
+	// Sort the straddlers by Triangle index so they can be looked up while distributing the other dimensions
+	std::sort(straddlers.begin(), straddlers.end(), [](const Straddler & a, const Straddler & b) { return a.index < b.index; });
+
+	// Distribute the references over the children. References that are not clipped keep their AABB and thus their relative order,
+	// clipped references are sorted separately and merged in afterwards
+	for_each_dimension(index_count >= PARALLEL_PARTITION_THRESHOLD, [&](int dimension) {
+		std::vector<PrimitiveRef> & left  = children_left .sorted[dimension];
+		std::vector<PrimitiveRef> & right = children_right.sorted[dimension];
+
+		std::vector<PrimitiveRef> clipped_left;
+		std::vector<PrimitiveRef> clipped_right;
+
+		for (const PrimitiveRef & reference : references.sorted[dimension]) {
+			bool goes_left  = calc_bin_min(reference.aabb) <  spatial_split.index;
+			bool goes_right = calc_bin_max(reference.aabb) >= spatial_split.index;
+
+			if (goes_left && goes_right) {
+				const Straddler & straddler = *std::lower_bound(straddlers.begin(), straddlers.end(), reference.index, [](const Straddler & straddler, int index) {
+					return straddler.index < index;
+				});
+				assert(straddler.index == reference.index);
+
+				if (straddler.goes_left && straddler.goes_right) {
+					clipped_left .push_back({ reference.index, straddler.aabb_left  });
+					clipped_right.push_back({ reference.index, straddler.aabb_right });
+
+					continue;
+				}
+
+				goes_left = straddler.goes_left;
+			}
+
+			if (goes_left) {
+				left.push_back(reference);
+			} else {
+				right.push_back(reference);
+			}
+		}
+
+		merge_clipped(left,  clipped_left,  dimension);
+		merge_clipped(right, clipped_right, dimension);
+	});
+
+	// We should have made the same decision (going left/right) in every dimension
+	assert(children_left .sorted[0].size() == children_left .sorted[1].size() && children_left .sorted[1].size() == children_left .sorted[2].size());
+	assert(children_right.sorted[0].size() == children_right.sorted[1].size() && children_right.sorted[1].size() == children_right.sorted[2].size());
+
+	int n_left  = children_left .size();
+	int n_right = children_right.size();
+
+	// The actual number of references going left/right should match the numbers calculated during spatial splitting
+	assert(n_left  == spatial_split.num_left  - rejected_left);
+	assert(n_right == spatial_split.num_right - rejected_right);
+
+	// A valid partition contains at least one and strictly less than all
+	assert(n_left  > 0 && n_left  < index_count);
+	assert(n_right > 0 && n_right < index_count);
+
+	// Make sure no triangles dissapeared
+	assert(n_left + n_right >= index_count);
+	assert(n_left + n_right <= index_count * 2);
+}
+
+void SBVHBuilder::build_sbvh(int node_id, References & references, int budget, Scratch & scratch) {
+	BVHNode & node = nodes_unordered[node_id];
+
+	int index_count = references.size();
+
+	auto make_leaf = [&]() {
+		node.first = index_offset.fetch_add(index_count);
+		node.count = index_count;
+
+		for (int i = 0; i < index_count; i++) {
+			indices_unordered[node.first + i] = references.sorted[0][i].index;
+		}
+	};
+
 	if (index_count == 1) {
 		// Leaf Node, terminate recursion
-		node.first = first_index;
-		node.count = index_count;
-			
-		return node.count;
+		make_leaf();
+
+		return;
 	}
-	
+
 	// Object Split information
-	BVHPartitions::ObjectSplit object_split = BVHPartitions::partition_object(triangles, indices, first_index, index_count, bounds, sah);
+	BVHPartitions::ObjectSplit object_split = partition_object(references, scratch);
 	assert(object_split.index != -1);
 
 	// Calculate the overlap between the child bounding boxes resulting from the Object Split
@@ -26,18 +387,23 @@ int SBVHBuilder::build_sbvh(BVHNode & node, const Triangle * triangles, Primitiv
 
 	// Divide by the surface area of the bounding box of the root Node
 	float ratio = lamba * inv_root_surface_area;
-		
+
 	assert(ratio >= 0.0f && ratio <= 1.0f);
 
 	BVHPartitions::SpatialSplit spatial_split;
 
-	// If ratio between overlap area and root area is large enough, consider a Spatial Split
-	if (ratio > SBVH_ALPHA) { 
-		spatial_split = BVHPartitions::partition_spatial(triangles, indices, first_index, index_count, sah, node.aabb);
+	// If ratio between overlap area and root area is large enough, and the budget allows for it, consider a Spatial Split
+	if (ratio > SBVH_ALPHA && budget > 0) {
+		spatial_split = partition_spatial(references, node.aabb);
+
+		// In the worst case every reference that straddles the split plane is duplicated
+		if (spatial_split.cost != INFINITY && spatial_split.num_left + spatial_split.num_right - index_count > budget) {
+			spatial_split.cost = INFINITY;
+		}
 	} else {
 		spatial_split.cost = INFINITY;
 	}
-	
+
 	assert(object_split.cost != INFINITY || spatial_split.cost != INFINITY);
 
 	if (index_count <= max_primitives_in_leaf) {
@@ -46,280 +412,153 @@ int SBVHBuilder::build_sbvh(BVHNode & node, const Triangle * triangles, Primitiv
 		float node_cost = node.aabb.surface_area() * SAH_COST_NODE + Math::min(object_split.cost, spatial_split.cost);
 
 		if (leaf_cost < node_cost) {
-			node.first = first_index;
-			node.count = index_count;
-			
-			return node.count;
-		} 
+			make_leaf();
+
+			return;
+		}
 	}
-	
-	node.left = node_index;
-	node_index += 2;
-
-	PrimitiveRef * children_left [3] { 
-		indices[0] + first_index,
-		indices[1] + first_index,
-		indices[2] + first_index
-	};
-	PrimitiveRef * children_right[3] {
-		indices_going_right_x + indices_going_right_offset,
-		indices_going_right_y + indices_going_right_offset,
-		indices_going_right_z + indices_going_right_offset
-	};
 
-	int children_left_count [3] = { 0, 0, 0 };
-	int children_right_count[3] = { 0, 0, 0 };
+	node.left = node_index.fetch_add(2);
 
-	int n_left, n_right;
+	References children_left;
+	References children_right;
 
 	AABB child_aabb_left;
 	AABB child_aabb_right;
-	
-	// The two temp arrays will be used as lookup tables
+
 	if (object_split.cost <= spatial_split.cost) {
-		// Perform Object Split
-	
 		node.count = (object_split.dimension + 1) << 30;
 
-		for (int i = first_index;        i < object_split.index;        i++) indices_going_left[indices[object_split.dimension][i].index] = true;
-		for (int i = object_split.index; i < first_index + index_count; i++) indices_going_left[indices[object_split.dimension][i].index] = false;
-
-		for (int dimension = 0; dimension < 3; dimension++) {
-			for (int i = first_index; i < first_index + index_count; i++) {
-				bool goes_left = indices_going_left[indices[dimension][i].index];
+		split_object(references, object_split, children_left, children_right);
 
-				if (goes_left) {
-					children_left[dimension][children_left_count[dimension]++] = indices[dimension][i];
-				} else {
-					children_right[dimension][children_right_count[dimension]++] = indices[dimension][i];
-				}
-			}
-		}
-			
-		// We should have made the same decision (going left/right) in every dimension
-		assert(children_left_count [0] == children_left_count [1] && children_left_count [1] == children_left_count [2]);
-		assert(children_right_count[0] == children_right_count[1] && children_right_count[1] == children_right_count[2]);
-			
-		n_left  = children_left_count [0];
-		n_right = children_right_count[0];
-
-		// Using object split, no duplicates can occur. 
-		// Thus, left + right should equal the total number of triangles
-		assert(first_index + n_left == object_split.index);
-		assert(n_left + n_right == index_count);
-		
 		child_aabb_left  = object_split.aabb_left;
 		child_aabb_right = object_split.aabb_right;
 	} else {
-		// Perform Spatial Split
-		
 		node.count = (spatial_split.dimension + 1) << 30;
 
-		int temp_left = 0, temp_right = 0;
-		
-		// Keep track of amount of rejected references on both sides for debugging purposes
-		int rejected_left  = 0;
-		int rejected_right = 0;
+		split_spatial(references, spatial_split, children_left, children_right, node.aabb);
 
-		float n_1 = float(spatial_split.num_left);
-		float n_2 = float(spatial_split.num_right);
+		child_aabb_left  = spatial_split.aabb_left;
+		child_aabb_right = spatial_split.aabb_right;
+	}
 
-		float bounds_min  = node.aabb.min[spatial_split.dimension] - 0.001f;
-		float bounds_max  = node.aabb.max[spatial_split.dimension] + 0.001f;
-		float bounds_step = (bounds_max - bounds_min) / BVHPartitions::SBVH_BIN_COUNT;
-		
-		float inv_bounds_delta = 1.0f / (bounds_max - bounds_min);
+	int n_left  = children_left .size();
+	int n_right = children_right.size();
 
-		for (int i = first_index; i < first_index + index_count; i++) {
-			int index = indices[spatial_split.dimension][i].index;
-			const Triangle & triangle = triangles[index];
-			
-			AABB triangle_aabb = indices[spatial_split.dimension][i].aabb;
+	// The references of this Node are no longer needed, release their memory before recursing
+	references = References();
 
-			Vector3 vertices[3] = { 
-				triangle.position_0,
-				triangle.position_1, 
-				triangle.position_2 
-			};
+	// Divide the remaining budget over the children, proportional to their number of references
+	int budget_remaining = budget - (n_left + n_right - index_count);
+	assert(budget_remaining >= 0);
 
-			// Sort the vertices along the current dimension
-			if (vertices[0][spatial_split.dimension] > vertices[1][spatial_split.dimension]) Util::swap(vertices[0], vertices[1]);
-			if (vertices[1][spatial_split.dimension] > vertices[2][spatial_split.dimension]) Util::swap(vertices[1], vertices[2]);
-			if (vertices[0][spatial_split.dimension] > vertices[1][spatial_split.dimension]) Util::swap(vertices[0], vertices[1]);
-
-			float vertex_min = triangle_aabb.min[spatial_split.dimension];
-			float vertex_max = triangle_aabb.max[spatial_split.dimension];
-			
-			int bin_min = int(BVHPartitions::SBVH_BIN_COUNT * ((vertex_min - bounds_min) * inv_bounds_delta));
-			int bin_max = int(BVHPartitions::SBVH_BIN_COUNT * ((vertex_max - bounds_min) * inv_bounds_delta));
-
-			bool goes_left  = bin_min <  spatial_split.index;
-			bool goes_right = bin_max >= spatial_split.index;
-
-			assert(goes_left || goes_right);
-
-			if (goes_left && goes_right) { // Straddler
-				// Consider unsplitting
-				AABB delta_left  = spatial_split.aabb_left;
-				AABB delta_right = spatial_split.aabb_right;
-
-				delta_left .expand(triangle_aabb);
-				delta_right.expand(triangle_aabb);
-
-				float spatial_split_aabb_left_surface_area  = spatial_split.aabb_left .surface_area();
-				float spatial_split_aabb_right_surface_area = spatial_split.aabb_right.surface_area();
-
-				// Calculate SAH cost for the 3 different cases
-				float c_split = spatial_split_aabb_left_surface_area   *  n_1       + spatial_split_aabb_right_surface_area   *  n_2;
-				float c_1     =              delta_left.surface_area() *  n_1       + spatial_split_aabb_right_surface_area   * (n_2-1.0f);
-				float c_2     = spatial_split_aabb_left_surface_area   * (n_1-1.0f) +              delta_right.surface_area() *  n_2;
-
-				// If C_1 resp. C_2 is cheapest, let the triangle go left resp. right
-				// Otherwise, do nothing and let the triangle go both left and right
-				if (c_1 < c_split) {
-					if (c_2 < c_1) { // C_2 is cheapest, remove from left
-						goes_left = false;
-						rejected_left++;
-
-						n_1 -= 1.0f;
-
-						spatial_split.aabb_right.expand(triangle_aabb);
-					} else { // C_1 is cheapest, remove from right
-						goes_right = false;
-						rejected_right++;
-								
-						n_2 -= 1.0f;
-
-						spatial_split.aabb_left.expand(triangle_aabb);
-					}
-				} else if (c_2 < c_split) { // C_2 is cheapest, remove from left
-					goes_left = false;
-					rejected_left++;
-							
-					n_1 -= 1.0f;
-
-					spatial_split.aabb_right.expand(triangle_aabb);
-				}
-			} 
-			
-			if (goes_left && goes_right) {
-				Vector3 intersections[6];
-				int     intersection_count = 0;
+	int budget_left  = int(static_cast<long long>(budget_remaining) * n_left / (n_left + n_right));
+	int budget_right = budget_remaining - budget_left;
 
-				BVHPartitions::triangle_intersect_plane(vertices, spatial_split.dimension, spatial_split.plane_distance, intersections, &intersection_count);
+	int node_left = node.left;
 
-				assert(intersection_count < Util::array_element_count(intersections));
+	nodes_unordered[node_left    ].aabb = child_aabb_left;
+	nodes_unordered[node_left + 1].aabb = child_aabb_right;
 
-				// All intersection points should be included both AABBs
-				AABB aabb_intersections = AABB::from_points(intersections, intersection_count);
-				AABB aabb_left 	= aabb_intersections;
-				AABB aabb_right = aabb_intersections;
+	if (index_count < PARALLEL_SUBTREE_THRESHOLD) {
+		build_sbvh(node_left,     children_left,  budget_left,  scratch);
+		build_sbvh(node_left + 1, children_right, budget_right, scratch);
+	} else {
+		// Build the left subtree as a separate Task, while this thread continues with the right subtree
+		ThreadPool::TaskGroup group;
+		ThreadPool::submit(group, [this, node_left, &children_left, budget_left]() {
+			Scratch scratch;
+			build_sbvh(node_left, children_left, budget_left, scratch);
+		});
 
-				for (int v = 0; v < 3; v++) {
-					if (vertices[v][spatial_split.dimension] < spatial_split.plane_distance) {
-						aabb_left.expand(vertices[v]);
-					} else {
-						aabb_right.expand(vertices[v]);
-					}
-				}
-				
-				aabb_left.min = Vector3::max(aabb_left.min, triangle_aabb.min);
-				aabb_left.max = Vector3::min(aabb_left.max, triangle_aabb.max);
-				aabb_right.min = Vector3::max(aabb_right.min, triangle_aabb.min);
-				aabb_right.max = Vector3::min(aabb_right.max, triangle_aabb.max);
-
-				aabb_left .fix_if_needed();
-				aabb_right.fix_if_needed();
-
-				spatial_split.aabb_left .expand(aabb_left);
-				spatial_split.aabb_right.expand(aabb_right);
-
-				children_left[0][children_left_count[0]++] = { indices[spatial_split.dimension][i].index, aabb_left };
-				children_left[1][children_left_count[1]++] = { indices[spatial_split.dimension][i].index, aabb_left };
-				children_left[2][children_left_count[2]++] = { indices[spatial_split.dimension][i].index, aabb_left };
-
-				children_right[0][children_right_count[0]++] = { indices[spatial_split.dimension][i].index, aabb_right };
-				children_right[1][children_right_count[1]++] = { indices[spatial_split.dimension][i].index, aabb_right };
-				children_right[2][children_right_count[2]++] = { indices[spatial_split.dimension][i].index, aabb_right };
-			} else if (goes_left) {
-				spatial_split.aabb_left.expand(triangle_aabb);
+		build_sbvh(node_left + 1, children_right, budget_right, scratch);
 
-				children_left[0][children_left_count[0]++] = indices[spatial_split.dimension][i];
-				children_left[1][children_left_count[1]++] = indices[spatial_split.dimension][i];
-				children_left[2][children_left_count[2]++] = indices[spatial_split.dimension][i];
-			} else if (goes_right) {
-				spatial_split.aabb_right.expand(triangle_aabb);
+		ThreadPool::wait(group);
+	}
+}
 
-				children_right[0][children_right_count[0]++] = indices[spatial_split.dimension][i];
-				children_right[1][children_right_count[1]++] = indices[spatial_split.dimension][i];
-				children_right[2][children_right_count[2]++] = indices[spatial_split.dimension][i];
-			} else {
-				assert(false);
-			}
+// Copies the Nodes and indices into the SBVH, in the same order as a single threaded depth first build would produce
+void SBVHBuilder::reorder_nodes() {
+	sbvh->node_count  = node_index;
+	sbvh->index_count = index_offset;
+
+	sbvh->nodes   = new BVHNode[sbvh->node_count];
+	sbvh->indices = new int    [sbvh->index_count];
+
+	// Stores pairs of old and new Node indices
+	int * stack = new int[2 * sbvh->node_count];
+	int   stack_size = 0;
+
+	stack[stack_size++] = 0;
+	stack[stack_size++] = 0;
+
+	int node_index_new   = 2;
+	int index_offset_new = 0;
+
+	while (stack_size > 0) {
+		int node_id_new = stack[--stack_size];
+		int node_id_old = stack[--stack_size];
+
+		const BVHNode & node = nodes_unordered[node_id_old];
+		sbvh->nodes[node_id_new] = node;
+
+		if (node.is_leaf()) {
+			memcpy(sbvh->indices + index_offset_new, indices_unordered + node.first, node.count * sizeof(int));
+
+			sbvh->nodes[node_id_new].first = index_offset_new;
+			index_offset_new += node.count;
+
+			continue;
 		}
-		
-		std::sort(children_left[0], children_left[0] + children_left_count[0], [](const PrimitiveRef & a, const PrimitiveRef & b) { return a.aabb.get_center().x < b.aabb.get_center().x; });
-		std::sort(children_left[1], children_left[1] + children_left_count[1], [](const PrimitiveRef & a, const PrimitiveRef & b) { return a.aabb.get_center().y < b.aabb.get_center().y; });
-		std::sort(children_left[2], children_left[2] + children_left_count[2], [](const PrimitiveRef & a, const PrimitiveRef & b) { return a.aabb.get_center().z < b.aabb.get_center().z; });
-		
-		std::sort(children_right[0], children_right[0] + children_right_count[0], [](const PrimitiveRef & a, const PrimitiveRef & b) { return a.aabb.get_center().x < b.aabb.get_center().x; });
-		std::sort(children_right[1], children_right[1] + children_right_count[1], [](const PrimitiveRef & a, const PrimitiveRef & b) { return a.aabb.get_center().y < b.aabb.get_center().y; });
-		std::sort(children_right[2], children_right[2] + children_right_count[2], [](const PrimitiveRef & a, const PrimitiveRef & b) { return a.aabb.get_center().z < b.aabb.get_center().z; });
-
-		// We should have made the same decision (going left/right) in every dimension
-		assert(children_left_count [0] == children_left_count [1] && children_left_count [1] == children_left_count [2]);
-		assert(children_right_count[0] == children_right_count[1] && children_right_count[1] == children_right_count[2]);
-		
-		n_left  = children_left_count [0];
-		n_right = children_right_count[0];
-		
-		// The actual number of references going left/right should match the numbers calculated during spatial splitting
-		assert(n_left  == spatial_split.num_left  - rejected_left);
-		assert(n_right == spatial_split.num_right - rejected_right);
-
-		// A valid partition contains at least one and strictly less than all
-		assert(n_left  > 0 && n_left  < index_count);
-		assert(n_right > 0 && n_right < index_count);
-		
-		// Make sure no triangles dissapeared
-		assert(n_left + n_right >= index_count);
-		assert(n_left + n_right <= index_count * 2);
 
-		child_aabb_left  = spatial_split.aabb_left;
-		child_aabb_right = spatial_split.aabb_right;
+		sbvh->nodes[node_id_new].left = node_index_new;
+
+		// Push the right child first so that the left subtree gets numbered first
+		stack[stack_size++] = node.left + 1;
+		stack[stack_size++] = node_index_new + 1;
+		stack[stack_size++] = node.left;
+		stack[stack_size++] = node_index_new;
+
+		node_index_new += 2;
 	}
 
-	sbvh->nodes[node.left    ].aabb = child_aabb_left;
-	sbvh->nodes[node.left + 1].aabb = child_aabb_right;
+	assert(node_index_new   == sbvh->node_count);
+	assert(index_offset_new == sbvh->index_count);
 
-	indices_going_right_offset += n_right;
+	delete [] stack;
+}
 
-	// Do a depth first traversal, so that we know the amount of indices that were recursively created by the left child
-	int num_leaves_left = build_sbvh(sbvh->nodes[node.left], triangles, indices, node_index, first_index, n_left, inv_root_surface_area);
+void SBVHBuilder::init(BVH * sbvh, int triangle_count, int max_primitives_in_leaf) {
+	this->sbvh = sbvh;
+	this->max_primitives_in_leaf = max_primitives_in_leaf;
 
-	// Using the depth first offset, we can now copy over the right references
-	memcpy(indices[0] + first_index + num_leaves_left, children_right[0], n_right * sizeof(PrimitiveRef));
-	memcpy(indices[1] + first_index + num_leaves_left, children_right[1], n_right * sizeof(PrimitiveRef));
-	memcpy(indices[2] + first_index + num_leaves_left, children_right[2], n_right * sizeof(PrimitiveRef));
-	
-	// Now recurse on the right side
-	int num_leaves_right = build_sbvh(sbvh->nodes[node.left + 1], triangles, indices, node_index, first_index + num_leaves_left, n_right, inv_root_surface_area);
-	
-	indices_going_right_offset -= n_right;
+	split_budget = int(SBVH_SPLIT_BUDGET * float(triangle_count));
 
-	return num_leaves_left + num_leaves_right;
+	// Every reference ends up in exactly one leaf, so the budget bounds the number of indices and Nodes
+	int reference_count_max = triangle_count + split_budget;
+
+	nodes_unordered   = new BVHNode[2 * reference_count_max];
+	indices_unordered = new int    [reference_count_max];
+}
+
+void SBVHBuilder::free() {
+	delete [] nodes_unordered;
+	delete [] indices_unordered;
 }
 
 void SBVHBuilder::build(const Triangle * triangles, int triangle_count) {
 	puts("Construcing SBVH, this may take a few seconds for large scenes...");
-	
+
+	this->triangles = triangles;
+
+	References references;
+	for (int dimension = 0; dimension < 3; dimension++) {
+		references.sorted[dimension].resize(triangle_count);
+	}
+
 	AABB root_aabb = AABB::create_empty();
 
 	for (int i = 0; i < triangle_count; i++) {
-		indices_x[i].index = i;
-		indices_y[i].index = i;
-		indices_z[i].index = i;
-
 		Vector3 vertices[3] = {
 			triangles[i].position_0,
 			triangles[i].position_1,
@@ -327,33 +566,31 @@ void SBVHBuilder::build(const Triangle * triangles, int triangle_count) {
 		};
 		AABB aabb = AABB::from_points(vertices, 3);
 
-		indices_x[i].aabb = aabb;
-		indices_y[i].aabb = aabb;
-		indices_z[i].aabb = aabb;
+		for (int dimension = 0; dimension < 3; dimension++) {
+			references.sorted[dimension][i] = { i, aabb };
+		}
 
 		root_aabb.expand(aabb);
 	}
 
-	std::sort(indices_x, indices_x + triangle_count, [](const PrimitiveRef & a, const PrimitiveRef & b) { return a.aabb.get_center().x < b.aabb.get_center().x; });
-	std::sort(indices_y, indices_y + triangle_count, [](const PrimitiveRef & a, const PrimitiveRef & b) { return a.aabb.get_center().y < b.aabb.get_center().y; });
-	std::sort(indices_z, indices_z + triangle_count, [](const PrimitiveRef & a, const PrimitiveRef & b) { return a.aabb.get_center().z < b.aabb.get_center().z; });
-	
-	indices_going_right_offset = 0;
+	for_each_dimension(true, [&](int dimension) {
+		std::vector<PrimitiveRef> & sorted = references.sorted[dimension];
+		std::vector<PrimitiveRef>   temp(triangle_count);
 
-	PrimitiveRef * indices[3] = { indices_x, indices_y, indices_z };
+		ThreadPool::parallel_sort(sorted.data(), sorted.data() + triangle_count, temp.data(), [dimension](const PrimitiveRef & a, const PrimitiveRef & b) {
+			return reference_less(a, b, dimension);
+		});
+	});
 
-	sbvh->nodes[0].aabb = root_aabb;
+	nodes_unordered[0].aabb = root_aabb;
 
-	int node_index = 2;
-	sbvh->index_count = build_sbvh(sbvh->nodes[0], triangles, indices, node_index, 0, triangle_count, 1.0f / root_aabb.surface_area());
-	sbvh->node_count = node_index;
-	
-	assert(node_index <= SBVH_OVERALLOCATION * triangle_count);
+	node_index   = 2;
+	index_offset = 0;
 
-	for (int i = 0; i < sbvh->index_count; i++) {
-		int index = indices_x[i].index;
-		assert(index >= 0 && index < triangle_count);
+	inv_root_surface_area = 1.0f / root_aabb.surface_area();
 
-		sbvh->indices[i] = index;
-	}
+	Scratch scratch;
+	build_sbvh(0, references, split_budget, scratch);
+
+	reorder_nodes();
 }
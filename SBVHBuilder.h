@@ -1,69 +1,66 @@
 #pragma once
+#include <atomic>
+#include <vector>
+
 #include "BVH.h"
 #include "BVHPartitions.h"
 
-#include "BitArray.h"
-
+// Builds a binary SAH-based BVH that is able to split Triangles using Spatial Splits, see Stich et al. 2009
+// Every Node owns its references, sorted along all 3 dimensions. When a Node is split the references are
+// distributed over its children in a way that preserves their order, and the memory of the parent is released.
+// The number of references that Spatial Splits may add is limited by a budget, which is divided over the subtrees.
+// Large Nodes evaluate splits using multiple Tasks, smaller subtrees are built by a single Task each.
+// The output does not depend on the number of threads
 struct SBVHBuilder {
 private:
-	static constexpr int SBVH_OVERALLOCATION = 4; // SBVH requires more space
+	static constexpr int PARALLEL_SUBTREE_THRESHOLD   = 4096;  // Nodes with fewer references have their subtree built by a single Task
+	static constexpr int PARALLEL_PARTITION_THRESHOLD = 65536; // Nodes with at least this many references evaluate splits using multiple Tasks
 
-	BVH * sbvh = nullptr;
-	
 	using PrimitiveRef = BVHPartitions::PrimitiveRef;
 
-	PrimitiveRef * indices_x = nullptr;
-	PrimitiveRef * indices_y = nullptr;
-	PrimitiveRef * indices_z = nullptr;
-
-	PrimitiveRef * indices_going_right_x = nullptr;
-	PrimitiveRef * indices_going_right_y = nullptr;
-	PrimitiveRef * indices_going_right_z = nullptr;
-	int            indices_going_right_offset;
-	
-	// Scatch memory
-	float * sah    = nullptr;
-	AABB  * bounds = nullptr;
-	BitArray indices_going_left;
-	BitArray indices_going_right;
+	// References of a single Node, sorted along all 3 dimensions
+	struct References {
+		std::vector<PrimitiveRef> sorted[3];
+
+		inline int size() const { return int(sorted[0].size()); }
+	};
+
+	// Scratch memory used to evaluate Object Splits, owned by a single Task
+	struct Scratch {
+		std::vector<float> sah;
+		std::vector<float> bounds; // Bounds of the references in Structure of Arrays layout, 6 floats per reference
+	};
+
+	BVH * sbvh = nullptr;
+
+	const Triangle * triangles = nullptr;
+
+	// Nodes and indices in the order they were allocated in, these are reordered into depth first order after the build
+	BVHNode * nodes_unordered   = nullptr;
+	int     * indices_unordered = nullptr;
+
+	std::atomic<int> node_index;
+	std::atomic<int> index_offset;
+
+	int split_budget;
+
+	float inv_root_surface_area;
 
 	int max_primitives_in_leaf;
 
-	int SBVHBuilder::build_sbvh(BVHNode & node, const Triangle * triangles, PrimitiveRef * indices[3], int & node_index, int first_index, int index_count, float inv_root_surface_area);
+	BVHPartitions::ObjectSplit  partition_object (References & references, Scratch & scratch);
+	BVHPartitions::SpatialSplit partition_spatial(References & references, const AABB & bounds);
+
+	void split_object (References & references, const BVHPartitions::ObjectSplit  & object_split,  References & children_left, References & children_right);
+	void split_spatial(References & references,       BVHPartitions::SpatialSplit & spatial_split, References & children_left, References & children_right, const AABB & bounds);
+
+	void build_sbvh(int node_id, References & references, int budget, Scratch & scratch);
+
+	void reorder_nodes();
 
 public:
-	inline void init(BVH * sbvh, int triangle_count, int max_primitives_in_leaf) {
-		this->sbvh = sbvh;
-		this->max_primitives_in_leaf = max_primitives_in_leaf;
-
-		PrimitiveRef * indices_xyz = new PrimitiveRef[3 * SBVH_OVERALLOCATION * triangle_count];
-		indices_x = indices_xyz;
-		indices_y = indices_xyz + SBVH_OVERALLOCATION * triangle_count;
-		indices_z = indices_xyz + SBVH_OVERALLOCATION * triangle_count * 2;
-
-		PrimitiveRef * indices_going_right_xyz = new PrimitiveRef[3 * 2 * triangle_count];
-		indices_going_right_x = indices_going_right_xyz;
-		indices_going_right_y = indices_going_right_xyz + 2 * triangle_count;
-		indices_going_right_z = indices_going_right_xyz + 2 * triangle_count * 2;
-		
-		sah    = new float[triangle_count];
-		bounds = new AABB [triangle_count * 2 + 1];
-		indices_going_left .init(triangle_count);
-		indices_going_right.init(triangle_count);
-		
-		sbvh->indices = new int    [SBVH_OVERALLOCATION * triangle_count];
-		sbvh->nodes   = new BVHNode[SBVH_OVERALLOCATION * triangle_count];
-	}
-
-	inline void free() {
-		delete [] indices_x;
-		delete [] indices_going_right_x;
-
-		delete [] sah;
-		delete [] bounds;
-		indices_going_left .free();
-		indices_going_right.free();
-	}
+	void init(BVH * sbvh, int triangle_count, int max_primitives_in_leaf);
+	void free();
 
 	void build(const Triangle * triangles, int triangle_count); // SAH-based object + spatial splits, Stich et al. 2009 (Triangles only)
 };
@@ -6,7 +6,7 @@
 
 #include "Util.h"
 
-void Scene::init(int mesh_count, const char * mesh_names[], const char * sky_name) {
+void Scene::init(int mesh_count, const char * mesh_names[], const char * sky_name, int bvh_type) {
 	if (mesh_count == 0) {
 		puts("ERROR: No Meshes provided!");
 		abort();
@@ -18,9 +18,14 @@ void Scene::init(int mesh_count, const char * mesh_names[], const char * sky_nam
 	this->mesh_count = mesh_count;
 	this->meshes     = new Mesh[mesh_count];
 	
+	int * mesh_data_indices = MALLOCA(int, mesh_count);
+	MeshData::load(mesh_count, mesh_names, mesh_data_indices, bvh_type);
+
 	for (int i = 0; i < mesh_count; i++) {
-		meshes[i].init(MeshData::load(mesh_names[i]));
+		meshes[i].init(mesh_data_indices[i]);
 	}
+
+	FREEA(mesh_data_indices);
 	
 	has_diffuse    = false;
 	has_dielectric = false;
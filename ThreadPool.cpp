@@ -0,0 +1,162 @@
+#include "ThreadPool.h"
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+struct QueuedTask {
+	ThreadPool::TaskGroup * group;
+	ThreadPool::Task        task;
+};
+
+struct TaskQueue {
+	std::mutex             mutex;
+	std::deque<QueuedTask> tasks;
+};
+
+static std::thread * threads;
+static int           thread_count = 0;
+
+// One queue per worker, the last queue is shared by all threads that are not part of the pool
+static TaskQueue * queues;
+static int         queue_count;
+
+static std::atomic<int> tasks_queued;
+static std::atomic<bool> is_shutting_down;
+
+static std::mutex              sleep_mutex;
+static std::condition_variable sleep_condition;
+
+static thread_local int worker_index = -1;
+
+static int get_queue_index() {
+	return worker_index != -1 ? worker_index : thread_count;
+}
+
+static bool try_pop(TaskQueue & queue, bool from_back, QueuedTask & result) {
+	std::lock_guard<std::mutex> lock(queue.mutex);
+
+	if (queue.tasks.empty()) return false;
+
+	if (from_back) {
+		result = std::move(queue.tasks.back());
+		queue.tasks.pop_back();
+	} else {
+		result = std::move(queue.tasks.front());
+		queue.tasks.pop_front();
+	}
+
+	tasks_queued--;
+
+	return true;
+}
+
+static bool try_execute_task() {
+	int queue_index = get_queue_index();
+
+	QueuedTask queued_task;
+
+	// Prefer the most recently submitted Task of our own queue, as its data is most likely still in cache
+	bool found = try_pop(queues[queue_index], true, queued_task);
+
+	// Otherwise steal the oldest Task from one of the other queues, as it is most likely to spawn more work
+	for (int i = 1; !found && i < queue_count; i++) {
+		found = try_pop(queues[(queue_index + i) % queue_count], false, queued_task);
+	}
+
+	if (!found) return false;
+
+	queued_task.task();
+	queued_task.group->pending--;
+
+	return true;
+}
+
+static void worker_main(int index) {
+	worker_index = index;
+
+	while (true) {
+		if (try_execute_task()) continue;
+
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		sleep_condition.wait(lock, []() { return tasks_queued > 0 || is_shutting_down; });
+
+		if (is_shutting_down) return;
+	}
+}
+
+void ThreadPool::init(int thread_count) {
+	if (thread_count == 0) {
+		thread_count = int(std::thread::hardware_concurrency()) - 1;
+	}
+	if (thread_count <= 0) return;
+
+	::thread_count = thread_count;
+
+	queue_count = thread_count + 1;
+	queues      = new TaskQueue[queue_count];
+
+	tasks_queued     = 0;
+	is_shutting_down = false;
+
+	threads = new std::thread[thread_count];
+	for (int i = 0; i < thread_count; i++) {
+		threads[i] = std::thread(worker_main, i);
+	}
+}
+
+void ThreadPool::free() {
+	if (::thread_count == 0) return;
+
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		is_shutting_down = true;
+	}
+	sleep_condition.notify_all();
+
+	for (int i = 0; i < ::thread_count; i++) {
+		threads[i].join();
+	}
+
+	delete [] threads;
+	delete [] queues;
+
+	::thread_count = 0;
+}
+
+int ThreadPool::get_thread_count() {
+	return ::thread_count;
+}
+
+void ThreadPool::submit(TaskGroup & group, Task && task) {
+	if (::thread_count == 0) {
+		task();
+
+		return;
+	}
+
+	group.pending++;
+
+	TaskQueue & queue = queues[get_queue_index()];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back({ &group, std::move(task) });
+	}
+
+	tasks_queued++;
+
+	// Lock the mutex so that the notification cannot be missed by a worker that is about to go to sleep
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+	}
+	sleep_condition.notify_one();
+}
+
+void ThreadPool::wait(TaskGroup & group) {
+	while (group.pending > 0) {
+		if (!try_execute_task()) {
+			std::this_thread::yield();
+		}
+	}
+}
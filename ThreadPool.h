@@ -0,0 +1,51 @@
+#pragma once
+#include <atomic>
+#include <algorithm>
+#include <functional>
+
+// Work stealing Thread Pool
+// Every worker owns a queue of Tasks. Workers execute Tasks from the back of their own queue,
+// and steal Tasks from the front of the queues of other workers once they run out of work
+namespace ThreadPool {
+	typedef std::function<void()> Task;
+
+	// Keeps track of a number of submitted Tasks so they can be waited on
+	struct TaskGroup {
+		std::atomic<int> pending = 0;
+	};
+
+	void init(int thread_count = 0); // Zero means one worker for every hardware thread, except the calling thread
+	void free();
+
+	int get_thread_count();
+
+	// If the Thread Pool was not initialized the Task is executed immediately on the calling thread
+	void submit(TaskGroup & group, Task && task);
+
+	// Blocks until all Tasks in the group have finished, helps executing Tasks while waiting
+	void wait(TaskGroup & group);
+
+	// Sorts the range [first, last> by sorting chunks in parallel and merging them
+	// Only produces the same result as std::sort if compare defines a strict total order, use an index to break ties
+	template<typename T, typename Compare>
+	void parallel_sort(T * first, T * last, T * temp, Compare compare) {
+		static constexpr int SERIAL_THRESHOLD = 16384;
+
+		int count = last - first;
+		if (count < SERIAL_THRESHOLD || get_thread_count() == 0) {
+			std::sort(first, last, compare);
+
+			return;
+		}
+
+		int count_left = count / 2;
+
+		TaskGroup group;
+		submit(group, [=]() { parallel_sort(first, first + count_left, temp, compare); });
+		parallel_sort(first + count_left, last, temp + count_left, compare);
+		wait(group);
+
+		std::merge(first, first + count_left, first + count_left, last, temp, compare);
+		std::copy(temp, temp + count, first);
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <vector>
+#include <cstring>
+
+// Stack of the CPU traversals. The first LOCAL_SIZE entries live in the stack frame of the traversal,
+// very deep or unbalanced trees (e.g. an unoptimized SBVH) continue on the heap instead of overflowing
+template<typename T, int LOCAL_SIZE = 256>
+struct TraversalStack {
+private:
+	T   local[LOCAL_SIZE];
+	T * entries  = local;
+	int capacity = LOCAL_SIZE;
+
+	std::vector<T> heap;
+
+	inline void grow() {
+		heap.resize(2 * capacity);
+		if (entries == local) memcpy(heap.data(), local, LOCAL_SIZE * sizeof(T));
+
+		entries  = heap.data();
+		capacity = heap.size();
+	}
+
+public:
+	int size = 0;
+
+	TraversalStack() = default;
+	TraversalStack(const TraversalStack &) = delete; // The entries may point into the local array of this instance
+	TraversalStack & operator=(const TraversalStack &) = delete;
+
+	inline void push(const T & entry) {
+		if (size == capacity) grow();
+
+		entries[size++] = entry;
+	}
+
+	inline T pop() {
+		return entries[--size];
+	}
+};
@@ -0,0 +1,377 @@
+#include "TrianglePresplitter.h"
+
+#include <vector>
+#include <algorithm>
+
+#include "Math.h"
+#include "Util.h"
+#include "ThreadPool.h"
+
+using PrimitiveRef = BVHPartitions::PrimitiveRef;
+
+// Runs the function over all Triangles in batches, in parallel if the Thread Pool is available
+template<typename Function>
+static void for_each_batch(int triangle_count, int batch_size, Function function) {
+	ThreadPool::TaskGroup group;
+
+	for (int first = 0; first < triangle_count; first += batch_size) {
+		int last = Math::min(first + batch_size, triangle_count);
+
+		ThreadPool::submit(group, [&function, first, last]() { function(first, last); });
+	}
+
+	ThreadPool::wait(group);
+}
+
+static int largest_dimension(const AABB & aabb) {
+	Vector3 extent = aabb.max - aabb.min;
+
+	int dimension = 0;
+	if (extent.y > extent[dimension]) dimension = 1;
+	if (extent.z > extent[dimension]) dimension = 2;
+
+	return dimension;
+}
+
+void TrianglePresplitter::init(int triangle_count, float budget) {
+	this->budget = budget;
+
+	int reference_count_max = triangle_count + int(float(triangle_count) * budget);
+
+	references = new PrimitiveRef[reference_count_max];
+
+	priorities   = new float[triangle_count];
+	split_counts = new int  [triangle_count];
+	offsets      = new int  [triangle_count];
+}
+
+void TrianglePresplitter::free() {
+	delete [] references;
+
+	delete [] priorities;
+	delete [] split_counts;
+	delete [] offsets;
+}
+
+// Finds the coarsest level of the grid that has a plane along the given dimension strictly inside the AABB.
+// There can only be one such plane, otherwise every other one of them would belong to the level above
+int TrianglePresplitter::find_plane_level(const AABB & aabb, int dimension, float & plane) const {
+	float min = (aabb.min[dimension] - grid.min[dimension]) * grid_inv_extent[dimension];
+	float max = (aabb.max[dimension] - grid.min[dimension]) * grid_inv_extent[dimension];
+
+	for (int level = 1; level <= GRID_LEVELS; level++) {
+		float cell_count = float(1 << level);
+
+		// Index of the first plane of this level above min
+		float plane_index = floorf(min * cell_count) + 1.0f;
+
+		if (plane_index < max * cell_count) {
+			plane = grid.min[dimension] + plane_index / cell_count * grid_extent[dimension];
+
+			return level;
+		}
+	}
+
+	return GRID_LEVELS + 1;
+}
+
+// Finds the most important grid plane inside the AABB over all dimensions, if there is none the spatial median is used
+int TrianglePresplitter::find_split_plane(const AABB & aabb, int & dimension, float & plane) const {
+	int level = GRID_LEVELS + 1;
+
+	Vector3 extent = aabb.max - aabb.min;
+
+	for (int d = 0; d < 3; d++) {
+		float plane_d;
+		int   level_d = find_plane_level(aabb, d, plane_d);
+
+		// Prefer the coarsest level, and the longest dimension if the levels are the same
+		if (level_d < level || (level_d == level && level_d <= GRID_LEVELS && extent[d] > extent[dimension])) {
+			level     = level_d;
+			dimension = d;
+			plane     = plane_d;
+		}
+	}
+
+	if (level > GRID_LEVELS) {
+		dimension = largest_dimension(aabb);
+		plane     = 0.5f * (aabb.min[dimension] + aabb.max[dimension]);
+	}
+
+	return level;
+}
+
+// The priority grows with the area that splitting could remove, and with the importance of the planes the Triangle crosses.
+// The ideal area is the limit of the total surface area of the AABBs of the pieces if the Triangle were split infinitely often,
+// which is twice the sum of the areas of its projections onto the three axis planes
+float TrianglePresplitter::calc_priority(const Triangle & triangle) const {
+	Vector3 cross = Vector3::cross(triangle.position_1 - triangle.position_0, triangle.position_2 - triangle.position_0);
+
+	float area_ideal = fabsf(cross.x) + fabsf(cross.y) + fabsf(cross.z);
+	float area_aabb  = triangle.aabb.surface_area();
+
+	int   dimension;
+	float plane;
+	int   level = find_split_plane(triangle.aabb, dimension, plane);
+
+	float importance = ldexpf(1.0f, -level);
+
+	return cbrtf(importance * Math::max(area_aabb - area_ideal, 0.0f));
+}
+
+// Clips the convex polygon against the plane, vertices that lie on the plane end up on both sides
+void TrianglePresplitter::split_polygon(const Polygon & polygon, int dimension, float plane, Polygon & left, Polygon & right) {
+	left .vertex_count = 0;
+	right.vertex_count = 0;
+
+	auto add_vertex = [](Polygon & polygon, const Vector3 & vertex) {
+		assert(polygon.vertex_count < MAX_POLYGON_VERTICES);
+
+		if (polygon.vertex_count < MAX_POLYGON_VERTICES) {
+			polygon.vertices[polygon.vertex_count++] = vertex;
+		}
+	};
+
+	for (int i = 0; i < polygon.vertex_count; i++) {
+		const Vector3 & vertex_a = polygon.vertices[i];
+		const Vector3 & vertex_b = polygon.vertices[(i + 1) % polygon.vertex_count];
+
+		float distance_a = vertex_a[dimension] - plane;
+		float distance_b = vertex_b[dimension] - plane;
+
+		if (distance_a <= 0.0f) add_vertex(left,  vertex_a);
+		if (distance_a >= 0.0f) add_vertex(right, vertex_a);
+
+		// Check if the edge crosses the plane
+		if ((distance_a < 0.0f && distance_b > 0.0f) || (distance_a > 0.0f && distance_b < 0.0f)) {
+			float t = distance_a / (distance_a - distance_b);
+
+			Vector3 intersection = vertex_a + t * (vertex_b - vertex_a);
+			intersection[dimension] = plane;
+
+			add_vertex(left,  intersection);
+			add_vertex(right, intersection);
+		}
+	}
+}
+
+// Calculates the AABB of the polygon, limited to the given bounds to avoid accumulating rounding errors
+AABB TrianglePresplitter::calc_bounds(const Polygon & polygon, const AABB & bounds) {
+	AABB aabb = AABB::create_empty();
+
+	for (int i = 0; i < polygon.vertex_count; i++) {
+		aabb.expand(polygon.vertices[i]);
+	}
+
+	aabb.min = Vector3::max(aabb.min, bounds.min);
+	aabb.max = Vector3::min(aabb.max, bounds.max);
+
+	aabb.fix_if_needed();
+
+	return aabb;
+}
+
+// Recursively splits the part of the Triangle given by the polygon into the given number of references,
+// returns the number of references that were created, which may be less if the polygon could not be split any further
+int TrianglePresplitter::split_triangle(int index, const Polygon & polygon, const AABB & aabb, int count, PrimitiveRef * result) const {
+	if (count == 1) {
+		result[0].index = index;
+		result[0].aabb  = aabb;
+
+		return 1;
+	}
+
+	int   dimension;
+	float plane;
+	find_split_plane(aabb, dimension, plane);
+
+	Polygon polygon_left;
+	Polygon polygon_right;
+	split_polygon(polygon, dimension, plane, polygon_left, polygon_right);
+
+	if (polygon_left.vertex_count < 3 || polygon_right.vertex_count < 3) {
+		// The plane only intersects the AABB but not the polygon itself, split at the spatial median instead
+		dimension = largest_dimension(aabb);
+		plane     = 0.5f * (aabb.min[dimension] + aabb.max[dimension]);
+
+		split_polygon(polygon, dimension, plane, polygon_left, polygon_right);
+
+		if (polygon_left.vertex_count < 3 || polygon_right.vertex_count < 3) {
+			result[0].index = index;
+			result[0].aabb  = aabb;
+
+			return 1;
+		}
+	}
+
+	AABB aabb_left  = calc_bounds(polygon_left,  aabb);
+	AABB aabb_right = calc_bounds(polygon_right, aabb);
+
+	// Distribute the references over both halves proportional to their surface area
+	float area_left  = aabb_left .surface_area();
+	float area_right = aabb_right.surface_area();
+
+	int count_left = Math::clamp(int(float(count) * area_left / (area_left + area_right) + 0.5f), 1, count - 1);
+
+	int reference_count = split_triangle(index, polygon_left, aabb_left, count_left, result);
+	reference_count    += split_triangle(index, polygon_right, aabb_right, count - count_left, result + reference_count);
+
+	return reference_count;
+}
+
+void TrianglePresplitter::presplit(const Triangle * triangles, int triangle_count) {
+	grid = AABB::create_empty();
+
+	for (int i = 0; i < triangle_count; i++) {
+		grid.expand(triangles[i].aabb);
+	}
+
+	grid_extent     = grid.max - grid.min;
+	grid_inv_extent = Vector3(
+		grid_extent.x > 0.0f ? 1.0f / grid_extent.x : 0.0f,
+		grid_extent.y > 0.0f ? 1.0f / grid_extent.y : 0.0f,
+		grid_extent.z > 0.0f ? 1.0f / grid_extent.z : 0.0f
+	);
+
+	for_each_batch(triangle_count, PARALLEL_BATCH_SIZE, [&](int first, int last) {
+		for (int i = first; i < last; i++) {
+			priorities[i] = calc_priority(triangles[i]);
+		}
+	});
+
+	// The priorities are summed in a fixed order, so that the result does not depend on the number of threads
+	double priority_sum = 0.0;
+	for (int i = 0; i < triangle_count; i++) {
+		priority_sum += double(priorities[i]);
+	}
+
+	int reference_count_max = triangle_count + int(float(triangle_count) * budget);
+	int split_budget        = reference_count_max - triangle_count;
+
+	// Counts the number of extra references if every Triangle receives floor(scale * priority) of them
+	auto count_splits = [&](double scale) {
+		long long split_count = 0;
+
+		for (int i = 0; i < triangle_count; i++) {
+			split_count += (long long)(scale * double(priorities[i]));
+		}
+
+		return split_count;
+	};
+
+	// Rounding down loses up to one split per Triangle, so the scale is found by bisection
+	// between the scale that ignores rounding and one that overshoots the budget, see Karras and Aila 2013
+	double scale = 0.0;
+
+	if (priority_sum > 0.0) {
+		double scale_min = double(split_budget)                  / priority_sum;
+		double scale_max = double(split_budget + triangle_count) / priority_sum;
+
+		for (int iteration = 0; iteration < PRIORITY_SCALE_ITERATIONS; iteration++) {
+			double scale_mid = 0.5 * (scale_min + scale_max);
+
+			if (count_splits(scale_mid) <= split_budget) {
+				scale_min = scale_mid;
+			} else {
+				scale_max = scale_mid;
+			}
+		}
+
+		scale = scale_min;
+	}
+
+	int offset = 0;
+
+	for (int i = 0; i < triangle_count; i++) {
+		int split_count = int(scale * double(priorities[i]));
+
+		// Guard against exceeding the allocated space, in case the bisection did not converge
+		split_count = Math::min(split_count, reference_count_max - (triangle_count - i) - offset);
+
+		split_counts[i] = 1 + Math::max(split_count, 0);
+		offsets     [i] = offset;
+
+		offset += split_counts[i];
+	}
+
+	assert(offset <= reference_count_max);
+
+	for_each_batch(triangle_count, PARALLEL_BATCH_SIZE, [&](int first, int last) {
+		for (int i = first; i < last; i++) {
+			const Triangle & triangle = triangles[i];
+
+			Polygon polygon;
+			polygon.vertices[0] = triangle.position_0;
+			polygon.vertices[1] = triangle.position_1;
+			polygon.vertices[2] = triangle.position_2;
+			polygon.vertex_count = 3;
+
+			split_counts[i] = split_triangle(i, polygon, triangle.aabb, split_counts[i], references + offsets[i]);
+		}
+	});
+
+	// Remove the gaps left by Triangles that could not be split as often as their budget allowed
+	reference_count = 0;
+
+	for (int i = 0; i < triangle_count; i++) {
+		if (offsets[i] != reference_count) {
+			memmove(references + reference_count, references + offsets[i], split_counts[i] * sizeof(PrimitiveRef));
+		}
+
+		reference_count += split_counts[i];
+	}
+
+	printf("Presplitting created %i references for %i Triangles\n", reference_count, triangle_count);
+}
+
+void TrianglePresplitter::remap_indices(BVH & bvh) const {
+	for (int i = 0; i < bvh.index_count; i++) {
+		bvh.indices[i] = references[bvh.indices[i]].index;
+	}
+
+	// Find the leaves, Node 1 is unused in a binary BVH so the tree is traversed from the root
+	std::vector<int> leaves;
+	std::vector<int> stack = { 0 };
+
+	bool has_multi_primitive_leaves = false;
+
+	while (!stack.empty()) {
+		int node_index = stack.back();
+		stack.pop_back();
+
+		const BVHNode & node = bvh.nodes[node_index];
+
+		if (node.is_leaf()) {
+			leaves.push_back(node_index);
+
+			has_multi_primitive_leaves |= node.get_count() > 1;
+		} else {
+			stack.push_back(node.left);
+			stack.push_back(node.left + 1);
+		}
+	}
+
+	// Leaves with a single reference cannot contain the same Triangle twice
+	if (!has_multi_primitive_leaves) return;
+
+	// Remove Triangles that occur more than once in the same leaf and close the gaps, in the order the leaves appear in the indices
+	std::sort(leaves.begin(), leaves.end(), [&bvh](int a, int b) {
+		return bvh.nodes[a].first < bvh.nodes[b].first;
+	});
+
+	int index_count = 0;
+
+	for (int node_index : leaves) {
+		BVHNode & node = bvh.nodes[node_index];
+
+		int count = remove_duplicate_indices(bvh.indices + node.first, node.get_count());
+		memmove(bvh.indices + index_count, bvh.indices + node.first, count * sizeof(int));
+
+		node.first = index_count;
+		node.count = (node.count & BVH_AXIS_MASK) | count;
+
+		index_count += count;
+	}
+
+	bvh.index_count = index_count;
+}
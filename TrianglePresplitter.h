@@ -0,0 +1,61 @@
+#pragma once
+#include "BVH.h"
+#include "BVHPartitions.h"
+
+// Splits Triangles with large, mostly empty AABBs into multiple references before BVH construction, see Karras and Aila 2013.
+// Every reference bounds the part of its Triangle that lies between a number of axis aligned planes.
+// The planes are taken from a uniform grid over the scene, where planes that subdivide the scene at a coarser level are preferred,
+// since those are the planes that the top levels of the BVH are most likely to split on.
+// The number of extra references is limited by a budget that is distributed over the Triangles by priority:
+// Triangles whose AABB is much larger than the area that tightly fitting boxes could achieve get more splits,
+// especially if they cross an important plane. The references can be fed to any of the binary BVH builders,
+// afterwards the indices of the BVH should be remapped so that they refer to Triangles again
+struct TrianglePresplitter {
+private:
+	static constexpr int GRID_LEVELS = 10; // The finest level of the grid has 2^GRID_LEVELS cells along every dimension
+
+	static constexpr int MAX_POLYGON_VERTICES = 9; // A Triangle clipped by an AABB has at most 3 + 6 vertices
+
+	static constexpr int PRIORITY_SCALE_ITERATIONS = 24; // Number of bisection steps used to fit the number of splits to the budget
+
+	static constexpr int PARALLEL_BATCH_SIZE = 4096; // Number of Triangles that are processed by a single Task
+
+	struct Polygon {
+		Vector3 vertices[MAX_POLYGON_VERTICES];
+		int     vertex_count;
+	};
+
+	float budget;
+
+	// Bounds of the scene that the grid covers
+	AABB    grid;
+	Vector3 grid_extent;
+	Vector3 grid_inv_extent;
+
+	float * priorities   = nullptr;
+	int   * split_counts = nullptr; // Number of references per Triangle, afterwards the number of references that were actually created
+	int   * offsets      = nullptr;
+
+	int find_plane_level(const AABB & aabb, int dimension, float & plane) const;
+	int find_split_plane(const AABB & aabb, int & dimension, float & plane) const;
+
+	float calc_priority(const Triangle & triangle) const;
+
+	static void split_polygon(const Polygon & polygon, int dimension, float plane, Polygon & left, Polygon & right);
+	static AABB calc_bounds  (const Polygon & polygon, const AABB & bounds);
+
+	int split_triangle(int index, const Polygon & polygon, const AABB & aabb, int count, BVHPartitions::PrimitiveRef * result) const;
+
+public:
+	BVHPartitions::PrimitiveRef * references = nullptr;
+	int                           reference_count;
+
+	void init(int triangle_count, float budget); // The budget is the maximum number of extra references, relative to the number of Triangles
+	void free();
+
+	void presplit(const Triangle * triangles, int triangle_count);
+
+	// Replaces the reference indices of the BVH by the indices of the Triangles they belong to,
+	// and removes Triangles that occur more than once within the same leaf
+	void remap_indices(BVH & bvh) const;
+};
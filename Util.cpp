@@ -5,6 +5,8 @@
 
 #include <filesystem>
 
+#include "MappedFile.h"
+
 void Util::get_path(const char * filename, char * path) {
 	const char * path_end      = filename;
 	const char * last_path_end = nullptr;
@@ -62,6 +64,56 @@ char * Util::file_read(const char * filename) {
 	return data;
 }
 
+// Processes 8 bytes at a time, words are mixed like in MurmurHash3 and the final avalanche is its fmix64
+unsigned long long Util::hash(const void * data, size_t size, unsigned long long seed) {
+	static constexpr unsigned long long c1 = 0x87c37b91114253d5ull;
+	static constexpr unsigned long long c2 = 0x4cf5ad432745937full;
+
+	auto rotl = [](unsigned long long x, int r) { return (x << r) | (x >> (64 - r)); };
+
+	const unsigned char * bytes = reinterpret_cast<const unsigned char *>(data);
+
+	unsigned long long h = seed ^ (size * c1);
+
+	size_t word_count = size / 8;
+	for (size_t i = 0; i < word_count; i++) {
+		unsigned long long word;
+		memcpy(&word, bytes + 8 * i, 8);
+
+		h ^= rotl(word * c1, 31) * c2;
+		h  = rotl(h, 27) * 5 + 0x52dce729;
+	}
+
+	// Remaining bytes
+	unsigned long long tail = 0;
+	memcpy(&tail, bytes + 8 * word_count, size % 8);
+	h ^= rotl(tail * c1, 31) * c2;
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+
+	return h;
+}
+
+unsigned long long Util::file_hash(const char * filename, unsigned long long seed) {
+	if (!file_exists(filename)) return 0;
+
+	// Empty files cannot be mapped
+	if (std::filesystem::file_size(filename) == 0) return hash("", 0, seed);
+
+	MappedFile file;
+	if (!file.init(filename)) return 0;
+
+	unsigned long long result = hash(file.data, file.size, seed);
+
+	file.free();
+
+	return result;
+}
+
 // Based on: https://rosettacode.org/wiki/Bitmap/Write_a_PPM_file
 void Util::export_ppm(const char * file_path, int width, int height, const unsigned char * data) {
 	FILE * file;
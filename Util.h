@@ -1,4 +1,5 @@
 #pragma once
+#include <cstddef>
 
 #define INVALID -1
 
@@ -29,6 +30,12 @@ namespace Util {
 
 	char * file_read(const char * filename);
 
+	// 64 bit non-cryptographic hash, the result of a previous call can be passed as seed to hash multiple blocks of memory in sequence
+	unsigned long long hash(const void * data, size_t size, unsigned long long seed = 0);
+
+	// Hash of the contents of the file, zero if the file does not exist
+	unsigned long long file_hash(const char * filename, unsigned long long seed = 0);
+
 	template<typename T>
 	void swap(T & a, T & b) {
 		T temp = a;